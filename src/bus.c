@@ -0,0 +1,394 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bus.h"
+#include "events.h"
+#include "ptys.h"
+#include "pty.h"
+#include "ring.h"
+#include "util.h"
+#include "debug.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+/** A stretch of the ring an endpoint wrote, not to be delivered back to it */
+struct bus_skip {
+    size_t start;
+    size_t end;
+};
+
+struct bus_endpoint {
+    int fd;
+    int slave_fd;
+    char *link;
+    struct ev_handle ev;
+    size_t cursor;       /* Next byte of the ring to deliver; never inside
+                            one of the skips */
+    struct bus_skip skips[BUS_SKIPS]; /* Oldest first */
+    unsigned skip_head;  /* Free-running indices into skips */
+    unsigned skip_tail;
+    uint64_t bytes_in;   /* Read from this endpoint */
+    uint64_t bytes_out;  /* Delivered to this endpoint */
+    uint64_t dropped;    /* Lost by this endpoint to overruns */
+};
+
+struct bus {
+    ev_loop_t ev;
+    struct ring ring;    /* Tail kept at the slowest endpoint's cursor */
+    enum bus_overrun overrun;
+    struct bus_endpoint *ep;
+    size_t n;
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Move the ring's tail up to the slowest endpoint's cursor
+ */
+static void bus_update_tail(struct bus *bus)
+{
+    size_t i, lag, max_lag = 0;
+
+    for ( i = 0; i < bus->n; i++ ) {
+        lag = bus->ring.head - bus->ep[i].cursor;
+        if ( lag > max_lag )
+            max_lag = lag;
+    }
+
+    bus->ring.tail = bus->ring.head - max_lag;
+}
+
+/**
+ * Discard the oldest undelivered data of endpoints which have fallen more
+ * than half the ring behind
+ */
+static void bus_drop(struct bus *bus)
+{
+    struct bus_endpoint *ep;
+    struct bus_skip *skip;
+    size_t floor = bus->ring.head - ( bus->ring.mask + 1 ) / 2;
+    size_t own, i;
+
+    for ( i = 0; i < bus->n; i++ ) {
+        ep = &bus->ep[i];
+        if ( bus->ring.head - ep->cursor <= bus->ring.head - floor )
+            continue;
+
+        /* The endpoint's own data wasn't going to be delivered anyway */
+        own = 0;
+        while ( ep->skip_tail != ep->skip_head ) {
+            skip = &ep->skips[ep->skip_tail % BUS_SKIPS];
+            if ( skip->start - ep->cursor >= floor - ep->cursor )
+                break;
+            if ( skip->end - ep->cursor > floor - ep->cursor ) {
+                own += floor - skip->start;
+                skip->start = floor;
+                break;
+            }
+            own += skip->end - skip->start;
+            ep->skip_tail++;
+        }
+
+        ep->dropped += floor - ep->cursor - own;
+        ep->cursor = floor;
+    }
+
+    bus_update_tail(bus);
+}
+
+/**
+ * Read from an endpoint into the shared ring
+ *
+ * @return 1 on progress, 0 if nothing could be read, -1 with errno on error
+ */
+static int bus_read(struct bus *bus, struct bus_endpoint *ep)
+{
+    struct bus_skip *last;
+    size_t start;
+    ssize_t n;
+
+    /* Until some of its own data has been skipped past, we've nowhere to
+     * note any more */
+    if ( ep->skip_head - ep->skip_tail == BUS_SKIPS )
+        return 0;
+
+    bus_update_tail(bus);
+    if ( bus->overrun == BUS_OVERRUN_DROP
+         && ring_len(&bus->ring) > ( bus->ring.mask + 1 ) / 2 )
+        bus_drop(bus);
+    if ( ring_space(&bus->ring) == 0 )
+        return 0;
+
+    start = bus->ring.head;
+    n = ring_readv(&bus->ring, ep->fd);
+    if ( n < 0 && errno == EINTR )
+        return 1;
+    if ( n < 0 && errno != EAGAIN )
+        return -1;
+    if ( n <= 0 ) {
+        ep->ev.ready &= ~EV_READ;
+        return 0;
+    }
+
+    ep->bytes_in += n;
+
+    /* An endpoint with nothing left to deliver can simply move past its
+     * own data; otherwise it skips it when it gets there */
+    if ( ep->cursor == start ) {
+        ep->cursor = bus->ring.head;
+        return 1;
+    }
+
+    last = &ep->skips[( ep->skip_head - 1 ) % BUS_SKIPS];
+    if ( ep->skip_head != ep->skip_tail && last->end == start ) {
+        last->end = bus->ring.head;
+    } else {
+        ep->skips[ep->skip_head % BUS_SKIPS].start = start;
+        ep->skips[ep->skip_head % BUS_SKIPS].end = bus->ring.head;
+        ep->skip_head++;
+    }
+
+    return 1;
+}
+
+/**
+ * Deliver as much pending data to an endpoint as it will take
+ *
+ * @return 1 on progress, 0 if nothing could be written, -1 with errno on
+ * error
+ */
+static int bus_write(struct bus *bus, struct bus_endpoint *ep)
+{
+    struct bus_skip *skip;
+    struct iovec iov[2];
+    size_t limit;
+    ssize_t n;
+    int iovcnt, progress = 0;
+
+    while ( ep->ev.ready & EV_WRITE ) {
+        limit = bus->ring.head;
+        if ( ep->skip_tail != ep->skip_head ) {
+            skip = &ep->skips[ep->skip_tail % BUS_SKIPS];
+            if ( skip->start == ep->cursor ) {
+                ep->cursor = skip->end;
+                ep->skip_tail++;
+                progress = 1;
+                continue;
+            }
+            limit = skip->start;
+        }
+
+        if ( limit == ep->cursor )
+            break;
+
+        iovcnt = ring_iov(&bus->ring, ep->cursor, limit - ep->cursor, iov);
+        n = writev(ep->fd, iov, iovcnt);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && errno == EAGAIN ) {
+            ep->ev.ready &= ~EV_WRITE;
+            break;
+        }
+        if ( n < 0 )
+            return -1;
+
+        ep->cursor += n;
+        ep->bytes_out += n;
+        progress = 1;
+    }
+
+    return progress;
+}
+
+/**
+ * Move data around the bus until no endpoint can make progress
+ *
+ * Each pass reads at most once from each endpoint in turn, so that a
+ * chatty endpoint can't crowd the others off the bus.
+ */
+static int bus_service(struct bus *bus)
+{
+    size_t i;
+    int progress, result;
+
+    do {
+        progress = 0;
+
+        for ( i = 0; i < bus->n; i++ ) {
+            if ( ! ( bus->ep[i].ev.ready & EV_READ ) )
+                continue;
+            if ( ( result = bus_read(bus, &bus->ep[i]) ) < 0 )
+                return -1;
+            progress |= result;
+        }
+
+        for ( i = 0; i < bus->n; i++ ) {
+            if ( ( result = bus_write(bus, &bus->ep[i]) ) < 0 )
+                return -1;
+            progress |= result;
+        }
+    } while ( progress );
+
+    return 0;
+}
+
+static void bus_free(bus_t bus, size_t nopen)
+{
+    size_t i;
+
+    for ( i = 0; i < nopen; i++ ) {
+        ev_del(bus->ev, &bus->ep[i].ev);
+        pty_close(bus->ep[i].link, bus->ep[i].fd, bus->ep[i].slave_fd);
+    }
+    for ( i = 0; i < bus->n; i++ )
+        free(bus->ep[i].link);
+
+    free(bus->ep);
+    ring_free(&bus->ring);
+    ev_close(bus->ev);
+    free(bus);
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+bus_t bus_open(char *const *links, size_t n, size_t size,
+               enum bus_overrun overrun)
+{
+    struct bus_endpoint *ep;
+    bus_t bus;
+    size_t nopen;
+
+    size = round_pow2(size);
+    if ( n < 2 || size < 2 || size > READ_BUF_MAX ) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    bus = calloc(1, sizeof(struct bus));
+    if ( bus == NULL )
+        goto error;
+
+    bus->overrun = overrun;
+    bus->n = n;
+
+    if ( ( bus->ev = ev_open() ) == NULL )
+        goto error_bus;
+    if ( ring_init(&bus->ring, size) < 0 )
+        goto error_ev;
+    if ( ( bus->ep = calloc(n, sizeof(struct bus_endpoint)) ) == NULL )
+        goto error_ring;
+
+    for ( nopen = 0; nopen < n; nopen++ ) {
+        ep = &bus->ep[nopen];
+        if ( ( ep->link = strdup(links[nopen]) ) == NULL )
+            goto error_ep;
+
+        if ( pty_open(ep->link, &ep->fd, &ep->slave_fd) < 0 )
+            goto error_ep;
+        if ( ev_add(bus->ev, &ep->ev, ep->fd, ep) < 0 ) {
+            pty_close(ep->link, ep->fd, ep->slave_fd);
+            goto error_ep;
+        }
+        ep->ev.want = EV_READ | EV_WRITE;
+    }
+
+    return bus;
+
+ error_ep:
+    bus_free(bus, nopen);
+    goto error;
+ error_ring:
+    ring_free(&bus->ring);
+ error_ev:
+    ev_close(bus->ev);
+ error_bus:
+    free(bus);
+ error:
+    return NULL;
+}
+
+int bus_close(bus_t bus)
+{
+    int result = 0;
+    size_t i;
+
+    for ( i = 0; i < bus->n; i++ ) {
+        ev_del(bus->ev, &bus->ep[i].ev);
+        if ( pty_close(bus->ep[i].link, bus->ep[i].fd,
+                       bus->ep[i].slave_fd) < 0 )
+            result = -1;
+    }
+
+    bus_free(bus, 0);
+    return result;
+}
+
+int bus_run(bus_t bus, sigsrc_t signals)
+{
+    struct ev_handle sig_ev, *active;
+    int signum, result = 0;
+
+    if ( signals != NULL ) {
+        if ( ev_add(bus->ev, &sig_ev, sigsrc_fd(signals), NULL) < 0 )
+            return -1;
+        sig_ev.want = EV_READ;
+    }
+
+    while ( true ) {
+        if ( ev_wait(bus->ev, &active, NULL, NULL) < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            result = -1;
+            break;
+        }
+
+        if ( signals != NULL && ( sig_ev.ready & EV_READ ) ) {
+            sig_ev.ready &= ~EV_READ;
+            while ( ( signum = sigsrc_read(signals) ) > 0 ) {
+                if ( ! nulltty_info_signal(signum) )
+                    goto end;
+                bus_printinfo(bus);
+            }
+            if ( signum < 0 ) {
+                result = -1;
+                break;
+            }
+        }
+
+        if ( bus_service(bus) < 0 ) {
+            result = -1;
+            break;
+        }
+    }
+
+ end:
+    if ( signals != NULL )
+        ev_del(bus->ev, &sig_ev);
+    return result;
+}
+
+void bus_printinfo(bus_t bus)
+{
+    const struct bus_endpoint *ep;
+    size_t i;
+
+    for ( i = 0; i < bus->n; i++ ) {
+        ep = &bus->ep[i];
+        fprintf(stderr, "%s: read %llu  delivered %llu  dropped %llu  "
+                "pending %zu\n", ep->link,
+                (unsigned long long)ep->bytes_in,
+                (unsigned long long)ep->bytes_out,
+                (unsigned long long)ep->dropped,
+                (size_t)( bus->ring.head - ep->cursor ));
+    }
+}
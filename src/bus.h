@@ -0,0 +1,86 @@
+#ifndef _NULLTTY_BUS_H_
+#define _NULLTTY_BUS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sigsrc.h"
+
+/**
+ * Multi-drop bus of pseudoterminals
+ *
+ * Emulates a shared line such as an RS-485 bus: any number of
+ * pseudoterminals are joined so that data written to any one of them is
+ * read from all of the others.
+ *
+ * Data is held once, in a single ring buffer shared by every endpoint.
+ * Each endpoint has its own cursor into the ring, marking the next byte
+ * to deliver to it; the ring can only be refilled up to the slowest
+ * cursor.  An endpoint's own data is skipped over rather than delivered
+ * back to it, by way of a short list of the stretches of the ring it
+ * wrote.
+ *
+ * What happens when an endpoint falls behind depends on the overrun
+ * policy.  Blocking holds up everyone's writes until the slow endpoint
+ * has caught up.  Dropping lets the bus run at the speed of its other
+ * endpoints: an endpoint more than half the ring behind loses its oldest
+ * undelivered data, like a UART overrun, and the loss is counted.
+ */
+
+/** Default size of the shared ring buffer */
+#define BUS_BUF_SZ ( 64 * 1024 )
+
+/** Stretches of its own data an endpoint can have pending in the ring */
+#define BUS_SKIPS 64
+
+/**
+ * What to do when an endpoint falls too far behind
+ */
+enum bus_overrun {
+    /** Discard the lagging endpoint's oldest data */
+    BUS_OVERRUN_DROP,
+    /** Stop taking in new data until the lagging endpoint catches up */
+    BUS_OVERRUN_BLOCK,
+};
+
+struct bus; /* Forward declaration */
+typedef struct bus *bus_t;
+
+/**
+ * Create a bus of pseudoterminals
+ *
+ * @param links Symlink names for the endpoints' pseudoterminals
+ * @param n Number of endpoints, at least two
+ * @param size Size of the shared ring buffer; rounded up to a power of two
+ * @param overrun Policy for endpoints which fall behind
+ * @return Bus, or NULL with errno on error
+ */
+bus_t bus_open(char *const *links, size_t n, size_t size,
+               enum bus_overrun overrun);
+
+/**
+ * Close a bus's pseudoterminals and remove their symlinks
+ *
+ * @param bus Bus returned by bus_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int bus_close(bus_t bus);
+
+/**
+ * Relay data between a bus's endpoints
+ *
+ * @param bus Bus returned by bus_open()
+ * @param signals Signal source to watch for termination and status
+ * requests, or NULL
+ * @return 0 on success (user request termination), -1 on error
+ */
+int bus_run(bus_t bus, sigsrc_t signals);
+
+/**
+ * Print each endpoint's byte counts to stderr
+ *
+ * @param bus Bus returned by bus_open()
+ */
+void bus_printinfo(bus_t bus);
+
+#endif /* ! defined _NULLTTY_BUS_H_ */
@@ -0,0 +1,279 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "capture.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+struct capture {
+    int fd;
+    uint8_t *map;
+    size_t size;                /* Of the file and mapping */
+    size_t page;                /* System page size */
+    uint64_t tail;              /* Record bytes reserved so far, which may
+                                 * run past the end once the log is full */
+    uint64_t full;              /* Where the first record not to fit began */
+    uint64_t dropped_records;
+    uint64_t dropped_bytes;
+    unsigned flush_ms;
+    pthread_t flusher;
+    int wake_fds[2];            /* Self-pipe to stop the flush thread */
+    size_t synced;              /* Flush thread: offset synced up to */
+    size_t faulted;             /* Flush thread: offset faulted in up to */
+#ifndef HAVE_ATOMIC_BUILTINS
+    pthread_mutex_t lock;
+#endif
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+static uint64_t capture_add(struct capture *cap, uint64_t *counter, uint64_t n)
+{
+#ifdef HAVE_ATOMIC_BUILTINS
+    (void)cap;
+    return __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+#else
+    uint64_t old;
+
+    pthread_mutex_lock(&cap->lock);
+    old = *counter;
+    *counter += n;
+    pthread_mutex_unlock(&cap->lock);
+    return old;
+#endif
+}
+
+/**
+ * Offset just past the records reserved so far
+ */
+static size_t capture_end(struct capture *cap)
+{
+    uint64_t tail = capture_add(cap, &cap->tail, 0);
+    uint64_t room = cap->size - sizeof(struct capture_header);
+
+    return sizeof(struct capture_header) + ( tail < room ? tail : room );
+}
+
+/**
+ * Sync the newly filled part of the log, and fault in the pages ahead
+ *
+ * The page the log currently ends in is synced again next time round,
+ * since it will have been written to since.
+ */
+static void capture_flush(struct capture *cap)
+{
+    size_t end = capture_end(cap);
+    size_t floor = end & ~( cap->page - 1 );
+#ifdef MADV_POPULATE_WRITE
+    size_t ahead;
+#endif
+
+    if ( end > cap->synced ) {
+        msync(cap->map + cap->synced, end - cap->synced, MS_SYNC);
+        cap->synced = floor;
+    }
+
+#ifdef MADV_POPULATE_WRITE
+    /* Faulting in writable pages doesn't change their contents, so this
+     * can't race with records being written to them */
+    ahead = ( end + CAPTURE_PREFAULT + cap->page - 1 ) & ~( cap->page - 1 );
+    if ( ahead > cap->size )
+        ahead = cap->size;
+    if ( cap->faulted < floor )
+        cap->faulted = floor;
+    if ( ahead > cap->faulted
+         && madvise(cap->map + cap->faulted, ahead - cap->faulted,
+                    MADV_POPULATE_WRITE) == 0 )
+        cap->faulted = ahead;
+#endif
+}
+
+static void *capture_flusher(void *arg)
+{
+    struct capture *cap = arg;
+    struct pollfd pfd;
+
+    pfd.fd = cap->wake_fds[0];
+    pfd.events = POLLIN;
+
+    while ( poll(&pfd, 1, cap->flush_ms) <= 0 )
+        capture_flush(cap);
+
+    return NULL;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+capture_t capture_open(const char *path, size_t size, unsigned flush_ms)
+{
+    struct capture_header *header;
+    capture_t cap;
+
+    if ( size < sizeof(struct capture_header) + capture_record_size(1) ) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    cap = calloc(1, sizeof(struct capture));
+    if ( cap == NULL )
+        goto error;
+
+    cap->size = size;
+    cap->page = sysconf(_SC_PAGESIZE);
+    cap->flush_ms = flush_ms;
+
+    cap->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( cap->fd < 0 )
+        goto error_cap;
+
+    /* Allocate the file's blocks up front where we can, so that running
+     * out of disk space shows up now rather than as SIGBUS mid-relay */
+#ifdef HAVE_POSIX_FALLOCATE
+    if ( ( errno = posix_fallocate(cap->fd, 0, size) ) != 0 )
+        goto error_file;
+#else
+    if ( ftruncate(cap->fd, size) < 0 )
+        goto error_file;
+#endif
+
+    cap->map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, cap->fd, 0);
+    if ( cap->map == MAP_FAILED )
+        goto error_file;
+
+#ifndef HAVE_ATOMIC_BUILTINS
+    if ( ( errno = pthread_mutex_init(&cap->lock, NULL) ) != 0 )
+        goto error_map;
+#endif
+
+    header = (struct capture_header *)cap->map;
+    header->version = CAPTURE_VERSION;
+    header->header_size = sizeof(struct capture_header);
+    header->start_mono = clock_ns(CLOCK_MONOTONIC);
+    header->start_real = clock_ns(CLOCK_REALTIME);
+    header->magic = CAPTURE_MAGIC;
+
+    if ( flush_ms > 0 ) {
+        if ( pipe(cap->wake_fds) < 0 )
+            goto error_lock;
+
+        capture_flush(cap);
+        if ( ( errno = pthread_create(&cap->flusher, NULL, capture_flusher,
+                                      cap) ) != 0 )
+            goto error_pipe;
+    }
+
+    return cap;
+
+ error_pipe:
+    close(cap->wake_fds[0]);
+    close(cap->wake_fds[1]);
+ error_lock:
+#ifndef HAVE_ATOMIC_BUILTINS
+    pthread_mutex_destroy(&cap->lock);
+ error_map:
+#endif
+    munmap(cap->map, size);
+ error_file:
+    close(cap->fd);
+    unlink(path);
+ error_cap:
+    free(cap);
+ error:
+    return NULL;
+}
+
+void capture_append(capture_t cap, unsigned pair, unsigned dir, uint64_t ts,
+                    const struct iovec *iov, int iovcnt)
+{
+    struct capture_record *rec;
+    uint8_t *data;
+    size_t len = 0, need;
+    uint64_t off;
+    int i;
+
+    for ( i = 0; i < iovcnt; i++ )
+        len += iov[i].iov_len;
+
+    need = capture_record_size(len);
+    off = capture_add(cap, &cap->tail, need);
+    if ( off + need > cap->size - sizeof(struct capture_header) ) {
+        /* Only the one reservation straddles the end of the log */
+        if ( off <= cap->size - sizeof(struct capture_header) )
+            cap->full = off;
+        capture_add(cap, &cap->dropped_records, 1);
+        capture_add(cap, &cap->dropped_bytes, len);
+        return;
+    }
+
+    rec = (struct capture_record *)
+        ( cap->map + sizeof(struct capture_header) + off );
+    rec->len = len;
+    rec->pair = pair;
+    rec->dir = dir;
+
+    data = (uint8_t *)( rec + 1 );
+    for ( i = 0; i < iovcnt; i++ ) {
+        memcpy(data, iov[i].iov_base, iov[i].iov_len);
+        data += iov[i].iov_len;
+    }
+
+#ifdef HAVE_ATOMIC_BUILTINS
+    __atomic_store_n(&rec->ts, ts, __ATOMIC_RELEASE);
+#else
+    rec->ts = ts;
+#endif
+}
+
+int capture_close(capture_t cap)
+{
+    struct capture_header *header = (struct capture_header *)cap->map;
+    size_t end;
+    int result = 0;
+
+    if ( cap->flush_ms > 0 ) {
+        if ( write(cap->wake_fds[1], "", 1) == 1 )
+            pthread_join(cap->flusher, NULL);
+        close(cap->wake_fds[0]);
+        close(cap->wake_fds[1]);
+    }
+
+    header->length = cap->dropped_records > 0 ? cap->full : cap->tail;
+    end = sizeof(struct capture_header) + header->length;
+    header->dropped_records = cap->dropped_records;
+    header->dropped_bytes = cap->dropped_bytes;
+
+    if ( msync(cap->map, cap->size, MS_SYNC) < 0 )
+        result = -1;
+    if ( munmap(cap->map, cap->size) < 0 )
+        result = -1;
+    if ( ftruncate(cap->fd, end) < 0 )
+        result = -1;
+    if ( close(cap->fd) < 0 )
+        result = -1;
+
+#ifndef HAVE_ATOMIC_BUILTINS
+    pthread_mutex_destroy(&cap->lock);
+#endif
+    free(cap);
+    return result;
+}
@@ -0,0 +1,127 @@
+#ifndef _NULLTTY_CAPTURE_H_
+#define _NULLTTY_CAPTURE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/**
+ * Traffic capture log
+ *
+ * Records every chunk of data the relay reads, tagged with its pair and
+ * direction and the CLOCK_MONOTONIC time it was read, in a log file which
+ * is preallocated at a fixed size and mapped into memory.  Appending a
+ * record is a memcpy() into the mapping; the relay never calls write().
+ * Once the log is full, further records are dropped and counted.
+ *
+ * Dirty pages of the log are left to the kernel to write back, unless a
+ * flush interval is given, in which case a background thread syncs each
+ * stretch of the log to disk as it fills and, where the platform allows,
+ * faults in the pages just ahead of the write position so that the relay
+ * doesn't take those faults itself.
+ *
+ * Several relay threads may append to the same log.  Space is reserved
+ * with an atomic add and a record's timestamp is stored last, with release
+ * ordering, so readers treat a zero timestamp as the end of the log.
+ */
+
+/** "NULLCAP1", identifying a capture log */
+#define CAPTURE_MAGIC UINT64_C(0x315041434c4c554e)
+
+/** Bumped whenever the layout of the log changes */
+#define CAPTURE_VERSION 1
+
+/** Default size of a capture log */
+#define CAPTURE_SIZE_DEFAULT ( 64 * 1024 * 1024 )
+
+/** How far ahead of the write position the flush thread faults pages in */
+#define CAPTURE_PREFAULT ( 1024 * 1024 )
+
+/** Record directions */
+#define CAPTURE_A_TO_B 0
+#define CAPTURE_B_TO_A 1
+
+/**
+ * Header at the start of a capture log, padded to 64 bytes
+ */
+struct capture_header {
+    uint64_t magic;            /**< CAPTURE_MAGIC */
+    uint32_t version;          /**< CAPTURE_VERSION */
+    uint32_t header_size;      /**< sizeof(struct capture_header) */
+    uint64_t start_mono;       /**< CLOCK_MONOTONIC ns when the log began */
+    uint64_t start_real;       /**< CLOCK_REALTIME ns at the same moment */
+    uint64_t length;           /**< Bytes of records, set when closed */
+    uint64_t dropped_records;  /**< Records which didn't fit, set when closed */
+    uint64_t dropped_bytes;    /**< Data bytes of those records */
+    uint64_t reserved;
+};
+
+/**
+ * Header of each record, followed by its data and padding up to a
+ * multiple of CAPTURE_ALIGN bytes
+ */
+struct capture_record {
+    uint64_t ts;               /**< CLOCK_MONOTONIC ns when the data was read */
+    uint32_t len;              /**< Bytes of data following */
+    uint16_t pair;             /**< Index of the pair, in command line order */
+    uint8_t dir;               /**< CAPTURE_A_TO_B or CAPTURE_B_TO_A */
+    uint8_t reserved;
+};
+
+#define CAPTURE_ALIGN 8
+
+/** Most pairs a log can tell apart by their 16-bit index */
+#define CAPTURE_PAIRS_MAX ( UINT16_MAX + 1 )
+
+/**
+ * Total size of a record holding len bytes of data
+ */
+static inline size_t capture_record_size(size_t len)
+{
+    return ( sizeof(struct capture_record) + len + CAPTURE_ALIGN - 1 )
+        & ~(size_t)( CAPTURE_ALIGN - 1 );
+}
+
+struct capture; /* Forward declaration */
+typedef struct capture *capture_t;
+
+/**
+ * Create a capture log
+ *
+ * Any existing file at the path is replaced.
+ *
+ * @param path Path of the log file
+ * @param size Size to preallocate, including the header
+ * @param flush_ms Interval at which a background thread syncs the log to
+ * disk, or 0 for no thread
+ * @return Capture log, or NULL with errno on error
+ */
+capture_t capture_open(const char *path, size_t size, unsigned flush_ms);
+
+/**
+ * Append a record to a capture log
+ *
+ * Safe to call from several threads at once.
+ *
+ * @param cap Capture log returned by capture_open()
+ * @param pair Index of the pair the data was read from
+ * @param dir CAPTURE_A_TO_B or CAPTURE_B_TO_A
+ * @param ts CLOCK_MONOTONIC ns at which the data was read
+ * @param iov Segments of data
+ * @param iovcnt Number of segments
+ */
+void capture_append(capture_t cap, unsigned pair, unsigned dir, uint64_t ts,
+                    const struct iovec *iov, int iovcnt);
+
+/**
+ * Finish a capture log
+ *
+ * Stops the flush thread, syncs the log and trims the file to the records
+ * actually written.  No records may be appended concurrently.
+ *
+ * @param cap Capture log returned by capture_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int capture_close(capture_t cap);
+
+#endif /* ! defined _NULLTTY_CAPTURE_H_ */
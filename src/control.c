@@ -0,0 +1,806 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "control.h"
+#include "sock.h"
+#include "util.h"
+#include "debug.h"
+
+/*** DATA STRUCTURES **********************************************************/
+
+/** Growable output buffer */
+struct strbuf {
+    char *buf;
+    size_t len;
+    size_t cap;
+    bool failed;
+};
+
+struct control_client {
+    struct ev_handle ev;
+    struct control *ctl;
+    char req[CONTROL_REQUEST_MAX]; /* HTTP request received so far */
+    size_t req_len;
+    struct strbuf out;
+    size_t off;                   /* Bytes of out already sent */
+    bool evicted;                 /* Hung up on to make room */
+    struct control_client *next;
+};
+
+/** Byte counts at the start of the current rate interval */
+struct control_sample {
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    double rate_in;
+    double rate_out;
+};
+
+struct control {
+    int fd;
+    char *path;                   /* Unix-domain socket path, or NULL */
+    enum control_format format;
+    ev_loop_t ev;
+    struct ev_handle listen_ev;
+    const nulltty_t *pairs;
+    size_t n;
+    struct nulltty_info *infos;   /* Snapshot taken for each report */
+    struct hist latency[2];       /* Latency snapshot of one pair */
+    struct control_sample *samples; /* Two per pair, A to B first */
+    struct timespec sample_time;
+    bool sampled;
+    struct control_client *clients; /* Most recently connected first */
+    size_t nclients;
+};
+
+/** How to render a Prometheus metric's value */
+enum metric_kind {
+    METRIC_U64,                   /* uint64_t */
+    METRIC_SIZE,                  /* size_t */
+    METRIC_NS,                    /* uint64_t nanoseconds, as seconds */
+};
+
+struct control_metric {
+    const char *name;
+    const char *type;
+    const char *help;
+    enum metric_kind kind;
+    size_t offset;                /* Within struct nulltty_stats */
+};
+
+static const struct control_metric metrics[] = {
+    { "nulltty_read_bytes_total", "counter",
+      "Bytes read from the sending pseudoterminal.",
+      METRIC_U64, offsetof(struct nulltty_stats, bytes_in) },
+    { "nulltty_written_bytes_total", "counter",
+      "Bytes written to the receiving pseudoterminal.",
+      METRIC_U64, offsetof(struct nulltty_stats, bytes_out) },
+    { "nulltty_read_syscalls_total", "counter",
+      "Read system calls on the sending pseudoterminal.",
+      METRIC_U64, offsetof(struct nulltty_stats, reads) },
+    { "nulltty_write_syscalls_total", "counter",
+      "Write system calls on the receiving pseudoterminal.",
+      METRIC_U64, offsetof(struct nulltty_stats, writes) },
+    { "nulltty_read_eagain_total", "counter",
+      "Reads which found nothing to read.",
+      METRIC_U64, offsetof(struct nulltty_stats, read_eagain) },
+    { "nulltty_write_eagain_total", "counter",
+      "Writes which found no room in the receiving pseudoterminal.",
+      METRIC_U64, offsetof(struct nulltty_stats, write_eagain) },
+    { "nulltty_wakeups_total", "counter",
+      "Times the relay found the direction ready.",
+      METRIC_U64, offsetof(struct nulltty_stats, wakeups) },
+    { "nulltty_coalesced_writes_total", "counter",
+      "Writes saved by holding data back to coalesce it.",
+      METRIC_U64, offsetof(struct nulltty_stats, coalesced) },
+    { "nulltty_coalesce_expired_total", "counter",
+      "Writes of held data once its latency budget ran out.",
+      METRIC_U64, offsetof(struct nulltty_stats, coalesce_expired) },
+    { "nulltty_blocked_seconds_total", "counter",
+      "Time spent with the receiving pseudoterminal full.",
+      METRIC_NS, offsetof(struct nulltty_stats, blocked_ns) },
+    { "nulltty_buffered_bytes", "gauge",
+      "Bytes currently held between the pseudoterminals.",
+      METRIC_SIZE, offsetof(struct nulltty_stats, buffered) },
+    { "nulltty_buffered_high_water_bytes", "gauge",
+      "Most bytes ever held between the pseudoterminals.",
+      METRIC_SIZE, offsetof(struct nulltty_stats, buf_hwm) },
+    { "nulltty_buffer_size_bytes", "gauge",
+      "Current relay buffer size (buffered modes only).",
+      METRIC_SIZE, offsetof(struct nulltty_stats, buf_size) },
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Make sure a buffer has room for some more bytes plus a terminating NUL
+ */
+static bool strbuf_reserve(struct strbuf *sb, size_t n)
+{
+    size_t cap;
+    char *buf;
+
+    if ( sb->failed )
+        return false;
+    if ( sb->cap - sb->len > n )
+        return true;
+
+    cap = sb->cap ? 2 * sb->cap : 4096;
+    while ( cap - sb->len <= n )
+        cap *= 2;
+
+    buf = realloc(sb->buf, cap);
+    if ( buf == NULL ) {
+        sb->failed = true;
+        return false;
+    }
+    sb->buf = buf;
+    sb->cap = cap;
+    return true;
+}
+
+static void strbuf_printf(struct strbuf *sb, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    while ( strbuf_reserve(sb, 0) ) {
+        va_start(ap, fmt);
+        n = vsnprintf(sb->buf + sb->len, sb->cap - sb->len, fmt, ap);
+        va_end(ap);
+
+        if ( n < 0 ) {
+            sb->failed = true;
+        } else if ( (size_t)n < sb->cap - sb->len ) {
+            sb->len += n;
+            return;
+        } else {
+            strbuf_reserve(sb, n);
+        }
+    }
+}
+
+static void strbuf_append(struct strbuf *sb, const char *data, size_t len)
+{
+    if ( ! strbuf_reserve(sb, len) )
+        return;
+
+    memcpy(sb->buf + sb->len, data, len);
+    sb->len += len;
+    sb->buf[sb->len] = '\0';
+}
+
+/**
+ * Append a string to a buffer as a quoted JSON string
+ */
+static void strbuf_json_string(struct strbuf *sb, const char *str)
+{
+    strbuf_printf(sb, "\"");
+    for ( ; *str != '\0'; str++ ) {
+        if ( *str == '"' || *str == '\\' )
+            strbuf_printf(sb, "\\%c", *str);
+        else if ( (unsigned char)*str < 0x20 )
+            strbuf_printf(sb, "\\u%04x", (unsigned char)*str);
+        else
+            strbuf_printf(sb, "%c", *str);
+    }
+    strbuf_printf(sb, "\"");
+}
+
+/**
+ * Append a string to a buffer as a quoted Prometheus label value
+ */
+static void strbuf_label_value(struct strbuf *sb, const char *str)
+{
+    strbuf_printf(sb, "\"");
+    for ( ; *str != '\0'; str++ ) {
+        if ( *str == '"' || *str == '\\' )
+            strbuf_printf(sb, "\\%c", *str);
+        else if ( *str == '\n' )
+            strbuf_printf(sb, "\\n");
+        else
+            strbuf_printf(sb, "%c", *str);
+    }
+    strbuf_printf(sb, "\"");
+}
+
+static void report_direction(struct strbuf *sb, const char *name,
+                             const struct nulltty_stats *stats,
+                             const struct hist *latency,
+                             const struct control_sample *sample)
+{
+    strbuf_printf(sb,
+                  "      \"%s\": {\n"
+                  "        \"bytes_in\": %llu,\n"
+                  "        \"bytes_out\": %llu,\n"
+                  "        \"reads\": %llu,\n"
+                  "        \"writes\": %llu,\n"
+                  "        \"read_eagain\": %llu,\n"
+                  "        \"write_eagain\": %llu,\n"
+                  "        \"wakeups\": %llu,\n"
+                  "        \"coalesced\": %llu,\n"
+                  "        \"coalesce_expired\": %llu,\n"
+                  "        \"blocked_ns\": %llu,\n"
+                  "        \"buffered\": %zu,\n"
+                  "        \"buf_hwm\": %zu,\n"
+                  "        \"buf_size\": %zu,\n"
+                  "        \"buf_peak\": %zu,\n"
+                  "        \"rate_in\": %.1f,\n"
+                  "        \"rate_out\": %.1f,\n"
+                  "        \"latency_ns\": {\n"
+                  "          \"bytes\": %llu,\n"
+                  "          \"p50\": %llu,\n"
+                  "          \"p90\": %llu,\n"
+                  "          \"p99\": %llu,\n"
+                  "          \"p999\": %llu,\n"
+                  "          \"max\": %llu\n"
+                  "        }\n"
+                  "      }",
+                  name,
+                  (unsigned long long)stats->bytes_in,
+                  (unsigned long long)stats->bytes_out,
+                  (unsigned long long)stats->reads,
+                  (unsigned long long)stats->writes,
+                  (unsigned long long)stats->read_eagain,
+                  (unsigned long long)stats->write_eagain,
+                  (unsigned long long)stats->wakeups,
+                  (unsigned long long)stats->coalesced,
+                  (unsigned long long)stats->coalesce_expired,
+                  (unsigned long long)stats->blocked_ns,
+                  stats->buffered, stats->buf_hwm,
+                  stats->buf_size, stats->buf_peak,
+                  sample->rate_in, sample->rate_out,
+                  (unsigned long long)latency->total,
+                  (unsigned long long)hist_quantile(latency, 0.5),
+                  (unsigned long long)hist_quantile(latency, 0.9),
+                  (unsigned long long)hist_quantile(latency, 0.99),
+                  (unsigned long long)hist_quantile(latency, 0.999),
+                  (unsigned long long)latency->max);
+}
+
+/**
+ * Update a direction's transfer rates if the rate interval is up
+ */
+static void sample_direction(struct control_sample *sample,
+                             const struct nulltty_stats *stats,
+                             double elapsed)
+{
+    if ( elapsed > 0 ) {
+        sample->rate_in = ( stats->bytes_in - sample->bytes_in ) / elapsed;
+        sample->rate_out = ( stats->bytes_out - sample->bytes_out ) / elapsed;
+    }
+
+    sample->bytes_in = stats->bytes_in;
+    sample->bytes_out = stats->bytes_out;
+}
+
+/**
+ * Snapshot every pair's counters, for a report
+ */
+static void control_snapshot(control_t ctl)
+{
+    size_t i;
+
+    for ( i = 0; i < ctl->n; i++ )
+        nulltty_get_info(ctl->pairs[i], &ctl->infos[i]);
+}
+
+/**
+ * Render the JSON statistics report for all pairs
+ *
+ * @param ctl Control socket
+ * @param sb Buffer to append the report to
+ */
+static void report_json(control_t ctl, struct strbuf *sb)
+{
+    const struct nulltty_info *info;
+    struct timespec now;
+    double elapsed = 0;
+    bool resample;
+    size_t i;
+
+    control_snapshot(ctl);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ( ctl->sampled )
+        elapsed = ( now.tv_sec - ctl->sample_time.tv_sec )
+            + ( now.tv_nsec - ctl->sample_time.tv_nsec ) / 1e9;
+    resample = ! ctl->sampled || elapsed >= CONTROL_RATE_SEC;
+    if ( resample ) {
+        ctl->sample_time = now;
+        ctl->sampled = true;
+    }
+
+    strbuf_printf(sb, "{\n  \"pairs\": [");
+
+    for ( i = 0; i < ctl->n; i++ ) {
+        info = &ctl->infos[i];
+
+        if ( resample ) {
+            sample_direction(&ctl->samples[2*i], &info->a_to_b, elapsed);
+            sample_direction(&ctl->samples[2*i+1], &info->b_to_a, elapsed);
+        }
+
+        strbuf_printf(sb, "%s\n    {\n      \"a\": ", i > 0 ? "," : "");
+        strbuf_json_string(sb, info->link_a);
+        strbuf_printf(sb, ",\n      \"b\": ");
+        strbuf_json_string(sb, info->link_b);
+        strbuf_printf(sb, ",\n      \"mode\": \"%s\",\n",
+                      nulltty_mode_name(info->mode));
+        nulltty_get_latency(ctl->pairs[i], &ctl->latency[0], &ctl->latency[1]);
+        report_direction(sb, "a_to_b", &info->a_to_b, &ctl->latency[0],
+                         &ctl->samples[2*i]);
+        strbuf_printf(sb, ",\n");
+        report_direction(sb, "b_to_a", &info->b_to_a, &ctl->latency[1],
+                         &ctl->samples[2*i+1]);
+        strbuf_printf(sb, "\n    }");
+    }
+
+    strbuf_printf(sb, "\n  ]\n}\n");
+}
+
+static void report_sample(struct strbuf *sb, const struct control_metric *metric,
+                          const struct nulltty_info *info, bool a_to_b)
+{
+    const struct nulltty_stats *stats = a_to_b ? &info->a_to_b : &info->b_to_a;
+    const char *field = (const char *)stats + metric->offset;
+
+    strbuf_printf(sb, "%s{a=", metric->name);
+    strbuf_label_value(sb, info->link_a);
+    strbuf_printf(sb, ",b=");
+    strbuf_label_value(sb, info->link_b);
+    strbuf_printf(sb, ",direction=\"%s\"} ", a_to_b ? "a_to_b" : "b_to_a");
+
+    switch ( metric->kind ) {
+    case METRIC_U64:
+        strbuf_printf(sb, "%llu\n",
+                      (unsigned long long)*(const uint64_t *)field);
+        break;
+
+    case METRIC_SIZE:
+        strbuf_printf(sb, "%zu\n", *(const size_t *)field);
+        break;
+
+    case METRIC_NS:
+        strbuf_printf(sb, "%.9f\n", *(const uint64_t *)field / 1e9);
+        break;
+    }
+}
+
+/**
+ * Render the statistics of all pairs in Prometheus text format
+ *
+ * @param ctl Control socket
+ * @param sb Buffer to append the report to
+ */
+static void report_prometheus(control_t ctl, struct strbuf *sb)
+{
+    const struct control_metric *metric;
+    size_t i, j;
+
+    control_snapshot(ctl);
+
+    for ( j = 0; j < sizeof(metrics) / sizeof(metrics[0]); j++ ) {
+        metric = &metrics[j];
+        strbuf_printf(sb, "# HELP %s %s\n# TYPE %s %s\n",
+                      metric->name, metric->help, metric->name, metric->type);
+
+        for ( i = 0; i < ctl->n; i++ ) {
+            report_sample(sb, metric, &ctl->infos[i], true);
+            report_sample(sb, metric, &ctl->infos[i], false);
+        }
+    }
+}
+
+/**
+ * Build the HTTP response to a scraper's request
+ *
+ * @param ctl Control socket
+ * @param req NUL-terminated request header
+ * @param sb Buffer to append the response to
+ */
+static void report_http(control_t ctl, const char *req, struct strbuf *sb)
+{
+    struct strbuf body = { NULL, 0, 0, false };
+    const char *status = "200 OK";
+    size_t len;
+    bool head = false;
+
+    if ( strncmp(req, "HEAD ", 5) == 0 ) {
+        head = true;
+        req += 5;
+    } else if ( strncmp(req, "GET ", 4) == 0 ) {
+        req += 4;
+    } else {
+        status = "405 Method Not Allowed";
+        req = NULL;
+    }
+
+    if ( req != NULL ) {
+        len = strcspn(req, " ?\r\n");
+        if ( ( len == 1 && req[0] == '/' )
+             || ( len == 8 && strncmp(req, "/metrics", 8) == 0 ) )
+            report_prometheus(ctl, &body);
+        else
+            status = "404 Not Found";
+    }
+
+    if ( body.failed ) {
+        status = "500 Internal Server Error";
+        body.len = 0;
+    }
+
+    strbuf_printf(sb,
+                  "HTTP/1.0 %s\r\n"
+                  "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                  "Content-Length: %zu\r\n"
+                  "Connection: close\r\n"
+                  "\r\n",
+                  status, body.len);
+    if ( ! head && body.len > 0 )
+        strbuf_append(sb, body.buf, body.len);
+
+    free(body.buf);
+}
+
+static void client_close(struct control_client *client)
+{
+    struct control *ctl = client->ctl;
+    struct control_client **p;
+
+    for ( p = &ctl->clients; *p != NULL; p = &(*p)->next ) {
+        if ( *p == client ) {
+            *p = client->next;
+            break;
+        }
+    }
+    if ( ! client->evicted )
+        ctl->nclients--;
+
+    ev_del(ctl->ev, &client->ev);
+    close(client->ev.fd);
+    free(client->out.buf);
+    free(client);
+}
+
+/**
+ * Send as much of a client's report as the socket will take
+ *
+ * Closes the client once the report is sent or the connection fails.
+ */
+static int client_flush(struct ev_handle *handle)
+{
+    struct control_client *client = handle->data;
+    ssize_t n;
+
+    while ( client->off < client->out.len ) {
+        n = send(handle->fd, client->out.buf + client->off,
+                 client->out.len - client->off, MSG_NOSIGNAL);
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN ) {
+                handle->ready &= ~EV_WRITE;
+                return 0;
+            }
+            break;
+        }
+
+        client->off += n;
+    }
+
+    client_close(client);
+    return 0;
+}
+
+/**
+ * Start sending a client its report, once it has been rendered
+ */
+static void client_respond(struct control_client *client)
+{
+    if ( client->out.failed ) {
+        client_close(client);
+        return;
+    }
+
+    client->ev.want = EV_WRITE;
+    client->ev.callback = client_flush;
+    client->ev.ready |= EV_WRITE;
+    client_flush(&client->ev);
+}
+
+/**
+ * Read a scraper's HTTP request, answering it once the header is complete
+ *
+ * Anything after the header is ignored.
+ */
+static int client_request(struct ev_handle *handle)
+{
+    struct control_client *client = handle->data;
+    ssize_t n;
+
+    while ( true ) {
+        n = recv(handle->fd, client->req + client->req_len,
+                 sizeof(client->req) - 1 - client->req_len, 0);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && errno == EAGAIN ) {
+            handle->ready &= ~EV_READ;
+            return 0;
+        }
+        if ( n <= 0 )
+            break;
+
+        client->req_len += n;
+        client->req[client->req_len] = '\0';
+
+        if ( strstr(client->req, "\r\n\r\n") != NULL
+             || strstr(client->req, "\n\n") != NULL ) {
+            report_http(client->ctl, client->req, &client->out);
+            client_respond(client);
+            return 0;
+        }
+
+        if ( client->req_len == sizeof(client->req) - 1 )
+            break;
+    }
+
+    /* Hung up early, failed, or sent an overlong request */
+    client_close(client);
+    return 0;
+}
+
+/**
+ * Accept pending connections and start serving each one
+ */
+static int control_accept(struct ev_handle *handle)
+{
+    struct control *ctl = handle->data;
+    struct control_client *client, *oldest;
+    int fd;
+
+    while ( true ) {
+        fd = accept(ctl->fd, NULL, NULL);
+        if ( fd < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                handle->ready &= ~EV_READ;
+                return 0;
+            }
+            /* Out of descriptors and the like; try again on the next
+             * connection rather than bringing the relay down */
+            perror("Unable to accept control connection");
+            handle->ready &= ~EV_READ;
+            return 0;
+        }
+
+        if ( sock_nonblock(fd) < 0 ) {
+            close(fd);
+            continue;
+        }
+
+        /* Make room by hanging up on whoever has been connected longest,
+         * so that idle clients can't lock everyone else out.  The client
+         * is only freed by its own handler, once it sees the hangup, since
+         * it may yet be dispatched in this pass of the event loop. */
+        if ( ctl->nclients >= CONTROL_CLIENTS_MAX ) {
+            oldest = NULL;
+            for ( client = ctl->clients; client != NULL; client = client->next ) {
+                if ( ! client->evicted )
+                    oldest = client;
+            }
+            shutdown(oldest->ev.fd, SHUT_RDWR);
+            oldest->evicted = true;
+            ctl->nclients--;
+        }
+
+        client = calloc(1, sizeof(struct control_client));
+        if ( client == NULL || ev_add(ctl->ev, &client->ev, fd, client) < 0 ) {
+            free(client);
+            close(fd);
+            continue;
+        }
+
+        client->ctl = ctl;
+        client->next = ctl->clients;
+        ctl->clients = client;
+        ctl->nclients++;
+
+        if ( ctl->format == CONTROL_FORMAT_JSON ) {
+            report_json(ctl, &client->out);
+            client_respond(client);
+        } else {
+            client->ev.want = EV_READ;
+            client->ev.callback = client_request;
+        }
+    }
+}
+
+/**
+ * Allocate a control socket's state, not yet listening
+ */
+static control_t control_new(enum control_format format, ev_loop_t ev,
+                             const nulltty_t *pairs, size_t n)
+{
+    control_t ctl;
+
+    ctl = calloc(1, sizeof(struct control));
+    if ( ctl == NULL )
+        goto error;
+
+    ctl->fd = -1;
+    ctl->format = format;
+    ctl->ev = ev;
+    ctl->pairs = pairs;
+    ctl->n = n;
+
+    ctl->infos = calloc(n, sizeof(struct nulltty_info));
+    if ( ctl->infos == NULL )
+        goto error_ctl;
+
+    ctl->samples = calloc(2 * n, sizeof(struct control_sample));
+    if ( ctl->samples == NULL )
+        goto error_infos;
+
+    return ctl;
+
+ error_infos:
+    free(ctl->infos);
+ error_ctl:
+    free(ctl);
+ error:
+    return NULL;
+}
+
+static void control_free(control_t ctl)
+{
+    free(ctl->path);
+    free(ctl->samples);
+    free(ctl->infos);
+    free(ctl);
+}
+
+/**
+ * Start listening on a control socket's bound descriptor
+ */
+static int control_listen(control_t ctl)
+{
+    if ( listen(ctl->fd, CONTROL_CLIENTS_MAX) < 0
+         || ev_add(ctl->ev, &ctl->listen_ev, ctl->fd, ctl) < 0 )
+        return -1;
+
+    ctl->listen_ev.want = EV_READ;
+    ctl->listen_ev.callback = control_accept;
+    return 0;
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+control_t control_open(const char *path, enum control_format format,
+                       ev_loop_t ev, const nulltty_t *pairs, size_t n)
+{
+    struct sockaddr_un addr;
+    control_t ctl;
+
+    if ( ( ctl = control_new(format, ev, pairs, n) ) == NULL )
+        goto error;
+
+    if ( ( ctl->path = abs_path(path, strlen(path)) ) == NULL )
+        goto error_ctl;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( strlcpy(addr.sun_path, ctl->path, sizeof(addr.sun_path))
+         >= sizeof(addr.sun_path) ) {
+        errno = ENAMETOOLONG;
+        goto error_ctl;
+    }
+
+    ctl->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( ctl->fd < 0 )
+        goto error_ctl;
+
+    if ( sock_nonblock(ctl->fd) < 0
+         || bind(ctl->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+        goto error_socket;
+
+    if ( control_listen(ctl) < 0 )
+        goto error_bind;
+
+    return ctl;
+
+ error_bind:
+    unlink(ctl->path);
+ error_socket:
+    close(ctl->fd);
+ error_ctl:
+    control_free(ctl);
+ error:
+    return NULL;
+}
+
+control_t control_open_tcp(const char *host, const char *port,
+                           enum control_format format, ev_loop_t ev,
+                           const nulltty_t *pairs, size_t n)
+{
+    struct addrinfo hints, *res, *ai;
+    control_t ctl;
+    int on = 1, result;
+
+    if ( ( ctl = control_new(format, ev, pairs, n) ) == NULL )
+        goto error;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    result = getaddrinfo(host, port, &hints, &res);
+    if ( result != 0 ) {
+        if ( result != EAI_SYSTEM )
+            errno = EINVAL;
+        goto error_ctl;
+    }
+
+    for ( ai = res; ai != NULL; ai = ai->ai_next ) {
+        ctl->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ( ctl->fd < 0 )
+            continue;
+
+        if ( setsockopt(ctl->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0
+             && sock_nonblock(ctl->fd) == 0
+             && bind(ctl->fd, ai->ai_addr, ai->ai_addrlen) == 0 )
+            break;
+
+        result = errno;
+        close(ctl->fd);
+        ctl->fd = -1;
+        errno = result;
+    }
+    freeaddrinfo(res);
+    if ( ctl->fd < 0 )
+        goto error_ctl;
+
+    if ( control_listen(ctl) < 0 )
+        goto error_socket;
+
+    return ctl;
+
+ error_socket:
+    close(ctl->fd);
+ error_ctl:
+    control_free(ctl);
+ error:
+    return NULL;
+}
+
+int control_close(control_t ctl)
+{
+    int result = 0;
+
+    while ( ctl->clients != NULL )
+        client_close(ctl->clients);
+
+    ev_del(ctl->ev, &ctl->listen_ev);
+    if ( close(ctl->fd) < 0 )
+        result = -1;
+    if ( ctl->path != NULL && unlink(ctl->path) < 0 )
+        result = -1;
+
+    control_free(ctl);
+    return result;
+}
@@ -0,0 +1,96 @@
+#ifndef _NULLTTY_CONTROL_H_
+#define _NULLTTY_CONTROL_H_
+
+#include <stddef.h>
+
+#include "events.h"
+#include "ptys.h"
+
+/**
+ * Local control sockets for querying relay statistics
+ *
+ * Listens on a Unix-domain or TCP stream socket, and reports the
+ * per-direction counters of each PTY pair (see struct nulltty_stats) to
+ * every client which connects, in one of two formats:
+ *
+ * - JSON: the report is sent as soon as the client connects, along with
+ *   each direction's current transfer rates and a summary of its queueing
+ *   latency histogram, and the connection closed.
+ *
+ * - Prometheus: the client is an HTTP scraper; the report is sent in
+ *   Prometheus' text exposition format in response to a GET request, and
+ *   the connection closed.
+ *
+ * All socket I/O is non-blocking and driven by the event loop the socket
+ * is attached to, and reports are only rendered when asked for, so a slow
+ * client never holds up the relay.
+ *
+ * Rates are averaged over the time since the previous report, or over at
+ * least CONTROL_RATE_SEC if reports are requested more often than that.
+ */
+
+/** Minimum interval over which transfer rates are measured, in seconds */
+#define CONTROL_RATE_SEC 1
+
+/**
+ * Most clients served at once; the longest connected is dropped to make
+ * room for any more
+ */
+#define CONTROL_CLIENTS_MAX 64
+
+/** Longest HTTP request header accepted, in bytes */
+#define CONTROL_REQUEST_MAX 4096
+
+/**
+ * Report format served by a control socket
+ */
+enum control_format {
+    /** JSON document, sent as soon as a client connects */
+    CONTROL_FORMAT_JSON,
+    /** Prometheus text exposition format, served over HTTP */
+    CONTROL_FORMAT_PROMETHEUS,
+};
+
+struct control; /* Forward declaration */
+typedef struct control *control_t;
+
+/**
+ * Create a Unix-domain control socket and start serving it
+ *
+ * @param path Path to bind the socket to; must not exist already
+ * @param format Report format to serve
+ * @param ev Event loop to serve the socket from, which must dispatch
+ * handles with callbacks
+ * @param pairs PTY pairs to report on, which must outlive the socket
+ * @param n Number of pairs
+ * @return Control socket, or NULL with errno on error
+ */
+control_t control_open(const char *path, enum control_format format,
+                       ev_loop_t ev, const nulltty_t *pairs, size_t n);
+
+/**
+ * Create a TCP control socket and start serving it
+ *
+ * @param host Host name or address to listen on, or NULL for all
+ * @param port Port number or service name to listen on
+ * @param format Report format to serve
+ * @param ev Event loop to serve the socket from, which must dispatch
+ * handles with callbacks
+ * @param pairs PTY pairs to report on, which must outlive the socket
+ * @param n Number of pairs
+ * @return Control socket, or NULL with errno on error (EINVAL if the
+ * address cannot be resolved)
+ */
+control_t control_open_tcp(const char *host, const char *port,
+                           enum control_format format, ev_loop_t ev,
+                           const nulltty_t *pairs, size_t n);
+
+/**
+ * Close a control socket, disconnecting any clients and removing its path
+ *
+ * @param ctl Control socket returned by control_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int control_close(control_t ctl);
+
+#endif /* ! defined _NULLTTY_CONTROL_H_ */
@@ -0,0 +1,61 @@
+#ifndef _NULLTTY_DEBUG_H_
+#define _NULLTTY_DEBUG_H_
+
+/**
+ * Debugging instrumentation
+ *
+ * When built with --enable-debug, wraps the system calls made by the relay
+ * so that we can count them all.  The counters themselves are defined in
+ * ptys.c; this header must be included after the system headers
+ * declaring the wrapped functions.
+ *
+ * Per-direction counts of the relay's reads and writes are kept in every
+ * build, in struct nulltty_stats.
+ */
+
+#ifdef DEBUG
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+extern unsigned long nsyscalls;
+extern unsigned long nselects;
+
+static inline ssize_t debug_read(int fd, void *buf, size_t count) {
+    nsyscalls++;
+    return read(fd, buf, count);
+}
+#define read(...) debug_read(__VA_ARGS__)
+
+static inline ssize_t debug_write(int fd, const void *buf, size_t count) {
+    nsyscalls++;
+    return write(fd, buf, count);
+}
+#define write(...) debug_write(__VA_ARGS__)
+
+static inline ssize_t debug_readv(int fd, const struct iovec *iov, int iovcnt) {
+    nsyscalls++;
+    return readv(fd, iov, iovcnt);
+}
+#define readv(...) debug_readv(__VA_ARGS__)
+
+static inline ssize_t debug_writev(int fd, const struct iovec *iov, int iovcnt) {
+    nsyscalls++;
+    return writev(fd, iov, iovcnt);
+}
+#define writev(...) debug_writev(__VA_ARGS__)
+
+#ifdef HAVE_SPLICE
+static inline ssize_t debug_splice(int fd_in, loff_t *off_in, int fd_out,
+                                   loff_t *off_out, size_t len,
+                                   unsigned int flags) {
+    nsyscalls++;
+    return splice(fd_in, off_in, fd_out, off_out, len, flags);
+}
+#define splice(...) debug_splice(__VA_ARGS__)
+#endif
+
+#endif /* DEBUG */
+
+#endif /* ! defined _NULLTTY_DEBUG_H_ */
@@ -0,0 +1,341 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <unistd.h>
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#include "events.h"
+#include "debug.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+#ifdef USE_EPOLL
+
+/** Maximum number of events to collect per epoll_pwait() */
+#define EV_BATCH 64
+
+struct ev_loop {
+    int epfd;
+};
+
+#else /* defined USE_EPOLL */
+
+struct ev_loop {
+    struct ev_handle **handles;
+    size_t n;
+    size_t cap;
+};
+
+#endif /* ! defined USE_EPOLL */
+
+
+/*** DEBUGGING INSTRUMENTATION ************************************************/
+
+#ifdef DEBUG
+
+#ifdef USE_EPOLL
+
+static inline int debug_epoll_pwait(int epfd, struct epoll_event *events,
+                                    int maxevents, int timeout,
+                                    const sigset_t *sigmask)
+{
+    nsyscalls++;
+    nselects++;
+    return epoll_pwait(epfd, events, maxevents, timeout, sigmask);
+}
+#define epoll_pwait(...) debug_epoll_pwait(__VA_ARGS__)
+
+#elif defined HAVE_PSELECT
+
+static inline int debug_pselect(int nfds, fd_set *readfds, fd_set *writefds,
+                                fd_set *exceptfds, const struct timespec *timeout,
+                                const sigset_t *sigmask)
+{
+    nsyscalls++;
+    nselects++;
+    return pselect(nfds, readfds, writefds, exceptfds, timeout, sigmask);
+}
+#define pselect(...) debug_pselect(__VA_ARGS__)
+
+#else /* defined HAVE_PSELECT */
+
+static inline int debug_select(int nfds, fd_set *readfds, fd_set *writefds,
+                               fd_set *exceptfds, struct timeval *timeout)
+{
+    nsyscalls++;
+    nselects++;
+    return select(nfds, readfds, writefds, exceptfds, timeout);
+}
+#define select(...) debug_select(__VA_ARGS__)
+
+#endif /* ! defined HAVE_PSELECT */
+
+#endif /* DEBUG */
+
+
+/*** EPOLL BACKEND ************************************************************/
+
+#ifdef USE_EPOLL
+
+ev_loop_t ev_open(void)
+{
+    ev_loop_t ev;
+
+    ev = calloc(1, sizeof(struct ev_loop));
+    if ( ev == NULL )
+        goto error;
+
+    ev->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if ( ev->epfd < 0 )
+        goto error_epoll;
+
+    return ev;
+
+ error_epoll:
+    free(ev);
+ error:
+    return NULL;
+}
+
+int ev_close(ev_loop_t ev)
+{
+    int result = 0;
+
+    if ( close(ev->epfd) < 0 )
+        result = -1;
+
+    free(ev);
+    return result;
+}
+
+int ev_add(ev_loop_t ev, struct ev_handle *handle, int fd, void *data)
+{
+    struct epoll_event event = { 0 };
+
+    handle->fd = fd;
+    handle->want = 0;
+    handle->ready = 0;
+    handle->data = data;
+    handle->callback = NULL;
+
+    /*
+     * Interest in both directions is registered up front and left alone
+     * from then on; the caller tracks readiness in the handle and only
+     * needs to hear from us again after it has seen EAGAIN.
+     */
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.ptr = handle;
+    return epoll_ctl(ev->epfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+int ev_del(ev_loop_t ev, struct ev_handle *handle)
+{
+    struct epoll_event event = { 0 };
+
+    return epoll_ctl(ev->epfd, EPOLL_CTL_DEL, handle->fd, &event);
+}
+
+int ev_fd(ev_loop_t ev)
+{
+    return ev->epfd;
+}
+
+int ev_wait(ev_loop_t ev, struct ev_handle **active,
+            const struct timespec *timeout, const sigset_t *sigmask)
+{
+    struct epoll_event events[EV_BATCH];
+    struct ev_handle *handle;
+    int i, n, timeout_ms = -1;
+
+    *active = NULL;
+
+    if ( timeout != NULL )
+        timeout_ms = timeout->tv_sec * 1000
+            + ( timeout->tv_nsec + 999999 ) / 1000000;
+
+    n = epoll_pwait(ev->epfd, events, EV_BATCH, timeout_ms, sigmask);
+    if ( n < 0 )
+        return -1;
+
+    for ( i = 0; i < n; i++ ) {
+        handle = events[i].data.ptr;
+
+        if ( events[i].events & ( EPOLLIN | EPOLLHUP | EPOLLERR ) )
+            handle->ready |= EV_READ;
+        if ( events[i].events & ( EPOLLOUT | EPOLLERR ) )
+            handle->ready |= EV_WRITE;
+
+        handle->next_active = *active;
+        *active = handle;
+    }
+
+    return n;
+}
+
+#endif /* USE_EPOLL */
+
+
+/*** SELECT BACKEND ***********************************************************/
+
+#ifndef USE_EPOLL
+
+ev_loop_t ev_open(void)
+{
+    return calloc(1, sizeof(struct ev_loop));
+}
+
+int ev_close(ev_loop_t ev)
+{
+    free(ev->handles);
+    free(ev);
+    return 0;
+}
+
+int ev_add(ev_loop_t ev, struct ev_handle *handle, int fd, void *data)
+{
+    struct ev_handle **handles;
+    size_t cap;
+
+    if ( fd >= FD_SETSIZE ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if ( ev->n == ev->cap ) {
+        cap = ev->cap ? 2 * ev->cap : 8;
+        handles = realloc(ev->handles, cap * sizeof(struct ev_handle *));
+        if ( handles == NULL )
+            return -1;
+
+        ev->handles = handles;
+        ev->cap = cap;
+    }
+
+    handle->fd = fd;
+    handle->want = 0;
+    handle->ready = 0;
+    handle->data = data;
+    handle->callback = NULL;
+
+    ev->handles[ev->n++] = handle;
+    return 0;
+}
+
+int ev_del(ev_loop_t ev, struct ev_handle *handle)
+{
+    size_t i;
+
+    for ( i = 0; i < ev->n; i++ ) {
+        if ( ev->handles[i] == handle ) {
+            ev->handles[i] = ev->handles[--ev->n];
+            return 0;
+        }
+    }
+
+    errno = ENOENT;
+    return -1;
+}
+
+int ev_fd(ev_loop_t ev)
+{
+    (void)ev;
+    errno = ENOTSUP;
+    return -1;
+}
+
+int ev_wait(ev_loop_t ev, struct ev_handle **active,
+            const struct timespec *timeout, const sigset_t *sigmask)
+{
+    struct ev_handle *handle;
+    fd_set rfds, wfds;
+    unsigned watch;
+    int nfds = 0, n = 0, result;
+    size_t i;
+
+    *active = NULL;
+
+    FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
+
+    /*
+     * select() is level-triggered, so only watch for events which the
+     * caller hasn't already been told about; otherwise we would return
+     * immediately for a descriptor that is readable but whose reader's
+     * buffer is full.
+     */
+    for ( i = 0; i < ev->n; i++ ) {
+        handle = ev->handles[i];
+        watch = handle->want & ~handle->ready;
+
+        if ( watch & EV_READ )
+            FD_SET(handle->fd, &rfds);
+        if ( watch & EV_WRITE )
+            FD_SET(handle->fd, &wfds);
+        if ( watch && handle->fd >= nfds )
+            nfds = handle->fd + 1;
+    }
+
+#ifdef HAVE_PSELECT
+
+    result = pselect(nfds, &rfds, &wfds, NULL, timeout, sigmask);
+
+#else /* defined HAVE_PSELECT */
+
+    {
+        sigset_t prev_set;
+        struct timeval tv, *tvp = NULL;
+
+        if ( timeout != NULL ) {
+            tv.tv_sec = timeout->tv_sec;
+            tv.tv_usec = ( timeout->tv_nsec + 999 ) / 1000;
+            tvp = &tv;
+        }
+
+        if ( sigmask != NULL
+             && pthread_sigmask(SIG_SETMASK, sigmask, &prev_set) != 0 )
+            return -1;
+
+        result = select(nfds, &rfds, &wfds, NULL, tvp);
+
+        if ( sigmask != NULL ) {
+            int select_errno = errno;
+            pthread_sigmask(SIG_SETMASK, &prev_set, NULL);
+            errno = select_errno;
+        }
+    }
+
+#endif /* ! defined HAVE_PSELECT */
+
+    if ( result < 0 )
+        return -1;
+
+    for ( i = 0; i < ev->n; i++ ) {
+        handle = ev->handles[i];
+        watch = 0;
+
+        if ( FD_ISSET(handle->fd, &rfds) )
+            watch |= EV_READ;
+        if ( FD_ISSET(handle->fd, &wfds) )
+            watch |= EV_WRITE;
+
+        if ( watch ) {
+            handle->ready |= watch;
+            handle->next_active = *active;
+            *active = handle;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+#endif /* ! defined USE_EPOLL */
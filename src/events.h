@@ -0,0 +1,130 @@
+#ifndef _NULLTTY_EVENTS_H_
+#define _NULLTTY_EVENTS_H_
+
+#include <signal.h>
+#include <time.h>
+
+/**
+ * Readiness notification backend for the relay loop
+ *
+ * Wraps the platform's descriptor readiness mechanism behind an
+ * edge-triggered interface.  Where epoll is available (and not disabled
+ * at configure time) descriptors are registered with the kernel once, in
+ * edge-triggered mode, and never re-registered; elsewhere we fall back on
+ * select() or pselect(), rebuilding the fd_sets from each handle's
+ * declared interest on every wait.
+ *
+ * In both cases the backend only ever sets bits in a handle's ready mask.
+ * It is up to the caller to clear them again once an operation on the
+ * descriptor fails with EAGAIN.
+ *
+ * Under strict ISO C, sigset_t needs a POSIX feature test macro (see
+ * ptys.h).
+ */
+
+#define EV_READ  0x01
+#define EV_WRITE 0x02
+
+struct ev_handle; /* Forward declaration */
+
+/**
+ * Handler for a descriptor's events, for loops which dispatch that way
+ *
+ * A handler may deregister and free its own handle, but no other, since
+ * the loop may be yet to dispatch it.
+ *
+ * @param handle Handle with new events in its ready mask
+ * @return 0 on success, -1 with errno on an error fatal to the loop
+ */
+typedef int (*ev_callback_t)(struct ev_handle *handle);
+
+/**
+ * Registration of a single descriptor with an event loop
+ *
+ * Handles are owned by the caller, typically embedded in whatever
+ * structure describes the descriptor, and must remain valid for as long
+ * as they are registered.
+ */
+struct ev_handle {
+    int fd;
+    unsigned want;   /**< Events the caller is waiting on */
+    unsigned ready;  /**< Events seen since last cleared by the caller */
+    void *data;      /**< Opaque caller data */
+    ev_callback_t callback; /**< Handler, or NULL; not used by ev_wait() */
+    struct ev_handle *next_active; /**< Next in list built by ev_wait() */
+};
+
+struct ev_loop; /* Forward declaration */
+typedef struct ev_loop *ev_loop_t;
+
+/**
+ * Create a new event loop
+ *
+ * @return Event loop, or NULL with errno on error
+ */
+ev_loop_t ev_open(void);
+
+/**
+ * Destroy an event loop
+ *
+ * Registered descriptors are not closed.
+ *
+ * @param ev Event loop returned by ev_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int ev_close(ev_loop_t ev);
+
+/**
+ * Register a descriptor with an event loop
+ *
+ * The handle's ready mask and callback are reset; readiness which already
+ * holds at registration time is reported by the next call to ev_wait().
+ *
+ * @param ev Event loop returned by ev_open()
+ * @param handle Caller-owned handle to register
+ * @param fd Descriptor to watch for readability and writability
+ * @param data Opaque pointer stored in the handle
+ * @return 0 on success, -1 with errno on error
+ */
+int ev_add(ev_loop_t ev, struct ev_handle *handle, int fd, void *data);
+
+/**
+ * Remove a descriptor from an event loop
+ *
+ * @param ev Event loop returned by ev_open()
+ * @param handle Handle previously passed to ev_add()
+ * @return 0 on success, -1 with errno on error
+ */
+int ev_del(ev_loop_t ev, struct ev_handle *handle);
+
+/**
+ * Get a descriptor which polls readable while an event loop has new
+ * events waiting, for nesting it inside another event loop
+ *
+ * @param ev Event loop returned by ev_open()
+ * @return Descriptor, owned by the event loop, or -1 with errno ENOTSUP
+ * under the select() backend, which has none
+ */
+int ev_fd(ev_loop_t ev);
+
+/**
+ * Wait for events on registered descriptors
+ *
+ * Blocks until at least one registered handle which wants an event not
+ * already in its ready mask receives that event, the timeout expires, or
+ * a signal is caught.  Newly seen events are or'ed into the handles'
+ * ready masks, and the handles concerned are returned as a list so that
+ * the caller need not scan every registered descriptor.
+ *
+ * @param ev Event loop returned by ev_open()
+ * @param active Set to a list, linked through next_active, of the handles
+ * with new events, or NULL if there are none
+ * @param timeout Maximum time to wait, or NULL to wait indefinitely
+ * @param sigmask Signal mask to apply atomically for the duration of the
+ * wait, or NULL to leave the current mask in place
+ * @return Number of handles with new events, or -1 with errno on error
+ */
+int ev_wait(ev_loop_t ev, struct ev_handle **active,
+            const struct timespec *timeout, const sigset_t *sigmask);
+
+#endif /* ! defined _NULLTTY_EVENTS_H_ */
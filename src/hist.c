@@ -0,0 +1,79 @@
+#include <stubs.h>
+
+#include "hist.h"
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Index of the most significant bit set in a non-zero value
+ */
+static int msb64(uint64_t v)
+{
+    int i = 0;
+
+    if ( v >> 32 ) { v >>= 32; i += 32; }
+    if ( v >> 16 ) { v >>= 16; i += 16; }
+    if ( v >> 8 )  { v >>= 8;  i += 8; }
+    if ( v >> 4 )  { v >>= 4;  i += 4; }
+    if ( v >> 2 )  { v >>= 2;  i += 2; }
+    if ( v >> 1 )  i += 1;
+
+    return i;
+}
+
+static size_t hist_bucket(uint64_t v)
+{
+    int shift;
+
+    if ( v < 2 * HIST_HALF )
+        return v;
+
+    shift = msb64(v) - ( HIST_SUB_BITS - 1 );
+    return shift * HIST_HALF + ( v >> shift );
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+void hist_add(struct hist *hist, uint64_t value, uint64_t weight)
+{
+    hist->count[hist_bucket(value)] += weight;
+    hist->total += weight;
+    if ( value > hist->max )
+        hist->max = value;
+}
+
+uint64_t hist_upper(size_t bucket)
+{
+    int shift;
+
+    if ( bucket < 2 * HIST_HALF )
+        return bucket;
+
+    shift = bucket / HIST_HALF - 1;
+    return ( ( (uint64_t)( bucket % HIST_HALF + HIST_HALF + 1 ) ) << shift ) - 1;
+}
+
+uint64_t hist_quantile(const struct hist *hist, double q)
+{
+    uint64_t rank, seen = 0, upper;
+    size_t i;
+
+    if ( hist->total == 0 )
+        return 0;
+
+    rank = q * hist->total;
+    if ( rank >= hist->total )
+        rank = hist->total - 1;
+
+    for ( i = 0; i < HIST_BUCKETS; i++ ) {
+        seen += hist->count[i];
+        if ( seen > rank ) {
+            upper = hist_upper(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
@@ -0,0 +1,51 @@
+#ifndef _NULLTTY_HIST_H_
+#define _NULLTTY_HIST_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Fixed-size log-linear histogram of nanosecond durations
+ *
+ * Buckets are exact below 2^HIST_SUB_BITS nanoseconds; above that each
+ * power of two is split into 2^(HIST_SUB_BITS-1) linear sub-buckets, for
+ * a worst case error of about 12%.  Every sample carries a weight, so that
+ * e.g. bytes rather than events may be counted.
+ */
+#define HIST_SUB_BITS  4
+#define HIST_HALF      ( 1 << ( HIST_SUB_BITS - 1 ) )
+#define HIST_BUCKETS   ( ( 64 - HIST_SUB_BITS + 2 ) * HIST_HALF )
+
+struct hist {
+    uint64_t count[HIST_BUCKETS]; /**< Total weight in each bucket */
+    uint64_t total;               /**< Total weight of all samples */
+    uint64_t max;                 /**< Largest value recorded */
+};
+
+/**
+ * Record a weighted sample
+ *
+ * @param hist Histogram, initially zeroed
+ * @param value Duration in nanoseconds
+ * @param weight Weight of the sample
+ */
+void hist_add(struct hist *hist, uint64_t value, uint64_t weight);
+
+/**
+ * Estimate a quantile of the recorded samples
+ *
+ * @param hist Histogram
+ * @param q Quantile, from 0 to 1
+ * @return Upper bound of the bucket holding the quantile, or 0 if empty
+ */
+uint64_t hist_quantile(const struct hist *hist, double q);
+
+/**
+ * Largest value falling into a bucket
+ *
+ * @param bucket Bucket index, less than HIST_BUCKETS
+ * @return Inclusive upper bound of the bucket, in nanoseconds
+ */
+uint64_t hist_upper(size_t bucket);
+
+#endif /* ! defined _NULLTTY_HIST_H_ */
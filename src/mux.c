@@ -0,0 +1,690 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mux.h"
+#include "events.h"
+#include "ptys.h"
+#include "pty.h"
+#include "ring.h"
+#include "util.h"
+#include "debug.h"
+
+/* Basic option framing */
+#define MUX_FLAG 0xf9
+#define MUX_EA   0x01   /* Address and length extension bit */
+#define MUX_CR   0x02   /* Command/response bit */
+#define MUX_PF   0x10   /* Poll/final bit of the control field */
+
+/* Frame types, control fields less the poll/final bit */
+#define MUX_SABM 0x2f
+#define MUX_UA   0x63
+#define MUX_DM   0x0f
+#define MUX_DISC 0x43
+#define MUX_UIH  0xef
+#define MUX_UI   0x03
+
+/** Bytes a frame adds around its information field, at most */
+#define MUX_OVERHEAD 7
+
+/** CRC of a frame's checked fields and its FCS, when the FCS is right */
+#define MUX_FCS_GOOD 0xcf
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+struct mux_endpoint {
+    int fd;
+    int slave_fd;
+    char *link;
+    struct ev_handle ev;
+    struct ring in;      /* Read from the PTY */
+    struct ring out;     /* To be written to the PTY */
+    bool open;           /* Channel opened with SABM */
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+};
+
+struct mux {
+    ev_loop_t ev;
+    size_t frame;        /* Largest information field */
+    struct mux_endpoint link;
+    struct mux_endpoint *ch;
+    size_t n;
+    size_t next;         /* Channel to offer the link to first */
+    bool synced;         /* The link's receive buffer starts at a frame
+                            or at more flags, rather than in noise */
+    uint64_t frames_in;
+    uint64_t frames_out;
+    uint64_t bad_frames; /* Malformed or failing their FCS */
+    uint64_t discarded;  /* Bytes skipped hunting for a flag */
+    uint64_t unrouted;   /* Bytes sent to DLCIs with no channel */
+};
+
+/* Reversed x^8 + x^2 + x + 1, as used for the FCS */
+static uint8_t crc_table[256];
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+static void crc_init(void)
+{
+    unsigned i, bit, crc;
+
+    for ( i = 0; i < 256; i++ ) {
+        crc = i;
+        for ( bit = 0; bit < 8; bit++ )
+            crc = crc & 1 ? ( crc >> 1 ) ^ 0xe0 : crc >> 1;
+        crc_table[i] = crc;
+    }
+}
+
+static uint8_t crc_update(uint8_t crc, const uint8_t *data, size_t len)
+{
+    while ( len-- > 0 )
+        crc = crc_table[crc ^ *data++];
+
+    return crc;
+}
+
+static uint8_t ring_byte(const struct ring *ring, size_t pos)
+{
+    return ring->buf[pos & ring->mask];
+}
+
+/**
+ * CRC a span of a ring buffer
+ */
+static uint8_t ring_crc(const struct ring *ring, size_t start, size_t len,
+                        uint8_t crc)
+{
+    struct iovec iov[2];
+    int i, iovcnt;
+
+    iovcnt = ring_iov(ring, start, len, iov);
+    for ( i = 0; i < iovcnt; i++ )
+        crc = crc_update(crc, iov[i].iov_base, iov[i].iov_len);
+
+    return crc;
+}
+
+/**
+ * Append data to a ring buffer, which must have room for it
+ */
+static void ring_put(struct ring *ring, const void *data, size_t len)
+{
+    struct iovec iov[2];
+    int i, iovcnt;
+
+    iovcnt = ring_iov(ring, ring->head, len, iov);
+    for ( i = 0; i < iovcnt; i++ ) {
+        memcpy(iov[i].iov_base, data, iov[i].iov_len);
+        data = (const uint8_t *)data + iov[i].iov_len;
+    }
+    ring->head += len;
+}
+
+/**
+ * Queue a frame to go out on the link
+ *
+ * The link's transmit buffer must have room for the information field
+ * plus MUX_OVERHEAD.  Only the header is checked by the FCS, which is
+ * right for every frame type we send.
+ *
+ * @param mux Multiplexer
+ * @param addr Address field
+ * @param ctrl Control field
+ * @param iov Pieces of the information field
+ * @param iovcnt Number of pieces, which may be 0
+ */
+static void mux_send(struct mux *mux, uint8_t addr, uint8_t ctrl,
+                     const struct iovec *iov, int iovcnt)
+{
+    struct ring *tx = &mux->link.out;
+    uint8_t hdr[5], trailer[2];
+    size_t len = 0, hlen;
+    int i;
+
+    for ( i = 0; i < iovcnt; i++ )
+        len += iov[i].iov_len;
+
+    hdr[0] = MUX_FLAG;
+    hdr[1] = addr;
+    hdr[2] = ctrl;
+    if ( len <= 0x7f ) {
+        hdr[3] = len << 1 | MUX_EA;
+        hlen = 4;
+    } else {
+        hdr[3] = ( len & 0x7f ) << 1;
+        hdr[4] = len >> 7;
+        hlen = 5;
+    }
+
+    trailer[0] = 0xff - crc_update(0xff, hdr + 1, hlen - 1);
+    trailer[1] = MUX_FLAG;
+
+    ring_put(tx, hdr, hlen);
+    for ( i = 0; i < iovcnt; i++ )
+        ring_put(tx, iov[i].iov_base, iov[i].iov_len);
+    ring_put(tx, trailer, sizeof(trailer));
+
+    mux->frames_out++;
+}
+
+/**
+ * Answer a message on the control channel
+ *
+ * Commands are returned as responses, by clearing the C/R bit of their
+ * type; responses, to commands we never send, are ignored.
+ *
+ * @return 1 if handled, 0 if the link has no room for the answer yet
+ */
+static int mux_control(struct mux *mux, size_t start, size_t len)
+{
+    struct ring *rx = &mux->link.in;
+    struct iovec iov[3];
+    uint8_t type;
+
+    if ( len == 0 || ! ( ring_byte(rx, start) & MUX_CR ) )
+        return 1;
+    if ( ring_space(&mux->link.out) < len + MUX_OVERHEAD )
+        return 0;
+
+    type = ring_byte(rx, start) & ~MUX_CR;
+    iov[0].iov_base = &type;
+    iov[0].iov_len = 1;
+    mux_send(mux, MUX_EA, MUX_UIH, iov,
+             1 + ring_iov(rx, start + 1, len - 1, iov + 1));
+    return 1;
+}
+
+/**
+ * Act on a well-formed frame from the link
+ *
+ * @param mux Multiplexer
+ * @param dlci Frame's DLCI
+ * @param ctrl Frame's control field
+ * @param start Position of its information field in the receive buffer
+ * @param len Length of its information field
+ * @return 1 if handled, 0 if it must wait for room in a buffer
+ */
+static int mux_frame_in(struct mux *mux, unsigned dlci, uint8_t ctrl,
+                        size_t start, size_t len)
+{
+    struct ring *rx = &mux->link.in;
+    struct mux_endpoint *ch;
+    struct iovec iov[2];
+    int i, iovcnt;
+
+    ch = dlci >= 1 && dlci <= mux->n ? &mux->ch[dlci-1] : NULL;
+
+    switch ( ctrl & ~MUX_PF ) {
+    case MUX_SABM:
+    case MUX_DISC:
+        if ( ring_space(&mux->link.out) < MUX_OVERHEAD )
+            return 0;
+
+        /* As the responding end, we set C/R on responses */
+        if ( dlci == 0 || ch != NULL )
+            mux_send(mux, dlci << 2 | MUX_CR | MUX_EA,
+                     MUX_UA | ( ctrl & MUX_PF ), NULL, 0);
+        else
+            mux_send(mux, dlci << 2 | MUX_CR | MUX_EA,
+                     MUX_DM | ( ctrl & MUX_PF ), NULL, 0);
+        if ( ch != NULL )
+            ch->open = ( ctrl & ~MUX_PF ) == MUX_SABM;
+        return 1;
+
+    case MUX_UIH:
+    case MUX_UI:
+        if ( dlci == 0 )
+            return mux_control(mux, start, len);
+        if ( ch == NULL ) {
+            mux->unrouted += len;
+            return 1;
+        }
+        if ( ring_space(&ch->out) < len )
+            return 0;
+
+        iovcnt = ring_iov(rx, start, len, iov);
+        for ( i = 0; i < iovcnt; i++ )
+            ring_put(&ch->out, iov[i].iov_base, iov[i].iov_len);
+        return 1;
+
+    default:
+        /* UA and DM answer commands, which we never send */
+        return 1;
+    }
+}
+
+/**
+ * Skip to just past the next flag in the link's receive buffer
+ *
+ * @return Whether a flag was found
+ */
+static bool mux_hunt(struct mux *mux)
+{
+    struct ring *rx = &mux->link.in;
+    struct iovec iov[2];
+    const uint8_t *flag;
+    size_t skipped = 0;
+    int i, iovcnt;
+
+    iovcnt = ring_iov(rx, rx->tail, ring_len(rx), iov);
+    for ( i = 0; i < iovcnt; i++ ) {
+        flag = memchr(iov[i].iov_base, MUX_FLAG, iov[i].iov_len);
+        if ( flag != NULL ) {
+            skipped += flag - (const uint8_t *)iov[i].iov_base;
+            mux->discarded += skipped;
+            rx->tail += skipped + 1;
+            mux->synced = true;
+            return true;
+        }
+        skipped += iov[i].iov_len;
+    }
+
+    mux->discarded += skipped;
+    rx->tail += skipped;
+    return false;
+}
+
+/**
+ * Act on as many complete frames in the link's receive buffer as we can
+ *
+ * Frames are handled where they lie.  Of an incomplete frame only the
+ * header is looked at each time more data arrives, and the information
+ * field not at all until the whole frame is in.
+ *
+ * @return 1 on progress, 0 if no more frames can be handled yet
+ */
+static int mux_parse(struct mux *mux)
+{
+    struct ring *rx = &mux->link.in;
+    size_t avail, hlen, len, fcs;
+    uint8_t addr, ctrl, crc;
+    int progress = 0;
+
+    while ( true ) {
+        if ( ! mux->synced && ! mux_hunt(mux) )
+            break;
+
+        /* Flags between frames, which may also be a shared closing and
+         * opening flag, or fill on an idle link */
+        while ( rx->tail != rx->head && ring_byte(rx, rx->tail) == MUX_FLAG )
+            rx->tail++;
+
+        avail = ring_len(rx);
+        if ( avail < 3 )
+            break;
+
+        addr = ring_byte(rx, rx->tail);
+        ctrl = ring_byte(rx, rx->tail + 1);
+        len = ring_byte(rx, rx->tail + 2);
+        hlen = 3;
+        if ( ! ( len & MUX_EA ) ) {
+            if ( avail < 4 )
+                break;
+            len = len >> 1 | (size_t)ring_byte(rx, rx->tail + 3) << 7;
+            hlen = 4;
+        } else {
+            len >>= 1;
+        }
+
+        if ( ( addr & MUX_EA ) && len <= mux->frame ) {
+            if ( avail < hlen + len + 2 )
+                break;
+
+            fcs = rx->tail + hlen + len;
+            crc = ring_crc(rx, rx->tail, hlen, 0xff);
+            if ( ( ctrl & ~MUX_PF ) != MUX_UIH )
+                crc = ring_crc(rx, rx->tail + hlen, len, crc);
+            crc = crc_table[crc ^ ring_byte(rx, fcs)];
+
+            if ( crc == MUX_FCS_GOOD && ring_byte(rx, fcs + 1) == MUX_FLAG ) {
+                if ( mux_frame_in(mux, addr >> 2, ctrl, rx->tail + hlen,
+                                  len) == 0 )
+                    break;
+
+                /* Leave the closing flag to open the next frame */
+                rx->tail = fcs + 1;
+                mux->frames_in++;
+                progress = 1;
+                continue;
+            }
+        }
+
+        /* Not a frame after all, so look for the next one */
+        mux->bad_frames++;
+        mux->synced = false;
+        rx->tail++;
+        progress = 1;
+    }
+
+    return progress;
+}
+
+/**
+ * Frame up data from the channels onto the link
+ *
+ * Channels take turns one frame at a time, the turn passing on from the
+ * last channel served whenever the link's transmit buffer fills.
+ *
+ * @return 1 on progress, 0 if nothing could be sent
+ */
+static int mux_schedule(struct mux *mux)
+{
+    struct mux_endpoint *ch;
+    struct iovec iov[2];
+    size_t len, i;
+    int iovcnt, progress = 0;
+    bool sent;
+
+    do {
+        sent = false;
+
+        for ( i = 0; i < mux->n; i++ ) {
+            ch = &mux->ch[mux->next];
+
+            len = ring_len(&ch->in);
+            if ( len > mux->frame )
+                len = mux->frame;
+            if ( len > 0 ) {
+                if ( ring_space(&mux->link.out) < len + MUX_OVERHEAD )
+                    return progress;
+
+                iovcnt = ring_iov(&ch->in, ch->in.tail, len, iov);
+                mux_send(mux, ( mux->next + 1 ) << 2 | MUX_EA, MUX_UIH,
+                         iov, iovcnt);
+                ch->in.tail += len;
+                sent = true;
+                progress = 1;
+            }
+
+            mux->next = ( mux->next + 1 ) % mux->n;
+        }
+    } while ( sent );
+
+    return progress;
+}
+
+/**
+ * Fill an endpoint's receive buffer from its PTY
+ *
+ * @return 1 on progress, 0 if nothing could be read, -1 with errno on error
+ */
+static int mux_read(struct mux_endpoint *ep)
+{
+    ssize_t n;
+
+    if ( ! ( ep->ev.ready & EV_READ ) || ring_space(&ep->in) == 0 )
+        return 0;
+
+    n = ring_readv(&ep->in, ep->fd);
+    if ( n < 0 && errno == EINTR )
+        return 1;
+    if ( n < 0 && errno != EAGAIN )
+        return -1;
+    if ( n <= 0 ) {
+        ep->ev.ready &= ~EV_READ;
+        return 0;
+    }
+
+    ep->bytes_in += n;
+    return 1;
+}
+
+/**
+ * Drain an endpoint's transmit buffer to its PTY
+ *
+ * @return 1 on progress, 0 if nothing could be written, -1 with errno on
+ * error
+ */
+static int mux_write(struct mux_endpoint *ep)
+{
+    ssize_t n;
+    int progress = 0;
+
+    while ( ( ep->ev.ready & EV_WRITE ) && ring_len(&ep->out) > 0 ) {
+        n = ring_writev(&ep->out, ep->fd);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && errno == EAGAIN ) {
+            ep->ev.ready &= ~EV_WRITE;
+            break;
+        }
+        if ( n < 0 )
+            return -1;
+
+        ep->bytes_out += n;
+        progress = 1;
+    }
+
+    return progress;
+}
+
+/**
+ * Move data between the link and its channels until no more can move
+ *
+ * Each pass reads at most once from each channel in turn, as on a bus.
+ */
+static int mux_service(struct mux *mux)
+{
+    size_t i;
+    int progress, result;
+
+    do {
+        if ( ( progress = mux_read(&mux->link) ) < 0 )
+            return -1;
+        progress |= mux_parse(mux);
+
+        for ( i = 0; i < mux->n; i++ ) {
+            if ( ( result = mux_write(&mux->ch[i]) ) < 0 )
+                return -1;
+            progress |= result;
+        }
+
+        for ( i = 0; i < mux->n; i++ ) {
+            if ( ( result = mux_read(&mux->ch[i]) ) < 0 )
+                return -1;
+            progress |= result;
+        }
+
+        progress |= mux_schedule(mux);
+        if ( ( result = mux_write(&mux->link) ) < 0 )
+            return -1;
+        progress |= result;
+    } while ( progress );
+
+    return 0;
+}
+
+/**
+ * Open an endpoint's PTY and buffers, and register it with the loop
+ */
+static int endpoint_open(struct mux *mux, struct mux_endpoint *ep,
+                         const char *link, size_t size)
+{
+    if ( ( ep->link = strdup(link) ) == NULL )
+        goto error;
+    if ( ring_init(&ep->in, size) < 0 )
+        goto error_link;
+    if ( ring_init(&ep->out, size) < 0 )
+        goto error_in;
+    if ( pty_open(ep->link, &ep->fd, &ep->slave_fd) < 0 )
+        goto error_out;
+    if ( ev_add(mux->ev, &ep->ev, ep->fd, ep) < 0 )
+        goto error_pty;
+    ep->ev.want = EV_READ | EV_WRITE;
+
+    return 0;
+
+ error_pty:
+    pty_close(ep->link, ep->fd, ep->slave_fd);
+ error_out:
+    ring_free(&ep->out);
+ error_in:
+    ring_free(&ep->in);
+ error_link:
+    free(ep->link);
+ error:
+    return -1;
+}
+
+static int endpoint_close(struct mux *mux, struct mux_endpoint *ep)
+{
+    int result;
+
+    ev_del(mux->ev, &ep->ev);
+    result = pty_close(ep->link, ep->fd, ep->slave_fd);
+    ring_free(&ep->out);
+    ring_free(&ep->in);
+    free(ep->link);
+
+    return result;
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+mux_t mux_open(const char *link, char *const *channels, size_t n,
+               size_t size, size_t frame)
+{
+    mux_t mux;
+    size_t nopen;
+
+    if ( n < 1 || n > MUX_CHANNELS_MAX || frame < 1
+         || frame > MUX_FRAME_MAX || size > READ_BUF_MAX ) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    /* Room for a whole frame to arrive while another is still waiting */
+    size = round_pow2(size);
+    if ( size < 2 * ( frame + MUX_OVERHEAD ) )
+        size = round_pow2(2 * ( frame + MUX_OVERHEAD ));
+
+    mux = calloc(1, sizeof(struct mux));
+    if ( mux == NULL )
+        goto error;
+
+    mux->frame = frame;
+    mux->n = n;
+    crc_init();
+
+    if ( ( mux->ev = ev_open() ) == NULL )
+        goto error_mux;
+    if ( ( mux->ch = calloc(n, sizeof(struct mux_endpoint)) ) == NULL )
+        goto error_ev;
+    if ( endpoint_open(mux, &mux->link, link, size) < 0 )
+        goto error_ch;
+
+    for ( nopen = 0; nopen < n; nopen++ )
+        if ( endpoint_open(mux, &mux->ch[nopen], channels[nopen], size) < 0 )
+            goto error_open;
+
+    return mux;
+
+ error_open:
+    while ( nopen-- > 0 )
+        endpoint_close(mux, &mux->ch[nopen]);
+    endpoint_close(mux, &mux->link);
+ error_ch:
+    free(mux->ch);
+ error_ev:
+    ev_close(mux->ev);
+ error_mux:
+    free(mux);
+ error:
+    return NULL;
+}
+
+int mux_close(mux_t mux)
+{
+    int result = 0;
+    size_t i;
+
+    for ( i = 0; i < mux->n; i++ )
+        if ( endpoint_close(mux, &mux->ch[i]) < 0 )
+            result = -1;
+    if ( endpoint_close(mux, &mux->link) < 0 )
+        result = -1;
+
+    free(mux->ch);
+    ev_close(mux->ev);
+    free(mux);
+    return result;
+}
+
+int mux_run(mux_t mux, sigsrc_t signals)
+{
+    struct ev_handle sig_ev, *active;
+    int signum, result = 0;
+
+    if ( signals != NULL ) {
+        if ( ev_add(mux->ev, &sig_ev, sigsrc_fd(signals), NULL) < 0 )
+            return -1;
+        sig_ev.want = EV_READ;
+    }
+
+    while ( true ) {
+        if ( ev_wait(mux->ev, &active, NULL, NULL) < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            result = -1;
+            break;
+        }
+
+        if ( signals != NULL && ( sig_ev.ready & EV_READ ) ) {
+            sig_ev.ready &= ~EV_READ;
+            while ( ( signum = sigsrc_read(signals) ) > 0 ) {
+                if ( ! nulltty_info_signal(signum) )
+                    goto end;
+                mux_printinfo(mux);
+            }
+            if ( signum < 0 ) {
+                result = -1;
+                break;
+            }
+        }
+
+        if ( mux_service(mux) < 0 ) {
+            result = -1;
+            break;
+        }
+    }
+
+ end:
+    if ( signals != NULL )
+        ev_del(mux->ev, &sig_ev);
+    return result;
+}
+
+void mux_printinfo(mux_t mux)
+{
+    const struct mux_endpoint *ch;
+    size_t i;
+
+    fprintf(stderr, "%s: frames in %llu  out %llu  bad %llu  "
+            "discarded %llu  unrouted %llu\n", mux->link.link,
+            (unsigned long long)mux->frames_in,
+            (unsigned long long)mux->frames_out,
+            (unsigned long long)mux->bad_frames,
+            (unsigned long long)mux->discarded,
+            (unsigned long long)mux->unrouted);
+
+    for ( i = 0; i < mux->n; i++ ) {
+        ch = &mux->ch[i];
+        fprintf(stderr, "%s: DLCI %zu%s  read %llu  delivered %llu  "
+                "pending %zu\n", ch->link, i + 1, ch->open ? " (open)" : "",
+                (unsigned long long)ch->bytes_in,
+                (unsigned long long)ch->bytes_out,
+                ring_len(&ch->out));
+    }
+}
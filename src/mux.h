@@ -0,0 +1,90 @@
+#ifndef _NULLTTY_MUX_H_
+#define _NULLTTY_MUX_H_
+
+#include <stddef.h>
+
+#include "sigsrc.h"
+
+/**
+ * GSM 07.10 multiplexer (CMUX) over a pseudoterminal
+ *
+ * Plays the far end of a modem's multiplexed serial link: a framed stream
+ * written to the link pseudoterminal is split up by DLCI into one
+ * pseudoterminal per channel, and data written to each channel
+ * pseudoterminal goes back out on the link in UIH frames addressed from
+ * that channel.  Channel pseudoterminals are numbered from DLCI 1, in the
+ * order given; DLCI 0 is the multiplexer's control channel.
+ *
+ * Only the basic option of the framing is spoken.  nulltty takes the
+ * responding end of the link: SABM and DISC commands are answered with UA,
+ * or DM for a DLCI with no channel, and commands on the control channel
+ * are acknowledged by returning them as responses.  Channels carry data
+ * whether or not they have been opened with SABM.
+ *
+ * Frames are parsed where they lie in the link's receive buffer: only the
+ * few bytes of each header are examined before the frame's information
+ * field is copied, in one piece, into its channel's buffer.  Malformed
+ * frames, or those failing their check sequence, are discarded and the
+ * parser hunts for the next flag.  A channel whose buffer is full holds
+ * up the link until its reader catches up, much as flow control would.
+ *
+ * In the other direction, channels with data take turns at the link one
+ * frame at a time, so that a busy channel can't starve the others.
+ */
+
+/** Default size of each buffer, in each direction */
+#define MUX_BUF_SZ ( 16 * 1024 )
+
+/** Default largest information field of a frame, N1 for the basic option */
+#define MUX_FRAME_SZ 127
+
+/** Largest information field the basic option's length can describe */
+#define MUX_FRAME_MAX 32767
+
+/** Most channels a link can carry, DLCIs 1 to 63 */
+#define MUX_CHANNELS_MAX 63
+
+struct mux; /* Forward declaration */
+typedef struct mux *mux_t;
+
+/**
+ * Create a multiplexed link and its channels' pseudoterminals
+ *
+ * @param link Symlink name for the multiplexed link's pseudoterminal
+ * @param channels Symlink names for the channels' pseudoterminals
+ * @param n Number of channels, from 1 to MUX_CHANNELS_MAX
+ * @param size Size of each buffer; rounded up to a power of two, and to
+ * no less than two of the largest frames on the link
+ * @param frame Largest information field to send or accept in a frame,
+ * from 1 to MUX_FRAME_MAX
+ * @return Multiplexer, or NULL with errno on error
+ */
+mux_t mux_open(const char *link, char *const *channels, size_t n,
+               size_t size, size_t frame);
+
+/**
+ * Close a multiplexer's pseudoterminals and remove their symlinks
+ *
+ * @param mux Multiplexer returned by mux_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int mux_close(mux_t mux);
+
+/**
+ * Relay data between a multiplexed link and its channels
+ *
+ * @param mux Multiplexer returned by mux_open()
+ * @param signals Signal source to watch for termination and status
+ * requests, or NULL
+ * @return 0 on success (user request termination), -1 on error
+ */
+int mux_run(mux_t mux, sigsrc_t signals);
+
+/**
+ * Print the link's frame counts and each channel's byte counts to stderr
+ *
+ * @param mux Multiplexer returned by mux_open()
+ */
+void mux_printinfo(mux_t mux);
+
+#endif /* ! defined _NULLTTY_MUX_H_ */
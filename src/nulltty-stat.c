@@ -0,0 +1,264 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "statfile.h"
+
+/**
+ * Print the statistics nulltty publishes with --stats-file
+ *
+ * Maps the statistics file read-only and reads the counters straight out
+ * of it, so monitoring costs the relay nothing.  Given an interval, keeps
+ * printing the counters along with each direction's delivery rate.
+ */
+
+#ifdef HAVE_ATOMIC_BUILTINS
+#define STAT_LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+#else
+#define STAT_LOAD(field) (field)
+#endif
+
+struct stat_file {
+    const union statfile_header *header;
+    const struct statfile_pair *records;
+    size_t npairs;
+    void *map;
+    size_t size;
+};
+
+static void print_usage(int retval)
+{
+    const char *usage_info =
+        "Usage: nulltty-stat [OPTIONS] stats_file\n"
+        "\n"
+        "Prints the per-direction counters of a running nulltty, read from\n"
+        "the statistics file given to its --stats-file option.\n"
+        "\n"
+        "Options:\n"
+        "\t-i <seconds>, --interval=<seconds>\n"
+        "\t\tKeep printing the counters at the given interval, along\n"
+        "\t\twith the rate at which each direction delivers data\n"
+        "\n"
+        "\t-c <count>, --count=<count>\n"
+        "\t\tStop after printing the counters count times\n"
+        "\n"
+        "\t-h, --help\n"
+        "\t\tShow this help message and exit\n"
+        "\n";
+
+    printf("%s", usage_info);
+    exit(retval);
+}
+
+/**
+ * Map a statistics file and check that it is one we understand
+ *
+ * @param path Path of the file
+ * @param sf Filled in with the mapping
+ * @return 0 on success, -1 with errno on error (EINVAL if the file is not
+ * a ready statistics file of this version)
+ */
+static int stat_file_open(const char *path, struct stat_file *sf)
+{
+    const struct statfile_info *info;
+    struct stat st;
+    uint64_t magic;
+    int fd;
+
+    if ( ( fd = open(path, O_RDONLY) ) < 0 )
+        goto error;
+
+    if ( fstat(fd, &st) < 0 )
+        goto error_fd;
+    if ( (size_t)st.st_size < sizeof(union statfile_header) ) {
+        errno = EINVAL;
+        goto error_fd;
+    }
+
+    sf->size = st.st_size;
+    sf->map = mmap(NULL, sf->size, PROT_READ, MAP_SHARED, fd, 0);
+    if ( sf->map == MAP_FAILED )
+        goto error_fd;
+    close(fd);
+
+    sf->header = sf->map;
+    info = &sf->header->info;
+
+#ifdef HAVE_ATOMIC_BUILTINS
+    magic = __atomic_load_n(&info->magic, __ATOMIC_ACQUIRE);
+#else
+    magic = info->magic;
+#endif
+    if ( magic != STATFILE_MAGIC
+         || info->version != STATFILE_VERSION
+         || info->header_size != sizeof(union statfile_header)
+         || info->record_size != sizeof(struct statfile_pair)
+         || sf->size < info->header_size
+                       + (size_t)info->npairs * info->record_size ) {
+        errno = EINVAL;
+        goto error_map;
+    }
+
+    sf->records = (const struct statfile_pair *)( sf->header + 1 );
+    sf->npairs = info->npairs;
+    return 0;
+
+ error_map:
+    munmap(sf->map, sf->size);
+    goto error;
+ error_fd:
+    close(fd);
+ error:
+    return -1;
+}
+
+/**
+ * Total time a direction has spent blocked, including any current spell
+ */
+static double blocked_secs(const struct nulltty_stats *stats,
+                           const struct timespec *now)
+{
+    uint64_t blocked = STAT_LOAD(stats->blocked_ns);
+    uint64_t since = STAT_LOAD(stats->blocked_since);
+    uint64_t now_ns = (uint64_t)now->tv_sec * 1000000000 + now->tv_nsec;
+
+    if ( since != 0 && now_ns > since )
+        blocked += now_ns - since;
+
+    return blocked / 1e9;
+}
+
+static void print_direction(const char *from, const char *to,
+                            const struct nulltty_stats *stats,
+                            uint64_t *last_bytes, double elapsed,
+                            const struct timespec *now)
+{
+    uint64_t bytes = STAT_LOAD(stats->bytes_out);
+    char rate[32] = "-";
+
+    if ( elapsed > 0 )
+        snprintf(rate, sizeof(rate), "%.0f", ( bytes - *last_bytes ) / elapsed);
+    *last_bytes = bytes;
+
+    printf("%-20s %-20s %12llu %10llu %10llu %10llu %10llu %9zu %9zu %9.3f %12s\n",
+           from, to,
+           (unsigned long long)bytes,
+           (unsigned long long)STAT_LOAD(stats->reads),
+           (unsigned long long)STAT_LOAD(stats->writes),
+           (unsigned long long)( STAT_LOAD(stats->read_eagain)
+                                 + STAT_LOAD(stats->write_eagain) ),
+           (unsigned long long)STAT_LOAD(stats->wakeups),
+           (size_t)STAT_LOAD(stats->buffered),
+           (size_t)STAT_LOAD(stats->buf_hwm),
+           blocked_secs(stats, now), rate);
+}
+
+int main(int argc, char *argv[])
+{
+    int longindex, c = 0;
+    const char *options = "hi:c:";
+    const struct option long_options[] = {
+        {"help",     no_argument,       NULL, 'h'},
+        {"interval", required_argument, NULL, 'i'},
+        {"count",    required_argument, NULL, 'c'},
+        {NULL,       0,                 NULL, 0},
+    };
+    struct stat_file sf;
+    struct timespec now, last, delay;
+    const struct statfile_pair *rec;
+    uint64_t *last_bytes;
+    double interval = 0, elapsed = 0;
+    long count = -1, n;
+    char *endptr;
+    size_t i;
+
+    while ( ( c = getopt_long(argc, argv, options,
+                              long_options, &longindex) ) != -1 ) {
+        switch ( c ) {
+        case 'h':
+            print_usage(0);
+            break;
+
+        case 'i':
+            interval = strtod(optarg, &endptr);
+            if ( *endptr != '\0' || ! ( interval > 0 ) ) {
+                fprintf(stderr, "Invalid interval: %s\n", optarg);
+                return 1;
+            }
+            break;
+
+        case 'c':
+            count = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || count <= 0 ) {
+                fprintf(stderr, "Invalid count: %s\n", optarg);
+                return 1;
+            }
+            break;
+
+        default:
+            print_usage(1);
+        }
+    }
+
+    if ( argc - optind != 1 )
+        print_usage(1);
+    if ( count < 0 )
+        count = interval > 0 ? 0 : 1;
+
+    if ( stat_file_open(argv[optind], &sf) < 0 ) {
+        fprintf(stderr, "Unable to read statistics file %s: %s\n",
+                argv[optind], errno == EINVAL ? "Not a nulltty statistics file"
+                                              : strerror(errno));
+        return 1;
+    }
+
+    last_bytes = calloc(2 * sf.npairs + 1, sizeof(uint64_t));
+    if ( last_bytes == NULL ) {
+        perror("Unable to allocate memory");
+        return 1;
+    }
+
+    delay.tv_sec = (time_t)interval;
+    delay.tv_nsec = ( interval - delay.tv_sec ) * 1e9;
+
+    for ( n = 0; count == 0 || n < count; n++ ) {
+        if ( n > 0 ) {
+            while ( nanosleep(&delay, NULL) < 0 && errno == EINTR )
+                ;
+            printf("\n");
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ( n > 0 )
+            elapsed = ( now.tv_sec - last.tv_sec )
+                + ( now.tv_nsec - last.tv_nsec ) / 1e9;
+        last = now;
+
+        printf("%-20s %-20s %12s %10s %10s %10s %10s %9s %9s %9s %12s\n",
+               "FROM", "TO", "BYTES", "READS", "WRITES", "EAGAINS",
+               "WAKEUPS", "BUFFERED", "HWM", "BLOCKED_S", "BYTES/S");
+
+        for ( i = 0; i < sf.npairs; i++ ) {
+            rec = &sf.records[i];
+            print_direction(rec->link_a, rec->link_b, &rec->a_to_b.stats,
+                            &last_bytes[2*i], elapsed, &now);
+            print_direction(rec->link_b, rec->link_a, &rec->b_to_a.stats,
+                            &last_bytes[2*i+1], elapsed, &now);
+        }
+        fflush(stdout);
+    }
+
+    free(last_bytes);
+    munmap(sf.map, sf.size);
+    return 0;
+}
@@ -1,8 +1,10 @@
 #include <stubs.h>
 
+#include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <netdb.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -11,35 +13,67 @@
 #include <sys/select.h>
 #include <unistd.h>
 
+#include "bus.h"
+#include "capture.h"
+#include "control.h"
+#include "mux.h"
+#include "pool.h"
 #include "ptys.h"
+#include "replay.h"
+#include "shards.h"
+#include "statfile.h"
 
 
 #define SIG_NAME_MAX 128
+#define CPU_LIST_MAX 1024
 
-static volatile sig_atomic_t exit_flag = 0;
-static nulltty_t nulltty = NULL;
-
-static void sigterm_handler(int signum)
-{
-    exit_flag = 1;
-}
-
-static void siginfo_handler(int signum)
-{
-    nulltty_printinfo(nulltty);
-}
+/**
+ * PTY symlink paths requested on the command line or in a pair file
+ *
+ * Holds an even number of paths, each pair being the A and B sides of one
+ * pseudoterminal pair, along with each pair's weight for distributing the
+ * pairs across relay threads.
+ */
+struct pair_list {
+    char **links;
+    unsigned *weights;
+    size_t n;
+    size_t cap;
+};
 
 static void print_usage(int retval)
 {
     const char *usage_info =
-        "Usage: nulltty [OPTIONS] path_a path_b\n"
+        "Usage: nulltty [OPTIONS] path_a path_b [path_a path_b ...]\n"
+        "       nulltty [OPTIONS] -f pair_file [path_a path_b ...]\n"
+        "       nulltty [OPTIONS] -N path path [path ...]\n"
+        "       nulltty [OPTIONS] -X mux_path channel_path [channel_path ...]\n"
+        "       nulltty [OPTIONS] -L count socket_path link_dir\n"
         "\n"
         "Provides a pair of joined pseudoterminal slaves, symbolically linked from\n"
         "the given paths.  The terminals are joined such that the input to terminal\n"
         "A serves as the output from terminal B, and vice-versa; the pseudoterminals\n"
         "act like two ends of a null modem cable, except implemented in software.\n"
         "\n"
-        "Options:\n"
+        "Either path of a pair may instead be the address of a stream socket to\n"
+        "relay to: tcp:host:port, tcp-listen:[host:]port, unix:path or\n"
+        "unix-listen:path, the TCP forms optionally followed by ,nodelay (the\n"
+        "default), ,delay or ,cork.  A listening side relays one client at a time.\n"
+        "\n"
+        "Any number of pairs may be given, and are all relayed by the one process.\n"
+        "Alternatively, any number of pseudoterminals may be joined as a bus, on\n"
+        "which data written to each is read from all of the others.\n"
+        "\n"
+        "Or a GSM 07.10 (CMUX) multiplexed link may be split up into a\n"
+        "pseudoterminal for each of its channels.\n"
+        "\n"
+        "Or a pool of pairs may be kept ready, symlinked from link_dir/0a,\n"
+        "link_dir/0b and so on, to be lent out to clients of a Unix-domain socket.\n"
+        "\n"
+        "Options:\n";
+
+    /* Split up to keep within the string length C99 guarantees */
+    const char *options_info =
         "\t-d, --daemonize\n"
         "\t\tDaemonize the program\n"
         "\n"
@@ -50,11 +84,122 @@ static void print_usage(int retval)
         "\t\tNotify nulltty's parent process with the given signal when\n"
         "\t\tthe pseoduterminals are ready\n"
         "\n"
+        "\t-b <size>, --buffer-size=<size>\n"
+        "\t\tSize of the relay buffer in each direction, optionally\n"
+        "\t\tsuffixed with k or m (default 1k)\n"
+        "\n"
+        "\t-B <size>, --buffer-max=<size>\n"
+        "\t\tLet each direction's buffer grow up to the given size while\n"
+        "\t\treads keep filling it, shrinking back when the link is idle\n"
+        "\n"
+        "\t-r <mode>, --relay-mode=<mode>\n"
+        "\t\tHow to move data between the pseudoterminals: \"buffered\",\n"
+        "\t\t\"splice\" or \"io_uring\" (Linux only), or \"auto\" to use\n"
+        "\t\tsplice where the kernel supports it (default auto)\n"
+        "\n"
+        "\t-C [a:|b:]<usec>[,<size>], --coalesce=[a:|b:]<usec>[,<size>]\n"
+        "\t\tHold relayed data back for up to usec microseconds, or until\n"
+        "\t\tsize bytes have built up, to write it out in fewer calls;\n"
+        "\t\twith a: or b:, only the data read from that side's PTY\n"
+        "\t\t(buffered mode only)\n"
+        "\n"
+        "\t-T, --pace\n"
+        "\t\tRelay data no faster than a real serial line would carry it,\n"
+        "\t\tat the speed, character size, parity and stop bits set on\n"
+        "\t\tthe sending PTY (buffered mode only)\n"
+        "\n"
+        "\t-D <msec>, --delay=<msec>\n"
+        "\t\tDelay the data relayed each way by msec milliseconds, like a\n"
+        "\t\tradio or satellite link; use -B to let the buffers grow to\n"
+        "\t\thold what is sent over the delay (buffered mode only)\n"
+        "\n"
+        "\t-P <usec>, --busy-poll=<usec>\n"
+        "\t\tSpin polling the PTYs instead of sleeping until they have\n"
+        "\t\tdata, going back to sleep after usec microseconds without\n"
+        "\t\tany, or never if 0; best combined with -c to pin the relay\n"
+        "\t\tto a CPU of its own (not in io_uring mode)\n"
+        "\n";
+    const char *more_options_info =
+        "\t-f <file>, --pair-file=<file>\n"
+        "\t\tRead additional pairs of paths from the given file, one\n"
+        "\t\tpair per line, separated by whitespace and optionally\n"
+        "\t\tfollowed by the pair's weight; blank lines and lines\n"
+        "\t\tstarting with # are ignored\n"
+        "\n"
+        "\t-t <n>, --threads=<n>\n"
+        "\t\tRelay the pairs from n worker threads, spreading them across\n"
+        "\t\tthe threads by weight\n"
+        "\n"
+        "\t-c <cpus>, --cpu-affinity=<cpus>\n"
+        "\t\tPin the worker threads to the given list of CPUs, such as\n"
+        "\t\t0,2-5, one thread per CPU in turn\n"
+        "\n"
+        "\t-S <path>, --control-socket=<path>\n"
+        "\t\tServe relay statistics as JSON to clients connecting to a\n"
+        "\t\tUnix-domain socket at the given path (not in io_uring mode)\n"
+        "\n"
+        "\t-m <file>, --stats-file=<file>\n"
+        "\t\tPublish relay statistics in a memory-mapped file, for\n"
+        "\t\treading with nulltty-stat\n"
+        "\n"
+        "\t-M <addr>, --metrics=<addr>\n"
+        "\t\tServe relay statistics to Prometheus over HTTP at the given\n"
+        "\t\t[host:]port, or Unix-domain socket path if it contains a\n"
+        "\t\tslash; the host defaults to 127.0.0.1 (not in io_uring mode)\n"
+        "\n"
+        "\t-w <file>, --capture=<file>\n"
+        "\t\tRecord all data relayed, with timestamps, in a memory-mapped\n"
+        "\t\tlog file (not in splice mode)\n"
+        "\n"
+        "\t-W <size>, --capture-size=<size>\n"
+        "\t\tSize to preallocate for the capture log, optionally suffixed\n"
+        "\t\twith k, m or g; data past it is dropped (default 64m)\n"
+        "\n"
+        "\t-F <ms>, --capture-flush=<ms>\n"
+        "\t\tSync the capture log to disk from a background thread at the\n"
+        "\t\tgiven interval, rather than leaving it to the kernel\n"
+        "\n"
+        "\t-R <file>, --replay=<file>\n"
+        "\t\tReplay the data recorded in a capture log into the PTYs it\n"
+        "\t\twas delivered to, pair by pair (not in io_uring mode)\n"
+        "\n"
+        "\t-I <side>, --replay-into=<side>\n"
+        "\t\tOnly replay into side \"a\" or \"b\" of each pair, rather than\n"
+        "\t\t\"both\" (the default)\n"
+        "\n"
+        "\t-x, --replay-fast\n"
+        "\t\tReplay as fast as possible instead of at the original timing\n"
+        "\n"
+        "\t-N, --bus\n"
+        "\t\tJoin all the given paths' pseudoterminals into a single\n"
+        "\t\tmulti-drop bus instead of pairing them up, buffering up\n"
+        "\t\tto the buffer size given with -b (default 64k)\n"
+        "\n"
+        "\t-O <policy>, --bus-overrun=<policy>\n"
+        "\t\tWhat to do when a bus endpoint falls more than half the\n"
+        "\t\tbuffer behind: \"drop\" its oldest data (default) or\n"
+        "\t\t\"block\" the bus until it catches up\n"
+        "\n"
+        "\t-X, --mux\n"
+        "\t\tSpeak GSM 07.10 basic option framing on the first path's\n"
+        "\t\tpseudoterminal, relaying DLCI 1 to the second path, DLCI 2\n"
+        "\t\tto the third and so on, buffering up to the buffer size\n"
+        "\t\tgiven with -b (default 16k)\n"
+        "\n"
+        "\t-Y <size>, --mux-frame=<size>\n"
+        "\t\tLargest information field to send or accept in a frame on a\n"
+        "\t\tmultiplexed link (default 127)\n"
+        "\n"
+        "\t-L <count>, --pool=<count>\n"
+        "\t\tKeep count pairs open, and lend one to each client of the\n"
+        "\t\tsocket which asks for \"paths\" or \"fds\", until it hangs up\n"
+        "\t\t(not in io_uring mode)\n"
+        "\n"
         "\t-h, --help\n"
         "\t\tShow this help message and exit\n"
         "\n";
 
-    printf("%s", usage_info);
+    printf("%s%s%s", usage_info, options_info, more_options_info);
     exit(retval);
 }
 
@@ -79,6 +224,120 @@ static int write_pid(const char *pid_path)
     return -1;
 }
 
+static int pairs_add(struct pair_list *pairs, const char *link_a,
+                     const char *link_b, unsigned weight)
+{
+    char **links;
+    unsigned *weights;
+    size_t cap;
+
+    if ( pairs->n == pairs->cap ) {
+        cap = pairs->cap ? 2 * pairs->cap : 16;
+        links = realloc(pairs->links, cap * sizeof(char *));
+        if ( links == NULL )
+            return -1;
+        pairs->links = links;
+
+        weights = realloc(pairs->weights, cap / 2 * sizeof(unsigned));
+        if ( weights == NULL )
+            return -1;
+        pairs->weights = weights;
+
+        pairs->cap = cap;
+    }
+
+    pairs->links[pairs->n] = strdup(link_a);
+    if ( pairs->links[pairs->n] == NULL )
+        return -1;
+    pairs->n++;
+
+    pairs->links[pairs->n] = strdup(link_b);
+    if ( pairs->links[pairs->n] == NULL )
+        return -1;
+    pairs->weights[pairs->n / 2] = weight;
+    pairs->n++;
+
+    return 0;
+}
+
+static int pairs_read_file(struct pair_list *pairs, const char *path)
+{
+    FILE *file;
+    char line[2 * PATH_MAX + 16];
+    char *link_a, *link_b, *weight, *extra, *saveptr, *endptr;
+    unsigned long w;
+    const char *sep = " \t\r\n";
+    unsigned lineno = 0;
+
+    if ( ( file = fopen(path, "r") ) == NULL )
+        goto error;
+
+    while ( fgets(line, sizeof(line), file) != NULL ) {
+        lineno++;
+
+        link_a = strtok_r(line, sep, &saveptr);
+        if ( link_a == NULL || link_a[0] == '#' )
+            continue;
+
+        link_b = strtok_r(NULL, sep, &saveptr);
+        weight = strtok_r(NULL, sep, &saveptr);
+        extra = strtok_r(NULL, sep, &saveptr);
+        if ( link_b == NULL || extra != NULL ) {
+            fprintf(stderr, "%s:%u: expected two paths and an optional weight\n",
+                    path, lineno);
+            errno = EINVAL;
+            goto error_fopen;
+        }
+
+        w = 1;
+        if ( weight != NULL ) {
+            w = strtoul(weight, &endptr, 10);
+            if ( *endptr != '\0' || w == 0 || w > UINT_MAX ) {
+                fprintf(stderr, "%s:%u: invalid weight: %s\n",
+                        path, lineno, weight);
+                errno = EINVAL;
+                goto error_fopen;
+            }
+        }
+
+        if ( pairs_add(pairs, link_a, link_b, w) < 0 )
+            goto error_fopen;
+    }
+
+    if ( ferror(file) )
+        goto error_fopen;
+
+    fclose(file);
+    return 0;
+
+ error_fopen:
+    fclose(file);
+ error:
+    return -1;
+}
+
+static bool links_relative(char *const *links, size_t n)
+{
+    size_t i;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( links[i][0] != '/' )
+            return true;
+    }
+
+    return false;
+}
+
+static void pairs_free(struct pair_list *pairs)
+{
+    size_t i;
+
+    for ( i = 0; i < pairs->n; i++ )
+        free(pairs->links[i]);
+    free(pairs->links);
+    free(pairs->weights);
+}
+
 static int upcase(char *str, size_t size)
 {
     size_t i;
@@ -91,6 +350,203 @@ static int upcase(char *str, size_t size)
     return i;
 }
 
+static long parse_size(const char *str, long max)
+{
+    char *endptr;
+    long result, unit = 1;
+
+    result = strtol(str, &endptr, 10);
+    if ( endptr == str || result <= 0 )
+        return -1;
+
+    switch ( *endptr ) {
+    case 'k':
+    case 'K':
+        unit = 1024;
+        endptr++;
+        break;
+
+    case 'm':
+    case 'M':
+        unit = 1024 * 1024;
+        endptr++;
+        break;
+
+    case 'g':
+    case 'G':
+        unit = 1024 * 1024 * 1024;
+        endptr++;
+        break;
+    }
+
+    if ( *endptr != '\0' || result > max / unit )
+        return -1;
+
+    return result * unit;
+}
+
+/**
+ * Record the links of a pool's pairs, named after their index in the given
+ * directory
+ *
+ * The links are made absolute, so that clients can use them from
+ * anywhere, and may not contain whitespace, which separates them in the
+ * pool's replies.
+ *
+ * @return 0 on success, -1 with errno on error
+ */
+static int pairs_add_pool(struct pair_list *pairs, const char *dir, long n)
+{
+    char base[PATH_MAX], cwd[PATH_MAX], link_a[PATH_MAX], link_b[PATH_MAX];
+    long i;
+
+    if ( dir[0] == '/' ) {
+        if ( strlcpy(base, dir, sizeof(base)) >= sizeof(base) )
+            goto error_length;
+    } else if ( getcwd(cwd, sizeof(cwd)) == NULL ) {
+        return -1;
+    } else if ( snprintf(base, sizeof(base), "%s/%s", cwd, dir)
+                >= (int)sizeof(base) ) {
+        goto error_length;
+    }
+
+    if ( strpbrk(base, " \t\r\n") != NULL ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        if ( snprintf(link_a, sizeof(link_a), "%s/%lda", base, i)
+             >= (int)sizeof(link_a)
+             || snprintf(link_b, sizeof(link_b), "%s/%ldb", base, i)
+             >= (int)sizeof(link_b) )
+            goto error_length;
+        if ( pairs_add(pairs, link_a, link_b, 1) < 0 )
+            return -1;
+    }
+
+    return 0;
+
+ error_length:
+    errno = ENAMETOOLONG;
+    return -1;
+}
+
+/**
+ * Parse a coalescing setting, [a:|b:]usec[,size], into the relay options
+ *
+ * @return 0 on success, -1 if malformed
+ */
+static int parse_coalesce(const char *str, struct nulltty_opts *opts)
+{
+    struct nulltty_coalesce coalesce = { 0, 0 };
+    bool from_a = true, from_b = true;
+    unsigned long delay;
+    char *endptr;
+    long size;
+
+    if ( ( str[0] == 'a' || str[0] == 'b' ) && str[1] == ':' ) {
+        from_a = str[0] == 'a';
+        from_b = str[0] == 'b';
+        str += 2;
+    }
+
+    if ( *str < '0' || *str > '9' )
+        return -1;
+    delay = strtoul(str, &endptr, 10);
+    if ( delay > UINT_MAX )
+        return -1;
+    coalesce.delay_us = delay;
+
+    if ( *endptr == ',' ) {
+        if ( ( size = parse_size(endptr + 1, READ_BUF_MAX) ) < 0 )
+            return -1;
+        coalesce.bytes = size;
+    } else if ( *endptr != '\0' ) {
+        return -1;
+    }
+
+    if ( from_a )
+        opts->coalesce[NULLTTY_SIDE_A] = coalesce;
+    if ( from_b )
+        opts->coalesce[NULLTTY_SIDE_B] = coalesce;
+    return 0;
+}
+
+static int parse_cpus(const char *str, int *cpus, size_t max)
+{
+    const char *p = str;
+    char *endptr;
+    long first, last, cpu;
+    size_t n = 0;
+
+    do {
+        first = strtol(p, &endptr, 10);
+        if ( endptr == p || first < 0 )
+            return -1;
+        p = endptr;
+
+        last = first;
+        if ( *p == '-' ) {
+            p++;
+            last = strtol(p, &endptr, 10);
+            if ( endptr == p || last < first )
+                return -1;
+            p = endptr;
+        }
+
+        for ( cpu = first; cpu <= last; cpu++ ) {
+            if ( n == max || cpu > INT_MAX )
+                return -1;
+            cpus[n++] = cpu;
+        }
+    } while ( *p++ == ',' );
+
+    if ( *--p != '\0' )
+        return -1;
+
+    return n;
+}
+
+/**
+ * Open the metrics exporter at a command line address
+ *
+ * An address containing a slash is the path of a Unix-domain socket;
+ * anything else is a TCP port, optionally preceded by a host name or
+ * address and a colon, with IPv6 addresses in brackets.  Without a host
+ * only the loopback interface is listened on, while an empty host before
+ * the colon listens on all interfaces.
+ */
+static control_t metrics_open(const char *addr, ev_loop_t ev,
+                              const nulltty_t *pairs, size_t n)
+{
+    char host[NI_MAXHOST] = "127.0.0.1";
+    const char *port, *colon;
+    size_t len;
+
+    if ( strchr(addr, '/') != NULL )
+        return control_open(addr, CONTROL_FORMAT_PROMETHEUS, ev, pairs, n);
+
+    port = addr;
+    if ( ( colon = strrchr(addr, ':') ) != NULL ) {
+        port = colon + 1;
+        len = colon - addr;
+        if ( len >= 2 && addr[0] == '[' && addr[len-1] == ']' ) {
+            addr++;
+            len -= 2;
+        }
+        if ( len >= sizeof(host) ) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        memcpy(host, addr, len);
+        host[len] = '\0';
+    }
+
+    return control_open_tcp(host[0] != '\0' ? host : NULL, port,
+                            CONTROL_FORMAT_PROMETHEUS, ev, pairs, n);
+}
+
 static int sig_num(const char *sig_name)
 {
     char name[SIG_NAME_MAX];
@@ -126,49 +582,110 @@ static int sig_num(const char *sig_name)
 int main(int argc, char* argv[])
 {
     int longindex, c = 0;
-    const char *options = "hdvp:s:";
+    const char *options = "hdvp:s:b:B:r:C:TD:P:f:t:c:S:M:m:w:W:F:R:I:xNO:XY:L:";
     const struct option long_options[] = {
         {"help",          no_argument,       NULL, 'h'},
         {"daemonize",     no_argument,       NULL, 'd'},
         {"pid-file",      required_argument, NULL, 'p'},
         {"signal-parent", required_argument, NULL, 's'},
+        {"buffer-size",   required_argument, NULL, 'b'},
+        {"buffer-max",    required_argument, NULL, 'B'},
+        {"relay-mode",    required_argument, NULL, 'r'},
+        {"pair-file",     required_argument, NULL, 'f'},
+        {"threads",       required_argument, NULL, 't'},
+        {"cpu-affinity",  required_argument, NULL, 'c'},
+        {"control-socket", required_argument, NULL, 'S'},
+        {"metrics",       required_argument, NULL, 'M'},
+        {"stats-file",    required_argument, NULL, 'm'},
+        {"capture",       required_argument, NULL, 'w'},
+        {"capture-size",  required_argument, NULL, 'W'},
+        {"capture-flush", required_argument, NULL, 'F'},
+        {"replay",        required_argument, NULL, 'R'},
+        {"replay-into",   required_argument, NULL, 'I'},
+        {"replay-fast",   no_argument,       NULL, 'x'},
+        {"bus",           no_argument,       NULL, 'N'},
+        {"bus-overrun",   required_argument, NULL, 'O'},
+        {"mux",           no_argument,       NULL, 'X'},
+        {"mux-frame",     required_argument, NULL, 'Y'},
+        {"coalesce",      required_argument, NULL, 'C'},
+        {"pace",          no_argument,       NULL, 'T'},
+        {"delay",         required_argument, NULL, 'D'},
+        {"busy-poll",     required_argument, NULL, 'P'},
+        {"pool",          required_argument, NULL, 'L'},
+        {NULL,            0,                 NULL, 0},
     };
+    struct nulltty_opts opts;
+    long size;
     bool daemonize = false;
     char *startup_wd = NULL;
     char *pid_path = NULL;
-    const char *link_a, *link_b;
-    struct sigaction action;
+    struct pair_list pairs = { NULL, NULL, 0, 0 };
+    long nthreads = 0;
+    int cpus[CPU_LIST_MAX];
+    int ncpus = 0;
+    char *endptr;
+    nulltty_t *ttys = NULL;
+    size_t npairs, nopen = 0, i;
+    nulltty_t nulltty = NULL;
+    nulltty_loop_t loop = NULL;
+    nulltty_shards_t shards = NULL;
+    char *control_path = NULL;
+    control_t control = NULL;
+    char *metrics_addr = NULL;
+    control_t metrics = NULL;
+    char *stats_path = NULL;
+    statfile_t stats = NULL;
+    char *capture_path = NULL;
+    long capture_size = CAPTURE_SIZE_DEFAULT;
+    long capture_flush = 0;
+    capture_t capture = NULL;
+    char *replay_path = NULL;
+    unsigned replay_into = REPLAY_INTO_A | REPLAY_INTO_B;
+    bool replay_fast = false;
+    replay_t replay = NULL;
+    bool bus_mode = false;
+    long bus_size = BUS_BUF_SZ;
+    enum bus_overrun bus_overrun = BUS_OVERRUN_DROP;
+    char **bus_links = NULL;
+    size_t nbus = 0;
+    bus_t bus = NULL;
+    bool mux_mode = false;
+    long mux_size = MUX_BUF_SZ;
+    long mux_frame = MUX_FRAME_SZ;
+    char **mux_links = NULL;
+    size_t nmux = 0;
+    mux_t mux = NULL;
+    long pool_size = 0;
+    char *pool_path = NULL;
+    pool_t pool = NULL;
+    ev_loop_t ev;
+    sigset_t sig_set;
+    sigsrc_t signals;
+    int result;
     int status = 0;
     int signum = -1;
 
-    memset(&action, 0, sizeof(action));
-    sigemptyset(&action.sa_mask);
+    nulltty_opts_init(&opts);
 
-    action.sa_handler = sigterm_handler;
-    if ( sigaction(SIGINT, &action, NULL) < 0 ) {
-        perror("Unable to establish SIGINT handler");
-        return 1;
-    }
-    if ( sigaction(SIGTERM, &action, NULL) < 0 ) {
-        perror("Unable to establish SIGTERM handler");
-        return 1;
-    }
-    if ( sigaction(SIGHUP, &action, NULL) < 0 ) {
-        perror("Unable to establish SIGHUP handler");
-        return 1;
-    }
-
-    action.sa_handler = siginfo_handler;
-    if ( sigaction(SIGUSR1, &action, NULL) < 0 ) {
-        perror("Unable to establish SIGUSR1 handler");
-        return 1;
-    }
+    /* Termination and status requests reach the relay loop as events on
+     * this, rather than through signal handlers */
+    sigemptyset(&sig_set);
+    sigaddset(&sig_set, SIGINT);
+    sigaddset(&sig_set, SIGTERM);
+    sigaddset(&sig_set, SIGHUP);
+    sigaddset(&sig_set, SIGUSR1);
 #ifdef SIGINFO
-    if ( sigaction(SIGINFO, &action, NULL) < 0 ) {
-        perror("Unable to establish SIGINFO handler");
+    sigaddset(&sig_set, SIGINFO);
+#endif
+    signals = sigsrc_open(&sig_set);
+    if ( signals == NULL ) {
+        perror("Unable to set up signal handling");
         return 1;
     }
-#endif
+
+    /* Socket endpoints are already written without raising SIGPIPE; this
+     * covers the rest, such as status reports to a closed pipe */
+    signal(SIGPIPE, SIG_IGN);
 
     while ( ( c = getopt_long(argc, argv, options,
                               long_options, &longindex) ) != -1 ) {
@@ -192,22 +709,309 @@ int main(int argc, char* argv[])
                 exit(1);
             }
             break;
+
+        case 'b':
+        case 'B':
+            size = parse_size(optarg, READ_BUF_MAX);
+            if ( size < 0 ) {
+                fprintf(stderr, "Invalid buffer size: %s\n", optarg);
+                exit(1);
+            }
+            if ( c == 'b' )
+                opts.buf_size = bus_size = mux_size = size;
+            else
+                opts.buf_max = size;
+            break;
+
+        case 'C':
+            if ( parse_coalesce(optarg, &opts) < 0 ) {
+                fprintf(stderr, "Invalid coalescing setting: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'T':
+            opts.pace = true;
+            break;
+
+        case 'D':
+            size = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || endptr == optarg || size < 0
+                 || size > UINT_MAX / 1000 ) {
+                fprintf(stderr, "Invalid delay: %s\n", optarg);
+                exit(1);
+            }
+            opts.delay_us = size * 1000;
+            break;
+
+        case 'P':
+            size = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || endptr == optarg || size < 0
+                 || size > UINT_MAX ) {
+                fprintf(stderr, "Invalid busy-poll idle time: %s\n", optarg);
+                exit(1);
+            }
+            opts.busy_poll = true;
+            opts.busy_poll_idle_us = size;
+            break;
+
+        case 'r':
+            if ( strcmp(optarg, "auto") == 0 )
+                opts.mode = NULLTTY_MODE_AUTO;
+            else if ( strcmp(optarg, "buffered") == 0 )
+                opts.mode = NULLTTY_MODE_BUFFERED;
+            else if ( strcmp(optarg, "splice") == 0 )
+                opts.mode = NULLTTY_MODE_SPLICE;
+            else if ( strcmp(optarg, "io_uring") == 0 )
+                opts.mode = NULLTTY_MODE_IO_URING;
+            else {
+                fprintf(stderr, "Invalid relay mode: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'f':
+            if ( pairs_read_file(&pairs, optarg) < 0 ) {
+                fprintf(stderr, "Unable to read pair file %s: %s\n",
+                        optarg, strerror(errno));
+                exit(1);
+            }
+            break;
+
+        case 't':
+            nthreads = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || nthreads <= 0 || nthreads > SHARDS_MAX ) {
+                fprintf(stderr, "Invalid thread count: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'c':
+            ncpus = parse_cpus(optarg, cpus, CPU_LIST_MAX);
+            if ( ncpus < 0 ) {
+                fprintf(stderr, "Invalid CPU list: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'S':
+            control_path = optarg;
+            break;
+
+        case 'M':
+            metrics_addr = optarg;
+            break;
+
+        case 'm':
+            stats_path = optarg;
+            break;
+
+        case 'w':
+            capture_path = optarg;
+            break;
+
+        case 'W':
+            capture_size = parse_size(optarg, LONG_MAX);
+            if ( capture_size < 0 ) {
+                fprintf(stderr, "Invalid capture size: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'F':
+            capture_flush = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || capture_flush <= 0
+                 || capture_flush > INT_MAX ) {
+                fprintf(stderr, "Invalid capture flush interval: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'R':
+            replay_path = optarg;
+            break;
+
+        case 'I':
+            if ( strcmp(optarg, "a") == 0 )
+                replay_into = REPLAY_INTO_A;
+            else if ( strcmp(optarg, "b") == 0 )
+                replay_into = REPLAY_INTO_B;
+            else if ( strcmp(optarg, "both") == 0 )
+                replay_into = REPLAY_INTO_A | REPLAY_INTO_B;
+            else {
+                fprintf(stderr, "Invalid replay side: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'x':
+            replay_fast = true;
+            break;
+
+        case 'N':
+            bus_mode = true;
+            break;
+
+        case 'O':
+            if ( strcmp(optarg, "drop") == 0 )
+                bus_overrun = BUS_OVERRUN_DROP;
+            else if ( strcmp(optarg, "block") == 0 )
+                bus_overrun = BUS_OVERRUN_BLOCK;
+            else {
+                fprintf(stderr, "Invalid bus overrun policy: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'X':
+            mux_mode = true;
+            break;
+
+        case 'Y':
+            mux_frame = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || mux_frame <= 0
+                 || mux_frame > MUX_FRAME_MAX ) {
+                fprintf(stderr, "Invalid frame size: %s\n", optarg);
+                exit(1);
+            }
+            break;
+
+        case 'L':
+            pool_size = strtol(optarg, &endptr, 10);
+            if ( *endptr != '\0' || pool_size <= 0 || pool_size > INT_MAX ) {
+                fprintf(stderr, "Invalid pool size: %s\n", optarg);
+                exit(1);
+            }
+            break;
         }
     }
 
-    /* We should have exactly two remaining arguments for the
-     * pseudoterminal slave symlink names... */
-    if ( optind != argc - 2 )
+    /* A pool's remaining arguments are its socket and the directory to
+     * link its pairs from; its pairs are all served from the one relay
+     * loop, which lends them out and resets them */
+    if ( pool_size > 0 ) {
+        if ( pairs.n > 0 || bus_mode || mux_mode || nthreads > 0 || ncpus > 0
+             || replay_path != NULL ) {
+            fprintf(stderr, "A pool can't be used with -f, -t, -c, -R, -N or -X\n");
+            status = 1;
+            goto end_pairs;
+        }
+        if ( argc - optind != 2 )
+            print_usage(1);
+
+        pool_path = argv[optind];
+        if ( pairs_add_pool(&pairs, argv[optind+1], pool_size) < 0 ) {
+            fprintf(stderr, "Unable to record pool links in %s: %s\n",
+                    argv[optind+1], strerror(errno));
+            status = 1;
+            goto end_pairs;
+        }
+        optind = argc;
+    }
+
+    /* On a bus, the remaining arguments are its endpoints; the relay
+     * options for pairs don't apply */
+    if ( bus_mode ) {
+        if ( pairs.n > 0 || mux_mode || nthreads > 0 || ncpus > 0
+             || opts.mode != NULLTTY_MODE_AUTO || opts.buf_max > 0
+             || opts.coalesce[NULLTTY_SIDE_A].delay_us > 0
+             || opts.coalesce[NULLTTY_SIDE_B].delay_us > 0 || opts.pace
+             || opts.delay_us > 0 || opts.busy_poll
+             || control_path != NULL || metrics_addr != NULL
+             || stats_path != NULL || capture_path != NULL
+             || replay_path != NULL ) {
+            fprintf(stderr, "Only the -b and -O relay options apply to a bus\n");
+            status = 1;
+            goto end_pairs;
+        }
+        if ( argc - optind < 2 )
+            print_usage(1);
+
+        bus_links = argv + optind;
+        nbus = argc - optind;
+        optind = argc;
+    }
+
+    /* Likewise a multiplexed link and then its channels */
+    if ( mux_mode ) {
+        if ( pairs.n > 0 || nthreads > 0 || ncpus > 0
+             || opts.mode != NULLTTY_MODE_AUTO || opts.buf_max > 0
+             || opts.coalesce[NULLTTY_SIDE_A].delay_us > 0
+             || opts.coalesce[NULLTTY_SIDE_B].delay_us > 0 || opts.pace
+             || opts.delay_us > 0 || opts.busy_poll
+             || control_path != NULL || metrics_addr != NULL
+             || stats_path != NULL || capture_path != NULL
+             || replay_path != NULL ) {
+            fprintf(stderr, "Only the -b and -Y relay options apply to a "
+                    "multiplexed link\n");
+            status = 1;
+            goto end_pairs;
+        }
+        if ( argc - optind < 2 || argc - optind > MUX_CHANNELS_MAX + 1 )
+            print_usage(1);
+
+        mux_links = argv + optind;
+        nmux = argc - optind;
+        optind = argc;
+    }
+
+    /* Any further arguments name pairs of pseudoterminal slave symlinks,
+     * which must come in pairs... */
+    if ( ( argc - optind ) % 2 != 0 )
         print_usage(1);
+    for ( ; optind < argc; optind += 2 ) {
+        if ( pairs_add(&pairs, argv[optind], argv[optind+1], 1) < 0 ) {
+            perror("Unable to record PTY links");
+            status = 1;
+            goto end_pairs;
+        }
+    }
+    if ( pairs.n == 0 && ! bus_mode && ! mux_mode )
+        print_usage(1);
+    npairs = pairs.n / 2;
 
-    link_a = argv[argc-2];
-    link_b = argv[argc-1];
+    if ( ncpus > 0 && nthreads == 0 )
+        nthreads = ncpus;
+
+    if ( pool_path != NULL && opts.mode == NULLTTY_MODE_IO_URING ) {
+        fprintf(stderr, "Pools are not supported in io_uring mode\n");
+        status = 1;
+        goto end_pairs;
+    }
+    if ( ( control_path != NULL || metrics_addr != NULL )
+         && opts.mode == NULLTTY_MODE_IO_URING ) {
+        fprintf(stderr, "Statistics sockets are not supported in io_uring mode\n");
+        status = 1;
+        goto end_pairs;
+    }
+    if ( replay_path != NULL && opts.mode == NULLTTY_MODE_IO_URING ) {
+        fprintf(stderr, "Replay is not supported in io_uring mode\n");
+        status = 1;
+        goto end_pairs;
+    }
+
+    /* Spliced data never passes through userspace to be captured */
+    if ( capture_path != NULL ) {
+        if ( opts.mode == NULLTTY_MODE_SPLICE ) {
+            fprintf(stderr, "Capture is not supported in splice mode\n");
+            status = 1;
+            goto end_pairs;
+        }
+        if ( npairs > CAPTURE_PAIRS_MAX ) {
+            fprintf(stderr, "Capture is limited to %d pairs\n",
+                    CAPTURE_PAIRS_MAX);
+            status = 1;
+            goto end_pairs;
+        }
+        if ( opts.mode == NULLTTY_MODE_AUTO )
+            opts.mode = NULLTTY_MODE_BUFFERED;
+    }
 
     if ( daemonize ) {
         startup_wd = malloc(PATH_MAX);
         if ( ! startup_wd ) {
             perror("Unable to save current working directory");
-            goto end;
+            goto end_pairs;
         }
         if ( ! getcwd(startup_wd, PATH_MAX) ) {
             perror("Unable to save current working directory");
@@ -215,24 +1019,141 @@ int main(int argc, char* argv[])
         }
     }
 
-    nulltty = nulltty_open(link_a, link_b);
-    if ( nulltty == NULL ) {
+    ttys = calloc(npairs, sizeof(nulltty_t));
+    if ( ttys == NULL && npairs > 0 ) {
         perror("Error opening requested PTYs");
         status = 1;
         goto end_malloc;
     }
+    for ( nopen = 0; nopen < npairs; nopen++ ) {
+        ttys[nopen] = nulltty_open(pairs.links[2*nopen], pairs.links[2*nopen+1],
+                                   &opts);
+        if ( ttys[nopen] == NULL ) {
+            fprintf(stderr, "Error opening requested PTYs %s and %s: %s\n",
+                    pairs.links[2*nopen], pairs.links[2*nopen+1],
+                    strerror(errno));
+            status = 1;
+            goto end_nulltty;
+        }
+    }
+
+    if ( bus_mode ) {
+        bus = bus_open(bus_links, nbus, bus_size, bus_overrun);
+        if ( bus == NULL ) {
+            perror("Error opening requested PTYs");
+            status = 1;
+            goto end_nulltty;
+        }
+    }
+    if ( mux_mode ) {
+        mux = mux_open(mux_links[0], mux_links + 1, nmux - 1, mux_size,
+                       mux_frame);
+        if ( mux == NULL ) {
+            perror("Error opening requested PTYs");
+            status = 1;
+            goto end_nulltty;
+        }
+    }
+
+    /* A single pair is relayed directly, which works in every relay mode;
+     * several are served together from one relay loop, or spread across
+     * the relay loops of several threads if asked.  The statistics
+     * sockets, replay and pools need a relay loop to be served from, even
+     * for one pair. */
+    if ( nthreads > 0 ) {
+        shards = nulltty_shards_open(nthreads, cpus, ncpus);
+        if ( shards == NULL ) {
+            perror("Error creating relay threads");
+            status = 1;
+            goto end_nulltty;
+        }
+        for ( i = 0; i < npairs; i++ ) {
+            if ( nulltty_shards_add(shards, ttys[i], pairs.weights[i]) < 0 ) {
+                perror("Error adding PTYs to relay threads");
+                status = 1;
+                goto end_loop;
+            }
+        }
+    } else if ( npairs > 1 || control_path != NULL || metrics_addr != NULL
+                || replay_path != NULL || pool_path != NULL ) {
+        loop = nulltty_loop_open();
+        if ( loop == NULL ) {
+            perror("Error creating relay loop");
+            status = 1;
+            goto end_nulltty;
+        }
+        for ( i = 0; i < npairs; i++ ) {
+            if ( nulltty_loop_add(loop, ttys[i]) < 0 ) {
+                perror("Error adding PTYs to relay loop");
+                status = 1;
+                goto end_loop;
+            }
+        }
+    } else if ( npairs == 1 ) {
+        nulltty = ttys[0];
+    }
+
+    ev = shards != NULL ? nulltty_shards_events(shards)
+        : loop != NULL ? nulltty_loop_events(loop) : NULL;
+    if ( control_path != NULL ) {
+        control = control_open(control_path, CONTROL_FORMAT_JSON, ev,
+                               ttys, npairs);
+        if ( control == NULL ) {
+            fprintf(stderr, "Unable to create control socket %s: %s\n",
+                    control_path, strerror(errno));
+            status = 1;
+            goto end_loop;
+        }
+    }
+    if ( metrics_addr != NULL ) {
+        metrics = metrics_open(metrics_addr, ev, ttys, npairs);
+        if ( metrics == NULL ) {
+            fprintf(stderr, "Unable to create metrics socket %s: %s\n",
+                    metrics_addr, strerror(errno));
+            status = 1;
+            goto end_loop;
+        }
+    }
+    if ( pool_path != NULL ) {
+        pool = pool_open(pool_path, ev, ttys, npairs);
+        if ( pool == NULL ) {
+            fprintf(stderr, "Unable to create pool socket %s: %s\n",
+                    pool_path, strerror(errno));
+            status = 1;
+            goto end_loop;
+        }
+    }
 
     /* We don't chdir here so that we can write the pid file using a
      * relative path, after daemonization. */
     if ( daemonize && daemon(1, 0) != 0 ) {
         perror("Error daemonizing");
         status = 1;
-        goto end_nulltty;
+        goto end_loop;
     }
     if ( pid_path != NULL && write_pid(pid_path) < 0 ) {
         perror("Error writing pid file");
         status = 1;
-        goto end_nulltty;
+        goto end_loop;
+    }
+    if ( stats_path != NULL
+         && ( stats = statfile_open(stats_path, ttys, npairs) ) == NULL ) {
+        fprintf(stderr, "Unable to create statistics file %s: %s\n",
+                stats_path, strerror(errno));
+        status = 1;
+        goto end_pid;
+    }
+    /* Opened after daemonizing, which the flush thread wouldn't survive */
+    if ( capture_path != NULL ) {
+        capture = capture_open(capture_path, capture_size, capture_flush);
+        if ( capture == NULL ) {
+            fprintf(stderr, "Unable to create capture file %s: %s\n",
+                    capture_path, strerror(errno));
+            status = 1;
+            goto end_pid;
+        }
+        for ( i = 0; i < npairs; i++ )
+            nulltty_capture(ttys[i], capture, i);
     }
     if ( daemonize && chdir("/") < 0 ) {
         perror("Unable to change working directory");
@@ -245,28 +1166,93 @@ int main(int argc, char* argv[])
         goto end_pid;
     }
 
-    if ( nulltty_relay(nulltty, &exit_flag) < 0 ) {
+    /* Opened last, since its schedule starts straight away */
+    if ( replay_path != NULL ) {
+        replay = replay_open(replay_path, ev, ttys, npairs, replay_into,
+                             replay_fast);
+        if ( replay == NULL ) {
+            fprintf(stderr, "Unable to replay capture file %s: %s\n",
+                    replay_path,
+                    errno == EINVAL ? "Not a nulltty capture file"
+                    : errno == ENOTSUP ? "Timed replay not supported"
+                    : strerror(errno));
+            status = 1;
+            goto end_pid;
+        }
+    }
+
+    if ( shards != NULL )
+        result = nulltty_shards_run(shards, signals);
+    else if ( loop != NULL )
+        result = nulltty_loop_run(loop, signals);
+    else if ( bus != NULL )
+        result = bus_run(bus, signals);
+    else if ( mux != NULL )
+        result = mux_run(mux, signals);
+    else
+        result = nulltty_relay(nulltty, signals);
+    if ( result < 0 ) {
         perror("Relaying failed");
         status = 2;
         goto end_pid;
     }
 
  end_pid:
-    if ( daemonize && pid_path[0] != '/' && chdir(startup_wd) < 0 ) {
+    if ( daemonize && pid_path != NULL && pid_path[0] != '/'
+         && chdir(startup_wd) < 0 ) {
         perror("Unable to restore working directory for pid file cleanup");
         status = 3;
     }
-    unlink(pid_path);
+    if ( pid_path != NULL )
+        unlink(pid_path);
+ end_loop:
+    if ( replay != NULL )
+        replay_close(replay);
+    replay = NULL;
+    if ( pool != NULL )
+        pool_close(pool);
+    pool = NULL;
+    if ( metrics != NULL )
+        control_close(metrics);
+    metrics = NULL;
+    if ( control != NULL )
+        control_close(control);
+    control = NULL;
+    if ( shards != NULL )
+        nulltty_shards_close(shards);
+    shards = NULL;
+    if ( loop != NULL )
+        nulltty_loop_close(loop);
+    loop = NULL;
+    if ( stats != NULL )
+        statfile_close(stats);
+    stats = NULL;
+    if ( capture != NULL && capture_close(capture) < 0 ) {
+        perror("Error finishing capture file");
+        status = 3;
+    }
+    capture = NULL;
+    nulltty = NULL;
  end_nulltty:
-    if ( daemonize && ( link_a[0] != '/' || link_b[0] != '/' )
+    if ( daemonize && ( links_relative(pairs.links, pairs.n)
+                        || links_relative(bus_links, nbus)
+                        || links_relative(mux_links, nmux) )
          && chdir(startup_wd) < 0 ) {
         perror("Unable to restore working directory for symlink cleanup");
         status = 3;
     }
-    nulltty_close(nulltty);
+    if ( bus != NULL )
+        bus_close(bus);
+    if ( mux != NULL )
+        mux_close(mux);
+    for ( i = 0; i < nopen; i++ )
+        nulltty_close(ttys[i]);
+    free(ttys);
  end_malloc:
     if ( daemonize )
         free(startup_wd);
- end:
+ end_pairs:
+    pairs_free(&pairs);
+    sigsrc_close(signals);
     return status;
 }
@@ -0,0 +1,531 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "pool.h"
+#include "sock.h"
+#include "util.h"
+#include "debug.h"
+
+/** No pair on loan */
+#define POOL_NO_PAIR ( (size_t)-1 )
+
+/*** DATA STRUCTURES **********************************************************/
+
+enum pool_state {
+    POOL_REQUESTING,              /* Reading the request line */
+    POOL_WAITING,                 /* Waiting for a pair to come back */
+    POOL_REPLYING,                /* Sending the reply */
+    POOL_LEASED,                  /* Holding a pair until it hangs up */
+    POOL_CLOSING,                 /* Hung up on, for its handler to free */
+};
+
+struct pool_client {
+    struct ev_handle ev;
+    struct pool *pool;
+    enum pool_state state;
+    bool want_fds;                /* Asked for descriptors, not just paths */
+    char req[POOL_REQUEST_MAX];   /* Request line received so far */
+    size_t req_len;
+    char reply[2 * PATH_MAX + 16];
+    size_t reply_len;
+    size_t off;                   /* Bytes of reply already sent */
+    int fds[2];                   /* Slave descriptors to pass, or -1 */
+    size_t pair;                  /* Index of the pair on loan, or
+                                     POOL_NO_PAIR */
+    struct pool_client *next;
+};
+
+struct pool {
+    int fd;
+    char *path;
+    ev_loop_t ev;
+    struct ev_handle listen_ev;
+    const nulltty_t *pairs;
+    size_t n;
+    bool *lent;                   /* Whether each pair is out on loan */
+    struct pool_client *clients;  /* Most recently connected first */
+    size_t nclients;
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+static void client_close_fds(struct pool_client *client)
+{
+    int i;
+
+    for ( i = 0; i < 2; i++ ) {
+        if ( client->fds[i] >= 0 )
+            close(client->fds[i]);
+        client->fds[i] = -1;
+    }
+}
+
+/**
+ * Hang up on a client some other handler is dealing with
+ *
+ * The client is only freed by its own handler, once it sees the hangup,
+ * since it may yet be dispatched in this pass of the event loop.
+ */
+static void client_abandon(struct pool_client *client)
+{
+    shutdown(client->ev.fd, SHUT_RDWR);
+    client->state = POOL_CLOSING;
+    client->ev.want = EV_READ;
+    client->ev.ready &= ~EV_READ;
+}
+
+/**
+ * Send as much of a client's reply as the socket will take, passing the
+ * slave descriptors along with its first byte
+ *
+ * @return 1 once the reply is all sent, 0 if there is more to send, -1 if
+ * the connection failed
+ */
+static int client_send(struct pool_client *client)
+{
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    struct iovec iov;
+    ssize_t n;
+
+    while ( client->off < client->reply_len ) {
+        iov.iov_base = client->reply + client->off;
+        iov.iov_len = client->reply_len - client->off;
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+
+        if ( client->fds[0] >= 0 ) {
+            memset(control, 0, sizeof(control));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+            memcpy(CMSG_DATA(cmsg), client->fds, 2 * sizeof(int));
+        }
+
+        n = sendmsg(client->ev.fd, &msg, MSG_NOSIGNAL);
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN ) {
+                client->ev.ready &= ~EV_WRITE;
+                return 0;
+            }
+            return -1;
+        }
+
+        /* The client has its own descriptors now */
+        client_close_fds(client);
+        client->off += n;
+    }
+
+    return 1;
+}
+
+/**
+ * Start sending a client its reply
+ *
+ * Clients lent a pair go on to hold it once the reply is sent; others are
+ * hung up on.
+ *
+ * @return Whether the connection is still good
+ */
+static bool client_reply(struct pool_client *client)
+{
+    int result;
+
+    client->state = POOL_REPLYING;
+    client->ev.want = EV_WRITE;
+    client->ev.ready |= EV_WRITE;
+
+    if ( ( result = client_send(client) ) <= 0 )
+        return result == 0;
+
+    if ( client->pair == POOL_NO_PAIR )
+        return false;
+
+    client->state = POOL_LEASED;
+    client->ev.want = EV_READ;
+    return true;
+}
+
+static void client_error(struct pool_client *client, const char *reason)
+{
+    client->reply_len = snprintf(client->reply, sizeof(client->reply),
+                                 "error %s\n", reason);
+}
+
+/**
+ * Lend a pair to a waiting client, and start sending it the reply
+ *
+ * If the pair can't be handed over, it stays in the pool and the client
+ * is sent an error instead.
+ *
+ * @param client Client to lend to
+ * @param pair Index of a pair not out on loan
+ * @return Whether the connection is still good
+ */
+static bool client_lend(struct pool_client *client, size_t pair)
+{
+    struct pool *pool = client->pool;
+    struct nulltty_info info;
+    int i;
+
+    nulltty_get_info(pool->pairs[pair], &info);
+    client->reply_len = snprintf(client->reply, sizeof(client->reply),
+                                 "ok %s %s\n", info.link_a, info.link_b);
+
+    /* Each client gets descriptors of its own, rather than sharing the
+     * file status flags of the ones the pair holds open */
+    for ( i = 0; client->want_fds && i < 2; i++ ) {
+        client->fds[i] = open(i == 0 ? info.link_a : info.link_b,
+                              O_RDWR | O_NOCTTY);
+        if ( client->fds[i] < 0 ) {
+            client_error(client, strerror(errno));
+            client_close_fds(client);
+            return client_reply(client);
+        }
+    }
+
+    pool->lent[pair] = true;
+    client->pair = pair;
+    return client_reply(client);
+}
+
+/**
+ * Lend out free pairs to waiting clients, longest waiting first
+ *
+ * @param pool Pool
+ * @param self Client whose handler we are in, left for it to close
+ * @return Whether self is still good
+ */
+static bool pool_lend(struct pool *pool, struct pool_client *self)
+{
+    struct pool_client *client, *oldest;
+    bool self_ok = true, ok;
+    size_t i = 0;
+
+    while ( true ) {
+        while ( i < pool->n && pool->lent[i] )
+            i++;
+        if ( i == pool->n )
+            break;
+
+        oldest = NULL;
+        for ( client = pool->clients; client != NULL; client = client->next ) {
+            if ( client->state == POOL_WAITING )
+                oldest = client;
+        }
+        if ( oldest == NULL )
+            break;
+
+        /* Either way, the client is no longer waiting */
+        ok = client_lend(oldest, i);
+        if ( oldest == self )
+            self_ok = ok;
+        else if ( ! ok )
+            client_abandon(oldest);
+    }
+
+    return self_ok;
+}
+
+/**
+ * Disconnect a client, putting any pair it held back into the pool
+ */
+static void client_close(struct pool_client *client)
+{
+    struct pool *pool = client->pool;
+    struct pool_client **p;
+    size_t pair = client->pair;
+
+    for ( p = &pool->clients; *p != NULL; p = &(*p)->next ) {
+        if ( *p == client ) {
+            *p = client->next;
+            break;
+        }
+    }
+    pool->nclients--;
+
+    ev_del(pool->ev, &client->ev);
+    close(client->ev.fd);
+    client_close_fds(client);
+    free(client);
+
+    if ( pair == POOL_NO_PAIR )
+        return;
+
+    /* A pair that can't be reset is better retired than lent out dirty */
+    if ( nulltty_reset(pool->pairs[pair]) < 0 ) {
+        perror("Unable to reset pooled PTYs");
+        return;
+    }
+
+    pool->lent[pair] = false;
+    pool_lend(pool, NULL);
+}
+
+/**
+ * Take in the request line, and queue the client for a pair once it is
+ * complete
+ *
+ * @return Whether the connection is still good
+ */
+static bool client_request(struct pool_client *client)
+{
+    char *eol;
+    ssize_t n;
+
+    while ( true ) {
+        n = recv(client->ev.fd, client->req + client->req_len,
+                 sizeof(client->req) - 1 - client->req_len, 0);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && errno == EAGAIN ) {
+            client->ev.ready &= ~EV_READ;
+            return true;
+        }
+        if ( n <= 0 )
+            return false;
+
+        client->req_len += n;
+        client->req[client->req_len] = '\0';
+        if ( ( eol = strchr(client->req, '\n') ) != NULL )
+            break;
+
+        if ( client->req_len == sizeof(client->req) - 1 )
+            return false;
+    }
+
+    if ( eol > client->req && eol[-1] == '\r' )
+        eol--;
+    *eol = '\0';
+
+    if ( strcmp(client->req, "paths") == 0 ) {
+        client->want_fds = false;
+    } else if ( strcmp(client->req, "fds") == 0 ) {
+        client->want_fds = true;
+    } else {
+        client_error(client, "unknown request");
+        return client_reply(client);
+    }
+
+    client->state = POOL_WAITING;
+    return pool_lend(client->pool, client);
+}
+
+/**
+ * Throw away whatever a client sends after its request, watching for it
+ * hanging up
+ *
+ * @return Whether the connection is still good
+ */
+static bool client_drain(struct pool_client *client)
+{
+    char buf[256];
+    ssize_t n;
+
+    while ( true ) {
+        n = recv(client->ev.fd, buf, sizeof(buf), 0);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && errno == EAGAIN ) {
+            client->ev.ready &= ~EV_READ;
+            return true;
+        }
+        if ( n <= 0 )
+            return false;
+    }
+}
+
+/**
+ * Move a client along as far as its connection allows
+ *
+ * Each state's work may leave the client in the next, with readiness
+ * already seen but not yet acted on, so they are taken in order.
+ */
+static int client_event(struct ev_handle *handle)
+{
+    struct pool_client *client = handle->data;
+    bool ok = client->state != POOL_CLOSING;
+    int result;
+
+    if ( ok && client->state == POOL_REQUESTING
+         && ( handle->ready & EV_READ ) )
+        ok = client_request(client);
+
+    if ( ok && client->state == POOL_REPLYING
+         && ( handle->ready & EV_WRITE ) ) {
+        if ( ( result = client_send(client) ) < 0 ) {
+            ok = false;
+        } else if ( result > 0 ) {
+            ok = client->pair != POOL_NO_PAIR;
+            client->state = POOL_LEASED;
+            client->ev.want = EV_READ;
+        }
+    }
+
+    if ( ok && ( client->state == POOL_WAITING
+                 || client->state == POOL_LEASED )
+         && ( handle->ready & EV_READ ) )
+        ok = client_drain(client);
+
+    if ( ! ok || client->state == POOL_CLOSING )
+        client_close(client);
+    return 0;
+}
+
+/**
+ * Accept pending connections, and start reading each one's request
+ */
+static int pool_accept(struct ev_handle *handle)
+{
+    struct pool *pool = handle->data;
+    struct pool_client *client;
+    int fd;
+
+    while ( true ) {
+        fd = accept(pool->fd, NULL, NULL);
+        if ( fd < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                handle->ready &= ~EV_READ;
+                return 0;
+            }
+            /* Out of descriptors and the like; try again on the next
+             * connection rather than bringing the relay down */
+            perror("Unable to accept pool connection");
+            handle->ready &= ~EV_READ;
+            return 0;
+        }
+
+        /* Unlike a statistics client, one holding a pair can't be hung up
+         * on to make room, so latecomers are turned away instead */
+        if ( pool->nclients >= POOL_CLIENTS_MAX || sock_nonblock(fd) < 0 ) {
+            close(fd);
+            continue;
+        }
+
+        client = calloc(1, sizeof(struct pool_client));
+        if ( client == NULL || ev_add(pool->ev, &client->ev, fd, client) < 0 ) {
+            free(client);
+            close(fd);
+            continue;
+        }
+
+        client->pool = pool;
+        client->state = POOL_REQUESTING;
+        client->fds[0] = client->fds[1] = -1;
+        client->pair = POOL_NO_PAIR;
+        client->ev.want = EV_READ;
+        client->ev.callback = client_event;
+        client->next = pool->clients;
+        pool->clients = client;
+        pool->nclients++;
+    }
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+pool_t pool_open(const char *path, ev_loop_t ev, const nulltty_t *pairs,
+                 size_t n)
+{
+    struct sockaddr_un addr;
+    pool_t pool;
+
+    pool = calloc(1, sizeof(struct pool));
+    if ( pool == NULL )
+        goto error;
+
+    pool->ev = ev;
+    pool->pairs = pairs;
+    pool->n = n;
+
+    pool->lent = calloc(n, sizeof(bool));
+    if ( pool->lent == NULL && n > 0 )
+        goto error_pool;
+
+    if ( ( pool->path = abs_path(path, strlen(path)) ) == NULL )
+        goto error_lent;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ( strlcpy(addr.sun_path, pool->path, sizeof(addr.sun_path))
+         >= sizeof(addr.sun_path) ) {
+        errno = ENAMETOOLONG;
+        goto error_path;
+    }
+
+    pool->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ( pool->fd < 0 )
+        goto error_path;
+
+    if ( sock_nonblock(pool->fd) < 0
+         || bind(pool->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+        goto error_socket;
+
+    if ( listen(pool->fd, POOL_CLIENTS_MAX) < 0
+         || ev_add(ev, &pool->listen_ev, pool->fd, pool) < 0 )
+        goto error_bind;
+
+    pool->listen_ev.want = EV_READ;
+    pool->listen_ev.callback = pool_accept;
+    return pool;
+
+ error_bind:
+    unlink(pool->path);
+ error_socket:
+    close(pool->fd);
+ error_path:
+    free(pool->path);
+ error_lent:
+    free(pool->lent);
+ error_pool:
+    free(pool);
+ error:
+    return NULL;
+}
+
+int pool_close(pool_t pool)
+{
+    struct pool_client *client;
+    int result = 0;
+
+    while ( ( client = pool->clients ) != NULL ) {
+        pool->clients = client->next;
+        ev_del(pool->ev, &client->ev);
+        close(client->ev.fd);
+        client_close_fds(client);
+        free(client);
+    }
+
+    ev_del(pool->ev, &pool->listen_ev);
+    if ( close(pool->fd) < 0 )
+        result = -1;
+    if ( unlink(pool->path) < 0 )
+        result = -1;
+
+    free(pool->path);
+    free(pool->lent);
+    free(pool);
+    return result;
+}
@@ -0,0 +1,68 @@
+#ifndef _NULLTTY_POOL_H_
+#define _NULLTTY_POOL_H_
+
+#include <stddef.h>
+
+#include "events.h"
+#include "ptys.h"
+
+/**
+ * Pool of ready PTY pairs lent out over a Unix-domain socket
+ *
+ * Starting nulltty and waiting for its pseudoterminals to appear costs a
+ * process start per pair, which adds up over a test suite.  A pool instead
+ * keeps a fixed set of pairs open and relaying, and lends one to each
+ * client of its socket, so that getting a pair takes a round trip rather
+ * than a fork.
+ *
+ * A client connects and sends one request line:
+ *
+ *   paths      Reply "ok <link_a> <link_b>", the symlinks of the pair's
+ *              two slaves, separated by a space
+ *   fds        The same reply, with descriptors of the two slaves, A then
+ *              B, passed along with it as SCM_RIGHTS ancillary data
+ *
+ * Replies are a single line, "error <reason>" if the request could not be
+ * met.  While every pair is out on loan, requests wait their turn in order
+ * of arrival.
+ *
+ * The client keeps the pair for as long as it stays connected; anything
+ * more it sends is ignored.  Once it hangs up, the pair is reset (see
+ * nulltty_reset()) and goes back into the pool.  Clients should close
+ * their own descriptors of the slaves before hanging up, or they could
+ * see the next borrower's data.
+ */
+
+/** Most clients connected at once, whether holding pairs or waiting */
+#define POOL_CLIENTS_MAX 256
+
+/** Longest request line accepted, in bytes */
+#define POOL_REQUEST_MAX 64
+
+struct pool; /* Forward declaration */
+typedef struct pool *pool_t;
+
+/**
+ * Create a pool's socket and start lending out its pairs
+ *
+ * @param path Path to bind the socket to; must not exist already
+ * @param ev Event loop to serve the socket from, which must dispatch
+ * handles with callbacks, and which relays the pairs
+ * @param pairs PTY pairs to lend out, which must outlive the pool
+ * @param n Number of pairs
+ * @return Pool, or NULL with errno on error
+ */
+pool_t pool_open(const char *path, ev_loop_t ev, const nulltty_t *pairs,
+                 size_t n);
+
+/**
+ * Close a pool's socket, disconnecting any clients and removing its path
+ *
+ * Pairs out on loan are left as they are.
+ *
+ * @param pool Pool returned by pool_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int pool_close(pool_t pool);
+
+#endif /* ! defined _NULLTTY_POOL_H_ */
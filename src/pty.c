@@ -0,0 +1,108 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#ifdef HAVE_UTIL_H
+#include <util.h>
+#endif
+
+#include "pty.h"
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+int pty_open(const char *link, int *master, int *slave)
+{
+    int flags;
+    struct termios t = { 0 };
+
+    if ( strnlen(link, PATH_MAX) == PATH_MAX ) {
+        errno = ENAMETOOLONG;
+        goto error_openpt;
+    }
+
+#ifdef HAVE_POSIX_OPENPT
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ( *master < 0 )
+        goto error_openpt;
+
+    if ( grantpt(*master) < 0 )
+        goto error_opened;
+
+    if ( unlockpt(*master) < 0 )
+        goto error_opened;
+
+    *slave = open(ptsname(*master), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ( *slave < 0 )
+        goto error_opened;
+
+#else /* defined POSIX_OPENPT */
+
+    /* The name parameter to openpty() needs to contain "at least sixteen
+     * characters" according to the man page in OpenBSD 5.2... */
+    char pty_slave_name[16];
+    if ( openpty(master, slave, pty_slave_name, NULL, NULL) < 0 )
+        goto error_openpt;
+
+#endif /* ! defined POSIX_OPENPT */
+
+    flags = fcntl(*master, F_GETFL);
+    if ( flags < 0 )
+        goto error_slave;
+
+    /*
+     * O_NONBLOCK is not a defined flag to posix_openpt (and in fact
+     * FreeBSD will return an error if you attempt to specify it), so
+     * instead we set the flag with fcntl after the fact.
+     */
+    if ( fcntl(*master, F_SETFL, flags | O_NONBLOCK) < 0 )
+        goto error_slave;
+
+    /*
+     * Put the slave pty fd into raw mode.
+     */
+    if ( tcgetattr(*slave, &t) == -1 )
+        goto error_slave;
+    cfmakeraw(&t);
+    if ( tcsetattr(*slave, TCSAFLUSH, &t) == -1 )
+        goto error_slave;
+
+#ifdef HAVE_PTSNAME
+    if ( symlink(ptsname(*master), link) < 0 )
+        goto error_slave;
+#else
+    if ( symlink(pty_slave_name, link) < 0 )
+        goto error_slave;
+#endif
+
+    return 0;
+
+ error_slave:
+    close(*slave);
+ error_opened:
+    close(*master);
+ error_openpt:
+    return -1;
+}
+
+int pty_close(const char *link, int master, int slave)
+{
+    int result = 0;
+
+    if ( close(slave) < 0 )
+        result = -1;
+
+    if ( close(master) < 0 )
+        result = -1;
+
+    if ( unlink(link) < 0 )
+        result = -1;
+
+    return result;
+}
@@ -0,0 +1,31 @@
+#ifndef _NULLTTY_PTY_H_
+#define _NULLTTY_PTY_H_
+
+/**
+ * Create a pseudoterminal, symbolically linked from the given path
+ *
+ * Uses the platform's pseudoterminal functions to open a pseudoterminal,
+ * puts its slave into raw mode and links the path to the slave device.
+ * The master is made non-blocking.  We hold a descriptor of the slave open
+ * for as long as the pseudoterminal exists: on Linux at least, reads of
+ * the master fail with EIO whenever the slave has no open descriptors,
+ * which would otherwise happen every time a user closed it.
+ *
+ * @param link Path of the symbolic link to create
+ * @param master Set to the master descriptor
+ * @param slave Set to the slave descriptor
+ * @return 0 on success, -1 with errno on error
+ */
+int pty_open(const char *link, int *master, int *slave);
+
+/**
+ * Close a pseudoterminal opened with pty_open() and remove its link
+ *
+ * @param link Path of the symbolic link
+ * @param master Master descriptor
+ * @param slave Slave descriptor
+ * @return 0 on success, -1 with errno on error
+ */
+int pty_close(const char *link, int master, int slave);
+
+#endif /* ! defined _NULLTTY_PTY_H_ */
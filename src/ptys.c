@@ -4,201 +4,452 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
-#ifdef HAVE_UTIL_H
-#include <util.h>
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
 #endif
 
 #include "ptys.h"
+#include "events.h"
+#include "pty.h"
+#include "ring.h"
+#include "hist.h"
+#include "capture.h"
+#include "sock.h"
+#include "wheel.h"
+#include "util.h"
+#ifdef HAVE_IO_URING
+#include "uring.h"
+#endif
+#include "debug.h"
 
 
 /*** DATA STRUCTURES **********************************************************/
 
+/**
+ * Number of buffered chunks per direction whose ingress time is remembered
+ */
+#define LAT_MARKS 64
+
+/**
+ * Most chunks per direction a delay line keeps the ingress time of; see
+ * delay_in()
+ */
+#define DELAY_MARKS 1024
+
+/** A chunk of data read but not yet fully written out */
+struct lat_mark {
+    uint64_t end;        /* Value of bytes_in just after the chunk */
+    uint64_t ts;         /* CLOCK_MONOTONIC ns at which it was read */
+};
+
 struct nulltty_pty {
     int fd;
     int slave_fd;
     char *link;
-    uint8_t *read_buf;
-    size_t read_n;
-    size_t read_total;
-    size_t write_total;
+    struct termios termios; /* Slave's settings as opened (PTYs only) */
+    struct ev_handle ev;
+    struct ring ring;
+    size_t ring_min;     /* Size to shrink back to when idle */
+    size_t ring_max;     /* Ceiling for adaptive growth */
+    unsigned fill_streak;
+    bool splice;         /* Relaying through pipe rather than ring */
+    int pipe_fds[2];
+    size_t pipe_n;       /* Bytes spliced into the pipe but not yet out */
+    bool pipe_full;
+    bool uring_reading;  /* io_uring read into ring in flight */
+    bool uring_writing;  /* io_uring write out of ring in flight */
+    struct nulltty_stats *stats; /* Direction from this PTY to the other */
+    struct nulltty_stats own_stats; /* Unless shared, see nulltty_share_stats() */
+    struct lat_mark lat_marks[LAT_MARKS]; /* Chunks in flight, oldest first */
+    unsigned lat_head;   /* Free-running indices into lat_marks */
+    unsigned lat_tail;
+    uint64_t discarded;  /* Bytes read but thrown away by resets, never to
+                            be written out */
+    struct hist latency; /* Bytes by time spent between read and write */
+    capture_t capture;   /* Log of the data read, if any */
+    unsigned capture_pair;
+    unsigned capture_dir;
+    struct sock_spec *sock; /* Socket address, if not a PTY */
+    int listen_fd;       /* Listening socket, or -1; fd is -1 until a client
+                            connects */
+    struct ev_handle listen_ev;
+    bool corked;
+    bool hangup;         /* Socket peer gone, to be disconnected */
+    uint64_t coalesce_ns; /* Longest to hold data back, or 0 */
+    size_t coalesce_bytes; /* Amount to write without waiting, or 0 */
+    uint64_t held_since; /* When the ring last went from empty to not */
+    unsigned reads_held; /* Reads into the ring since the last write */
+    bool holding;        /* Data held back at the last chance to write */
+    uint64_t hold_until; /* When data being held back is due */
+    bool pace;           /* Release data no faster than a real UART */
+    bool pacing;         /* Data held back by pacing, due at pace_until */
+    uint64_t pace_until;
+    unsigned long pace_bps; /* Line speed, or 0 to leave the data unpaced */
+    unsigned pace_bits;  /* Bits on the line per character */
+    uint64_t pace_free_at; /* When the line has sent all data let out */
+    uint64_t pace_rem;   /* Part nanosecond of line time, in 1/pace_bps */
+    uint64_t pace_read_at; /* When the line settings were last read */
+    uint64_t delay_ns;   /* Delay line latency, or 0 */
+    struct lat_mark *delay_marks; /* Chunks not yet due, oldest first */
+    unsigned delay_head; /* Free-running indices into delay_marks */
+    unsigned delay_tail;
+    uint64_t delay_ticks; /* Delay line ticks per mark, see delay_in() */
+    uint64_t delay_released; /* Value of bytes_in up to which data is due
+                                to be written out */
+    bool delaying;       /* Data held back by the delay line */
+    uint64_t delay_until; /* When the oldest of it is due */
+    struct wheel_timer delay_timer; /* On the loop's wheel, for delay_until */
 };
 
 struct nulltty {
     struct nulltty_pty a;
     struct nulltty_pty b;
-    sig_atomic_t info_req;
+    enum nulltty_mode mode;
+#ifdef HAVE_IO_URING
+    struct uring uring;
+#endif
+    nulltty_loop_t loop;      /* Relay loop serving this pair, if any */
+    struct nulltty *next_run; /* Next pair for the loop to service */
+    bool queued;              /* Whether on the loop's list to service */
+    bool grown;               /* Whether either ring is above its minimum */
+    struct nulltty *next_held; /* Next pair on the loop's held list */
+    bool held;                /* Whether on the loop's held list */
+    bool busy_poll;
+    uint64_t busy_idle_ns;    /* Idle time before backing off, or 0 */
+    volatile sig_atomic_t info_req;
+};
+
+struct nulltty_loop {
+    ev_loop_t ev;
+    int wake_fds[2];          /* Self-pipe for nulltty_loop_wake() */
+    struct ev_handle wake_ev;
+    struct ev_handle sig_ev;  /* Signal source, while running */
+    nulltty_t *pairs;
+    size_t n;
+    size_t cap;
+    size_t ngrown;            /* Pairs with grown rings */
+    nulltty_t held;           /* Pairs which may be holding data back */
+    uint64_t flush_at;        /* When the earliest held data is due */
+    struct wheel delays;      /* Delay lines' timers, in DELAY_TICK_NS */
+#ifdef HAVE_TIMERFD
+    struct ev_handle flush_ev; /* Timer for flush_at, once needed */
+    uint64_t flush_armed;     /* Time the timer is set for, or 0 */
+#endif
+    bool busy_poll;           /* Whether any pair asks to be busy-polled */
+    uint64_t busy_idle_ns;    /* Idle time before backing off, or 0 */
+    bool spinning;            /* Busy-polling now, rather than backed off */
+    uint64_t last_moved;      /* When a poll last moved data */
+    uint64_t polls;           /* Busy-polling passes over the pairs */
+    uint64_t polls_moved;     /* Passes which moved any data */
+    uint64_t backoffs;        /* Times spinning went back to sleeping */
+    uint64_t events_at;       /* When a step last found events */
+    volatile sig_atomic_t stop;
+    volatile sig_atomic_t info_pending;
+    volatile sig_atomic_t info_all;
 };
 
 
+/*** STATISTICS *************************************************************/
+
+/*
+ * Counters may be mapped into other processes (see statfile.h), which read
+ * them while we relay.  Each is only ever written by the thread relaying
+ * its pair, so a relaxed atomic store of the incremented value is enough
+ * for readers never to see a torn update; unlike an atomic read-modify-
+ * write, it compiles to the same plain load and store as before.
+ */
+#ifdef HAVE_ATOMIC_BUILTINS
+#define STAT_SET(field, value) \
+    __atomic_store_n(&(field), (value), __ATOMIC_RELAXED)
+#else
+#define STAT_SET(field, value) ( (field) = (value) )
+#endif
+
+#define STAT_ADD(field, n) STAT_SET(field, (field) + (n))
+#define STAT_INC(field) STAT_ADD(field, 1)
+#define STAT_MAX(field, value) \
+    do { if ( (value) > (field) ) STAT_SET(field, value); } while ( 0 )
+
+
 /*** DEBUGGING INSTRUMENTATION ************************************************/
 
 #ifdef DEBUG
 
-static unsigned long nsyscalls = 0;
-static unsigned long nreads = 0;
-static unsigned long nwrites = 0;
-static unsigned long nselects = 0;
+unsigned long nsyscalls = 0;
+unsigned long nselects = 0;
 
-static inline ssize_t debug_read(int fd, void *buf, size_t count) {
-    nsyscalls++;
-    nreads++;
-    return read(fd, buf, count);
-}
-#define read(...) debug_read(__VA_ARGS__)
+#endif /* DEBUG */
 
-static inline ssize_t debug_write(int fd, const void *buf, size_t count) {
-    nsyscalls++;
-    nwrites++;
-    return write(fd, buf, count);
-}
-#define write(...) debug_write(__VA_ARGS__)
 
-#ifdef HAVE_PSELECT
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Number of consecutive reads which must fill an empty ring buffer before
+ * we double its size
+ */
+#define RING_GROW_STREAK 2
 
-static inline ssize_t debug_pselect(int nfds, fd_set *readfds, fd_set *writefds,
-                                    fd_set *exceptfds, struct timespec *timeout,
-                                    const sigset_t *sigmask)
-{
-    nsyscalls++;
-    nselects++;
-    return pselect(nfds, readfds, writefds, exceptfds, timeout, sigmask);
-}
-#define pselect(...) debug_pselect(__VA_ARGS__)
+/**
+ * Seconds without relay activity after which grown ring buffers are
+ * shrunk back to their initial size
+ */
+#define RING_IDLE_SEC 1
+
+/**
+ * Busy-polling passes of a relay loop between checks for other events,
+ * such as signals
+ */
+#define BUSY_POLL_EVENTS 64
+
+/**
+ * Line time by which a paced direction may run ahead of the clock, so
+ * that data is let out in bursts of about this long rather than a
+ * character per timer expiry
+ */
+#define PACE_BURST_NS 1000000
+
+/**
+ * Interval at which a paced direction picks up changes to its PTY's line
+ * settings, rather than asking on every write
+ */
+#define PACE_REREAD_NS 100000000
 
-#else /* defined HAVE_PSELECT */
+/**
+ * Resolution of delay lines: data falling due within the same tick is
+ * written out together, on the one timer expiry
+ */
+#define DELAY_TICK_NS 1000000
 
-static inline ssize_t debug_select(int nfds, fd_set *readfds, fd_set *writefds,
-                                   fd_set *exceptfds, struct timeval *timeout)
+static uint64_t timespec_ns(const struct timespec *ts)
 {
-    nsyscalls++;
-    nselects++;
-    return select(nfds, readfds, writefds, exceptfds, timeout);
+    return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
 }
-#define select(...) debug_select(__VA_ARGS__)
 
-#endif /* ! defined HAVE_PSELECT */
-
-#endif /* DEBUG */
+static uint64_t now_ns(void)
+{
+    struct timespec now;
 
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return timespec_ns(&now);
+}
 
-/*** HELPER FUNCTIONS *********************************************************/
+/**
+ * Remember when a chunk of data was read, for latency accounting
+ *
+ * If too many chunks are already in flight, the new one is folded into
+ * the most recent, whose earlier ingress time then slightly overstates
+ * the new bytes' residency.
+ *
+ * @param pty Descriptor of the sending PTY
+ * @param end Byte count read from pty so far, including the chunk
+ * @param ts CLOCK_MONOTONIC ns at which the chunk was read
+ */
+static void latency_in(struct nulltty_pty *pty, uint64_t end, uint64_t ts)
+{
+    if ( pty->lat_head - pty->lat_tail == LAT_MARKS ) {
+        pty->lat_marks[( pty->lat_head - 1 ) % LAT_MARKS].end = end;
+        return;
+    }
 
-#define MAX(a, b) ((a)>(b)) ? (a) : (b)
+    pty->lat_marks[pty->lat_head % LAT_MARKS].end = end;
+    pty->lat_marks[pty->lat_head % LAT_MARKS].ts = ts;
+    pty->lat_head++;
+}
 
 /**
- * Open a single PTY nulltty endpoint
+ * Account for bytes written out in a direction's latency histogram
  *
- * Prepares one of the two pseudoterminals used by the nulltty process,
- * saving its file descriptor and other data in the given structure.
+ * Each byte is recorded with the time since the chunk holding it was
+ * read, so that a chunk written out piecemeal is attributed correctly.
  *
- * @param pty Pseudoterminal descriptor structure, to which fd and other
- * information is to be written
- * @param link Name of symbolic link requested for this PTY slave
- * @return 0 on success, -1 with errno on error
+ * @param pty Descriptor of the sending PTY
+ * @param from Byte count written out before the write
+ * @param to Byte count written out after the write
  */
-static int endpoint_open(struct nulltty_pty *pty, const char *link)
+static void latency_out(struct nulltty_pty *pty, uint64_t from, uint64_t to)
 {
-    int link_len, flags;
-    struct termios t = { 0 };
+    struct lat_mark *mark;
+    uint64_t now = now_ns(), upto;
 
-#ifdef HAVE_POSIX_OPENPT
+    /* Line the write up with the reads, past any data reset away */
+    from += pty->discarded;
+    to += pty->discarded;
+
+    while ( from < to && pty->lat_tail != pty->lat_head ) {
+        mark = &pty->lat_marks[pty->lat_tail % LAT_MARKS];
+        upto = mark->end < to ? mark->end : to;
+
+        hist_add(&pty->latency, now - mark->ts, upto - from);
+        from = upto;
+        if ( mark->end <= to )
+            pty->lat_tail++;
+    }
+}
 
-    pty->fd = posix_openpt(O_RDWR | O_NOCTTY);
-    if ( pty->fd < 0 )
-        goto error_openpt;
+/**
+ * Append a chunk just read into a direction's ring to the capture log
+ *
+ * @param pty Descriptor of the sending PTY
+ * @param n Bytes read, now at the head of its ring
+ * @param ts CLOCK_MONOTONIC ns at which they were read
+ */
+static void relay_capture(struct nulltty_pty *pty, size_t n, uint64_t ts)
+{
+    struct iovec iov[2];
+    int iovcnt;
 
-    if ( grantpt(pty->fd) < 0 )
-        goto error_opened;
+    iovcnt = ring_iov(&pty->ring, pty->ring.head - n, n, iov);
+    capture_append(pty->capture, pty->capture_pair, pty->capture_dir, ts,
+                   iov, iovcnt);
+}
 
-    if ( unlockpt(pty->fd) < 0 )
-        goto error_opened;
+/**
+ * Nanoseconds a direction has been blocked on a full destination so far
+ *
+ * @param pty Descriptor of the sending PTY
+ * @return Blocked time, including any current spell
+ */
+static uint64_t relay_blocked_ns(const struct nulltty_pty *pty)
+{
+    struct timespec now;
 
-    /*
-     * On Linux at least, when the last fd of the slave PTY is closed an
-     * error condition is set, causing reads of the master side to result
-     * in EIO.  By holding our own copy of the slave PTY open we can avoid
-     * this, preventing more complicated error handling in our select()
-     * loop.
-     */
-    pty->slave_fd = open(ptsname(pty->fd), O_RDWR | O_NOCTTY | O_NONBLOCK);
-    if ( pty->slave_fd < 0 )
-        goto error_opened;
+    if ( pty->stats->blocked_since == 0 )
+        return pty->stats->blocked_ns;
 
-#else /* defined POSIX_OPENPT */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return pty->stats->blocked_ns
+        + ( timespec_ns(&now) - pty->stats->blocked_since );
+}
 
-    /* The name parameter to openpty() needs to contain "at least sixteen
-     * characters" according to the man page in OpenBSD 5.2... */
-    char pty_slave_name[16];
-    if ( openpty(&pty->fd, &pty->slave_fd, pty_slave_name, NULL, NULL) < 0 )
-        goto error_openpt;
+/**
+ * Note a write which the receiving PTY refused, for lack of room
+ *
+ * The clock is only read when a direction starts or stops being blocked,
+ * not on every write.
+ *
+ * @param pty Descriptor of the sending PTY
+ */
+static void relay_block(struct nulltty_pty *pty)
+{
+    struct timespec now;
 
-#endif /* ! defined POSIX_OPENPT */
+    if ( pty->stats->blocked_since != 0 )
+        return;
 
-    flags = fcntl(pty->fd, F_GETFL);
-    if ( flags < 0 )
-        goto error_opened;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    STAT_SET(pty->stats->blocked_since, timespec_ns(&now));
+}
 
-    /*
-     * O_NONBLOCK is not a defined flag to posix_openpt (and in fact
-     * FreeBSD will return an error if you attempt to specify it), so
-     * instead we set the flag with fcntl after the fact.
-     */
-    if ( fcntl(pty->fd, F_SETFL, flags | O_NONBLOCK) < 0 )
-        goto error_opened;
+/**
+ * Note a write which the receiving PTY accepted
+ *
+ * @param pty Descriptor of the sending PTY
+ */
+static void relay_unblock(struct nulltty_pty *pty)
+{
+    if ( pty->stats->blocked_since == 0 )
+        return;
 
-    /*
-     * Put the slave pty fd into raw mode.
-     */
-    if ( tcgetattr(pty->slave_fd, &t) == -1 )
-        goto error_termios;
-    cfmakeraw(&t);
-    if ( tcsetattr(pty->slave_fd, TCSAFLUSH, &t) == -1 )
-        goto error_termios;
+    STAT_SET(pty->stats->blocked_ns, relay_blocked_ns(pty));
+    STAT_SET(pty->stats->blocked_since, 0);
+}
 
-    link_len = strnlen(link, PATH_MAX);
-    if ( link[link_len] != '\0' ) {
-        errno = ENAMETOOLONG;
-        goto error_link_name;
+/**
+ * Open a socket endpoint
+ *
+ * Connects straight away, or starts listening for a client.
+ *
+ * @param pty Descriptor to fill in
+ * @param name Socket address
+ * @return 0 on success, -1 with errno on error
+ */
+static int endpoint_open_sock(struct nulltty_pty *pty, const char *name)
+{
+    int saved_errno;
+
+    if ( ( pty->sock = sock_parse(name) ) == NULL )
+        return -1;
+
+    pty->fd = -1;
+    pty->slave_fd = -1;
+    if ( pty->sock->listen )
+        pty->listen_fd = sock_listen(pty->sock);
+    else
+        pty->fd = sock_connect(pty->sock);
+
+    if ( pty->fd < 0 && pty->listen_fd < 0 ) {
+        saved_errno = errno;
+        sock_free(pty->sock);
+        pty->sock = NULL;
+        errno = saved_errno;
+        return -1;
     }
 
-    pty->link = calloc(link_len+1, sizeof(char));
-    if ( pty->link == NULL )
-        goto error_link_name;
-
-    strlcpy(pty->link, link, link_len+1);
+    return 0;
+}
 
-    pty->read_buf = calloc(READ_BUF_SZ, 1);
-    if ( pty->read_buf == NULL )
-        goto error_read_buf;
-    pty->read_n = 0;
+/**
+ * Open a single PTY nulltty endpoint
+ *
+ * Prepares one of the two pseudoterminals used by the nulltty process,
+ * saving its file descriptor and other data in the given structure.
+ *
+ * @param pty Pseudoterminal descriptor structure, to which fd and other
+ * information is to be written
+ * @param link Name of symbolic link requested for this PTY slave, or a
+ * socket address (see sock.h)
+ * @param opts Relay options
+ * @return 0 on success, -1 with errno on error
+ */
+static int endpoint_open(struct nulltty_pty *pty, const char *link,
+                         const struct nulltty_opts *opts)
+{
+    pty->listen_fd = -1;
+    pty->ring_min = round_pow2(opts->buf_size);
+    pty->ring_max = round_pow2(opts->buf_max);
+    if ( pty->ring_max < pty->ring_min )
+        pty->ring_max = pty->ring_min;
+    if ( pty->ring_max > READ_BUF_MAX ) {
+        errno = EINVAL;
+        goto error;
+    }
 
-#ifdef HAVE_PTSNAME
-    if ( symlink(ptsname(pty->fd), link) < 0 )
-        goto error_symlink;
-#else
-    if ( symlink(pty_slave_name, link) < 0 )
-        goto error_symlink;
-#endif
+    pty->link = strdup(link);
+    if ( pty->link == NULL )
+        goto error;
+
+    if ( ring_init(&pty->ring, pty->ring_min) < 0 )
+        goto error_link;
+    pty->stats = &pty->own_stats;
+    pty->stats->buf_size = pty->ring_min;
+    pty->stats->buf_peak = pty->ring_min;
+
+    if ( sock_is_spec(link) ) {
+        if ( endpoint_open_sock(pty, link) < 0 )
+            goto error_ring;
+    } else if ( pty_open(link, &pty->fd, &pty->slave_fd) < 0 ) {
+        goto error_ring;
+    } else if ( tcgetattr(pty->slave_fd, &pty->termios) < 0 ) {
+        pty_close(link, pty->fd, pty->slave_fd);
+        goto error_ring;
+    }
 
     return 0;
 
- error_symlink:
-    free(pty->read_buf);
- error_read_buf:
+ error_ring:
+    ring_free(&pty->ring);
+ error_link:
     free(pty->link);
- error_termios:
- error_link_name:
-    close(pty->slave_fd);
- error_opened:
-    close(pty->fd);
- error_openpt:
+ error:
     return -1;
 }
 
@@ -214,241 +465,2431 @@ static int endpoint_close(struct nulltty_pty *pty)
 {
     int result = 0;
 
-    if ( close(pty->slave_fd) < 0 )
-        result = -1;
-
-    if ( close(pty->fd) < 0 )
-        result = -1;
-
-    if ( unlink(pty->link) < 0 )
+    if ( pty->sock != NULL ) {
+        if ( pty->fd >= 0 && close(pty->fd) < 0 )
+            result = -1;
+        if ( pty->listen_fd >= 0
+             && sock_unlisten(pty->sock, pty->listen_fd) < 0 )
+            result = -1;
+        sock_free(pty->sock);
+        pty->sock = NULL;
+    } else if ( pty_close(pty->link, pty->fd, pty->slave_fd) < 0 ) {
         result = -1;
+    }
 
     free(pty->link);
     pty->link = NULL;
+    ring_free(&pty->ring);
+    free(pty->delay_marks);
+    pty->delay_marks = NULL;
+
+    if ( pty->splice ) {
+        close(pty->pipe_fds[0]);
+        close(pty->pipe_fds[1]);
+        pty->splice = false;
+    }
 
     return result;
 }
 
 /**
- * Prepare select() fd_sets for this iteration of the relay
- *
- * Prepares read and write fd_sets by setting the appropriate file
- * descriptors in order for pty_dst to receive data from pty_src, depending
- * on the current state of pty_dst's receive buffer.
+ * Discard the data read from an endpoint and not yet relayed, along with
+ * anything still queued in its pseudoterminal either way
  *
- * This function is half-duplex with respect to the relay.
+ * Also puts a PTY's slave back into the settings it was opened with.
  *
- * @param pty_dst Descriptor of receiving PTY
- * @param pty_src Descriptor of sending PTY
- * @param rfds Pointer to read fd_set
- * @param wfds Pointer to write fd_set
+ * @param pty Descriptor of the endpoint
+ * @return 0 on success, -1 with errno on error
  */
-static void relay_set_fds(struct nulltty_pty *pty_dst,
-                          struct nulltty_pty *pty_src,
-                          fd_set *rfds, fd_set *wfds)
+static int endpoint_reset(struct nulltty_pty *pty)
 {
-    if ( pty_src->read_n < READ_BUF_SZ - 1 )
-        FD_SET(pty_src->fd, rfds);
+    char buf[4096];
+
+    if ( pty->sock == NULL
+         && ( tcflush(pty->fd, TCIOFLUSH) < 0
+              || tcflush(pty->slave_fd, TCIOFLUSH) < 0
+              || tcsetattr(pty->slave_fd, TCSANOW, &pty->termios) < 0 ) )
+        return -1;
+
+    if ( pty->splice ) {
+        while ( read(pty->pipe_fds[0], buf, sizeof(buf)) > 0 )
+            ;
+        pty->discarded += pty->pipe_n;
+        pty->pipe_n = 0;
+        pty->pipe_full = false;
+    }
+
+    pty->discarded += ring_len(&pty->ring);
+    pty->ring.tail = pty->ring.head;
+    pty->lat_tail = pty->lat_head;
+    pty->reads_held = 0;
+    pty->holding = false;
+    pty->pacing = false;
+    pty->pace_read_at = 0;
+    pty->delay_tail = pty->delay_head;
+    pty->delay_released = pty->stats->bytes_in;
+    pty->delaying = false;
+    relay_unblock(pty);
+    STAT_SET(pty->stats->buffered, 0);
+
+    /* The flush made room for writes, without saying so */
+    if ( pty->fd >= 0 )
+        pty->ev.ready |= EV_WRITE;
 
-    if ( pty_src->read_n > 0 )
-        FD_SET(pty_dst->fd, wfds);
+    return 0;
 }
 
 /**
- * Shuffle data between two PTYs
+ * Set up write coalescing of the data read from an endpoint
  *
- * Depending on the file descriptor states returned by select(), performs
- * non-blocking writes out of, and reads into, the read buffer in order to
- * shuffle data from pty_src to pty_dst.
- *
- * This function is half-duplex with respect to the relay.
+ * @param pty Descriptor of the endpoint
+ * @param coalesce Coalescing options for its data
+ */
+static void endpoint_coalesce(struct nulltty_pty *pty,
+                              const struct nulltty_coalesce *coalesce)
+{
+    pty->coalesce_ns = coalesce->delay_us * UINT64_C(1000);
+    pty->coalesce_bytes = coalesce->bytes;
+}
+
+/**
+ * Set up a delay line for the data read from an endpoint
  *
- * @param pty_dst Descriptor of receiving PTY
- * @param pty_src Descriptor of sending PTY
- * @param rfds Pointer to read fd_set
- * @param wfds Pointer to write fd_set
+ * @param pty Descriptor of the endpoint
+ * @param delay_us Latency to add, in microseconds, or 0 for none
  * @return 0 on success, -1 with errno on error
  */
-static int relay_shuffle_data(struct nulltty_pty *pty_dst,
-                              struct nulltty_pty *pty_src,
-                              fd_set *rfds, fd_set *wfds)
+static int endpoint_delay(struct nulltty_pty *pty, unsigned delay_us)
 {
-    ssize_t n;
-
-    if ( FD_ISSET(pty_src->fd, rfds) ) {
-        n = read(pty_src->fd, pty_src->read_buf + pty_src->read_n,
-                 READ_BUF_SZ - pty_src->read_n);
-        if ( n < 0 )
-            return -1;
-
-        pty_src->read_n += n;
-        pty_src->read_total += n;
-    }
-
-    if ( FD_ISSET(pty_dst->fd, wfds) ) {
-        n = write(pty_dst->fd, pty_src->read_buf, pty_src->read_n);
-        if ( n < 0 )
-            return -1;
+    const uint64_t span = DELAY_MARKS / 2 * (uint64_t)DELAY_TICK_NS;
 
-        if ( n > 0 ) {
-            memmove(pty_src->read_buf, pty_src->read_buf + n, pty_src->read_n - n);
-            pty_src->read_n -= n;
-        }
+    pty->delay_ns = delay_us * UINT64_C(1000);
+    if ( pty->delay_ns == 0 )
+        return 0;
 
-        pty_dst->write_total += n;
-    }
+    pty->delay_marks = malloc(DELAY_MARKS * sizeof(struct lat_mark));
+    if ( pty->delay_marks == NULL )
+        return -1;
 
-    assert(pty_src->read_n >= 0);
-    assert(pty_src->read_n <= READ_BUF_SZ);
+    pty->delay_ticks = ( pty->delay_ns + span - 1 ) / span;
     return 0;
 }
 
-static void relay_printinfo(nulltty_t nulltty)
-{
-    fprintf(stderr, "bytes written to PTY A: %zd  PTY B: %zd\n",
-            nulltty->a.read_total, nulltty->b.read_total);
-}
-
-/*** INTERFACE FUNCTIONS ******************************************************/
+#ifdef HAVE_SPLICE
 
-nulltty_t nulltty_open(const char *link_a, const char *link_b)
+/**
+ * Check whether the kernel can splice between two PTY masters
+ *
+ * Splicing from an empty non-blocking master into a pipe, and from an
+ * empty pipe into a master, both fail with EAGAIN if the kernel supports
+ * the operation at all, and with EINVAL if it does not.  No data is moved
+ * either way.
+ *
+ * @param pty_src Descriptor of sending PTY
+ * @param pty_dst Descriptor of receiving PTY
+ * @return 1 if splicing is supported, 0 if not, -1 with errno on error
+ */
+static int splice_probe(struct nulltty_pty *pty_src,
+                        struct nulltty_pty *pty_dst)
 {
-    nulltty_t nulltty = NULL;
-
-    nulltty = calloc(1, sizeof(struct nulltty));
-    if ( nulltty == NULL )
-        goto error_nulltty;
-
-    if ( endpoint_open(&nulltty->a, link_a) < 0 )
-        goto error_link_a;
-
-    if ( endpoint_open(&nulltty->b, link_b) < 0 )
-        goto error_link_b;
-
-    return nulltty;
+    int fds[2], result = 1;
 
- error_link_b:
-    endpoint_close(&nulltty->a);
- error_link_a:
-    free(nulltty);
- error_nulltty:
-    return NULL;
-}
+    if ( pipe(fds) < 0 )
+        return -1;
 
-int nulltty_close(nulltty_t nulltty)
-{
-    int result = 0;
+    if ( splice(pty_src->fd, NULL, fds[1], NULL, 1, SPLICE_F_NONBLOCK) >= 0
+         || errno != EAGAIN )
+        result = 0;
 
-    result += endpoint_close(&nulltty->a);
-    result += endpoint_close(&nulltty->b);
-    free(nulltty);
+    if ( splice(fds[0], NULL, pty_dst->fd, NULL, 1, SPLICE_F_NONBLOCK) >= 0
+         || errno != EAGAIN )
+        result = 0;
 
+    close(fds[0]);
+    close(fds[1]);
     return result;
 }
 
-void nulltty_printinfo(nulltty_t nulltty)
+/**
+ * Prepare an endpoint to relay its input through a pipe
+ *
+ * @param pty Descriptor of sending PTY
+ * @return 0 on success, -1 with errno on error
+ */
+static int splice_open(struct nulltty_pty *pty)
 {
-    if ( nulltty )
-        nulltty->info_req = true;
-}
+    int i, flags;
 
-int nulltty_relay(nulltty_t nulltty, volatile sig_atomic_t *exit_flag)
-{
-    int nfds = MAX(nulltty->a.fd, nulltty->b.fd) + 1;
-    fd_set rfds, wfds;
-    sigset_t block_set, prev_set;
-    int result = 0;
+    if ( pipe(pty->pipe_fds) < 0 )
+        return -1;
 
-    sigemptyset(&block_set);
-    sigaddset(&block_set, SIGINT);
-    sigaddset(&block_set, SIGTERM);
-    sigaddset(&block_set, SIGHUP);
+    for ( i = 0; i < 2; i++ ) {
+        flags = fcntl(pty->pipe_fds[i], F_GETFL);
+        if ( flags < 0 || fcntl(pty->pipe_fds[i], F_SETFL, flags | O_NONBLOCK) < 0 )
+            goto error;
+    }
 
-    while ( true ) {
-        FD_ZERO(&rfds);
-        FD_ZERO(&wfds);
+    pty->pipe_n = 0;
+    pty->pipe_full = false;
+    pty->splice = true;
+    pty->stats->buf_size = pty->stats->buf_peak = 0;
+    return 0;
 
-        relay_set_fds(&nulltty->a, &nulltty->b, &rfds, &wfds);
-        relay_set_fds(&nulltty->b, &nulltty->a, &rfds, &wfds);
+ error:
+    close(pty->pipe_fds[0]);
+    close(pty->pipe_fds[1]);
+    return -1;
+}
 
-        if ( sigprocmask(SIG_BLOCK, &block_set, &prev_set) < 0 ) {
-            result = -1;
-            goto end;
+/**
+ * Splice data between two PTYs
+ *
+ * The splice() counterpart to relay_shuffle_data(), moving data from
+ * pty_src to pty_dst through pty_src's pipe without copying it into
+ * userspace.
+ *
+ * A splice into the pipe fails with EAGAIN either when the source is
+ * empty or when the pipe has run out of slots, which may happen well
+ * before pipe_n reaches the pipe's nominal capacity since each splice
+ * takes up at least one page.  We can only be sure the source is drained
+ * if the pipe was empty at the time; otherwise we hold off on reading
+ * until some of the pipe has been spliced out again.
+ *
+ * This function is half-duplex with respect to the relay.
+ *
+ * @param pty_dst Descriptor of receiving PTY
+ * @param pty_src Descriptor of sending PTY
+ * @return 0 on success, -1 with errno on error
+ */
+static int relay_splice_data(struct nulltty_pty *pty_dst,
+                             struct nulltty_pty *pty_src)
+{
+    struct nulltty_stats *stats = pty_src->stats;
+    uint64_t calls = stats->reads + stats->writes;
+    ssize_t n;
+    bool progress;
+
+    do {
+        progress = false;
+
+        if ( ( pty_src->ev.ready & EV_READ ) && ! pty_src->pipe_full ) {
+            n = splice(pty_src->fd, NULL, pty_src->pipe_fds[1], NULL,
+                       READ_BUF_MAX, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if ( n < 0 && errno != EAGAIN && errno != EINTR )
+                return -1;
+
+            STAT_INC(stats->reads);
+            if ( n < 0 && errno == EINTR ) {
+                progress = true;
+            } else if ( n > 0 ) {
+                pty_src->pipe_n += n;
+                STAT_ADD(stats->bytes_in, n);
+                latency_in(pty_src, stats->bytes_in, now_ns());
+                STAT_MAX(stats->buf_hwm, pty_src->pipe_n);
+                progress = true;
+            } else if ( pty_src->pipe_n > 0 ) {
+                STAT_INC(stats->read_eagain);
+                pty_src->pipe_full = true;
+            } else {
+                STAT_INC(stats->read_eagain);
+                pty_src->ev.ready &= ~EV_READ;
+            }
         }
 
-        if ( *exit_flag != 0 )
-            goto end_masked;
-
-        if ( nulltty->info_req ) {
-            relay_printinfo(nulltty);
-            nulltty->info_req = false;
+        if ( ( pty_dst->ev.ready & EV_WRITE ) && pty_src->pipe_n > 0 ) {
+            n = splice(pty_src->pipe_fds[0], NULL, pty_dst->fd, NULL,
+                       pty_src->pipe_n, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+            if ( n < 0 && errno != EAGAIN && errno != EINTR )
+                return -1;
+
+            STAT_INC(stats->writes);
+            if ( n < 0 && errno == EINTR ) {
+                progress = true;
+            } else if ( n > 0 ) {
+                pty_src->pipe_n -= n;
+                pty_src->pipe_full = false;
+                latency_out(pty_src, stats->bytes_out, stats->bytes_out + n);
+                STAT_ADD(stats->bytes_out, n);
+                relay_unblock(pty_src);
+                progress = true;
+            } else {
+                STAT_INC(stats->write_eagain);
+                relay_block(pty_src);
+                pty_dst->ev.ready &= ~EV_WRITE;
+            }
         }
+    } while ( progress );
 
-#ifdef HAVE_PSELECT
+    if ( stats->reads + stats->writes != calls )
+        STAT_INC(stats->wakeups);
+    STAT_SET(stats->buffered, pty_src->pipe_n);
 
-        if ( pselect(nfds, &rfds, &wfds, NULL, NULL, &prev_set) < 0 ) {
+    return 0;
+}
 
-#else /* defined HAVE_PSELECT */
+#endif /* HAVE_SPLICE */
 
-        if ( sigprocmask(SIG_SETMASK, &prev_set, NULL) < 0 ) {
-            result = -1;
-            goto end;
-        }
-        if ( select(nfds, &rfds, &wfds, NULL, NULL) < 0 ) {
+#ifdef HAVE_IO_URING
 
-#endif /* ! defined HAVE_PSELECT */
+/**
+ * Submission queue depth for the io_uring relay
+ *
+ * At most one read and one write are in flight per direction.
+ */
+#define URING_ENTRIES 8
 
-            switch ( errno ) {
-            case EINTR:
-                sigprocmask(SIG_SETMASK, &prev_set, NULL);
-                continue;
+/** Set in a request's user_data if it is a write rather than a read */
+#define URING_OP_WRITE 0x1
 
-            default:
-                result = -1;
-                goto end_masked;
-            }
-        }
+/**
+ * Set up io_uring for a freshly opened PTY pair
+ *
+ * Registers both endpoints' ring buffers with the kernel, as fixed buffers
+ * 0 (A to B) and 1 (B to A).  Since registered buffers can't move, the
+ * rings are pinned at their initial size.
+ *
+ * @param nulltty PTY pair to set up
+ * @return 0 on success, -1 with errno on error
+ */
+static int uring_open(nulltty_t nulltty)
+{
+    struct iovec iov[2];
 
-        if ( sigprocmask(SIG_SETMASK, &prev_set, NULL) < 0 ) {
-            result = -1;
-            goto end;
-        }
+    if ( uring_init(&nulltty->uring, URING_ENTRIES) < 0 )
+        return -1;
 
-        if ( relay_shuffle_data(&nulltty->a, &nulltty->b, &rfds, &wfds) < 0
-             || relay_shuffle_data(&nulltty->b, &nulltty->a, &rfds, &wfds) < 0 ) {
-            result = -1;
-            goto end;
-        }
+    iov[0].iov_base = nulltty->a.ring.buf;
+    iov[0].iov_len  = ring_size(&nulltty->a.ring);
+    iov[1].iov_base = nulltty->b.ring.buf;
+    iov[1].iov_len  = ring_size(&nulltty->b.ring);
 
-#ifdef DEBUG
-        printf("%lu\t%lu\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\n",
-               nselects, nsyscalls,
-               nulltty->a.read_n, nulltty->a.read_total, nulltty->a.write_total,
-               nulltty->b.read_n, nulltty->b.read_total, nulltty->b.write_total);
-#endif
+    if ( uring_register_buffers(&nulltty->uring, iov, 2) < 0 ) {
+        uring_free(&nulltty->uring);
+        return -1;
     }
 
- end_masked:
-    sigprocmask(SIG_SETMASK, &prev_set, NULL);
- end:
+    nulltty->a.ring_max = nulltty->a.ring_min;
+    nulltty->b.ring_max = nulltty->b.ring_min;
+    return 0;
+}
 
-#ifdef DEBUG
-    printf("\n\n"
-           "========================================\n"
-           "Totals\n"
+/**
+ * Queue io_uring requests to move data from one PTY to the other
+ *
+ * Keeps a read into the free part of pty_src's ring and a write out of its
+ * buffered part in flight whenever there is room or data for them.  The
+ * two requests always cover disjoint parts of the ring, but each only
+ * covers the contiguous span up to the end of the buffer.
+ *
+ * A read can't usefully be linked to the write that follows it, since the
+ * write's length isn't known until the read completes; instead the write
+ * is queued on the next pass, in the same batch as whatever else is due.
+ *
+ * This function is half-duplex with respect to the relay.
+ *
+ * @param uring io_uring instance
+ * @param pty_dst Descriptor of receiving PTY
+ * @param pty_src Descriptor of sending PTY
+ * @param buf_index Index of pty_src's registered ring buffer
+ */
+static void uring_queue(struct uring *uring, struct nulltty_pty *pty_dst,
+                        struct nulltty_pty *pty_src, unsigned buf_index)
+{
+    struct ring *ring = &pty_src->ring;
+    struct io_uring_sqe *sqe;
+    size_t offset, len;
+
+    if ( ! pty_src->uring_reading && ring_space(ring) > 0
+         && ( sqe = uring_get_sqe(uring) ) != NULL ) {
+        offset = ring->head & ring->mask;
+        len = ring_size(ring) - offset;
+        if ( len > ring_space(ring) )
+            len = ring_space(ring);
+
+        sqe->opcode    = IORING_OP_READ_FIXED;
+        sqe->fd        = pty_src->fd;
+        sqe->addr      = (uintptr_t)( ring->buf + offset );
+        sqe->len       = len;
+        sqe->buf_index = buf_index;
+        sqe->user_data = (uintptr_t)pty_src;
+        pty_src->uring_reading = true;
+    }
+
+    if ( ! pty_src->uring_writing && ring_len(ring) > 0
+         && ( sqe = uring_get_sqe(uring) ) != NULL ) {
+        offset = ring->tail & ring->mask;
+        len = ring_size(ring) - offset;
+        if ( len > ring_len(ring) )
+            len = ring_len(ring);
+
+        sqe->opcode    = IORING_OP_WRITE_FIXED;
+        sqe->fd        = pty_dst->fd;
+        sqe->addr      = (uintptr_t)( ring->buf + offset );
+        sqe->len       = len;
+        sqe->buf_index = buf_index;
+        sqe->user_data = (uintptr_t)pty_src | URING_OP_WRITE;
+        pty_src->uring_writing = true;
+    }
+}
+
+/**
+ * Account for a completed io_uring request
+ *
+ * @param nulltty PTY pair the request belongs to
+ * @param cqe Completion queue entry
+ * @return 0 on success, -1 with errno on error
+ */
+static int uring_complete(nulltty_t nulltty, const struct io_uring_cqe *cqe)
+{
+    struct nulltty_pty *pty_src;
+    bool is_write = cqe->user_data & URING_OP_WRITE;
+    uint64_t ts;
+
+    pty_src = (struct nulltty_pty *)(uintptr_t)( cqe->user_data & ~URING_OP_WRITE );
+
+    if ( is_write )
+        pty_src->uring_writing = false;
+    else
+        pty_src->uring_reading = false;
+
+    if ( is_write )
+        STAT_INC(pty_src->stats->writes);
+    else
+        STAT_INC(pty_src->stats->reads);
+
+    if ( cqe->res < 0 ) {
+        if ( cqe->res == -EAGAIN && is_write ) {
+            STAT_INC(pty_src->stats->write_eagain);
+            relay_block(pty_src);
+        }
+        else if ( cqe->res == -EAGAIN )
+            STAT_INC(pty_src->stats->read_eagain);
+
+        if ( cqe->res == -EINTR || cqe->res == -EAGAIN )
+            return 0;
+
+        errno = -cqe->res;
+        return -1;
+    }
+
+    if ( is_write ) {
+        pty_src->ring.tail += cqe->res;
+        latency_out(pty_src, pty_src->stats->bytes_out,
+                    pty_src->stats->bytes_out + cqe->res);
+        STAT_ADD(pty_src->stats->bytes_out, cqe->res);
+        relay_unblock(pty_src);
+    } else {
+        pty_src->ring.head += cqe->res;
+        ts = now_ns();
+        STAT_ADD(pty_src->stats->bytes_in, cqe->res);
+        latency_in(pty_src, pty_src->stats->bytes_in, ts);
+        if ( pty_src->capture != NULL )
+            relay_capture(pty_src, cqe->res, ts);
+        STAT_MAX(pty_src->stats->buf_hwm, ring_len(&pty_src->ring));
+    }
+    STAT_SET(pty_src->stats->buffered, ring_len(&pty_src->ring));
+
+    return 0;
+}
+
+/**
+ * Put a PTY master into blocking or non-blocking mode
+ *
+ * io_uring arms its own poll handlers for blocking descriptors, whereas
+ * on some kernels a non-blocking one would just complete with -EAGAIN.
+ *
+ * @param fd Descriptor to modify
+ * @param nonblock Whether O_NONBLOCK should be set
+ * @return 0 on success, -1 with errno on error
+ */
+static int set_nonblock(int fd, bool nonblock)
+{
+    int flags = fcntl(fd, F_GETFL);
+
+    if ( flags < 0 )
+        return -1;
+
+    flags = nonblock ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    return fcntl(fd, F_SETFL, flags);
+}
+
+#endif /* HAVE_IO_URING */
+
+/**
+ * Select the relay mode for a freshly opened PTY pair
+ *
+ * @param nulltty PTY pair whose endpoints are to be set up
+ * @param mode Requested relay mode
+ * @return 0 on success, -1 with errno on error
+ */
+static int relay_set_mode(nulltty_t nulltty, enum nulltty_mode mode)
+{
+    int supported = 0;
+
+    /* The io_uring relay sleeps in the kernel, not in a loop that can
+     * spin */
+    if ( nulltty->busy_poll && mode == NULLTTY_MODE_IO_URING ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    /* Socket endpoints come and go, and coalescing, pacing and delay
+     * lines hold data back for a while, none of which any but the
+     * buffered relay copes with */
+    if ( nulltty->a.sock != NULL || nulltty->b.sock != NULL
+         || nulltty->a.coalesce_ns > 0 || nulltty->b.coalesce_ns > 0
+         || nulltty->a.pace || nulltty->b.pace
+         || nulltty->a.delay_ns > 0 || nulltty->b.delay_ns > 0 ) {
+        if ( mode == NULLTTY_MODE_AUTO )
+            mode = NULLTTY_MODE_BUFFERED;
+        if ( mode != NULLTTY_MODE_BUFFERED ) {
+            errno = ENOTSUP;
+            return -1;
+        }
+    }
+
+    switch ( mode ) {
+    case NULLTTY_MODE_BUFFERED:
+        break;
+
+    case NULLTTY_MODE_IO_URING:
+#ifdef HAVE_IO_URING
+        if ( uring_open(nulltty) < 0 )
+            return -1;
+        break;
+#else
+        errno = ENOTSUP;
+        return -1;
+#endif
+
+    case NULLTTY_MODE_AUTO:
+    case NULLTTY_MODE_SPLICE:
+#ifdef HAVE_SPLICE
+        supported = splice_probe(&nulltty->a, &nulltty->b);
+        if ( supported > 0 )
+            supported = splice_probe(&nulltty->b, &nulltty->a);
+        if ( supported < 0 )
+            return -1;
+#endif
+
+        if ( ! supported ) {
+            if ( mode == NULLTTY_MODE_AUTO ) {
+                mode = NULLTTY_MODE_BUFFERED;
+                break;
+            }
+
+            errno = ENOTSUP;
+            return -1;
+        }
+
+#ifdef HAVE_SPLICE
+        if ( splice_open(&nulltty->a) < 0 || splice_open(&nulltty->b) < 0 )
+            return -1;
+#endif
+
+        mode = NULLTTY_MODE_SPLICE;
+        break;
+    }
+
+    nulltty->mode = mode;
+    return 0;
+}
+
+/**
+ * Declare the events this iteration of the relay is waiting on
+ *
+ * Sets the interest of pty_src's and pty_dst's event handles, depending on
+ * the current state of pty_src's ring buffer, such that the event backend
+ * can wake us once pty_dst can receive more data from pty_src.
+ *
+ * This function is half-duplex with respect to the relay.
+ *
+ * @param pty_dst Descriptor of receiving PTY
+ * @param pty_src Descriptor of sending PTY
+ */
+static void relay_set_want(struct nulltty_pty *pty_dst,
+                           struct nulltty_pty *pty_src)
+{
+    if ( pty_src->splice ) {
+        if ( ! pty_src->pipe_full )
+            pty_src->ev.want |= EV_READ;
+        else
+            pty_src->ev.want &= ~EV_READ;
+
+        if ( pty_src->pipe_n > 0 )
+            pty_dst->ev.want |= EV_WRITE;
+        else
+            pty_dst->ev.want &= ~EV_WRITE;
+
+        return;
+    }
+
+    if ( ring_space(&pty_src->ring) > 0 )
+        pty_src->ev.want |= EV_READ;
+    else
+        pty_src->ev.want &= ~EV_READ;
+
+    if ( ring_len(&pty_src->ring) > 0 )
+        pty_dst->ev.want |= EV_WRITE;
+    else
+        pty_dst->ev.want &= ~EV_WRITE;
+}
+
+/**
+ * Grow a PTY's ring buffer if reads keep filling it
+ *
+ * Called after each successful read.  A read which fills a ring that was
+ * empty beforehand means the sender has more data waiting than we can
+ * take in one go; after RING_GROW_STREAK of those in a row we double the
+ * ring's size, up to the endpoint's ceiling.  A delay line's ring is
+ * never empty while data flows, and once full holds the sender up for
+ * the whole delay, so it is doubled by any one read which fills it.
+ * Failure to grow is not an error, we just carry on at the current size.
+ *
+ * @param pty Descriptor of the PTY that was read from
+ * @param was_empty Whether the ring was empty before the read
+ */
+static void relay_grow_ring(struct nulltty_pty *pty, bool was_empty)
+{
+    size_t size = ring_size(&pty->ring);
+
+    if ( ! ( was_empty || pty->delay_ns > 0 ) || ring_space(&pty->ring) > 0 ) {
+        pty->fill_streak = 0;
+        return;
+    }
+
+    if ( ( ++pty->fill_streak < RING_GROW_STREAK && pty->delay_ns == 0 )
+         || size >= pty->ring_max )
+        return;
+
+    pty->fill_streak = 0;
+    if ( ring_resize(&pty->ring, 2 * size) < 0 )
+        return;
+
+    STAT_SET(pty->stats->buf_size, ring_size(&pty->ring));
+    STAT_MAX(pty->stats->buf_peak, ring_size(&pty->ring));
+}
+
+/**
+ * Shrink a PTY's ring buffer back to its initial size
+ *
+ * Called when the relay has been idle for RING_IDLE_SEC.  Only empty rings
+ * are shrunk, so nothing has to be copied.
+ *
+ * @param pty Descriptor of the PTY whose ring is to be shrunk
+ * @return Whether the ring remains larger than its initial size
+ */
+static bool relay_shrink_ring(struct nulltty_pty *pty)
+{
+    if ( ring_size(&pty->ring) > pty->ring_min && ring_len(&pty->ring) == 0 )
+        ring_resize(&pty->ring, pty->ring_min);
+    STAT_SET(pty->stats->buf_size, ring_size(&pty->ring));
+
+    pty->fill_streak = 0;
+    return ring_size(&pty->ring) > pty->ring_min;
+}
+
+/**
+ * Note that a socket endpoint's peer has gone
+ *
+ * The connection is dropped by loop_service(), once done with the pair.
+ *
+ * @param pty Descriptor of the socket endpoint
+ */
+static void relay_hangup(struct nulltty_pty *pty)
+{
+    pty->hangup = true;
+    pty->ev.ready = 0;
+}
+
+/**
+ * Cork or uncork a socket endpoint which asks for it
+ *
+ * Failure isn't an error: the data just goes out in smaller segments.
+ *
+ * @param pty Descriptor of the endpoint
+ * @param cork Whether to cork
+ */
+static void relay_cork(struct nulltty_pty *pty, bool cork)
+{
+    if ( pty->sock == NULL || ! ( pty->sock->flags & SOCK_CORK )
+         || pty->corked == cork || pty->fd < 0 )
+        return;
+
+    if ( sock_cork(pty->fd, cork) == 0 )
+        pty->corked = cork;
+}
+
+/**
+ * Decide whether to hold back a PTY's buffered data rather than write it
+ *
+ * Data is held while there is room to read more, less than the size
+ * threshold has built up, and the oldest of it is still within the
+ * latency budget.
+ *
+ * @param pty Descriptor of the sending PTY, with data in its ring
+ * @return Whether to hold the data back for now
+ */
+static bool relay_hold(struct nulltty_pty *pty)
+{
+    bool was_holding = pty->holding;
+
+    pty->holding = false;
+    pty->pacing = false;
+    pty->delaying = false;
+    if ( pty->coalesce_ns == 0 || ring_space(&pty->ring) == 0
+         || ( pty->coalesce_bytes > 0
+              && ring_len(&pty->ring) >= pty->coalesce_bytes ) )
+        return false;
+
+    if ( now_ns() - pty->held_since >= pty->coalesce_ns ) {
+        if ( was_holding )
+            STAT_INC(pty->stats->coalesce_expired);
+        return false;
+    }
+
+    pty->holding = true;
+    pty->hold_until = pty->held_since + pty->coalesce_ns;
+    return true;
+}
+
+/**
+ * Rate in bits per second of a termios speed
+ *
+ * @return Rate, or 0 for B0 or a speed we don't know
+ */
+static unsigned long speed_bps(speed_t speed)
+{
+    static const struct {
+        speed_t speed;
+        unsigned long bps;
+    } speeds[] = {
+        { B50, 50 }, { B75, 75 }, { B110, 110 }, { B134, 134 },
+        { B150, 150 }, { B200, 200 }, { B300, 300 }, { B600, 600 },
+        { B1200, 1200 }, { B1800, 1800 }, { B2400, 2400 },
+        { B4800, 4800 }, { B9600, 9600 }, { B19200, 19200 },
+        { B38400, 38400 },
+#ifdef B57600
+        { B57600, 57600 },
+#endif
+#ifdef B115200
+        { B115200, 115200 },
+#endif
+#ifdef B230400
+        { B230400, 230400 },
+#endif
+#ifdef B460800
+        { B460800, 460800 },
+#endif
+#ifdef B500000
+        { B500000, 500000 },
+#endif
+#ifdef B576000
+        { B576000, 576000 },
+#endif
+#ifdef B921600
+        { B921600, 921600 },
+#endif
+#ifdef B1000000
+        { B1000000, 1000000 },
+#endif
+#ifdef B1152000
+        { B1152000, 1152000 },
+#endif
+#ifdef B1500000
+        { B1500000, 1500000 },
+#endif
+#ifdef B2000000
+        { B2000000, 2000000 },
+#endif
+#ifdef B2500000
+        { B2500000, 2500000 },
+#endif
+#ifdef B3000000
+        { B3000000, 3000000 },
+#endif
+#ifdef B3500000
+        { B3500000, 3500000 },
+#endif
+#ifdef B4000000
+        { B4000000, 4000000 },
+#endif
+    };
+    size_t i;
+
+    for ( i = 0; i < sizeof(speeds) / sizeof(speeds[0]); i++ )
+        if ( speeds[i].speed == speed )
+            return speeds[i].bps;
+
+    return 0;
+}
+
+/**
+ * Pick up the line settings a paced direction's data is sent with
+ *
+ * Those of the sending PTY's slave, as set by the application with
+ * cfsetospeed() and friends, or the receiving PTY's if the data comes
+ * from a socket.  A character takes a start bit, its data bits, any
+ * parity bit and its stop bits.
+ */
+static void relay_pace_read(struct nulltty_pty *pty_dst,
+                            struct nulltty_pty *pty_src)
+{
+    struct nulltty_pty *line = pty_src->sock == NULL ? pty_src : pty_dst;
+    struct termios t;
+    unsigned bits;
+
+    pty_src->pace_bps = 0;
+    if ( line->sock != NULL || tcgetattr(line->slave_fd, &t) < 0 )
+        return;
+
+    switch ( t.c_cflag & CSIZE ) {
+    case CS5:
+        bits = 5;
+        break;
+    case CS6:
+        bits = 6;
+        break;
+    case CS7:
+        bits = 7;
+        break;
+    default:
+        bits = 8;
+        break;
+    }
+    bits += 1 + ( t.c_cflag & PARENB ? 1 : 0 ) + ( t.c_cflag & CSTOPB ? 2 : 1 );
+
+    pty_src->pace_bps = speed_bps(cfgetospeed(&t));
+    pty_src->pace_bits = bits;
+}
+
+/**
+ * Work out how much of a PTY's buffered data pacing lets out now
+ *
+ * A token bucket in the form of the time at which the line will have
+ * sent everything let out so far, which may run up to a burst ahead of
+ * the clock.  A line which ran dry restarts when data next arrives; one
+ * which had data waiting all along makes up for the timer firing late,
+ * by at most a burst.  When nothing may be written yet, the data is held
+ * until there is a burst's worth of room, or room for all of it if that
+ * is less.
+ *
+ * @param pty_dst Descriptor of the receiving PTY
+ * @param pty_src Descriptor of the sending PTY, with data in its ring
+ * @return Bytes which may be written, SIZE_MAX if the direction is not
+ * paced, or 0 to hold the data back for now
+ */
+static size_t relay_pace(struct nulltty_pty *pty_dst,
+                         struct nulltty_pty *pty_src)
+{
+    uint64_t now, burst, room, char_ns, want;
+
+    pty_src->pacing = false;
+    if ( ! pty_src->pace )
+        return SIZE_MAX;
+
+    now = now_ns();
+    if ( now - pty_src->pace_read_at >= PACE_REREAD_NS
+         || pty_src->pace_read_at == 0 ) {
+        relay_pace_read(pty_dst, pty_src);
+        pty_src->pace_read_at = now;
+    }
+    if ( pty_src->pace_bps == 0 )
+        return SIZE_MAX;
+
+    char_ns = ( pty_src->pace_bits * UINT64_C(1000000000)
+                + pty_src->pace_bps - 1 ) / pty_src->pace_bps;
+    burst = char_ns > PACE_BURST_NS ? char_ns : PACE_BURST_NS;
+
+    if ( pty_src->pace_free_at < pty_src->held_since ) {
+        pty_src->pace_free_at = pty_src->held_since;
+        pty_src->pace_rem = 0;
+    }
+    if ( pty_src->pace_free_at + burst < now ) {
+        pty_src->pace_free_at = now - burst;
+        pty_src->pace_rem = 0;
+    }
+    room = ( now + burst - pty_src->pace_free_at ) * pty_src->pace_bps
+        / ( pty_src->pace_bits * UINT64_C(1000000000) );
+    if ( room > 0 )
+        return room;
+
+    want = burst / char_ns;
+    if ( want > ring_len(&pty_src->ring) )
+        want = ring_len(&pty_src->ring);
+    pty_src->pacing = true;
+    pty_src->pace_until = pty_src->pace_free_at + want * char_ns - burst;
+    return 0;
+}
+
+/**
+ * Account for the line time taken by data let out by pacing
+ *
+ * @param pty Descriptor of the sending PTY
+ * @param n Bytes written
+ */
+static void relay_paced(struct nulltty_pty *pty, size_t n)
+{
+    uint64_t bits;
+
+    if ( ! pty->pace || pty->pace_bps == 0 )
+        return;
+
+    bits = (uint64_t)n * pty->pace_bits * 1000000000 + pty->pace_rem;
+    pty->pace_free_at += bits / pty->pace_bps;
+    pty->pace_rem = bits % pty->pace_bps;
+}
+
+/**
+ * Remember when a chunk of data entered a delay line
+ *
+ * Chunks read within the same window of delay_ticks are kept as one, due
+ * a delay after the last of them, so that no data is let out early and a
+ * line never has more than about half of DELAY_MARKS in flight.  Should
+ * they run out all the same, while the receiving PTY refuses data, new
+ * chunks join the most recent, which is held back that much longer.
+ *
+ * @param pty Descriptor of the sending PTY
+ * @param end Byte count read from pty so far, including the chunk
+ * @param ts CLOCK_MONOTONIC ns at which the chunk was read
+ */
+static void delay_in(struct nulltty_pty *pty, uint64_t end, uint64_t ts)
+{
+    struct lat_mark *mark;
+    uint64_t window = pty->delay_ticks * DELAY_TICK_NS;
+
+    mark = &pty->delay_marks[( pty->delay_head - 1 ) % DELAY_MARKS];
+    if ( pty->delay_head == pty->delay_tail
+         || ( pty->delay_head - pty->delay_tail < DELAY_MARKS
+              && mark->ts / window != ts / window ) )
+        mark = &pty->delay_marks[pty->delay_head++ % DELAY_MARKS];
+
+    mark->end = end;
+    mark->ts = ts;
+}
+
+/**
+ * Work out how much of a PTY's buffered data its delay line lets out now
+ *
+ * @param pty Descriptor of the sending PTY, with data in its ring
+ * @return Bytes which may be written, SIZE_MAX if the direction has no
+ * delay line, or 0 to hold the data back until delay_until
+ */
+static size_t relay_delay(struct nulltty_pty *pty)
+{
+    struct lat_mark *mark;
+    uint64_t now, out;
+
+    pty->delaying = false;
+    if ( pty->delay_ns == 0 )
+        return SIZE_MAX;
+
+    if ( pty->delay_tail != pty->delay_head ) {
+        now = now_ns();
+        do {
+            mark = &pty->delay_marks[pty->delay_tail % DELAY_MARKS];
+            if ( now - mark->ts < pty->delay_ns )
+                break;
+
+            pty->delay_released = mark->end;
+            pty->delay_tail++;
+        } while ( pty->delay_tail != pty->delay_head );
+    }
+
+    out = pty->stats->bytes_out + pty->discarded;
+    if ( pty->delay_released > out )
+        return pty->delay_released - out;
+
+    mark = &pty->delay_marks[pty->delay_tail % DELAY_MARKS];
+    pty->delaying = true;
+    pty->delay_until = mark->ts + pty->delay_ns;
+    return 0;
+}
+
+/**
+ * Shuffle data between two PTYs
+ *
+ * Performs non-blocking reads into, and writes out of, pty_src's ring buffer in
+ * order to shuffle data from pty_src to pty_dst, for as long as the
+ * readiness last reported by the event backend allows.  Readiness is
+ * cleared once a read or write fails with EAGAIN, so that we only go back
+ * to the backend when there is genuinely nothing left to do.  A socket
+ * endpoint reaching end of stream, or failing, is marked as hung up
+ * rather than failing the relay.  With coalescing, writes are put off for
+ * as long as relay_hold() says so, and with a delay line or pacing,
+ * limited to what relay_delay() and then relay_pace() let out.
+ *
+ * This function is half-duplex with respect to the relay.
+ *
+ * @param pty_dst Descriptor of receiving PTY
+ * @param pty_src Descriptor of sending PTY
+ * @return 0 on success, -1 with errno on error
+ */
+static int relay_shuffle_data(struct nulltty_pty *pty_dst,
+                              struct nulltty_pty *pty_src)
+{
+    struct nulltty_stats *stats = pty_src->stats;
+    uint64_t calls = stats->reads + stats->writes, ts;
+    size_t max, pace;
+    ssize_t n;
+    bool progress, was_empty;
+
+#ifdef HAVE_SPLICE
+    if ( pty_src->splice )
+        return relay_splice_data(pty_dst, pty_src);
+#endif
+
+    do {
+        progress = false;
+
+        if ( ( pty_src->ev.ready & EV_READ ) && ring_space(&pty_src->ring) > 0 ) {
+            was_empty = ring_len(&pty_src->ring) == 0;
+            n = ring_readv(&pty_src->ring, pty_src->fd);
+            if ( n < 0 && errno != EAGAIN && errno != EINTR
+                 && pty_src->sock == NULL )
+                return -1;
+
+            STAT_INC(stats->reads);
+            if ( n < 0 && errno == EINTR ) {
+                progress = true;
+            } else if ( n > 0 ) {
+                ts = now_ns();
+                STAT_ADD(stats->bytes_in, n);
+                latency_in(pty_src, stats->bytes_in, ts);
+                if ( pty_src->delay_ns > 0 )
+                    delay_in(pty_src, stats->bytes_in, ts);
+                if ( pty_src->capture != NULL )
+                    relay_capture(pty_src, n, ts);
+                STAT_MAX(stats->buf_hwm, ring_len(&pty_src->ring));
+                relay_grow_ring(pty_src, was_empty);
+                if ( was_empty )
+                    pty_src->held_since = ts;
+                pty_src->reads_held++;
+                progress = true;
+            } else if ( ( n < 0 && errno != EAGAIN )
+                        || ( n == 0 && pty_src->sock != NULL ) ) {
+                relay_hangup(pty_src);
+            } else {
+                STAT_INC(stats->read_eagain);
+                pty_src->ev.ready &= ~EV_READ;
+            }
+        }
+
+        if ( ( pty_dst->ev.ready & EV_WRITE ) && ring_len(&pty_src->ring) > 0
+             && ! relay_hold(pty_src)
+             && ( max = relay_delay(pty_src) ) > 0
+             && ( pace = relay_pace(pty_dst, pty_src) ) > 0 ) {
+            if ( pace < max )
+                max = pace;
+            relay_cork(pty_dst, true);
+            if ( pty_dst->sock != NULL )
+                n = ring_sendmsg_max(&pty_src->ring, pty_dst->fd, max,
+                                     MSG_NOSIGNAL);
+            else
+                n = ring_writev_max(&pty_src->ring, pty_dst->fd, max);
+            if ( n < 0 && errno != EAGAIN && errno != EINTR
+                 && pty_dst->sock == NULL )
+                return -1;
+
+            STAT_INC(stats->writes);
+            if ( n < 0 && errno == EINTR ) {
+                progress = true;
+            } else if ( n > 0 ) {
+                latency_out(pty_src, stats->bytes_out, stats->bytes_out + n);
+                STAT_ADD(stats->bytes_out, n);
+                relay_unblock(pty_src);
+                relay_paced(pty_src, n);
+                if ( pty_src->coalesce_ns > 0 && pty_src->reads_held > 1 )
+                    STAT_ADD(stats->coalesced, pty_src->reads_held - 1);
+                pty_src->reads_held = 0;
+                progress = true;
+            } else if ( n < 0 && errno != EAGAIN ) {
+                relay_hangup(pty_dst);
+            } else {
+                STAT_INC(stats->write_eagain);
+                relay_block(pty_src);
+                pty_dst->ev.ready &= ~EV_WRITE;
+            }
+        }
+    } while ( progress );
+
+    /* Only data we could have written counts as held */
+    if ( ! ( pty_dst->ev.ready & EV_WRITE ) ) {
+        pty_src->holding = false;
+        pty_src->pacing = false;
+        pty_src->delaying = false;
+    }
+
+    if ( stats->reads + stats->writes != calls )
+        STAT_INC(stats->wakeups);
+    STAT_SET(stats->buffered, ring_len(&pty_src->ring));
+
+    assert(ring_len(&pty_src->ring) <= ring_size(&pty_src->ring));
+    return 0;
+}
+
+/**
+ * Format a duration in nanoseconds with a suitable unit
+ */
+static const char *format_ns(uint64_t ns, char *buf, size_t len)
+{
+    if ( ns < 1000 )
+        snprintf(buf, len, "%lluns", (unsigned long long)ns);
+    else if ( ns < 1000000 )
+        snprintf(buf, len, "%.1fus", ns / 1e3);
+    else if ( ns < 1000000000 )
+        snprintf(buf, len, "%.1fms", ns / 1e6);
+    else
+        snprintf(buf, len, "%.2fs", ns / 1e9);
+
+    return buf;
+}
+
+/**
+ * Print one direction's queueing latency histogram
+ *
+ * @param dir Name of the direction
+ * @param hist Histogram of bytes by residency time
+ */
+static void relay_print_latency(const char *dir, const struct hist *hist)
+{
+    char b1[16], b2[16], b3[16], b4[16], b5[16];
+    size_t i;
+
+    if ( hist->total == 0 )
+        return;
+
+    fprintf(stderr, "queueing latency %s, %llu bytes: p50 %s  p90 %s  p99 %s"
+            "  p99.9 %s  max %s\n",
+            dir, (unsigned long long)hist->total,
+            format_ns(hist_quantile(hist, 0.5), b1, sizeof(b1)),
+            format_ns(hist_quantile(hist, 0.9), b2, sizeof(b2)),
+            format_ns(hist_quantile(hist, 0.99), b3, sizeof(b3)),
+            format_ns(hist_quantile(hist, 0.999), b4, sizeof(b4)),
+            format_ns(hist->max, b5, sizeof(b5)));
+
+    for ( i = 0; i < HIST_BUCKETS; i++ ) {
+        if ( hist->count[i] > 0 )
+            fprintf(stderr, "  <= %-8s %llu\n",
+                    format_ns(hist_upper(i), b1, sizeof(b1)),
+                    (unsigned long long)hist->count[i]);
+    }
+}
+
+static void relay_print_pace(const char *dir, const struct nulltty_pty *pty)
+{
+    if ( pty->pace_bps > 0 )
+        fprintf(stderr, "paced %s: %lu bps, %u bits per character\n",
+                dir, pty->pace_bps, pty->pace_bits);
+    else
+        fprintf(stderr, "paced %s: not yet, or line speed unknown\n", dir);
+}
+
+static void relay_printinfo(nulltty_t nulltty)
+{
+    char buf[16];
+
+    fprintf(stderr, "bytes written to PTY A: %llu  PTY B: %llu\n",
+            (unsigned long long)nulltty->a.stats->bytes_in,
+            (unsigned long long)nulltty->b.stats->bytes_in);
+    if ( nulltty->mode == NULLTTY_MODE_IO_URING )
+        fprintf(stderr, "relaying with io_uring\n");
+    else if ( nulltty->a.splice )
+        fprintf(stderr, "spliced bytes in pipe A->B: %zu  B->A: %zu\n",
+                nulltty->a.pipe_n, nulltty->b.pipe_n);
+    else
+        fprintf(stderr, "buffer A->B: %zu (peak %zu)  B->A: %zu (peak %zu)\n",
+                ring_size(&nulltty->a.ring), nulltty->a.stats->buf_peak,
+                ring_size(&nulltty->b.ring), nulltty->b.stats->buf_peak);
+
+    if ( nulltty->a.coalesce_ns > 0 || nulltty->b.coalesce_ns > 0 )
+        fprintf(stderr, "writes saved by coalescing A->B: %llu  B->A: %llu\n",
+                (unsigned long long)nulltty->a.stats->coalesced,
+                (unsigned long long)nulltty->b.stats->coalesced);
+
+    if ( nulltty->a.pace )
+        relay_print_pace("A->B", &nulltty->a);
+    if ( nulltty->b.pace )
+        relay_print_pace("B->A", &nulltty->b);
+
+    if ( nulltty->a.delay_ns > 0 )
+        fprintf(stderr, "delay line A->B of %s, in flight: %zu\n",
+                format_ns(nulltty->a.delay_ns, buf, sizeof(buf)),
+                ring_len(&nulltty->a.ring));
+    if ( nulltty->b.delay_ns > 0 )
+        fprintf(stderr, "delay line B->A of %s, in flight: %zu\n",
+                format_ns(nulltty->b.delay_ns, buf, sizeof(buf)),
+                ring_len(&nulltty->b.ring));
+
+    relay_print_latency("A->B", &nulltty->a.latency);
+    relay_print_latency("B->A", &nulltty->b.latency);
+}
+
+#ifdef DEBUG
+static void relay_print_totals(const nulltty_t *pairs, size_t n)
+{
+    const struct nulltty_stats *stats;
+    unsigned long nreads = 0, nwrites = 0, nsplices = 0;
+    size_t i;
+
+    for ( i = 0; i < 2 * n; i++ ) {
+        stats = i % 2 ? pairs[i/2]->b.stats : pairs[i/2]->a.stats;
+        if ( pairs[i/2]->mode == NULLTTY_MODE_SPLICE ) {
+            nsplices += stats->reads + stats->writes;
+        } else {
+            nreads += stats->reads;
+            nwrites += stats->writes;
+        }
+    }
+
+    printf("\n\n"
+           "========================================\n"
+           "Totals\n"
            "========================================\n"
-           "select()s:                  %lu\n"
+           "Event waits:                %lu\n"
            "read()s:                    %lu\n"
            "write()s:                   %lu\n"
-           "All tracked syscalls:       %lu\n"
-           "Bytes read from PTY A:      %zu\n"
-           "Bytes written to PTY A:     %zu\n"
-           "Bytes read from PTY B:      %zu\n"
-           "Bytes written to PTY B:     %zu\n",
-           nselects, nreads, nwrites, nsyscalls,
-           nulltty->a.read_total, nulltty->a.write_total,
-           nulltty->b.read_total, nulltty->b.write_total);
+           "splice()s:                  %lu\n"
+           "All tracked syscalls:       %lu\n",
+           nselects, nreads, nwrites, nsplices, nsyscalls);
+
+    for ( i = 0; i < n; i++ ) {
+        if ( n > 1 )
+            printf("%s <-> %s\n", pairs[i]->a.link, pairs[i]->b.link);
+        printf("Bytes read from PTY A:      %llu\n"
+               "Bytes written to PTY A:     %llu\n"
+               "Bytes read from PTY B:      %llu\n"
+               "Bytes written to PTY B:     %llu\n",
+               (unsigned long long)pairs[i]->a.stats->bytes_in,
+               (unsigned long long)pairs[i]->b.stats->bytes_out,
+               (unsigned long long)pairs[i]->b.stats->bytes_in,
+               (unsigned long long)pairs[i]->a.stats->bytes_out);
+    }
+}
+#endif
+
+/**
+ * Drop a socket endpoint's connection once its peer has gone
+ *
+ * A listening endpoint goes back to waiting for a client, holding on to
+ * whatever data is buffered for it meanwhile.  Without its peer, a
+ * connecting endpoint has nothing left to relay to.
+ *
+ * @param nulltty PTY pair the endpoint belongs to
+ * @param pty Descriptor of the socket endpoint
+ * @return 0 on success, -1 with errno on error (ECONNRESET for a connecting
+ * endpoint)
+ */
+static int relay_disconnect(nulltty_t nulltty, struct nulltty_pty *pty)
+{
+    pty->hangup = false;
+    if ( pty->listen_fd < 0 ) {
+        errno = ECONNRESET;
+        return -1;
+    }
+
+    ev_del(nulltty->loop->ev, &pty->ev);
+    close(pty->fd);
+    pty->fd = -1;
+    pty->ev.ready = 0;
+    pty->corked = false;
+    return 0;
+}
+
+/**
+ * Take a client on a listening socket endpoint
+ *
+ * Only one client is relayed at a time; any others are hung up on
+ * straight away.
+ *
+ * @param handle Listening socket's handle
+ * @return 0 on success, -1 with errno on error
+ */
+static int relay_accept(struct ev_handle *handle)
+{
+    nulltty_t nulltty = handle->data;
+    struct nulltty_pty *pty;
+    int fd;
+
+    pty = handle == &nulltty->a.listen_ev ? &nulltty->a : &nulltty->b;
+
+    while ( true ) {
+        fd = sock_accept(pty->sock, handle->fd);
+        if ( fd < 0 ) {
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+            if ( errno != EAGAIN && errno != EWOULDBLOCK )
+                perror("Unable to accept connection");
+            handle->ready &= ~EV_READ;
+            return 0;
+        }
+
+        if ( pty->fd >= 0 ) {
+            close(fd);
+            continue;
+        }
+
+        if ( ev_add(nulltty->loop->ev, &pty->ev, fd, nulltty) < 0 ) {
+            close(fd);
+            return -1;
+        }
+
+        pty->fd = fd;
+        relay_set_want(&nulltty->a, &nulltty->b);
+        relay_set_want(&nulltty->b, &nulltty->a);
+    }
+}
+
+/**
+ * Set a delay line's timer for when the oldest of its data is due
+ *
+ * @param loop Relay loop
+ * @param pty Descriptor of the sending PTY, holding data back
+ */
+static void loop_delay(nulltty_loop_t loop, struct nulltty_pty *pty)
+{
+    uint64_t tick = ( pty->delay_until + DELAY_TICK_NS - 1 ) / DELAY_TICK_NS;
+
+    if ( wheel_pending(&pty->delay_timer) ) {
+        if ( pty->delay_timer.due == tick )
+            return;
+        wheel_del(&loop->delays, &pty->delay_timer);
+    }
+
+    wheel_add(&loop->delays, &pty->delay_timer, tick);
+}
+
+/**
+ * Service one of a relay loop's PTY pairs after it has had events
+ *
+ * @param loop Relay loop the pair belongs to
+ * @param nulltty PTY pair to service
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_service(nulltty_loop_t loop, nulltty_t nulltty)
+{
+    bool grown;
+
+    if ( relay_shuffle_data(&nulltty->a, &nulltty->b) < 0
+         || relay_shuffle_data(&nulltty->b, &nulltty->a) < 0 )
+        return -1;
+
+    relay_cork(&nulltty->a, false);
+    relay_cork(&nulltty->b, false);
+
+    if ( ( nulltty->a.hangup && relay_disconnect(nulltty, &nulltty->a) < 0 )
+         || ( nulltty->b.hangup && relay_disconnect(nulltty, &nulltty->b) < 0 ) )
+        return -1;
+
+    relay_set_want(&nulltty->a, &nulltty->b);
+    relay_set_want(&nulltty->b, &nulltty->a);
+
+    grown = ring_size(&nulltty->a.ring) > nulltty->a.ring_min
+        || ring_size(&nulltty->b.ring) > nulltty->b.ring_min;
+    if ( grown != nulltty->grown ) {
+        nulltty->grown = grown;
+        if ( grown )
+            loop->ngrown++;
+        else
+            loop->ngrown--;
+    }
+
+    if ( ( nulltty->a.holding || nulltty->b.holding || nulltty->a.pacing
+           || nulltty->b.pacing ) && ! nulltty->held ) {
+        nulltty->held = true;
+        nulltty->next_held = loop->held;
+        loop->held = nulltty;
+    }
+
+    if ( nulltty->a.delaying )
+        loop_delay(loop, &nulltty->a);
+    if ( nulltty->b.delaying )
+        loop_delay(loop, &nulltty->b);
+
+#ifdef DEBUG
+    printf("%lu\t%lu\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\n",
+           nselects, nsyscalls,
+           ring_len(&nulltty->a.ring),
+           (size_t)nulltty->a.stats->bytes_in, (size_t)nulltty->b.stats->bytes_out,
+           ring_len(&nulltty->b.ring),
+           (size_t)nulltty->b.stats->bytes_in, (size_t)nulltty->a.stats->bytes_out);
+#endif
+
+    return 0;
+}
+
+/**
+ * When the earliest of the data a pair is holding back is due
+ *
+ * @param nulltty PTY pair
+ * @return CLOCK_MONOTONIC ns, or UINT64_MAX if the pair holds nothing back
+ */
+static uint64_t relay_held_until(nulltty_t nulltty)
+{
+    uint64_t due = UINT64_MAX;
+
+    if ( nulltty->a.holding && nulltty->a.hold_until < due )
+        due = nulltty->a.hold_until;
+    if ( nulltty->a.pacing && nulltty->a.pace_until < due )
+        due = nulltty->a.pace_until;
+    if ( nulltty->b.holding && nulltty->b.hold_until < due )
+        due = nulltty->b.hold_until;
+    if ( nulltty->b.pacing && nulltty->b.pace_until < due )
+        due = nulltty->b.pace_until;
+
+    return due;
+}
+
+/**
+ * Write out held data which has used up its latency budget, or which
+ * pacing now lets out
+ *
+ * Pairs no longer holding anything back are dropped from the loop's held
+ * list, and the time the next of the rest is due is noted in flush_at.
+ *
+ * @param loop Relay loop
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_flush_held(nulltty_loop_t loop)
+{
+    nulltty_t nulltty, *link = &loop->held;
+    uint64_t now = now_ns(), due;
+
+    loop->flush_at = UINT64_MAX;
+    while ( ( nulltty = *link ) != NULL ) {
+        due = relay_held_until(nulltty);
+        if ( due <= now ) {
+            if ( loop_service(loop, nulltty) < 0 )
+                return -1;
+            due = relay_held_until(nulltty);
+        }
+
+        if ( due == UINT64_MAX ) {
+            nulltty->held = false;
+            *link = nulltty->next_held;
+            continue;
+        }
+
+        if ( due < loop->flush_at )
+            loop->flush_at = due;
+        link = &nulltty->next_held;
+    }
+
+    return 0;
+}
+
+/**
+ * Write out the data which delay lines have held back until now
+ *
+ * The directions falling due in the same tick come off the wheel
+ * together, and each of their pairs is serviced once.
+ *
+ * @param loop Relay loop
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_flush_delayed(nulltty_loop_t loop)
+{
+    struct wheel_timer *timer;
+    nulltty_t nulltty, run = NULL;
+
+    if ( wheel_next(&loop->delays) == UINT64_MAX )
+        return 0;
+
+    timer = wheel_advance(&loop->delays, now_ns() / DELAY_TICK_NS);
+    for ( ; timer != NULL; timer = timer->next ) {
+        nulltty = timer->data;
+        if ( ! nulltty->queued ) {
+            nulltty->queued = true;
+            nulltty->next_run = run;
+            run = nulltty;
+        }
+    }
+
+    /* Only now, with the expired list walked, may timers be set again */
+    for ( ; run != NULL; run = run->next_run ) {
+        run->queued = false;
+        if ( loop_service(loop, run) < 0 )
+            return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Write out whatever held data is due
+ *
+ * @param loop Relay loop
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_flush_due(nulltty_loop_t loop)
+{
+    if ( loop->held != NULL && loop_flush_held(loop) < 0 )
+        return -1;
+
+    return loop_flush_delayed(loop);
+}
+
+#ifdef HAVE_TIMERFD
+static int loop_flush_timer(struct ev_handle *handle)
+{
+    nulltty_loop_t loop = handle->data;
+    uint64_t expirations;
+
+    while ( read(handle->fd, &expirations, sizeof(expirations)) > 0 )
+        ;
+    if ( errno != EAGAIN && errno != EINTR )
+        return -1;
+    handle->ready &= ~EV_READ;
+
+    /* loop_flush_due() runs on every pass anyway */
+    loop->flush_armed = 0;
+    return 0;
+}
+#endif
+
+/**
+ * Bytes a pair has moved so far, in both directions
+ */
+static uint64_t relay_moved(nulltty_t nulltty)
+{
+    return nulltty->a.stats->bytes_in + nulltty->a.stats->bytes_out
+        + nulltty->b.stats->bytes_in + nulltty->b.stats->bytes_out;
+}
+
+/**
+ * Busy-poll each of a relay loop's pairs once
+ *
+ * Every endpoint is taken to be ready, so that the relay tries reads and
+ * writes on it whatever the event backend last said; those which fail
+ * with EAGAIN just clear the readiness again.  The loop stops spinning
+ * once nothing has moved for its idle period.
+ *
+ * @param loop Relay loop, spinning
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_spin(nulltty_loop_t loop)
+{
+    nulltty_t nulltty;
+    uint64_t moved = 0;
+    size_t i;
+
+    for ( i = 0; i < loop->n; i++ ) {
+        nulltty = loop->pairs[i];
+        moved -= relay_moved(nulltty);
+
+        if ( nulltty->a.fd >= 0 )
+            nulltty->a.ev.ready |= EV_READ | EV_WRITE;
+        if ( nulltty->b.fd >= 0 )
+            nulltty->b.ev.ready |= EV_READ | EV_WRITE;
+        if ( loop_service(loop, nulltty) < 0 )
+            return -1;
+
+        moved += relay_moved(nulltty);
+    }
+
+    loop->polls++;
+    if ( moved > 0 ) {
+        loop->polls_moved++;
+        loop->last_moved = now_ns();
+    } else if ( loop->busy_idle_ns > 0
+                && now_ns() - loop->last_moved >= loop->busy_idle_ns ) {
+        loop->spinning = false;
+        loop->backoffs++;
+    }
+
+    return 0;
+}
+
+#ifdef HAVE_TIMERFD
+/**
+ * Give a relay loop a timer for writing out held data, once one of its
+ * pairs coalesces, is paced or has a delay line
+ *
+ * @param loop Relay loop
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_open_flush_timer(nulltty_loop_t loop)
+{
+    int fd;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if ( fd < 0 )
+        return -1;
+
+    if ( ev_add(loop->ev, &loop->flush_ev, fd, loop) < 0 ) {
+        close(fd);
+        return -1;
+    }
+
+    loop->flush_ev.want = EV_READ;
+    loop->flush_ev.callback = loop_flush_timer;
+    return 0;
+}
+#endif
+
+/**
+ * Work out how long a relay loop may wait for events
+ *
+ * Held data, and the next tick of the delay lines' wheel with anything
+ * to do, are waited for with the loop's timerfd where there is one,
+ * since epoll only times out to the millisecond; otherwise through the
+ * wait's own timeout.  A stepped loop whose backend has no descriptor
+ * to poll cannot be woken by the timerfd, so must not rely on it.
+ *
+ * @param loop Relay loop
+ * @param idle Timeout after which to shrink grown rings
+ * @param buf Space for a shorter timeout
+ * @param timer Whether the loop's timerfd wakes whoever waits
+ * @return Timeout for ev_wait(), or NULL to wait indefinitely
+ */
+static const struct timespec *loop_timeout(nulltty_loop_t loop,
+                                           const struct timespec *idle,
+                                           struct timespec *buf, bool timer)
+{
+#ifdef HAVE_TIMERFD
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+#endif
+    uint64_t due, tick, now, left;
+
+    if ( loop->ngrown == 0 )
+        idle = NULL;
+
+    due = loop->held != NULL ? loop->flush_at : UINT64_MAX;
+    tick = wheel_next(&loop->delays);
+    if ( tick != UINT64_MAX && tick * DELAY_TICK_NS < due )
+        due = tick * DELAY_TICK_NS;
+    if ( due == UINT64_MAX )
+        return idle;
+
+#ifdef HAVE_TIMERFD
+    if ( timer && loop->flush_ev.fd >= 0 ) {
+        if ( loop->flush_armed == due )
+            return idle;
+
+        its.it_value.tv_sec = due / 1000000000;
+        its.it_value.tv_nsec = due % 1000000000;
+        if ( timerfd_settime(loop->flush_ev.fd, TFD_TIMER_ABSTIME, &its,
+                             NULL) == 0 ) {
+            loop->flush_armed = due;
+            return idle;
+        }
+    }
+#endif
+
+    now = now_ns();
+    left = due > now ? due - now : 0;
+    if ( idle != NULL && left >= timespec_ns(idle) )
+        return idle;
+
+    buf->tv_sec = left / 1000000000;
+    buf->tv_nsec = left % 1000000000;
+    return buf;
+}
+
+/**
+ * Register one of a pair's endpoints with a relay loop
+ *
+ * A listening socket endpoint has its listening socket registered, and
+ * its connection only once a client arrives.
+ *
+ * @param loop Relay loop
+ * @param nulltty PTY pair the endpoint belongs to
+ * @param pty Descriptor of the endpoint
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_add_endpoint(nulltty_loop_t loop, nulltty_t nulltty,
+                             struct nulltty_pty *pty)
+{
+    if ( pty->listen_fd >= 0 ) {
+        if ( ev_add(loop->ev, &pty->listen_ev, pty->listen_fd, nulltty) < 0 )
+            return -1;
+        pty->listen_ev.want = EV_READ;
+        pty->listen_ev.callback = relay_accept;
+    }
+
+    if ( pty->fd >= 0 && ev_add(loop->ev, &pty->ev, pty->fd, nulltty) < 0 ) {
+        if ( pty->listen_fd >= 0 )
+            ev_del(loop->ev, &pty->listen_ev);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Deregister an endpoint registered by loop_add_endpoint()
+ *
+ * @param loop Relay loop
+ * @param pty Descriptor of the endpoint
+ */
+static void loop_del_endpoint(nulltty_loop_t loop, struct nulltty_pty *pty)
+{
+    if ( pty->listen_fd >= 0 )
+        ev_del(loop->ev, &pty->listen_ev);
+    if ( pty->fd >= 0 )
+        ev_del(loop->ev, &pty->ev);
+}
+
+/**
+ * Consume pending wakeups of a relay loop
+ *
+ * The wakeup itself is all that matters: it gets the loop back around to
+ * checking its stop flag and info requests.
+ *
+ * @param loop Relay loop
+ */
+static void loop_drain_wake(nulltty_loop_t loop)
+{
+    char buf[64];
+
+    while ( read(loop->wake_fds[0], buf, sizeof(buf)) > 0 )
+        ;
+
+    loop->wake_ev.ready &= ~EV_READ;
+}
+
+/**
+ * Act on the signals pending on a relay's signal source
+ *
+ * @param signals Signal source
+ * @param info_req Set if a status report was requested
+ * @return 1 if a terminating signal arrived, 0 if not, -1 with errno on
+ * error
+ */
+static int relay_read_signals(sigsrc_t signals, bool *info_req)
+{
+    int signum;
+
+    while ( ( signum = sigsrc_read(signals) ) > 0 ) {
+        if ( ! nulltty_info_signal(signum) )
+            return 1;
+        *info_req = true;
+    }
+
+    return signum;
+}
+
+/**
+ * Shrink the grown ring buffers of an idle relay loop's pairs
+ *
+ * @param loop Idle relay loop
+ */
+static void loop_shrink_rings(nulltty_loop_t loop)
+{
+    nulltty_t nulltty;
+    size_t i;
+
+    for ( i = 0; i < loop->n && loop->ngrown > 0; i++ ) {
+        nulltty = loop->pairs[i];
+        if ( ! nulltty->grown )
+            continue;
+
+        nulltty->grown = relay_shrink_ring(&nulltty->a);
+        nulltty->grown = relay_shrink_ring(&nulltty->b) || nulltty->grown;
+        if ( ! nulltty->grown )
+            loop->ngrown--;
+    }
+}
+
+/**
+ * Print status reports for a relay loop's pairs, as requested
+ *
+ * Pairs are identified by their symlinks when the loop serves more than
+ * one of them.
+ *
+ * @param loop Relay loop
+ */
+static void loop_printinfo(nulltty_loop_t loop)
+{
+    nulltty_t nulltty;
+    bool all = loop->info_all;
+    size_t i;
+
+    loop->info_pending = false;
+    loop->info_all = false;
+
+    for ( i = 0; i < loop->n; i++ ) {
+        nulltty = loop->pairs[i];
+        if ( ! all && ! nulltty->info_req )
+            continue;
+
+        nulltty->info_req = false;
+        if ( loop->n > 1 )
+            fprintf(stderr, "%s <-> %s\n", nulltty->a.link, nulltty->b.link);
+        relay_printinfo(nulltty);
+    }
+
+    if ( all && loop->busy_poll )
+        fprintf(stderr, "busy-poll: %llu polls, %llu moved data (%.3f%%), "
+                "%llu back-offs\n",
+                (unsigned long long)loop->polls,
+                (unsigned long long)loop->polls_moved,
+                loop->polls > 0 ? 100.0 * loop->polls_moved / loop->polls : 0.0,
+                (unsigned long long)loop->backoffs);
+}
+
+#ifdef HAVE_IO_URING
+
+/** user_data of the poll request on the signal source */
+#define URING_SIGNALS 0
+
+/**
+ * Relay data between the pseudoterminal pair using io_uring
+ *
+ * The io_uring counterpart to the event loop in nulltty_relay().  Each
+ * pass queues whatever reads and writes have become possible, then
+ * submits them and waits for at least one completion with a single
+ * io_uring_enter(), and finally reaps every completion that is ready.
+ * Signals arrive as the completion of a poll on the signal source.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @param signals Signal source, or NULL
+ * @return 0 on success (user request termination), -1 on error
+ */
+static int relay_uring(nulltty_t nulltty, sigsrc_t signals)
+{
+    struct io_uring_cqe *cqe;
+    struct io_uring_sqe *sqe;
+    bool polling = false, info_req;
+    uint64_t calls_a, calls_b;
+    int result = 0, stop;
+
+    if ( set_nonblock(nulltty->a.fd, false) < 0
+         || set_nonblock(nulltty->b.fd, false) < 0 ) {
+        result = -1;
+        goto end;
+    }
+
+    while ( true ) {
+        if ( signals != NULL && ! polling
+             && ( sqe = uring_get_sqe(&nulltty->uring) ) != NULL ) {
+            sqe->opcode      = IORING_OP_POLL_ADD;
+            sqe->fd          = sigsrc_fd(signals);
+            sqe->poll_events = POLLIN;
+            sqe->user_data   = URING_SIGNALS;
+            polling = true;
+        }
+
+        uring_queue(&nulltty->uring, &nulltty->b, &nulltty->a, 0);
+        uring_queue(&nulltty->uring, &nulltty->a, &nulltty->b, 1);
+
+        if ( uring_enter(&nulltty->uring, 1, NULL) < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            result = -1;
+            goto end;
+        }
+
+        calls_a = nulltty->a.stats->reads + nulltty->a.stats->writes;
+        calls_b = nulltty->b.stats->reads + nulltty->b.stats->writes;
+
+        while ( ( cqe = uring_peek_cqe(&nulltty->uring) ) != NULL ) {
+            if ( cqe->user_data == URING_SIGNALS ) {
+                uring_cqe_seen(&nulltty->uring);
+                polling = false;
+
+                info_req = false;
+                stop = relay_read_signals(signals, &info_req);
+                if ( info_req )
+                    relay_printinfo(nulltty);
+                if ( stop != 0 ) {
+                    result = stop < 0 ? -1 : 0;
+                    goto end;
+                }
+                continue;
+            }
+
+            if ( uring_complete(nulltty, cqe) < 0 ) {
+                uring_cqe_seen(&nulltty->uring);
+                result = -1;
+                goto end;
+            }
+            uring_cqe_seen(&nulltty->uring);
+        }
+
+        if ( nulltty->a.stats->reads + nulltty->a.stats->writes != calls_a )
+            STAT_INC(nulltty->a.stats->wakeups);
+        if ( nulltty->b.stats->reads + nulltty->b.stats->writes != calls_b )
+            STAT_INC(nulltty->b.stats->wakeups);
+
+#ifdef DEBUG
+        printf("%lu\t%lu\t%zu\t%zu\t%zu\t%zu\t%zu\t%zu\n",
+               nselects, nsyscalls,
+               ring_len(&nulltty->a.ring),
+               (size_t)nulltty->a.stats->bytes_in, (size_t)nulltty->b.stats->bytes_out,
+               ring_len(&nulltty->b.ring),
+               (size_t)nulltty->b.stats->bytes_in, (size_t)nulltty->a.stats->bytes_out);
+#endif
+    }
+
+ end:
+    set_nonblock(nulltty->a.fd, true);
+    set_nonblock(nulltty->b.fd, true);
+
+#ifdef DEBUG
+    relay_print_totals(&nulltty, 1);
+#endif
+
+    return result;
+}
+
+#endif /* HAVE_IO_URING */
+
+
+/**
+ * Act on the events of one wait of a relay loop
+ *
+ * Runs the callbacks of handles which have them, then services each pair
+ * which had events, and writes out any held data which is due.
+ *
+ * @param loop Relay loop
+ * @param signals Signal source registered with the loop, or NULL
+ * @param active List of handles with new events, from ev_wait()
+ * @return 0 on success, -1 with errno on error
+ */
+static int loop_dispatch(nulltty_loop_t loop, sigsrc_t signals,
+                         struct ev_handle *active)
+{
+    struct ev_handle *next;
+    nulltty_t nulltty, run;
+    bool info_req;
+    int stop;
+
+    /*
+     * Both endpoints of a pair may have had events, but each pair only
+     * needs servicing once per wakeup.
+     */
+    for ( run = NULL; active != NULL; active = next ) {
+        /* A callback may free its own handle */
+        next = active->next_active;
+
+        if ( active == &loop->wake_ev ) {
+            loop_drain_wake(loop);
+            continue;
+        }
+
+        if ( active->callback != NULL ) {
+            if ( active->callback(active) < 0 )
+                return -1;
+            continue;
+        }
+
+        if ( active == &loop->sig_ev ) {
+            loop->sig_ev.ready &= ~EV_READ;
+
+            info_req = false;
+            stop = relay_read_signals(signals, &info_req);
+            if ( info_req )
+                nulltty_loop_printinfo(loop);
+            if ( stop < 0 )
+                return -1;
+            if ( stop > 0 )
+                loop->stop = 1;
+            continue;
+        }
+
+        nulltty = active->data;
+        if ( ! nulltty->queued ) {
+            nulltty->queued = true;
+            nulltty->next_run = run;
+            run = nulltty;
+        }
+    }
+
+    /* Data's moving again, so back to spinning */
+    if ( run != NULL && loop->busy_poll && ! loop->spinning ) {
+        loop->spinning = true;
+        loop->last_moved = now_ns();
+    }
+
+    for ( ; run != NULL; run = run->next_run ) {
+        run->queued = false;
+        if ( loop_service(loop, run) < 0 )
+            return -1;
+    }
+
+    return loop_flush_due(loop);
+}
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+void nulltty_opts_init(struct nulltty_opts *opts)
+{
+    memset(opts, 0, sizeof(struct nulltty_opts));
+    opts->buf_size = READ_BUF_SZ;
+    opts->buf_max = 0;
+}
+
+nulltty_t nulltty_open(const char *link_a, const char *link_b,
+                       const struct nulltty_opts *opts)
+{
+    nulltty_t nulltty = NULL;
+    struct nulltty_opts default_opts;
+
+    if ( opts == NULL ) {
+        nulltty_opts_init(&default_opts);
+        opts = &default_opts;
+    }
+
+    nulltty = calloc(1, sizeof(struct nulltty));
+    if ( nulltty == NULL )
+        goto error_nulltty;
+
+    if ( endpoint_open(&nulltty->a, link_a, opts) < 0 )
+        goto error_link_a;
+
+    if ( endpoint_open(&nulltty->b, link_b, opts) < 0 )
+        goto error_link_b;
+
+    endpoint_coalesce(&nulltty->a, &opts->coalesce[NULLTTY_SIDE_A]);
+    endpoint_coalesce(&nulltty->b, &opts->coalesce[NULLTTY_SIDE_B]);
+    nulltty->a.pace = nulltty->b.pace = opts->pace;
+    if ( endpoint_delay(&nulltty->a, opts->delay_us) < 0
+         || endpoint_delay(&nulltty->b, opts->delay_us) < 0 )
+        goto error_mode;
+    nulltty->a.delay_timer.data = nulltty->b.delay_timer.data = nulltty;
+    nulltty->busy_poll = opts->busy_poll;
+    nulltty->busy_idle_ns = opts->busy_poll_idle_us * UINT64_C(1000);
+
+    if ( relay_set_mode(nulltty, opts->mode) < 0 )
+        goto error_mode;
+
+    return nulltty;
+
+ error_mode:
+    endpoint_close(&nulltty->b);
+ error_link_b:
+    endpoint_close(&nulltty->a);
+ error_link_a:
+    free(nulltty);
+ error_nulltty:
+    return NULL;
+}
+
+int nulltty_close(nulltty_t nulltty)
+{
+    int result = 0;
+
+#ifdef HAVE_IO_URING
+    if ( nulltty->mode == NULLTTY_MODE_IO_URING )
+        uring_free(&nulltty->uring);
+#endif
+
+    result += endpoint_close(&nulltty->a);
+    result += endpoint_close(&nulltty->b);
+    free(nulltty);
+
+    return result;
+}
+
+void nulltty_get_info(nulltty_t nulltty, struct nulltty_info *info)
+{
+    info->link_a = nulltty->a.link;
+    info->link_b = nulltty->b.link;
+    info->mode = nulltty->mode;
+    info->a_to_b = *nulltty->a.stats;
+    info->b_to_a = *nulltty->b.stats;
+    info->a_to_b.blocked_ns = relay_blocked_ns(&nulltty->a);
+    info->b_to_a.blocked_ns = relay_blocked_ns(&nulltty->b);
+}
+
+void nulltty_get_latency(nulltty_t nulltty, struct hist *a_to_b,
+                         struct hist *b_to_a)
+{
+    *a_to_b = nulltty->a.latency;
+    *b_to_a = nulltty->b.latency;
+}
+
+int nulltty_capture(nulltty_t nulltty, capture_t cap, unsigned pair)
+{
+    if ( nulltty->mode == NULLTTY_MODE_SPLICE ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    nulltty->a.capture = cap;
+    nulltty->a.capture_pair = pair;
+    nulltty->a.capture_dir = CAPTURE_A_TO_B;
+    nulltty->b.capture = cap;
+    nulltty->b.capture_pair = pair;
+    nulltty->b.capture_dir = CAPTURE_B_TO_A;
+    return 0;
+}
+
+int nulltty_master_fd(nulltty_t nulltty, enum nulltty_side side)
+{
+    const struct nulltty_pty *pty;
+
+    pty = side == NULLTTY_SIDE_A ? &nulltty->a : &nulltty->b;
+    return pty->sock == NULL ? pty->fd : -1;
+}
+
+int nulltty_reset(nulltty_t nulltty)
+{
+    if ( nulltty->mode == NULLTTY_MODE_IO_URING ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if ( endpoint_reset(&nulltty->a) < 0 || endpoint_reset(&nulltty->b) < 0 )
+        return -1;
+
+    relay_set_want(&nulltty->a, &nulltty->b);
+    relay_set_want(&nulltty->b, &nulltty->a);
+    return 0;
+}
+
+void nulltty_share_stats(nulltty_t nulltty, struct nulltty_stats *a_to_b,
+                         struct nulltty_stats *b_to_a)
+{
+    *a_to_b = *nulltty->a.stats;
+    *b_to_a = *nulltty->b.stats;
+    nulltty->a.stats = a_to_b;
+    nulltty->b.stats = b_to_a;
+}
+
+const char *nulltty_mode_name(enum nulltty_mode mode)
+{
+    switch ( mode ) {
+    case NULLTTY_MODE_AUTO:
+        return "auto";
+    case NULLTTY_MODE_BUFFERED:
+        return "buffered";
+    case NULLTTY_MODE_SPLICE:
+        return "splice";
+    case NULLTTY_MODE_IO_URING:
+        return "io_uring";
+    }
+
+    return "unknown";
+}
+
+bool nulltty_info_signal(int signum)
+{
+#ifdef SIGINFO
+    if ( signum == SIGINFO )
+        return true;
+#endif
+    return signum == SIGUSR1;
+}
+
+void nulltty_printinfo(nulltty_t nulltty)
+{
+    if ( nulltty ) {
+        nulltty->info_req = true;
+        if ( nulltty->loop )
+            nulltty->loop->info_pending = true;
+    }
+}
+
+int nulltty_relay(nulltty_t nulltty, sigsrc_t signals)
+{
+    nulltty_loop_t loop;
+    int result;
+
+#ifdef HAVE_IO_URING
+    if ( nulltty->mode == NULLTTY_MODE_IO_URING )
+        return relay_uring(nulltty, signals);
+#endif
+
+    loop = nulltty_loop_open();
+    if ( loop == NULL )
+        return -1;
+
+    result = nulltty_loop_add(loop, nulltty);
+    if ( result == 0 )
+        result = nulltty_loop_run(loop, signals);
+
+    nulltty_loop_close(loop);
+    return result;
+}
+
+nulltty_loop_t nulltty_loop_open(void)
+{
+    nulltty_loop_t loop;
+    int i, flags;
+
+    loop = calloc(1, sizeof(struct nulltty_loop));
+    if ( loop == NULL )
+        goto error;
+
+    loop->ev = ev_open();
+    if ( loop->ev == NULL )
+        goto error_ev;
+
+    if ( pipe(loop->wake_fds) < 0 )
+        goto error_pipe;
+
+    for ( i = 0; i < 2; i++ ) {
+        flags = fcntl(loop->wake_fds[i], F_GETFL);
+        if ( flags < 0
+             || fcntl(loop->wake_fds[i], F_SETFL, flags | O_NONBLOCK) < 0 )
+            goto error_wake;
+    }
+
+    if ( ev_add(loop->ev, &loop->wake_ev, loop->wake_fds[0], loop) < 0 )
+        goto error_wake;
+    loop->wake_ev.want = EV_READ;
+
+#ifdef HAVE_TIMERFD
+    loop->flush_ev.fd = -1;
+#endif
+    wheel_init(&loop->delays, now_ns() / DELAY_TICK_NS);
+
+    return loop;
+
+ error_wake:
+    close(loop->wake_fds[0]);
+    close(loop->wake_fds[1]);
+ error_pipe:
+    ev_close(loop->ev);
+ error_ev:
+    free(loop);
+ error:
+    return NULL;
+}
+
+int nulltty_loop_close(nulltty_loop_t loop)
+{
+    int result;
+    size_t i;
+
+    for ( i = 0; i < loop->n; i++ ) {
+        loop->pairs[i]->loop = NULL;
+        if ( wheel_pending(&loop->pairs[i]->a.delay_timer) )
+            wheel_del(&loop->delays, &loop->pairs[i]->a.delay_timer);
+        if ( wheel_pending(&loop->pairs[i]->b.delay_timer) )
+            wheel_del(&loop->delays, &loop->pairs[i]->b.delay_timer);
+    }
+
+    result = ev_close(loop->ev);
+    close(loop->wake_fds[0]);
+    close(loop->wake_fds[1]);
+#ifdef HAVE_TIMERFD
+    if ( loop->flush_ev.fd >= 0 )
+        close(loop->flush_ev.fd);
+#endif
+    free(loop->pairs);
+    free(loop);
+
+    return result;
+}
+
+int nulltty_loop_add(nulltty_loop_t loop, nulltty_t nulltty)
+{
+    nulltty_t *pairs;
+    size_t cap;
+
+    if ( nulltty->loop != NULL ) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if ( nulltty->mode == NULLTTY_MODE_IO_URING ) {
+        errno = ENOTSUP;
+        return -1;
+    }
+
+    if ( loop->n == loop->cap ) {
+        cap = loop->cap ? 2 * loop->cap : 8;
+        pairs = realloc(loop->pairs, cap * sizeof(nulltty_t));
+        if ( pairs == NULL )
+            return -1;
+
+        loop->pairs = pairs;
+        loop->cap = cap;
+    }
+
+#ifdef HAVE_TIMERFD
+    if ( ( nulltty->a.coalesce_ns > 0 || nulltty->b.coalesce_ns > 0
+           || nulltty->a.pace || nulltty->b.pace
+           || nulltty->a.delay_ns > 0 || nulltty->b.delay_ns > 0 )
+         && loop->flush_ev.fd < 0 && loop_open_flush_timer(loop) < 0 )
+        return -1;
+#endif
+
+    if ( loop_add_endpoint(loop, nulltty, &nulltty->a) < 0 )
+        return -1;
+
+    if ( loop_add_endpoint(loop, nulltty, &nulltty->b) < 0 ) {
+        loop_del_endpoint(loop, &nulltty->a);
+        return -1;
+    }
+
+    relay_set_want(&nulltty->a, &nulltty->b);
+    relay_set_want(&nulltty->b, &nulltty->a);
+
+    /* Spin for as long as the most patient pair asks */
+    if ( nulltty->busy_poll ) {
+        if ( ! loop->busy_poll
+             || ( loop->busy_idle_ns > 0
+                  && ( nulltty->busy_idle_ns == 0
+                       || nulltty->busy_idle_ns > loop->busy_idle_ns ) ) )
+            loop->busy_idle_ns = nulltty->busy_idle_ns;
+        loop->busy_poll = true;
+        loop->spinning = true;
+        loop->last_moved = now_ns();
+    }
+
+    nulltty->loop = loop;
+    loop->pairs[loop->n++] = nulltty;
+    return 0;
+}
+
+void nulltty_loop_printinfo(nulltty_loop_t loop)
+{
+    if ( loop ) {
+        loop->info_all = true;
+        loop->info_pending = true;
+    }
+}
+
+ev_loop_t nulltty_loop_events(nulltty_loop_t loop)
+{
+    return loop->ev;
+}
+
+void nulltty_loop_stop(nulltty_loop_t loop)
+{
+    loop->stop = 1;
+    nulltty_loop_wake(loop);
+}
+
+void nulltty_loop_wake(nulltty_loop_t loop)
+{
+    const char c = 0;
+    int saved_errno = errno;
+
+    /* If the pipe is full the loop has a wakeup coming already */
+    if ( write(loop->wake_fds[1], &c, 1) < 0 && errno != EAGAIN )
+        perror("Unable to wake relay loop");
+
+    errno = saved_errno;
+}
+
+int nulltty_loop_run(nulltty_loop_t loop, sigsrc_t signals)
+{
+    struct ev_handle *active;
+    const struct timespec idle_timeout = { RING_IDLE_SEC, 0 }, *timeout;
+    const struct timespec poll_timeout = { 0, 0 };
+    struct timespec flush_timeout;
+    int n, result = 0;
+
+    if ( signals != NULL ) {
+        if ( ev_add(loop->ev, &loop->sig_ev, sigsrc_fd(signals), loop) < 0 )
+            return -1;
+        loop->sig_ev.want = EV_READ;
+    }
+
+    /*
+     * Signals, wakeups from other threads and PTY traffic all arrive as
+     * descriptor events, so each pass makes the one wait call with no
+     * signal mask juggling around it.
+     */
+    while ( ! loop->stop ) {
+        if ( loop->info_pending )
+            loop_printinfo(loop);
+
+        /* Spinning, only look for other events every so often */
+        if ( loop->spinning ) {
+            if ( loop_spin(loop) < 0 || loop_flush_due(loop) < 0 ) {
+                result = -1;
+                goto end;
+            }
+            if ( loop->polls % BUSY_POLL_EVENTS != 0 )
+                continue;
+        }
+
+        /* Only bother waking up for idleness when there is a ring to
+         * shrink, and for held data when it is due */
+        if ( loop->spinning )
+            timeout = &poll_timeout;
+        else
+            timeout = loop_timeout(loop, &idle_timeout, &flush_timeout, true);
+        n = ev_wait(loop->ev, &active, timeout, NULL);
+        if ( n < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            result = -1;
+            goto end;
+        }
+
+        if ( n == 0 && timeout == &idle_timeout )
+            loop_shrink_rings(loop);
+
+        if ( loop_dispatch(loop, signals, active) < 0 ) {
+            result = -1;
+            goto end;
+        }
+    }
+
+ end:
+    loop->stop = 0;
+    if ( signals != NULL )
+        ev_del(loop->ev, &loop->sig_ev);
+
+#ifdef DEBUG
+    relay_print_totals(loop->pairs, loop->n);
 #endif
 
     return result;
 }
+
+int nulltty_loop_step(nulltty_loop_t loop, int *timeout_ms)
+{
+    struct ev_handle *active;
+    const struct timespec idle_timeout = { RING_IDLE_SEC, 0 }, *timeout;
+    const struct timespec poll_timeout = { 0, 0 };
+    struct timespec flush_timeout;
+    uint64_t now;
+    int n;
+
+    if ( loop->info_pending )
+        loop_printinfo(loop);
+
+    if ( loop->spinning && ( loop_spin(loop) < 0 || loop_flush_due(loop) < 0 ) )
+        return -1;
+
+    n = ev_wait(loop->ev, &active, &poll_timeout, NULL);
+    if ( n < 0 ) {
+        if ( errno != EINTR )
+            return -1;
+    } else if ( loop_dispatch(loop, NULL, active) < 0 ) {
+        return -1;
+    }
+
+    /* Without a wait to time out, idleness is judged by the time since
+     * the last step which found events */
+    now = now_ns();
+    if ( n > 0 || loop->ngrown == 0 ) {
+        loop->events_at = now;
+    } else if ( now - loop->events_at >= timespec_ns(&idle_timeout) ) {
+        loop_shrink_rings(loop);
+        loop->events_at = now;
+    }
+
+    /* The timerfd wakes callers polling the loop's descriptor once held
+     * data is due, but the time left is reported all the same, for
+     * callers which only go by the timeout */
+    if ( ! loop->spinning && ev_fd(loop->ev) >= 0 )
+        loop_timeout(loop, &idle_timeout, &flush_timeout, true);
+
+    if ( timeout_ms != NULL ) {
+        if ( loop->spinning )
+            timeout = &poll_timeout;
+        else
+            timeout = loop_timeout(loop, &idle_timeout, &flush_timeout,
+                                   false);
+        *timeout_ms = timeout == NULL ? -1
+            : (int)( ( timespec_ns(timeout) + 999999 ) / 1000000 );
+    }
+
+    return 0;
+}
+
+int nulltty_loop_fd(nulltty_loop_t loop)
+{
+    return ev_fd(loop->ev);
+}
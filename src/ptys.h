@@ -1,18 +1,182 @@
 #ifndef _NULLTTY_PTYS_H_
 #define _NULLTTY_PTYS_H_
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include "capture.h"
+#include "events.h"
+#include "hist.h"
+#include "sigsrc.h"
+
+/*
+ * These headers use POSIX types such as sigset_t, which a strict ISO C
+ * compilation (e.g. -std=c99) only declares given a POSIX feature test
+ * macro, such as -D_POSIX_C_SOURCE=200809L, defined before the first
+ * system header is included.  The default GNU dialects need nothing.
+ */
+
 /**
- * Size of the half-duplex buffer between pseudoterminals
+ * Default size of the half-duplex ring buffer between pseudoterminals
  *
- * Two of these will be allocated for each PTY pair.
+ * Two of these will be allocated for each PTY pair.  Must be a power of
+ * two.
  */
 #define READ_BUF_SZ 1024
 
+/**
+ * Largest ring buffer size that may be requested, initially or by growth
+ */
+#define READ_BUF_MAX ( 64 * 1024 * 1024 )
+
+/**
+ * How data is moved between the two pseudoterminals
+ */
+enum nulltty_mode {
+    /** Use splice() where the platform supports it, else buffered */
+    NULLTTY_MODE_AUTO,
+    /** Read into and write out of a userspace ring buffer */
+    NULLTTY_MODE_BUFFERED,
+    /** Move data through an in-kernel pipe with splice() (Linux only) */
+    NULLTTY_MODE_SPLICE,
+    /** Batch reads and writes through io_uring (Linux only) */
+    NULLTTY_MODE_IO_URING,
+};
+
+/**
+ * One of the two pseudoterminals of a pair
+ */
+enum nulltty_side {
+    NULLTTY_SIDE_A,
+    NULLTTY_SIDE_B,
+};
+
+/**
+ * Write coalescing for one direction of a PTY pair's relay
+ *
+ * Rather than being written out as soon as it is read, data is held back
+ * until enough has built up, or until the oldest of it has waited for the
+ * given time, so that a sender trickling out a byte at a time doesn't
+ * cost a write system call per byte.
+ */
+struct nulltty_coalesce {
+    /** Longest to hold data back, in microseconds; 0 to write it at once */
+    unsigned delay_us;
+
+    /** Write as soon as this many bytes are held; 0 to hold until the
+     * buffer is full */
+    size_t bytes;
+};
+
+/**
+ * Relay tuning options
+ *
+ * Initialize with nulltty_opts_init() before overriding individual fields,
+ * so that options added in the future take their default values.
+ */
+struct nulltty_opts {
+    /** Initial size of each direction's buffer; rounded up to a power of two */
+    size_t buf_size;
+
+    /**
+     * Size up to which a direction's buffer may grow while reads keep
+     * filling it, shrinking back to buf_size once the link goes idle; 0 or
+     * no larger than buf_size to disable adaptive sizing
+     */
+    size_t buf_max;
+
+    /** Relay mode; buffer sizes only apply to the buffered mode */
+    enum nulltty_mode mode;
+
+    /**
+     * Coalescing of the data read from each side, indexed by enum
+     * nulltty_side; only in buffered mode, which coalescing pairs use
+     * unless another mode is asked for
+     */
+    struct nulltty_coalesce coalesce[2];
+
+    /**
+     * Let data out no faster than a real UART would send it, at the speed,
+     * character size, parity and stop bits set on the sending PTY's slave
+     * (or the receiving one's, for data from a socket); only in buffered
+     * mode, which pacing pairs use unless another mode is asked for
+     */
+    bool pace;
+
+    /**
+     * Latency to add to the data relayed each way, in microseconds, as
+     * over a radio or satellite link; 0 for none.  Only in buffered mode,
+     * which delayed pairs use unless another mode is asked for.  To keep
+     * up the link's throughput, buf_max should leave room for the data
+     * sent over the delay
+     */
+    unsigned delay_us;
+
+    /**
+     * Busy-poll the pair instead of sleeping until it has events, for the
+     * lowest forwarding latency at the cost of a whole CPU; not in
+     * io_uring mode
+     */
+    bool busy_poll;
+
+    /**
+     * Microseconds without data moving after which a busy-polling relay
+     * goes back to sleeping until the next event; 0 to spin regardless
+     */
+    unsigned busy_poll_idle_us;
+};
+
+/**
+ * Counters for one direction of a PTY pair's relay
+ *
+ * These are always maintained; they cost an increment or two per system
+ * call.  In splice mode the reads and writes are the splice() calls into
+ * and out of the pipe.
+ */
+struct nulltty_stats {
+    uint64_t bytes_in;     /**< Bytes read from the sending PTY */
+    uint64_t bytes_out;    /**< Bytes written to the receiving PTY */
+    uint64_t reads;        /**< Read system calls on the sending PTY */
+    uint64_t writes;       /**< Write system calls on the receiving PTY */
+    uint64_t read_eagain;  /**< Reads which found nothing to read */
+    uint64_t write_eagain; /**< Writes which found no room */
+    uint64_t wakeups;      /**< Times the relay found this direction ready */
+    uint64_t coalesced;    /**< Writes saved by holding data back */
+    uint64_t coalesce_expired; /**< Writes of held data once due */
+    uint64_t blocked_ns;   /**< Time spent with the receiving PTY full */
+    uint64_t blocked_since; /**< CLOCK_MONOTONIC ns when the current spell
+                                 of blocked_ns began, or 0 if not blocked */
+    size_t buffered;       /**< Bytes currently held between the PTYs */
+    size_t buf_hwm;        /**< Most bytes ever held between the PTYs */
+    size_t buf_size;       /**< Current buffer size (buffered mode only) */
+    size_t buf_peak;       /**< Largest buffer size reached */
+};
+
+/**
+ * Snapshot of a PTY pair's state, for reporting
+ */
+struct nulltty_info {
+    const char *link_a;
+    const char *link_b;
+    enum nulltty_mode mode;      /**< Mode in use, never NULLTTY_MODE_AUTO */
+    struct nulltty_stats a_to_b;
+    struct nulltty_stats b_to_a;
+};
+
 struct nulltty; /* Forward declaration */
 typedef struct nulltty *nulltty_t;
 
+struct nulltty_loop; /* Forward declaration */
+typedef struct nulltty_loop *nulltty_loop_t;
+
+/**
+ * Fill in default relay options
+ *
+ * @param opts Options structure to initialize
+ */
+void nulltty_opts_init(struct nulltty_opts *opts);
+
 /**
  * Opens a pair of pseudoterminals and creates requested symlinks
  *
@@ -20,11 +184,20 @@ typedef struct nulltty *nulltty_t;
  * pseudoterminals and then creates the requested symbolic links to their
  * slave devices.
  *
- * @param link_a Symlink name for tty A
- * @param link_b Symlink name for tty B
- * @return Pointer to nulltty struct with PTY info, or NULL on error
+ * Either side may instead be a stream socket, given as a socket address
+ * (see sock.h) in place of the symlink name.  Such pairs are only relayed
+ * in buffered mode.  Writes to a socket whose peer has gone fail with
+ * EPIPE rather than raising SIGPIPE.
+ *
+ * @param link_a Symlink name for tty A, or socket address
+ * @param link_b Symlink name for tty B, or socket address
+ * @param opts Relay options, or NULL for defaults
+ * @return Pointer to nulltty struct with PTY info, or NULL on error (with
+ * errno set to ENOTSUP if the requested relay mode is unavailable, or
+ * doesn't support socket endpoints, coalescing, pacing or delay lines)
  */
-nulltty_t nulltty_open(const char *link_a, const char *link_b);
+nulltty_t nulltty_open(const char *link_a, const char *link_b,
+                       const struct nulltty_opts *opts);
 
 /**
  * Closes a pair of pseudoterminals and cleans up their symlinks
@@ -38,13 +211,119 @@ int nulltty_close(nulltty_t nulltty);
  * Relay data between the pseudoterminal pair
  *
  * Implements the program's main loop behavior of ferrying data between the
- * two pseudoterminal devices.
+ * two pseudoterminal devices.  This is a convenience wrapper which runs a
+ * relay loop serving just the one pair.
  *
  * @param nulltty Pointer to structure returned by openptys()
- * @param exit_flag Flag to signal program termination
+ * @param signals Signal source to watch for termination and status
+ * requests, or NULL
  * @return 0 on success (user request termination), -1 on error
  */
-int nulltty_relay(nulltty_t nulltty, volatile sig_atomic_t *exit_flag);
+int nulltty_relay(nulltty_t nulltty, sigsrc_t signals);
+
+/**
+ * Take a snapshot of a PTY pair's counters
+ *
+ * May be called from a thread other than the one relaying the pair, in
+ * which case counters may be caught mid-update relative to one another.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @param info Filled in with the pair's state; the link strings remain
+ * owned by the pair
+ */
+void nulltty_get_info(nulltty_t nulltty, struct nulltty_info *info);
+
+/**
+ * Take a snapshot of a PTY pair's queueing latency histograms
+ *
+ * The histograms count the bytes relayed in each direction by the time
+ * each spent inside the relay, from the read which brought it in to the
+ * write which sent it on.  The same caveat as for nulltty_get_info()
+ * applies when called from another thread.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @param a_to_b Filled in with the A to B direction's histogram
+ * @param b_to_a Filled in with the B to A direction's histogram
+ */
+void nulltty_get_latency(nulltty_t nulltty, struct hist *a_to_b,
+                         struct hist *b_to_a);
+
+/**
+ * Move a PTY pair's counters into caller-provided storage
+ *
+ * The counters accumulated so far are copied over, and all further updates
+ * are made in place there, with relaxed atomic stores, so that they may be
+ * read from shared memory by other processes.  Must be called before the
+ * pair is relayed.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @param a_to_b Storage for the A to B direction's counters
+ * @param b_to_a Storage for the B to A direction's counters; both must
+ * outlive the pair
+ */
+void nulltty_share_stats(nulltty_t nulltty, struct nulltty_stats *a_to_b,
+                         struct nulltty_stats *b_to_a);
+
+/**
+ * Record the data a PTY pair relays in a capture log
+ *
+ * Every chunk read from either PTY is appended to the log as it comes in.
+ * Must be called before the pair is relayed; the log must outlive it.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @param cap Capture log returned by capture_open()
+ * @param pair Index to tag the pair's records with
+ * @return 0 on success, -1 with errno on error (ENOTSUP if the pair relays
+ * in splice mode, where the data never passes through userspace)
+ */
+int nulltty_capture(nulltty_t nulltty, capture_t cap, unsigned pair);
+
+/**
+ * Get the master descriptor of one of a pair's pseudoterminals
+ *
+ * Data written to it is read from that side's slave, as if relayed from
+ * the other side.  The descriptor is non-blocking and remains owned by
+ * the pair; to watch it in an event loop the pair is also registered
+ * with, register a dup() of it instead.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @param side Which pseudoterminal
+ * @return Master descriptor, or -1 if that side is a socket
+ */
+int nulltty_master_fd(nulltty_t nulltty, enum nulltty_side side);
+
+/**
+ * Discard everything in flight through a PTY pair
+ *
+ * Flushes the data buffered between the two sides and anything still
+ * queued in either pseudoterminal, and puts both slaves back into the raw
+ * mode they were opened in, so that the pair can be handed on as good as
+ * new.  Counters carry on from where they were.  Must be called from the
+ * thread relaying the pair, if any, between passes of its relay loop.
+ *
+ * @param nulltty Pointer to structure returned by openptys()
+ * @return 0 on success, -1 with errno on error (ENOTSUP if the pair relays
+ * in io_uring mode)
+ */
+int nulltty_reset(nulltty_t nulltty);
+
+/**
+ * Name of a relay mode, as accepted on the command line
+ *
+ * @param mode Relay mode
+ * @return Static string
+ */
+const char *nulltty_mode_name(enum nulltty_mode mode);
+
+/**
+ * Whether a signal asks the relay for a status report
+ *
+ * The relay stops on any other signal delivered through its signal source.
+ *
+ * @param signum Signal number
+ * @return true for SIGUSR1 or SIGINFO, false otherwise
+ */
+bool nulltty_info_signal(int signum);
 
 /**
  * Cause the nulltty relay to print a status report
@@ -53,4 +332,128 @@ int nulltty_relay(nulltty_t nulltty, volatile sig_atomic_t *exit_flag);
  */
 void nulltty_printinfo(nulltty_t nulltty);
 
+/**
+ * Create a relay loop capable of serving many PTY pairs
+ *
+ * @return Relay loop, or NULL with errno on error
+ */
+nulltty_loop_t nulltty_loop_open(void);
+
+/**
+ * Destroy a relay loop
+ *
+ * The PTY pairs added to the loop are not closed.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int nulltty_loop_close(nulltty_loop_t loop);
+
+/**
+ * Add a PTY pair to a relay loop
+ *
+ * A pair can belong to at most one loop, and must stay open until the loop
+ * is closed.  Pairs opened in io_uring mode can only be relayed on their
+ * own, with nulltty_relay().
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ * @param nulltty Pointer to structure returned by openptys()
+ * @return 0 on success, -1 with errno on error (EBUSY if the pair already
+ * belongs to a loop, ENOTSUP if it was opened in io_uring mode)
+ */
+int nulltty_loop_add(nulltty_loop_t loop, nulltty_t nulltty);
+
+/**
+ * Relay data between all of a loop's pseudoterminal pairs
+ *
+ * Runs until a terminating signal arrives through the signal source or
+ * nulltty_loop_stop() is called.
+ *
+ * If any of the loop's pairs asks to be busy-polled, the loop spins
+ * trying non-blocking reads and writes on every pair rather than waiting
+ * for events, only checking for other events every so often.  After the
+ * longest idle period asked for by those pairs without any data moving,
+ * it goes back to waiting until data next arrives.  Status reports then
+ * include how many polls moved data.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ * @param signals Signal source to watch for termination and status
+ * requests, or NULL
+ * @return 0 on success (user request termination), -1 on error
+ */
+int nulltty_loop_run(nulltty_loop_t loop, sigsrc_t signals);
+
+/**
+ * Relay whatever data is waiting on a loop's pairs, without blocking
+ *
+ * For embedding the relay in a program with an event loop of its own, in
+ * place of nulltty_loop_run(): each step services the pairs with new
+ * events and returns.  Step again once the loop's descriptor (see
+ * nulltty_loop_fd()) polls readable, or once the timeout left in
+ * timeout_ms runs out, whichever comes first.
+ *
+ * A busy-polled loop which is spinning asks to be stepped again at once.
+ * A loop must not be stepped and run at the same time, nor stepped from
+ * more than one thread at a time.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ * @param timeout_ms Set, unless NULL, to the most milliseconds to wait
+ * before the next step even without events, as taken by poll(): finite
+ * while data is held back for coalescing or in a delay line, or grown
+ * buffers wait to shrink, and otherwise -1 for no limit
+ * @return 0 on success, -1 with errno on error
+ */
+int nulltty_loop_step(nulltty_loop_t loop, int *timeout_ms);
+
+/**
+ * Get a descriptor to poll for readability to know when a relay loop
+ * has events to step through with nulltty_loop_step()
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ * @return Descriptor, owned by the loop, or -1 with errno ENOTSUP where
+ * the event backend has none (select()), in which case the loop must be
+ * stepped periodically instead
+ */
+int nulltty_loop_fd(nulltty_loop_t loop);
+
+/**
+ * Get the event loop underlying a relay loop
+ *
+ * Other descriptors may be registered with it, with a callback set in
+ * their handles, to be serviced by the relay loop alongside its pairs.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ * @return Event loop, owned by the relay loop
+ */
+ev_loop_t nulltty_loop_events(nulltty_loop_t loop);
+
+/**
+ * Make a relay loop return
+ *
+ * If the loop is not running, its next run returns straight away.  Safe
+ * to call from another thread or from a signal handler.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ */
+void nulltty_loop_stop(nulltty_loop_t loop);
+
+/**
+ * Cause the relay loop to print a status report for each of its pairs
+ *
+ * Safe to call from a signal handler.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ */
+void nulltty_loop_printinfo(nulltty_loop_t loop);
+
+/**
+ * Interrupt a relay loop's wait for events
+ *
+ * Makes a loop running in another thread notice info requests.  Safe to
+ * call from a signal handler.
+ *
+ * @param loop Relay loop returned by nulltty_loop_open()
+ */
+void nulltty_loop_wake(nulltty_loop_t loop);
+
 #endif /* ! defined _NULLTTY_PTYS_H_ */
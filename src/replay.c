@@ -0,0 +1,399 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_TIMERFD
+#include <sys/timerfd.h>
+#endif
+
+#include "replay.h"
+#include "capture.h"
+#include "debug.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+struct replay {
+    ev_loop_t ev;
+    const uint8_t *map;
+    size_t size;
+    size_t off;               /* Offset of the record being replayed */
+    size_t end;               /* Offset just past the last record */
+    size_t written;           /* Bytes of the current record written so far */
+    bool fast;
+    bool finished;
+    uint64_t base_ts;         /* Timestamp of the log's first record */
+    uint64_t start;           /* CLOCK_MONOTONIC ns the replay started */
+    struct ev_handle *targets; /* Into A then B for each pair; fd -1 if not
+                                * replayed into */
+    size_t n;
+#ifdef HAVE_TIMERFD
+    struct ev_handle timer_ev;
+    uint64_t armed;           /* Time the timer is set for, or 0 */
+#endif
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+static uint64_t now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * The record being replayed, or NULL at the end of the log
+ */
+static const struct capture_record *replay_record(const struct replay *rp)
+{
+    const struct capture_record *rec;
+
+    if ( rp->end - rp->off < sizeof(struct capture_record) )
+        return NULL;
+
+    rec = (const struct capture_record *)( rp->map + rp->off );
+    if ( rec->ts == 0 || rp->end - rp->off < capture_record_size(rec->len) )
+        return NULL;
+
+    return rec;
+}
+
+/**
+ * Handle of the pseudoterminal a record is to be written into
+ *
+ * @return Handle, or NULL if the record is not to be replayed
+ */
+static struct ev_handle *replay_target(const struct replay *rp,
+                                       const struct capture_record *rec)
+{
+    struct ev_handle *target;
+
+    if ( rec->pair >= rp->n )
+        return NULL;
+
+    /* Data read from A was delivered into B, and vice-versa */
+    target = &rp->targets[2 * rec->pair
+                          + ( rec->dir == CAPTURE_A_TO_B ? 1 : 0 )];
+    return target->fd >= 0 ? target : NULL;
+}
+
+#ifdef HAVE_TIMERFD
+static int replay_arm(struct replay *rp, uint64_t due)
+{
+    struct itimerspec its = { { 0, 0 }, { 0, 0 } };
+
+    if ( rp->armed == due )
+        return 0;
+
+    its.it_value.tv_sec = due / 1000000000;
+    its.it_value.tv_nsec = due % 1000000000;
+    if ( timerfd_settime(rp->timer_ev.fd, TFD_TIMER_ABSTIME, &its, NULL) < 0 )
+        return -1;
+
+    rp->armed = due;
+    return 0;
+}
+#endif
+
+/**
+ * Stop watching the pseudoterminals once the whole log has been replayed
+ *
+ * This runs from the handlers, so the handles stay registered until
+ * replay_close(): the loop may be yet to dispatch any of them.
+ */
+static void replay_finish(struct replay *rp)
+{
+    size_t i;
+
+    for ( i = 0; i < 2 * rp->n; i++ )
+        rp->targets[i].want = 0;
+
+#ifdef HAVE_TIMERFD
+    rp->timer_ev.want = 0;
+#endif
+
+    rp->finished = true;
+}
+
+/**
+ * Deregister and close the replay's descriptors
+ */
+static void replay_release(struct replay *rp)
+{
+    size_t i;
+
+    for ( i = 0; i < 2 * rp->n; i++ ) {
+        if ( rp->targets[i].fd < 0 )
+            continue;
+
+        ev_del(rp->ev, &rp->targets[i]);
+        close(rp->targets[i].fd);
+        rp->targets[i].fd = -1;
+    }
+
+#ifdef HAVE_TIMERFD
+    if ( rp->timer_ev.fd >= 0 ) {
+        ev_del(rp->ev, &rp->timer_ev);
+        close(rp->timer_ev.fd);
+        rp->timer_ev.fd = -1;
+    }
+#endif
+}
+
+/**
+ * Write out records until one isn't due yet or its PTY is full
+ *
+ * The clock is only read again once a record looks like it isn't due,
+ * so that a backlog of records is written out without a system call
+ * apiece.
+ */
+static int replay_pump(struct replay *rp)
+{
+    const struct capture_record *rec;
+    struct ev_handle *target;
+#ifdef HAVE_TIMERFD
+    uint64_t now = 0, due;
+#endif
+    ssize_t n;
+
+    if ( rp->finished )
+        return 0;
+
+    while ( ( rec = replay_record(rp) ) != NULL ) {
+        target = replay_target(rp, rec);
+        if ( target == NULL ) {
+            rp->off += capture_record_size(rec->len);
+            continue;
+        }
+
+#ifdef HAVE_TIMERFD
+        if ( ! rp->fast ) {
+            due = rp->start;
+            if ( rec->ts > rp->base_ts )
+                due += rec->ts - rp->base_ts;
+
+            if ( now < due )
+                now = now_ns();
+            if ( now < due )
+                return replay_arm(rp, due);
+        }
+#endif
+
+        if ( ! ( target->ready & EV_WRITE ) )
+            return 0;
+
+        n = write(target->fd, (const uint8_t *)( rec + 1 ) + rp->written,
+                  rec->len - rp->written);
+        if ( n < 0 && errno == EINTR )
+            continue;
+        if ( n < 0 && errno == EAGAIN ) {
+            target->ready &= ~EV_WRITE;
+            return 0;
+        }
+        if ( n < 0 )
+            return -1;
+
+        rp->written += n;
+        if ( rp->written == rec->len ) {
+            rp->off += capture_record_size(rec->len);
+            rp->written = 0;
+        }
+    }
+
+    replay_finish(rp);
+    return 0;
+}
+
+static int replay_writable(struct ev_handle *handle)
+{
+    return replay_pump(handle->data);
+}
+
+#ifdef HAVE_TIMERFD
+static int replay_timer(struct ev_handle *handle)
+{
+    struct replay *rp = handle->data;
+    uint64_t expirations;
+
+    while ( read(handle->fd, &expirations, sizeof(expirations)) > 0 )
+        ;
+    if ( errno != EAGAIN && errno != EINTR )
+        return -1;
+    handle->ready &= ~EV_READ;
+
+    rp->armed = 0;
+    return replay_pump(rp);
+}
+#endif
+
+/**
+ * Map a capture log and check that it is one we understand
+ */
+static int replay_map(struct replay *rp, const char *path)
+{
+    const struct capture_header *header;
+    struct stat st;
+    int fd;
+
+    if ( ( fd = open(path, O_RDONLY) ) < 0 )
+        goto error;
+
+    if ( fstat(fd, &st) < 0 )
+        goto error_fd;
+    if ( (size_t)st.st_size < sizeof(struct capture_header) ) {
+        errno = EINVAL;
+        goto error_fd;
+    }
+
+    rp->size = st.st_size;
+    rp->map = mmap(NULL, rp->size, PROT_READ, MAP_SHARED, fd, 0);
+    if ( rp->map == MAP_FAILED )
+        goto error_fd;
+    close(fd);
+
+    /* Read ahead aggressively, and drop pages once replayed */
+#ifdef MADV_SEQUENTIAL
+    madvise((void *)rp->map, rp->size, MADV_SEQUENTIAL);
+#endif
+
+    header = (const struct capture_header *)rp->map;
+    if ( header->magic != CAPTURE_MAGIC
+         || header->version != CAPTURE_VERSION
+         || header->header_size != sizeof(struct capture_header) ) {
+        errno = EINVAL;
+        goto error_map;
+    }
+
+    /* A log still being written, or never finished, has no length yet */
+    rp->off = header->header_size;
+    rp->end = rp->size;
+    if ( header->length > 0 && header->length <= rp->size - rp->off )
+        rp->end = rp->off + header->length;
+
+    if ( replay_record(rp) != NULL )
+        rp->base_ts = replay_record(rp)->ts;
+
+    return 0;
+
+ error_map:
+    munmap((void *)rp->map, rp->size);
+    goto error;
+ error_fd:
+    close(fd);
+ error:
+    return -1;
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+replay_t replay_open(const char *path, ev_loop_t ev, const nulltty_t *pairs,
+                     size_t n, unsigned into, bool fast)
+{
+    struct ev_handle *target;
+    replay_t rp;
+    size_t i;
+    int fd;
+
+#ifndef HAVE_TIMERFD
+    if ( ! fast ) {
+        errno = ENOTSUP;
+        goto error;
+    }
+#endif
+
+    rp = calloc(1, sizeof(struct replay));
+    if ( rp == NULL )
+        goto error;
+
+    rp->ev = ev;
+    rp->fast = fast;
+    rp->n = n;
+#ifdef HAVE_TIMERFD
+    rp->timer_ev.fd = -1;
+#endif
+
+    rp->targets = calloc(2 * n, sizeof(struct ev_handle));
+    if ( rp->targets == NULL )
+        goto error_rp;
+    for ( i = 0; i < 2 * n; i++ )
+        rp->targets[i].fd = -1;
+
+    if ( replay_map(rp, path) < 0 )
+        goto error_targets;
+
+    /* The pairs have the masters registered with the loop already, so we
+     * watch duplicates of them */
+    for ( i = 0; i < 2 * n; i++ ) {
+        if ( ! ( into & ( i % 2 ? REPLAY_INTO_B : REPLAY_INTO_A ) ) )
+            continue;
+
+        /* Sockets have no master to write to */
+        target = &rp->targets[i];
+        fd = nulltty_master_fd(pairs[i/2], i % 2 ? NULLTTY_SIDE_B
+                                                 : NULLTTY_SIDE_A);
+        if ( fd < 0 )
+            continue;
+        if ( ( fd = dup(fd) ) < 0 )
+            goto error_fds;
+        if ( ev_add(ev, target, fd, rp) < 0 ) {
+            close(fd);
+            target->fd = -1;
+            goto error_fds;
+        }
+
+        target->want = EV_WRITE;
+        target->callback = replay_writable;
+    }
+
+#ifdef HAVE_TIMERFD
+    if ( ! fast ) {
+        fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if ( fd < 0 )
+            goto error_fds;
+        if ( ev_add(ev, &rp->timer_ev, fd, rp) < 0 ) {
+            close(fd);
+            rp->timer_ev.fd = -1;
+            goto error_fds;
+        }
+
+        rp->timer_ev.want = EV_READ;
+        rp->timer_ev.callback = replay_timer;
+    }
+#endif
+
+    rp->start = now_ns();
+    return rp;
+
+ error_fds:
+    replay_release(rp);
+    munmap((void *)rp->map, rp->size);
+ error_targets:
+    free(rp->targets);
+ error_rp:
+    free(rp);
+ error:
+    return NULL;
+}
+
+int replay_close(replay_t rp)
+{
+    int result = 0;
+
+    replay_release(rp);
+    if ( munmap((void *)rp->map, rp->size) < 0 )
+        result = -1;
+
+    free(rp->targets);
+    free(rp);
+    return result;
+}
@@ -0,0 +1,66 @@
+#ifndef _NULLTTY_REPLAY_H_
+#define _NULLTTY_REPLAY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "events.h"
+#include "ptys.h"
+
+/**
+ * Timed replay of a capture log
+ *
+ * Writes the data recorded in a capture log (see capture.h) into the
+ * pseudoterminals it was originally delivered to, as though relayed from
+ * the other side once more: data read from a pair's PTY A is written to
+ * its PTY B, and vice-versa.  Records are matched to pairs by index, and
+ * those of pairs beyond the ones given are skipped.
+ *
+ * Records are replayed either as fast as the pseudoterminals will take
+ * them, or at their original spacing, measured from the first record in
+ * the log.  In the latter case a timerfd armed at each record's due time
+ * wakes the event loop, so timing doesn't depend on how busy the loop is
+ * otherwise.  Writes are non-blocking and driven by the event loop the
+ * replay is attached to; a full pseudoterminal holds up the rest of the
+ * replay, which then catches up with its schedule as fast as it can.
+ *
+ * The log is mapped into memory with sequential access advice, so the
+ * kernel reads ahead and drops pages already replayed.
+ */
+
+/** Replay into a pair's PTY A the data originally read from its PTY B */
+#define REPLAY_INTO_A 0x01
+/** Replay into a pair's PTY B the data originally read from its PTY A */
+#define REPLAY_INTO_B 0x02
+
+struct replay; /* Forward declaration */
+typedef struct replay *replay_t;
+
+/**
+ * Open a capture log and start replaying it
+ *
+ * The replay's schedule starts straight away, so this should be called
+ * just before the event loop is run.
+ *
+ * @param path Path of the capture log
+ * @param ev Event loop from which to drive the replay
+ * @param pairs PTY pairs to replay into, by record pair index
+ * @param n Number of pairs
+ * @param into REPLAY_INTO_A, REPLAY_INTO_B or both
+ * @param fast Whether to ignore the records' timing
+ * @return Replay, or NULL with errno on error (EINVAL if the file is not
+ * a capture log of this version, ENOTSUP for a timed replay on a platform
+ * without timerfd)
+ */
+replay_t replay_open(const char *path, ev_loop_t ev, const nulltty_t *pairs,
+                     size_t n, unsigned into, bool fast);
+
+/**
+ * Stop a replay and unmap its log
+ *
+ * @param rp Replay returned by replay_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int replay_close(replay_t rp);
+
+#endif /* ! defined _NULLTTY_REPLAY_H_ */
@@ -0,0 +1,144 @@
+#include <stubs.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "ring.h"
+#include "debug.h"
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+int ring_iov(const struct ring *ring, size_t start, size_t len,
+             struct iovec iov[2])
+{
+    size_t offset = start & ring->mask;
+    size_t first = ring_size(ring) - offset;
+
+    iov[0].iov_base = ring->buf + offset;
+
+    if ( len <= first ) {
+        iov[0].iov_len = len;
+        return 1;
+    }
+
+    iov[0].iov_len = first;
+    iov[1].iov_base = ring->buf;
+    iov[1].iov_len = len - first;
+    return 2;
+}
+
+int ring_init(struct ring *ring, size_t size)
+{
+    if ( size == 0 || ( size & ( size - 1 ) ) != 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    ring->buf = malloc(size);
+    if ( ring->buf == NULL )
+        return -1;
+
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    return 0;
+}
+
+void ring_free(struct ring *ring)
+{
+    free(ring->buf);
+    ring->buf = NULL;
+}
+
+int ring_resize(struct ring *ring, size_t size)
+{
+    struct iovec iov[2];
+    uint8_t *buf;
+    size_t len = ring_len(ring);
+    int i, n;
+
+    if ( size == 0 || ( size & ( size - 1 ) ) != 0 || size < len ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    buf = malloc(size);
+    if ( buf == NULL )
+        return -1;
+
+    if ( len > 0 ) {
+        n = ring_iov(ring, ring->tail, len, iov);
+        for ( i = 0, len = 0; i < n; len += iov[i++].iov_len )
+            memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+    }
+
+    free(ring->buf);
+    ring->buf = buf;
+    ring->mask = size - 1;
+    ring->head = len;
+    ring->tail = 0;
+    return 0;
+}
+
+ssize_t ring_readv(struct ring *ring, int fd)
+{
+    struct iovec iov[2];
+    ssize_t n;
+
+    assert(ring_space(ring) > 0);
+
+    n = readv(fd, iov, ring_iov(ring, ring->head, ring_space(ring), iov));
+    if ( n > 0 )
+        ring->head += n;
+
+    return n;
+}
+
+ssize_t ring_writev(struct ring *ring, int fd)
+{
+    return ring_writev_max(ring, fd, ring_len(ring));
+}
+
+ssize_t ring_writev_max(struct ring *ring, int fd, size_t max)
+{
+    struct iovec iov[2];
+    ssize_t n;
+
+    assert(ring_len(ring) > 0 && max > 0);
+
+    if ( max > ring_len(ring) )
+        max = ring_len(ring);
+
+    n = writev(fd, iov, ring_iov(ring, ring->tail, max, iov));
+    if ( n > 0 )
+        ring->tail += n;
+
+    return n;
+}
+
+ssize_t ring_sendmsg_max(struct ring *ring, int fd, size_t max, int flags)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t n;
+
+    assert(ring_len(ring) > 0 && max > 0);
+
+    if ( max > ring_len(ring) )
+        max = ring_len(ring);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = ring_iov(ring, ring->tail, max, iov);
+
+    n = sendmsg(fd, &msg, flags);
+    if ( n > 0 )
+        ring->tail += n;
+
+    return n;
+}
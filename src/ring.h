@@ -0,0 +1,123 @@
+#ifndef _NULLTTY_RING_H_
+#define _NULLTTY_RING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * Byte ring buffer for one direction of the relay
+ *
+ * The capacity is always a power of two, and the head and tail are
+ * free-running byte counters which are only ever masked when indexing into
+ * the buffer.  The producer only advances the head and the consumer only
+ * advances the tail, so data never has to be moved once it has been read;
+ * transfers that straddle the end of the buffer are done with a single
+ * readv() or writev().
+ */
+struct ring {
+    uint8_t *buf;
+    size_t mask;   /**< Capacity minus one */
+    size_t head;   /**< Total bytes ever written into the ring */
+    size_t tail;   /**< Total bytes ever consumed from the ring */
+};
+
+/**
+ * Allocate a ring's buffer
+ *
+ * @param ring Ring to initialize
+ * @param size Capacity in bytes; must be a power of two
+ * @return 0 on success, -1 with errno on error
+ */
+int ring_init(struct ring *ring, size_t size);
+
+/**
+ * Release a ring's buffer
+ *
+ * @param ring Ring previously initialized with ring_init()
+ */
+void ring_free(struct ring *ring);
+
+/**
+ * Change a ring's capacity, preserving its contents
+ *
+ * Buffered data is copied to the start of the new buffer.
+ *
+ * @param ring Ring previously initialized with ring_init()
+ * @param size New capacity in bytes; must be a power of two no smaller
+ * than the amount of data currently buffered
+ * @return 0 on success, -1 with errno on error (in which case the ring is
+ * left unchanged)
+ */
+int ring_resize(struct ring *ring, size_t size);
+
+/**
+ * Describe a span of the ring as at most two iovecs
+ *
+ * @param ring Ring buffer
+ * @param start Free-running offset of the start of the span
+ * @param len Length of the span in bytes
+ * @param iov Array of two iovecs to fill in
+ * @return Number of iovecs used
+ */
+int ring_iov(const struct ring *ring, size_t start, size_t len,
+             struct iovec iov[2]);
+
+/**
+ * Fill free space in the ring with a non-blocking read
+ *
+ * @param ring Ring to read into
+ * @param fd Descriptor to read from
+ * @return Result of the underlying readv() call
+ */
+ssize_t ring_readv(struct ring *ring, int fd);
+
+/**
+ * Drain buffered data from the ring with a non-blocking write
+ *
+ * @param ring Ring to write out of
+ * @param fd Descriptor to write to
+ * @return Result of the underlying writev() call
+ */
+ssize_t ring_writev(struct ring *ring, int fd);
+
+/**
+ * Drain at most a given amount of buffered data from the ring with a
+ * non-blocking write
+ *
+ * @param ring Ring to write out of
+ * @param fd Descriptor to write to
+ * @param max Most bytes to write, at least 1
+ * @return Result of the underlying writev() call
+ */
+ssize_t ring_writev_max(struct ring *ring, int fd, size_t max);
+
+/**
+ * Drain at most a given amount of buffered data from the ring into a
+ * socket with a non-blocking send
+ *
+ * @param ring Ring to write out of
+ * @param fd Socket to send to
+ * @param max Most bytes to send, at least 1
+ * @param flags Flags for sendmsg(), such as MSG_NOSIGNAL
+ * @return Result of the underlying sendmsg() call
+ */
+ssize_t ring_sendmsg_max(struct ring *ring, int fd, size_t max, int flags);
+
+static inline size_t ring_size(const struct ring *ring)
+{
+    return ring->mask + 1;
+}
+
+static inline size_t ring_len(const struct ring *ring)
+{
+    return ring->head - ring->tail;
+}
+
+static inline size_t ring_space(const struct ring *ring)
+{
+    return ring_size(ring) - ring_len(ring);
+}
+
+#endif /* ! defined _NULLTTY_RING_H_ */
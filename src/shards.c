@@ -0,0 +1,323 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shards.h"
+#include "events.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+struct shard {
+    struct nulltty_shards *shards;
+    nulltty_loop_t loop;
+    pthread_t thread;
+    bool started;
+    int cpu;              /* CPU to pin to, or -1 */
+    unsigned long load;   /* Sum of the weights of this shard's pairs */
+    int error;            /* errno of a failed relay loop, or 0 */
+};
+
+struct nulltty_shards {
+    struct shard *shard;
+    size_t n;
+    int done_fds[2];      /* Written to by workers whose relay loop fails */
+    ev_loop_t ev;         /* Main thread's event loop */
+    struct ev_handle done_ev;
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Pin the calling thread to a CPU
+ *
+ * @param cpu CPU number
+ * @return 0 on success, -1 with errno on error
+ */
+static int shard_pin(int cpu)
+{
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+    cpu_set_t set;
+    int err;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if ( err != 0 ) {
+        errno = err;
+        return -1;
+    }
+
+    return 0;
+#else
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
+
+/**
+ * Worker thread entry point
+ *
+ * @param arg The worker's shard
+ * @return NULL
+ */
+static void *shard_main(void *arg)
+{
+    struct shard *shard = arg;
+    const char c = 0;
+
+    if ( ( shard->cpu >= 0 && shard_pin(shard->cpu) < 0 )
+         || nulltty_loop_run(shard->loop, NULL) < 0 ) {
+        shard->error = errno;
+        if ( write(shard->shards->done_fds[1], &c, 1) < 0 )
+            perror("Unable to report relay worker failure");
+    }
+
+    return NULL;
+}
+
+/**
+ * Stop and join every started worker
+ *
+ * @param shards Worker pool
+ */
+static void shards_join(nulltty_shards_t shards)
+{
+    size_t i;
+
+    for ( i = 0; i < shards->n; i++ ) {
+        if ( shards->shard[i].started )
+            nulltty_loop_stop(shards->shard[i].loop);
+    }
+
+    for ( i = 0; i < shards->n; i++ ) {
+        if ( shards->shard[i].started ) {
+            pthread_join(shards->shard[i].thread, NULL);
+            shards->shard[i].started = false;
+        }
+    }
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+nulltty_shards_t nulltty_shards_open(size_t nthreads, const int *cpus,
+                                     size_t ncpus)
+{
+    nulltty_shards_t shards;
+    size_t i;
+
+#ifndef HAVE_PTHREAD_SETAFFINITY_NP
+    if ( ncpus > 0 ) {
+        errno = ENOTSUP;
+        goto error;
+    }
+#endif
+
+    if ( nthreads == 0 || nthreads > SHARDS_MAX ) {
+        errno = EINVAL;
+        goto error;
+    }
+
+    shards = calloc(1, sizeof(struct nulltty_shards));
+    if ( shards == NULL )
+        goto error;
+
+    shards->shard = calloc(nthreads, sizeof(struct shard));
+    if ( shards->shard == NULL )
+        goto error_shards;
+
+    if ( pipe(shards->done_fds) < 0 )
+        goto error_shard;
+
+    shards->ev = ev_open();
+    if ( shards->ev == NULL )
+        goto error_pipe;
+
+    if ( ev_add(shards->ev, &shards->done_ev, shards->done_fds[0], NULL) < 0 )
+        goto error_ev;
+    shards->done_ev.want = EV_READ;
+
+    for ( shards->n = 0; shards->n < nthreads; shards->n++ ) {
+        struct shard *shard = &shards->shard[shards->n];
+
+        shard->shards = shards;
+        shard->cpu = ncpus > 0 ? cpus[shards->n % ncpus] : -1;
+        shard->loop = nulltty_loop_open();
+        if ( shard->loop == NULL )
+            goto error_loops;
+    }
+
+    return shards;
+
+ error_loops:
+    for ( i = 0; i < shards->n; i++ )
+        nulltty_loop_close(shards->shard[i].loop);
+ error_ev:
+    ev_close(shards->ev);
+ error_pipe:
+    close(shards->done_fds[0]);
+    close(shards->done_fds[1]);
+ error_shard:
+    free(shards->shard);
+ error_shards:
+    free(shards);
+ error:
+    return NULL;
+}
+
+int nulltty_shards_close(nulltty_shards_t shards)
+{
+    int result = 0;
+    size_t i;
+
+    shards_join(shards);
+
+    for ( i = 0; i < shards->n; i++ ) {
+        if ( nulltty_loop_close(shards->shard[i].loop) < 0 )
+            result = -1;
+    }
+
+    ev_close(shards->ev);
+    close(shards->done_fds[0]);
+    close(shards->done_fds[1]);
+    free(shards->shard);
+    free(shards);
+
+    return result;
+}
+
+int nulltty_shards_add(nulltty_shards_t shards, nulltty_t nulltty,
+                       unsigned weight)
+{
+    struct shard *least = &shards->shard[0];
+    size_t i;
+
+    for ( i = 1; i < shards->n; i++ ) {
+        if ( shards->shard[i].load < least->load )
+            least = &shards->shard[i];
+    }
+
+    if ( nulltty_loop_add(least->loop, nulltty) < 0 )
+        return -1;
+
+    least->load += weight;
+    return 0;
+}
+
+ev_loop_t nulltty_shards_events(nulltty_shards_t shards)
+{
+    return shards->ev;
+}
+
+void nulltty_shards_printinfo(nulltty_shards_t shards)
+{
+    size_t i;
+
+    if ( shards == NULL )
+        return;
+
+    for ( i = 0; i < shards->n; i++ ) {
+        nulltty_loop_printinfo(shards->shard[i].loop);
+        nulltty_loop_wake(shards->shard[i].loop);
+    }
+}
+
+int nulltty_shards_run(nulltty_shards_t shards, sigsrc_t signals)
+{
+    sigset_t all_set, prev_set;
+    struct ev_handle sig_ev, *active, *next;
+    int err, signum, result = 0;
+    bool stop = false;
+    size_t i;
+
+    if ( ev_add(shards->ev, &sig_ev, sigsrc_fd(signals), NULL) < 0 )
+        return -1;
+    sig_ev.want = EV_READ;
+
+    /*
+     * Workers inherit our signal mask, and are started with every signal
+     * blocked so that process-directed signals always land on us.
+     */
+    sigfillset(&all_set);
+    pthread_sigmask(SIG_BLOCK, &all_set, &prev_set);
+
+    for ( i = 0; i < shards->n; i++ ) {
+        err = pthread_create(&shards->shard[i].thread, NULL, shard_main,
+                             &shards->shard[i]);
+        if ( err != 0 ) {
+            pthread_sigmask(SIG_SETMASK, &prev_set, NULL);
+            errno = err;
+            result = -1;
+            goto end_join;
+        }
+        shards->shard[i].started = true;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &prev_set, NULL);
+
+    while ( ! stop ) {
+        if ( ev_wait(shards->ev, &active, NULL, NULL) < 0 ) {
+            if ( errno == EINTR )
+                continue;
+
+            result = -1;
+            goto end_join;
+        }
+
+        for ( ; active != NULL; active = next ) {
+            /* A callback may free its own handle */
+            next = active->next_active;
+
+            if ( active->callback != NULL ) {
+                if ( active->callback(active) < 0 ) {
+                    result = -1;
+                    goto end_join;
+                }
+                continue;
+            }
+
+            /* A worker has failed */
+            if ( active == &shards->done_ev )
+                stop = true;
+
+            if ( active == &sig_ev ) {
+                sig_ev.ready &= ~EV_READ;
+                while ( ( signum = sigsrc_read(signals) ) > 0 ) {
+                    if ( nulltty_info_signal(signum) )
+                        nulltty_shards_printinfo(shards);
+                    else
+                        stop = true;
+                }
+                if ( signum < 0 ) {
+                    result = -1;
+                    goto end_join;
+                }
+            }
+        }
+    }
+
+ end_join:
+    ev_del(shards->ev, &sig_ev);
+    shards_join(shards);
+
+    for ( i = 0; i < shards->n && result == 0; i++ ) {
+        if ( shards->shard[i].error != 0 ) {
+            errno = shards->shard[i].error;
+            result = -1;
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,88 @@
+#ifndef _NULLTTY_SHARDS_H_
+#define _NULLTTY_SHARDS_H_
+
+#include <stddef.h>
+
+#include "events.h"
+#include "ptys.h"
+#include "sigsrc.h"
+
+/**
+ * Maximum number of relay worker threads
+ */
+#define SHARDS_MAX 256
+
+struct nulltty_shards; /* Forward declaration */
+typedef struct nulltty_shards *nulltty_shards_t;
+
+/**
+ * Create a pool of relay worker threads
+ *
+ * Each worker owns a shard of the PTY pairs, served by its own relay loop.
+ * The threads themselves are not started until nulltty_shards_run().
+ *
+ * @param nthreads Number of worker threads, at most SHARDS_MAX
+ * @param cpus CPUs to pin the workers to, assigned round-robin, or NULL to
+ * leave them unpinned
+ * @param ncpus Number of entries in cpus
+ * @return Worker pool, or NULL with errno on error (ENOTSUP if CPU
+ * affinity was requested on a platform without it)
+ */
+nulltty_shards_t nulltty_shards_open(size_t nthreads, const int *cpus,
+                                     size_t ncpus);
+
+/**
+ * Destroy a worker pool
+ *
+ * The PTY pairs added to the pool are not closed.
+ *
+ * @param shards Worker pool returned by nulltty_shards_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int nulltty_shards_close(nulltty_shards_t shards);
+
+/**
+ * Assign a PTY pair to the least loaded shard
+ *
+ * @param shards Worker pool returned by nulltty_shards_open()
+ * @param nulltty Pointer to structure returned by nulltty_open()
+ * @param weight Expected load of the pair relative to the others
+ * @return 0 on success, -1 with errno on error
+ */
+int nulltty_shards_add(nulltty_shards_t shards, nulltty_t nulltty,
+                       unsigned weight);
+
+/**
+ * Get the event loop of the pool's controlling thread
+ *
+ * Other descriptors may be registered with it, with a callback set in
+ * their handles, to be serviced by the thread calling nulltty_shards_run().
+ *
+ * @param shards Worker pool returned by nulltty_shards_open()
+ * @return Event loop, owned by the pool
+ */
+ev_loop_t nulltty_shards_events(nulltty_shards_t shards);
+
+/**
+ * Relay data on every shard until told to stop
+ *
+ * Starts the worker threads, with all signals blocked, and then waits in
+ * the calling thread for a terminating signal or for a worker to fail,
+ * passing status requests on to the workers meanwhile.  Either way every
+ * worker is then stopped and joined before returning.
+ *
+ * @param shards Worker pool returned by nulltty_shards_open()
+ * @param signals Signal source to watch for termination and status
+ * requests
+ * @return 0 on success (user request termination), -1 with errno on error
+ */
+int nulltty_shards_run(nulltty_shards_t shards, sigsrc_t signals);
+
+/**
+ * Cause every shard to print status reports for its pairs
+ *
+ * @param shards Worker pool returned by nulltty_shards_open()
+ */
+void nulltty_shards_printinfo(nulltty_shards_t shards);
+
+#endif /* ! defined _NULLTTY_SHARDS_H_ */
@@ -0,0 +1,254 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef USE_SIGNALFD
+#include <sys/signalfd.h>
+#endif
+
+#include "sigsrc.h"
+#include "debug.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+struct sigsrc {
+    int fd;
+    sigset_t set;
+#ifdef USE_SIGNALFD
+    sigset_t prev_mask;
+#else
+    int wr_fd;
+#endif
+};
+
+
+/*** SIGNALFD BACKEND *********************************************************/
+
+#ifdef USE_SIGNALFD
+
+sigsrc_t sigsrc_open(const sigset_t *set)
+{
+    sigsrc_t src;
+    int err;
+
+    src = calloc(1, sizeof(struct sigsrc));
+    if ( src == NULL )
+        goto error;
+
+    src->set = *set;
+
+    /* signalfd only sees signals which would otherwise stay pending */
+    err = pthread_sigmask(SIG_BLOCK, set, &src->prev_mask);
+    if ( err != 0 ) {
+        errno = err;
+        goto error_src;
+    }
+
+    src->fd = signalfd(-1, set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if ( src->fd < 0 )
+        goto error_mask;
+
+    return src;
+
+ error_mask:
+    pthread_sigmask(SIG_SETMASK, &src->prev_mask, NULL);
+ error_src:
+    free(src);
+ error:
+    return NULL;
+}
+
+int sigsrc_close(sigsrc_t src)
+{
+    int result = 0;
+
+    if ( close(src->fd) < 0 )
+        result = -1;
+
+    pthread_sigmask(SIG_SETMASK, &src->prev_mask, NULL);
+    free(src);
+    return result;
+}
+
+int sigsrc_read(sigsrc_t src)
+{
+    struct signalfd_siginfo info;
+    ssize_t n;
+
+    do {
+        n = read(src->fd, &info, sizeof(info));
+    } while ( n < 0 && errno == EINTR );
+
+    if ( n < 0 )
+        return errno == EAGAIN ? 0 : -1;
+
+    if ( n != sizeof(info) ) {
+        errno = EIO;
+        return -1;
+    }
+
+    return info.ssi_signo;
+}
+
+#endif /* USE_SIGNALFD */
+
+
+/*** SELF-PIPE BACKEND ********************************************************/
+
+#ifndef USE_SIGNALFD
+
+/** Write end of the self-pipe, for the benefit of the signal handler */
+static volatile int sigsrc_wr_fd = -1;
+
+static void sigsrc_handler(int signum)
+{
+    unsigned char c = signum;
+    int saved_errno = errno;
+
+    /* If the pipe is full the signal is dropped, but the reader will wake up
+     * for the ones already queued */
+    if ( write(sigsrc_wr_fd, &c, 1) < 0 ) {
+        /* Nothing else we can safely do about it here */
+    }
+
+    errno = saved_errno;
+}
+
+static int set_flags(int fd)
+{
+    int flags;
+
+    if ( ( flags = fcntl(fd, F_GETFL) ) < 0
+         || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 )
+        return -1;
+
+    if ( ( flags = fcntl(fd, F_GETFD) ) < 0
+         || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0 )
+        return -1;
+
+    return 0;
+}
+
+static void restore_handlers(const sigset_t *set)
+{
+    struct sigaction action;
+    int signum;
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = SIG_DFL;
+
+    for ( signum = 1; signum < NSIG; signum++ ) {
+        if ( sigismember(set, signum) == 1 )
+            sigaction(signum, &action, NULL);
+    }
+}
+
+sigsrc_t sigsrc_open(const sigset_t *set)
+{
+    struct sigaction action;
+    sigsrc_t src;
+    int fds[2], signum, err;
+
+    if ( sigsrc_wr_fd >= 0 ) {
+        errno = EBUSY;
+        goto error;
+    }
+
+    src = calloc(1, sizeof(struct sigsrc));
+    if ( src == NULL )
+        goto error;
+
+    src->set = *set;
+
+    if ( pipe(fds) < 0 )
+        goto error_src;
+    if ( set_flags(fds[0]) < 0 || set_flags(fds[1]) < 0 )
+        goto error_pipe;
+
+    src->fd = fds[0];
+    src->wr_fd = fds[1];
+    sigsrc_wr_fd = fds[1];
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = sigsrc_handler;
+
+    for ( signum = 1; signum < NSIG; signum++ ) {
+        if ( sigismember(set, signum) == 1
+             && sigaction(signum, &action, NULL) < 0 )
+            goto error_handlers;
+    }
+
+    /* We may have been started with some of them blocked */
+    err = pthread_sigmask(SIG_UNBLOCK, set, NULL);
+    if ( err != 0 ) {
+        errno = err;
+        goto error_handlers;
+    }
+
+    return src;
+
+ error_handlers:
+    restore_handlers(set);
+    sigsrc_wr_fd = -1;
+ error_pipe:
+    close(fds[0]);
+    close(fds[1]);
+ error_src:
+    free(src);
+ error:
+    return NULL;
+}
+
+int sigsrc_close(sigsrc_t src)
+{
+    int result = 0;
+
+    restore_handlers(&src->set);
+    sigsrc_wr_fd = -1;
+
+    if ( close(src->fd) < 0 )
+        result = -1;
+    if ( close(src->wr_fd) < 0 )
+        result = -1;
+
+    free(src);
+    return result;
+}
+
+int sigsrc_read(sigsrc_t src)
+{
+    unsigned char c;
+    ssize_t n;
+
+    do {
+        n = read(src->fd, &c, 1);
+    } while ( n < 0 && errno == EINTR );
+
+    if ( n < 0 )
+        return errno == EAGAIN ? 0 : -1;
+
+    if ( n == 0 ) {
+        errno = EIO;
+        return -1;
+    }
+
+    return c;
+}
+
+#endif /* ! defined USE_SIGNALFD */
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+int sigsrc_fd(sigsrc_t src)
+{
+    return src->fd;
+}
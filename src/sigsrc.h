@@ -0,0 +1,62 @@
+#ifndef _NULLTTY_SIGSRC_H_
+#define _NULLTTY_SIGSRC_H_
+
+#include <signal.h>
+
+/**
+ * Signals delivered as descriptor readiness
+ *
+ * Turns a set of signals into a descriptor which becomes readable when
+ * any of them arrives, so that the relay loop can wait for signals and
+ * PTY traffic in the same call without juggling the signal mask around
+ * it.  On Linux this is a signalfd, with the signals blocked in the
+ * calling thread (and in any threads it creates afterwards); elsewhere
+ * it is the read end of a self-pipe written to by a signal handler.
+ *
+ * Only one signal source may exist at a time.
+ *
+ * Under strict ISO C, sigset_t needs a POSIX feature test macro (see
+ * ptys.h).
+ */
+
+struct sigsrc; /* Forward declaration */
+typedef struct sigsrc *sigsrc_t;
+
+/**
+ * Start receiving signals through a descriptor
+ *
+ * Must be called before any other threads are created.
+ *
+ * @param set Signals to receive
+ * @return Signal source, or NULL with errno on error
+ */
+sigsrc_t sigsrc_open(const sigset_t *set);
+
+/**
+ * Stop receiving signals through a descriptor
+ *
+ * Restores the signal mask and dispositions in place before
+ * sigsrc_open().
+ *
+ * @param src Signal source returned by sigsrc_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int sigsrc_close(sigsrc_t src);
+
+/**
+ * Get the descriptor to wait on for readability
+ *
+ * @param src Signal source returned by sigsrc_open()
+ * @return Non-blocking descriptor
+ */
+int sigsrc_fd(sigsrc_t src);
+
+/**
+ * Collect the next pending signal
+ *
+ * @param src Signal source returned by sigsrc_open()
+ * @return Signal number, 0 if none are pending, or -1 with errno on error
+ */
+int sigsrc_read(sigsrc_t src);
+
+#endif /* ! defined _NULLTTY_SIGSRC_H_ */
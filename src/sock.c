@@ -0,0 +1,427 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "sock.h"
+#include "util.h"
+#include "debug.h"
+
+/* BSD spells TCP_CORK as TCP_NOPUSH */
+#if ! defined TCP_CORK && defined TCP_NOPUSH
+#define TCP_CORK TCP_NOPUSH
+#endif
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Make a freshly connected socket ready for relaying
+ */
+static int sock_setup(const struct sock_spec *spec, int fd)
+{
+    int on = 1;
+
+    if ( sock_nonblock(fd) < 0 )
+        return -1;
+
+    if ( ( spec->flags & SOCK_NODELAY )
+         && setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0 )
+        return -1;
+
+    return 0;
+}
+
+static int sock_unix_addr(const struct sock_spec *spec,
+                          struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if ( strlcpy(addr->sun_path, spec->path, sizeof(addr->sun_path))
+         >= sizeof(addr->sun_path) ) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Split a TCP address into host and port
+ *
+ * @param spec Socket address to fill in
+ * @param addr [host:]port, with the host optional only when listening
+ * @param len Length of addr
+ * @return 0 on success, -1 with errno on error
+ */
+static int sock_parse_tcp(struct sock_spec *spec, const char *addr, size_t len)
+{
+    const char *colon = NULL, *p;
+    size_t host_len;
+
+    for ( p = addr; p < addr + len; p++ )
+        if ( *p == ':' )
+            colon = p;
+
+    if ( colon == NULL ) {
+        if ( ! spec->listen ) {
+            errno = EINVAL;
+            return -1;
+        }
+        colon = addr - 1;
+    }
+
+    spec->port = strndup(colon + 1, addr + len - ( colon + 1 ));
+    if ( spec->port == NULL )
+        return -1;
+    if ( spec->port[0] == '\0' ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    host_len = colon >= addr ? (size_t)( colon - addr ) : 0;
+    if ( host_len >= 2 && addr[0] == '[' && addr[host_len-1] == ']' ) {
+        addr++;
+        host_len -= 2;
+    }
+    if ( host_len == 0 ) {
+        if ( ! spec->listen ) {
+            errno = EINVAL;
+            return -1;
+        }
+        return 0;
+    }
+
+    spec->host = strndup(addr, host_len);
+    return spec->host != NULL ? 0 : -1;
+}
+
+/**
+ * Parse a Unix-domain socket path, made absolute so that a listening
+ * socket can still be removed after daemonizing
+ */
+static int sock_parse_unix(struct sock_spec *spec, const char *addr,
+                           size_t len)
+{
+    if ( len == 0 ) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    spec->path = abs_path(addr, len);
+    return spec->path != NULL ? 0 : -1;
+}
+
+/**
+ * Apply a comma-separated list of options
+ */
+static int sock_parse_opts(struct sock_spec *spec, const char *opts)
+{
+    const char *opt = opts, *end;
+    size_t len;
+
+    while ( *opt != '\0' ) {
+        end = strchr(opt, ',');
+        len = end != NULL ? (size_t)( end - opt ) : strlen(opt);
+
+        if ( spec->unix_domain ) {
+            errno = EINVAL;
+            return -1;
+        } else if ( len == 7 && strncmp(opt, "nodelay", len) == 0 ) {
+            spec->flags |= SOCK_NODELAY;
+        } else if ( len == 5 && strncmp(opt, "delay", len) == 0 ) {
+            spec->flags &= ~SOCK_NODELAY;
+        } else if ( len == 4 && strncmp(opt, "cork", len) == 0 ) {
+#ifdef TCP_CORK
+            spec->flags |= SOCK_CORK;
+#else
+            errno = ENOTSUP;
+            return -1;
+#endif
+        } else {
+            errno = EINVAL;
+            return -1;
+        }
+
+        opt += len;
+        if ( *opt == ',' )
+            opt++;
+    }
+
+    return 0;
+}
+
+/**
+ * Length of a socket address prefix, including its colon
+ *
+ * @return Length, or 0 if name doesn't start with prefix
+ */
+static size_t prefix_len(const char *name, const char *prefix)
+{
+    size_t len = strlen(prefix);
+
+    if ( strncmp(name, prefix, len) != 0 || name[len] != ':' )
+        return 0;
+
+    return len + 1;
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+int sock_nonblock(int fd)
+{
+    int flags;
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+
+    if ( setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on)) < 0 )
+        return -1;
+#endif
+
+    if ( ( flags = fcntl(fd, F_GETFL) ) < 0
+         || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 )
+        return -1;
+
+    if ( ( flags = fcntl(fd, F_GETFD) ) < 0
+         || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) < 0 )
+        return -1;
+
+    return 0;
+}
+
+bool sock_is_spec(const char *name)
+{
+    return prefix_len(name, "tcp") > 0 || prefix_len(name, "tcp-listen") > 0
+        || prefix_len(name, "unix") > 0 || prefix_len(name, "unix-listen") > 0;
+}
+
+struct sock_spec *sock_parse(const char *name)
+{
+    struct sock_spec *spec;
+    const char *addr, *opts;
+    size_t len;
+
+    spec = calloc(1, sizeof(struct sock_spec));
+    if ( spec == NULL )
+        return NULL;
+
+    if ( ( len = prefix_len(name, "tcp") ) > 0 ) {
+        spec->flags = SOCK_NODELAY;
+    } else if ( ( len = prefix_len(name, "tcp-listen") ) > 0 ) {
+        spec->flags = SOCK_NODELAY;
+        spec->listen = true;
+    } else if ( ( len = prefix_len(name, "unix") ) > 0 ) {
+        spec->unix_domain = true;
+    } else if ( ( len = prefix_len(name, "unix-listen") ) > 0 ) {
+        spec->unix_domain = true;
+        spec->listen = true;
+    } else {
+        errno = EINVAL;
+        goto error;
+    }
+
+    addr = name + len;
+    opts = strchr(addr, ',');
+    len = opts != NULL ? (size_t)( opts - addr ) : strlen(addr);
+
+    if ( spec->unix_domain ) {
+        if ( sock_parse_unix(spec, addr, len) < 0 )
+            goto error;
+    } else {
+        if ( sock_parse_tcp(spec, addr, len) < 0 )
+            goto error;
+    }
+
+    if ( opts != NULL && sock_parse_opts(spec, opts + 1) < 0 )
+        goto error;
+
+    return spec;
+
+ error:
+    sock_free(spec);
+    return NULL;
+}
+
+void sock_free(struct sock_spec *spec)
+{
+    if ( spec == NULL )
+        return;
+
+    free(spec->host);
+    free(spec->port);
+    free(spec->path);
+    free(spec);
+}
+
+int sock_listen(const struct sock_spec *spec)
+{
+    struct addrinfo hints, *res, *ai;
+    struct sockaddr_un addr;
+    int fd = -1, on = 1, result;
+
+    if ( spec->unix_domain ) {
+        if ( sock_unix_addr(spec, &addr) < 0 )
+            return -1;
+
+        if ( ( fd = socket(AF_UNIX, SOCK_STREAM, 0) ) < 0 )
+            return -1;
+
+        if ( sock_nonblock(fd) < 0
+             || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+            goto error_socket;
+
+        if ( listen(fd, 1) < 0 ) {
+            unlink(spec->path);
+            goto error_socket;
+        }
+
+        return fd;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    result = getaddrinfo(spec->host, spec->port, &hints, &res);
+    if ( result != 0 ) {
+        if ( result != EAI_SYSTEM )
+            errno = EINVAL;
+        return -1;
+    }
+
+    for ( ai = res; ai != NULL; ai = ai->ai_next ) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if ( fd < 0 )
+            continue;
+
+        if ( setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) == 0
+             && sock_nonblock(fd) == 0
+             && bind(fd, ai->ai_addr, ai->ai_addrlen) == 0
+             && listen(fd, 1) == 0 )
+            break;
+
+        result = errno;
+        close(fd);
+        fd = -1;
+        errno = result;
+    }
+    freeaddrinfo(res);
+
+    return fd;
+
+ error_socket:
+    result = errno;
+    close(fd);
+    errno = result;
+    return -1;
+}
+
+int sock_accept(const struct sock_spec *spec, int fd)
+{
+    int conn;
+
+    if ( ( conn = accept(fd, NULL, NULL) ) < 0 )
+        return -1;
+
+    if ( sock_setup(spec, conn) < 0 ) {
+        close(conn);
+        return -1;
+    }
+
+    return conn;
+}
+
+int sock_connect(const struct sock_spec *spec)
+{
+    struct addrinfo hints, *res, *ai;
+    struct sockaddr_un addr;
+    int fd = -1, result;
+
+    if ( spec->unix_domain ) {
+        if ( sock_unix_addr(spec, &addr) < 0 )
+            return -1;
+
+        if ( ( fd = socket(AF_UNIX, SOCK_STREAM, 0) ) < 0 )
+            return -1;
+
+        if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 )
+            goto error_socket;
+    } else {
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+
+        result = getaddrinfo(spec->host, spec->port, &hints, &res);
+        if ( result != 0 ) {
+            if ( result != EAI_SYSTEM )
+                errno = EINVAL;
+            return -1;
+        }
+
+        for ( ai = res; ai != NULL; ai = ai->ai_next ) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if ( fd < 0 )
+                continue;
+
+            if ( connect(fd, ai->ai_addr, ai->ai_addrlen) == 0 )
+                break;
+
+            result = errno;
+            close(fd);
+            fd = -1;
+            errno = result;
+        }
+        freeaddrinfo(res);
+
+        if ( fd < 0 )
+            return -1;
+    }
+
+    if ( sock_setup(spec, fd) < 0 )
+        goto error_socket;
+
+    return fd;
+
+ error_socket:
+    result = errno;
+    close(fd);
+    errno = result;
+    return -1;
+}
+
+int sock_unlisten(const struct sock_spec *spec, int fd)
+{
+    int result = 0;
+
+    if ( close(fd) < 0 )
+        result = -1;
+    if ( spec->unix_domain && unlink(spec->path) < 0 )
+        result = -1;
+
+    return result;
+}
+
+int sock_cork(int fd, bool cork)
+{
+#ifdef TCP_CORK
+    int on = cork;
+
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+#else
+    (void)fd;
+    (void)cork;
+    errno = ENOTSUP;
+    return -1;
+#endif
+}
@@ -0,0 +1,131 @@
+#ifndef _NULLTTY_SOCK_H_
+#define _NULLTTY_SOCK_H_
+
+#include <stdbool.h>
+#include <sys/socket.h>
+
+/**
+ * Stream socket endpoints
+ *
+ * Either side of a pair may be a stream socket rather than a
+ * pseudoterminal, named by a prefixed address in place of the symlink
+ * path:
+ *
+ *   tcp:host:port              Connect to a TCP server
+ *   tcp-listen:[host:]port     Accept a TCP client, on all interfaces
+ *                              unless a host is given
+ *   unix:path                  Connect to a Unix-domain socket
+ *   unix-listen:path           Accept a client on a Unix-domain socket
+ *
+ * IPv6 addresses go in brackets.  TCP addresses may be followed by
+ * options, separated by commas: "nodelay" (the default) disables Nagle's
+ * algorithm, "delay" leaves it enabled, and "cork" holds back partial
+ * segments for as long as each pass of the relay is writing.
+ *
+ * Connections are made up front and in blocking mode; the descriptors are
+ * then switched to non-blocking, for relaying like any other endpoint.
+ */
+
+/* Writes to a socket whose peer has gone must not raise SIGPIPE, so are
+ * sent with MSG_NOSIGNAL; platforms without it have SO_NOSIGPIPE set by
+ * sock_nonblock() instead */
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/** Disable Nagle's algorithm */
+#define SOCK_NODELAY 0x01
+/** Cork the socket while relaying writes to it */
+#define SOCK_CORK    0x02
+
+struct sock_spec {
+    bool unix_domain;
+    bool listen;
+    char *host;          /* NULL to listen on all interfaces */
+    char *port;
+    char *path;          /* Unix-domain sockets only */
+    unsigned flags;      /* SOCK_NODELAY, SOCK_CORK */
+};
+
+/**
+ * Whether an endpoint name is a socket address rather than a path
+ *
+ * @param name Endpoint name
+ * @return Whether it has one of the socket address prefixes
+ */
+bool sock_is_spec(const char *name);
+
+/**
+ * Parse a socket address
+ *
+ * @param name Endpoint name for which sock_is_spec() holds
+ * @return Newly allocated address, or NULL with errno on error (EINVAL if
+ * the address is malformed, ENOTSUP for cork on a platform without it)
+ */
+struct sock_spec *sock_parse(const char *name);
+
+/**
+ * Free a socket address returned by sock_parse()
+ *
+ * @param spec Socket address
+ */
+void sock_free(struct sock_spec *spec);
+
+/**
+ * Create a non-blocking listening socket
+ *
+ * @param spec Socket address, in listen mode
+ * @return Listening descriptor, or -1 with errno on error
+ */
+int sock_listen(const struct sock_spec *spec);
+
+/**
+ * Accept a client on a listening socket
+ *
+ * @param spec Socket address the descriptor listens on
+ * @param fd Descriptor returned by sock_listen()
+ * @return Non-blocking descriptor of the connection, or -1 with errno on
+ * error (EAGAIN if no client is waiting)
+ */
+int sock_accept(const struct sock_spec *spec, int fd);
+
+/**
+ * Make a socket non-blocking and close-on-exec, and keep writes to it
+ * from raising SIGPIPE where MSG_NOSIGNAL can't
+ *
+ * @param fd Socket descriptor
+ * @return 0 on success, -1 with errno on error
+ */
+int sock_nonblock(int fd);
+
+/**
+ * Connect to a socket address
+ *
+ * @param spec Socket address, in connect mode
+ * @return Non-blocking descriptor of the connection, or -1 with errno on
+ * error
+ */
+int sock_connect(const struct sock_spec *spec);
+
+/**
+ * Close a listening socket, removing its path if Unix-domain
+ *
+ * @param spec Socket address the descriptor listens on
+ * @param fd Descriptor returned by sock_listen()
+ * @return 0 on success, -1 with errno on error
+ */
+int sock_unlisten(const struct sock_spec *spec, int fd);
+
+/**
+ * Cork or uncork a TCP connection
+ *
+ * Uncorking sends any partial segment held back.
+ *
+ * @param fd Connection descriptor
+ * @param cork Whether to cork
+ * @return 0 on success, -1 with errno on error (ENOTSUP on a platform
+ * without corking)
+ */
+int sock_cork(int fd, bool cork);
+
+#endif /* ! defined _NULLTTY_SOCK_H_ */
@@ -0,0 +1,103 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "statfile.h"
+#include "util.h"
+#include "debug.h"
+
+
+/*** DATA STRUCTURES **********************************************************/
+
+struct statfile {
+    char *path;
+    void *map;
+    size_t size;
+};
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+statfile_t statfile_open(const char *path, const nulltty_t *pairs, size_t n)
+{
+    union statfile_header *header;
+    struct statfile_pair *records;
+    struct nulltty_info info;
+    statfile_t sf;
+    size_t i;
+    int fd;
+
+    sf = calloc(1, sizeof(struct statfile));
+    if ( sf == NULL )
+        goto error;
+
+    if ( ( sf->path = abs_path(path, strlen(path)) ) == NULL )
+        goto error_sf;
+
+    fd = open(sf->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+        goto error_path;
+
+    sf->size = sizeof(union statfile_header) + n * sizeof(struct statfile_pair);
+    if ( ftruncate(fd, sf->size) < 0 )
+        goto error_file;
+
+    sf->map = mmap(NULL, sf->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if ( sf->map == MAP_FAILED )
+        goto error_file;
+    close(fd);
+
+    header = sf->map;
+    header->info.version = STATFILE_VERSION;
+    header->info.npairs = n;
+    header->info.header_size = sizeof(union statfile_header);
+    header->info.record_size = sizeof(struct statfile_pair);
+    header->info.pid = getpid();
+
+    records = (struct statfile_pair *)( header + 1 );
+    for ( i = 0; i < n; i++ ) {
+        nulltty_get_info(pairs[i], &info);
+        strlcpy(records[i].link_a, info.link_a, STATFILE_LINK_MAX);
+        strlcpy(records[i].link_b, info.link_b, STATFILE_LINK_MAX);
+        strlcpy(records[i].mode, nulltty_mode_name(info.mode), STATFILE_LINE);
+        nulltty_share_stats(pairs[i], &records[i].a_to_b.stats,
+                            &records[i].b_to_a.stats);
+    }
+
+#ifdef HAVE_ATOMIC_BUILTINS
+    __atomic_store_n(&header->info.magic, STATFILE_MAGIC, __ATOMIC_RELEASE);
+#else
+    header->info.magic = STATFILE_MAGIC;
+#endif
+    return sf;
+
+ error_file:
+    close(fd);
+    unlink(sf->path);
+ error_path:
+    free(sf->path);
+ error_sf:
+    free(sf);
+ error:
+    return NULL;
+}
+
+int statfile_close(statfile_t sf)
+{
+    int result = 0;
+
+    if ( munmap(sf->map, sf->size) < 0 )
+        result = -1;
+    if ( unlink(sf->path) < 0 )
+        result = -1;
+
+    free(sf->path);
+    free(sf);
+    return result;
+}
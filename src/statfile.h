@@ -0,0 +1,93 @@
+#ifndef _NULLTTY_STATFILE_H_
+#define _NULLTTY_STATFILE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ptys.h"
+
+/**
+ * Memory-mapped statistics file
+ *
+ * Publishes the counters of every PTY pair (see struct nulltty_stats) in a
+ * file which the relay maps shared and updates in place.  Monitoring tools
+ * such as nulltty-stat map the same file and read the counters directly,
+ * without any system calls into, or wakeups of, the relay.
+ *
+ * The file holds a header followed by one record per pair.  Each
+ * direction's counters start on a cache line of their own, so that pairs
+ * relayed by different threads never write to the same line.  The header's
+ * magic number is stored last, with release ordering, once the rest of the
+ * file is in place.
+ *
+ * Counters are written with relaxed atomic stores and should be read with
+ * relaxed atomic loads; no ordering holds between different counters.
+ */
+
+/** "NULLTTYS", identifying a statistics file */
+#define STATFILE_MAGIC UINT64_C(0x5359545454554c4e)
+
+/** Bumped whenever the layout of the file changes */
+#define STATFILE_VERSION 2
+
+/** Cache line size the layout is padded to */
+#define STATFILE_LINE 64
+
+/** Space for each PTY path, including the terminating NUL; longer paths
+ * are truncated */
+#define STATFILE_LINK_MAX 256
+
+struct statfile_info {
+    uint64_t magic;        /**< STATFILE_MAGIC once the file is ready */
+    uint32_t version;      /**< STATFILE_VERSION */
+    uint32_t npairs;       /**< Number of pair records following */
+    uint32_t header_size;  /**< sizeof(union statfile_header) */
+    uint32_t record_size;  /**< sizeof(struct statfile_pair) */
+    int64_t pid;           /**< Relay process */
+};
+
+union statfile_header {
+    struct statfile_info info;
+    char pad[STATFILE_LINE];
+};
+
+/** One direction's counters, padded out to whole cache lines */
+union statfile_stats {
+    struct nulltty_stats stats;
+    char pad[( sizeof(struct nulltty_stats) + STATFILE_LINE - 1 )
+             / STATFILE_LINE * STATFILE_LINE];
+};
+
+struct statfile_pair {
+    union statfile_stats a_to_b;
+    union statfile_stats b_to_a;
+    char link_a[STATFILE_LINK_MAX];
+    char link_b[STATFILE_LINK_MAX];
+    char mode[STATFILE_LINE];
+};
+
+struct statfile; /* Forward declaration */
+typedef struct statfile *statfile_t;
+
+/**
+ * Create a statistics file and move the pairs' counters into it
+ *
+ * Any existing file at the path is replaced.  The pairs must not be
+ * relayed yet, nor after the file is closed.
+ *
+ * @param path Path of the file to create
+ * @param pairs PTY pairs to publish
+ * @param n Number of pairs
+ * @return Statistics file, or NULL with errno on error
+ */
+statfile_t statfile_open(const char *path, const nulltty_t *pairs, size_t n);
+
+/**
+ * Unmap and remove a statistics file
+ *
+ * @param sf Statistics file returned by statfile_open()
+ * @return 0 on success, -1 with errno on error
+ */
+int statfile_close(statfile_t sf);
+
+#endif /* ! defined _NULLTTY_STATFILE_H_ */
@@ -0,0 +1,160 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "uring.h"
+#include "debug.h"
+
+
+/*** SYSTEM CALLS *************************************************************/
+
+static inline int sys_io_uring_setup(unsigned entries,
+                                     struct io_uring_params *params)
+{
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static inline int sys_io_uring_enter(int fd, unsigned to_submit,
+                                     unsigned min_complete, unsigned flags,
+                                     const sigset_t *sigmask)
+{
+#ifdef DEBUG
+    nsyscalls++;
+    nselects++;
+#endif
+    /* The kernel's sigset_t is only _NSIG bits long, unlike libc's */
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   sigmask, _NSIG / 8);
+}
+
+static inline int sys_io_uring_register(int fd, unsigned opcode,
+                                        const void *arg, unsigned nr_args)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+int uring_init(struct uring *ring, unsigned entries)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(ring, 0, sizeof(struct uring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = sys_io_uring_setup(entries, &p);
+    if ( ring->fd < 0 )
+        goto error;
+
+    ring->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->sq_ring = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_SQ_RING);
+    if ( ring->sq_ring == MAP_FAILED )
+        goto error_setup;
+
+    ring->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->cq_ring = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring->fd,
+                         IORING_OFF_CQ_RING);
+    if ( ring->cq_ring == MAP_FAILED )
+        goto error_sq_ring;
+
+    ring->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if ( ring->sqes == MAP_FAILED )
+        goto error_cq_ring;
+
+    sq = ring->sq_ring;
+    ring->sq_head  = (unsigned *)( sq + p.sq_off.head );
+    ring->sq_tail  = (unsigned *)( sq + p.sq_off.tail );
+    ring->sq_mask  = (unsigned *)( sq + p.sq_off.ring_mask );
+    ring->sq_array = (unsigned *)( sq + p.sq_off.array );
+
+    cq = ring->cq_ring;
+    ring->cq_head = (unsigned *)( cq + p.cq_off.head );
+    ring->cq_tail = (unsigned *)( cq + p.cq_off.tail );
+    ring->cq_mask = (unsigned *)( cq + p.cq_off.ring_mask );
+    ring->cqes    = (struct io_uring_cqe *)( cq + p.cq_off.cqes );
+
+    return 0;
+
+ error_cq_ring:
+    munmap(ring->cq_ring, ring->cq_ring_sz);
+ error_sq_ring:
+    munmap(ring->sq_ring, ring->sq_ring_sz);
+ error_setup:
+    close(ring->fd);
+ error:
+    return -1;
+}
+
+void uring_free(struct uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_sz);
+    munmap(ring->cq_ring, ring->cq_ring_sz);
+    munmap(ring->sq_ring, ring->sq_ring_sz);
+    close(ring->fd);
+}
+
+int uring_register_buffers(struct uring *ring, const struct iovec *iov,
+                           unsigned n)
+{
+    return sys_io_uring_register(ring->fd, IORING_REGISTER_BUFFERS, iov, n);
+}
+
+struct io_uring_sqe *uring_get_sqe(struct uring *ring)
+{
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *ring->sq_tail;
+    unsigned index;
+
+    if ( tail - head > *ring->sq_mask )
+        return NULL;
+
+    index = tail & *ring->sq_mask;
+    ring->sq_array[index] = index;
+    memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+
+    /* Published to the kernel straight away; it won't look until we enter */
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    return &ring->sqes[index];
+}
+
+int uring_enter(struct uring *ring, unsigned min_complete,
+                const sigset_t *sigmask)
+{
+    /*
+     * Work out how much is outstanding from the kernel's own head rather
+     * than keeping count ourselves, since an interrupted wait may or may
+     * not have consumed earlier submissions.
+     */
+    unsigned pending = *ring->sq_tail
+        - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+    return sys_io_uring_enter(ring->fd, pending, min_complete,
+                              IORING_ENTER_GETEVENTS, sigmask);
+}
+
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring)
+{
+    unsigned head = *ring->cq_head;
+
+    if ( head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE) )
+        return NULL;
+
+    return &ring->cqes[head & *ring->cq_mask];
+}
+
+void uring_cqe_seen(struct uring *ring)
+{
+    __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
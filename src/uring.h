@@ -0,0 +1,99 @@
+#ifndef _NULLTTY_URING_H_
+#define _NULLTTY_URING_H_
+
+#include <signal.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/**
+ * Minimal io_uring wrapper
+ *
+ * Just enough of the io_uring interface for the relay, talking to the
+ * kernel directly through the raw system calls so that we don't depend on
+ * liburing.  Submission queue entries are queued with uring_get_sqe() and
+ * handed to the kernel in a batch by the next uring_enter(), which can
+ * also wait for completions in the same system call.
+ */
+struct uring {
+    int fd;
+
+    void *sq_ring;
+    size_t sq_ring_sz;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_sz;
+
+    void *cq_ring;
+    size_t cq_ring_sz;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+/**
+ * Set up an io_uring instance
+ *
+ * @param ring Structure to initialize
+ * @param entries Number of submission queue entries
+ * @return 0 on success, -1 with errno on error
+ */
+int uring_init(struct uring *ring, unsigned entries);
+
+/**
+ * Tear down an io_uring instance, cancelling any requests in flight
+ *
+ * @param ring Ring initialized with uring_init()
+ */
+void uring_free(struct uring *ring);
+
+/**
+ * Register fixed buffers for use with READ_FIXED and WRITE_FIXED
+ *
+ * @param ring Ring initialized with uring_init()
+ * @param iov Buffers to register, indexed from zero
+ * @param n Number of buffers
+ * @return 0 on success, -1 with errno on error
+ */
+int uring_register_buffers(struct uring *ring, const struct iovec *iov,
+                           unsigned n);
+
+/**
+ * Get a zeroed submission queue entry to fill in
+ *
+ * @param ring Ring initialized with uring_init()
+ * @return Submission queue entry, or NULL if the queue is full
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *ring);
+
+/**
+ * Submit queued entries and wait for completions
+ *
+ * @param ring Ring initialized with uring_init()
+ * @param min_complete Number of completions to wait for
+ * @param sigmask Signal mask to apply for the duration of the wait, or
+ * NULL to leave the current mask in place
+ * @return Number of entries submitted, or -1 with errno on error
+ */
+int uring_enter(struct uring *ring, unsigned min_complete,
+                const sigset_t *sigmask);
+
+/**
+ * Get the next completion, if any
+ *
+ * @param ring Ring initialized with uring_init()
+ * @return Completion queue entry, or NULL if none are pending
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *ring);
+
+/**
+ * Release the completion returned by uring_peek_cqe()
+ *
+ * @param ring Ring initialized with uring_init()
+ */
+void uring_cqe_seen(struct uring *ring);
+
+#endif /* ! defined _NULLTTY_URING_H_ */
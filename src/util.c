@@ -0,0 +1,32 @@
+#include <stubs.h>
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "debug.h"
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+char *abs_path(const char *path, size_t len)
+{
+    char cwd[PATH_MAX];
+    char *result;
+    size_t size;
+
+    if ( len > 0 && path[0] == '/' )
+        return strndup(path, len);
+
+    if ( getcwd(cwd, sizeof(cwd)) == NULL )
+        return NULL;
+
+    size = strlen(cwd) + len + 2;
+    if ( ( result = malloc(size) ) != NULL )
+        snprintf(result, size, "%s/%.*s", cwd, (int)len, path);
+
+    return result;
+}
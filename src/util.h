@@ -0,0 +1,37 @@
+#ifndef _NULLTTY_UTIL_H_
+#define _NULLTTY_UTIL_H_
+
+#include <stddef.h>
+
+/**
+ * Small helpers shared between modules
+ */
+
+/**
+ * Round a buffer size up to the next power of two
+ *
+ * @param n Requested size
+ * @return Smallest power of two no less than n
+ */
+static inline size_t round_pow2(size_t n)
+{
+    size_t size = 1;
+
+    while ( size < n )
+        size <<= 1;
+
+    return size;
+}
+
+/**
+ * Make a path absolute, against the current directory, so that what it
+ * names can still be cleaned up after daemonizing or changing directory
+ *
+ * @param path Path, not necessarily NUL-terminated
+ * @param len Length of the path
+ * @return Absolute path, to be freed by the caller, or NULL with errno
+ * on error
+ */
+char *abs_path(const char *path, size_t len);
+
+#endif /* ! defined _NULLTTY_UTIL_H_ */
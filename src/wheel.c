@@ -0,0 +1,185 @@
+#include <stubs.h>
+
+#include <stddef.h>
+
+#include "wheel.h"
+
+#define WHEEL_MASK ( WHEEL_SLOTS - 1 )
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+/**
+ * Index of the least significant bit set in a non-zero value
+ */
+static unsigned lsb64(uint64_t v)
+{
+    unsigned i = 0;
+
+    if ( ! ( v & 0xffffffff ) ) { v >>= 32; i += 32; }
+    if ( ! ( v & 0xffff ) )     { v >>= 16; i += 16; }
+    if ( ! ( v & 0xff ) )       { v >>= 8;  i += 8; }
+    if ( ! ( v & 0xf ) )        { v >>= 4;  i += 4; }
+    if ( ! ( v & 0x3 ) )        { v >>= 2;  i += 2; }
+    if ( ! ( v & 0x1 ) )        i += 1;
+
+    return i;
+}
+
+/**
+ * File a timer into the slot for its due tick
+ *
+ * That is in the lowest level on whose current turn the tick falls, which
+ * is never the level's current slot: that was already cascaded when the
+ * wheel came to it.
+ *
+ * @param wheel Wheel
+ * @param timer Timer, not pending, due after wheel->now
+ */
+static void wheel_insert(struct wheel *wheel, struct wheel_timer *timer)
+{
+    struct wheel_timer **head;
+    uint64_t at = timer->due;
+    unsigned level = 0, shift = 0;
+
+    while ( ( at >> shift ) - ( wheel->now >> shift ) >= WHEEL_SLOTS ) {
+        if ( level == WHEEL_LEVELS - 1 ) {
+            /* Beyond the wheel's reach: wait in the furthest slot */
+            at = ( ( wheel->now >> shift ) + WHEEL_SLOTS - 1 ) << shift;
+            break;
+        }
+
+        level++;
+        shift += WHEEL_BITS;
+    }
+
+    timer->level = level;
+    timer->slot = ( at >> shift ) & WHEEL_MASK;
+
+    head = &wheel->slots[level][timer->slot];
+    timer->next = *head;
+    if ( *head != NULL )
+        (*head)->pprev = &timer->next;
+    timer->pprev = head;
+    *head = timer;
+
+    wheel->occupied[level] |= (uint64_t)1 << timer->slot;
+}
+
+/**
+ * Empty one of a wheel's slots
+ *
+ * @return The slot's timers, still marked as pending
+ */
+static struct wheel_timer *wheel_take(struct wheel *wheel, unsigned level,
+                                      unsigned slot)
+{
+    struct wheel_timer *list = wheel->slots[level][slot];
+
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~( (uint64_t)1 << slot );
+    return list;
+}
+
+
+/*** INTERFACE FUNCTIONS ******************************************************/
+
+void wheel_init(struct wheel *wheel, uint64_t now)
+{
+    unsigned level, slot;
+
+    wheel->now = now;
+    for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+        wheel->occupied[level] = 0;
+        for ( slot = 0; slot < WHEEL_SLOTS; slot++ )
+            wheel->slots[level][slot] = NULL;
+    }
+}
+
+void wheel_add(struct wheel *wheel, struct wheel_timer *timer, uint64_t due)
+{
+    timer->due = due > wheel->now ? due : wheel->now + 1;
+    wheel_insert(wheel, timer);
+}
+
+void wheel_del(struct wheel *wheel, struct wheel_timer *timer)
+{
+    *timer->pprev = timer->next;
+    if ( timer->next != NULL )
+        timer->next->pprev = timer->pprev;
+    if ( wheel->slots[timer->level][timer->slot] == NULL )
+        wheel->occupied[timer->level] &= ~( (uint64_t)1 << timer->slot );
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+uint64_t wheel_next(const struct wheel *wheel)
+{
+    uint64_t next = UINT64_MAX, map, pos, tick;
+    unsigned level, shift, from;
+
+    for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+        map = wheel->occupied[level];
+        if ( map == 0 )
+            continue;
+
+        /* Count slots from the one after the current slot */
+        shift = level * WHEEL_BITS;
+        pos = wheel->now >> shift;
+        from = ( pos + 1 ) & WHEEL_MASK;
+        if ( from != 0 )
+            map = map >> from | map << ( WHEEL_SLOTS - from );
+
+        tick = ( pos + 1 + lsb64(map) ) << shift;
+        if ( tick < next )
+            next = tick;
+    }
+
+    return next;
+}
+
+struct wheel_timer *wheel_advance(struct wheel *wheel, uint64_t now)
+{
+    struct wheel_timer *expired = NULL, *list, *timer;
+    uint64_t tick;
+    unsigned level, shift;
+
+    while ( ( tick = wheel_next(wheel) ) <= now ) {
+        wheel->now = tick;
+
+        /* Bring down the timers of each level whose slot starts here */
+        for ( level = WHEEL_LEVELS - 1; level > 0; level-- ) {
+            shift = level * WHEEL_BITS;
+            if ( tick & ( ( (uint64_t)1 << shift ) - 1 ) )
+                continue;
+
+            list = wheel_take(wheel, level, ( tick >> shift ) & WHEEL_MASK);
+            while ( ( timer = list ) != NULL ) {
+                list = timer->next;
+                if ( timer->due > tick ) {
+                    wheel_insert(wheel, timer);
+                    continue;
+                }
+
+                timer->pprev = NULL;
+                timer->next = expired;
+                expired = timer;
+            }
+        }
+
+        list = wheel_take(wheel, 0, tick & WHEEL_MASK);
+        while ( ( timer = list ) != NULL ) {
+            list = timer->next;
+            timer->pprev = NULL;
+            timer->next = expired;
+            expired = timer;
+        }
+    }
+
+    /* Nothing else falls due in between */
+    if ( now > wheel->now )
+        wheel->now = now;
+
+    return expired;
+}
@@ -0,0 +1,102 @@
+#ifndef _NULLTTY_WHEEL_H_
+#define _NULLTTY_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Hierarchical timing wheel
+ *
+ * Timers are kept in WHEEL_LEVELS wheels of WHEEL_SLOTS slots each.  The
+ * lowest level's slots are one tick apart, and each level's slots span a
+ * whole turn of the level below; a timer goes into the lowest level whose
+ * turn reaches its due tick, and is moved down a level ("cascaded") each
+ * time the wheel comes round to its slot, until it lands in the slot for
+ * the tick itself.  Adding and removing a timer is constant time whatever
+ * the number of timers, and all the timers due in a tick expire together.
+ *
+ * Each level keeps a bitmap of its occupied slots, so that the wheel can
+ * skip straight to the next tick with anything to do rather than step
+ * through the empty ones.  Timers due beyond the top level's reach wait
+ * in its furthest slot, to be put back in when it comes round.
+ *
+ * Ticks are whatever unit the caller counts time in.
+ */
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  ( 1 << WHEEL_BITS )
+#define WHEEL_LEVELS 4
+
+/**
+ * A timer, to be embedded in whatever it times
+ */
+struct wheel_timer {
+    struct wheel_timer *next;    /**< Next timer in the slot, or expired */
+    struct wheel_timer **pprev;  /**< Link to this timer, or NULL if not
+                                      pending */
+    uint64_t due;                /**< Tick at which the timer expires */
+    unsigned level;
+    unsigned slot;
+    void *data;                  /**< For the caller's use */
+};
+
+struct wheel {
+    uint64_t now;                /**< Last tick expired */
+    uint64_t occupied[WHEEL_LEVELS]; /**< Bitmaps of non-empty slots */
+    struct wheel_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+/**
+ * Initialize an empty wheel
+ *
+ * @param wheel Wheel to initialize
+ * @param now Current tick
+ */
+void wheel_init(struct wheel *wheel, uint64_t now);
+
+/**
+ * Start a timer
+ *
+ * @param wheel Wheel to add the timer to
+ * @param timer Timer, not pending
+ * @param due Tick at which it is to expire; the next tick, if that has
+ * already passed
+ */
+void wheel_add(struct wheel *wheel, struct wheel_timer *timer, uint64_t due);
+
+/**
+ * Stop a pending timer
+ *
+ * @param wheel Wheel the timer was added to
+ * @param timer Pending timer
+ */
+void wheel_del(struct wheel *wheel, struct wheel_timer *timer);
+
+/**
+ * Earliest tick at which the wheel next has work to do
+ *
+ * That is when its first timer is due, unless some other must be cascaded
+ * before then, in which case the wheel should be advanced to that tick
+ * and asked again.
+ *
+ * @param wheel Wheel
+ * @return Tick, or UINT64_MAX if no timers are pending
+ */
+uint64_t wheel_next(const struct wheel *wheel);
+
+/**
+ * Move the wheel on, expiring the timers due by then
+ *
+ * @param wheel Wheel
+ * @param now Current tick
+ * @return Expired timers, linked through their next fields, or NULL; they
+ * are no longer pending, and may be added again once the list has been
+ * walked
+ */
+struct wheel_timer *wheel_advance(struct wheel *wheel, uint64_t now);
+
+static inline bool wheel_pending(const struct wheel_timer *timer)
+{
+    return timer->pprev != NULL;
+}
+
+#endif /* ! defined _NULLTTY_WHEEL_H_ */
@@ -0,0 +1,415 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_STREAM stderr
+#include "nulltty_child.h"
+#include "hist.h"
+
+/**
+ * Relay round-trip latency benchmark
+ *
+ * Sends a message into PTY A, reads it back out of PTY B, echoes it into
+ * PTY B and times how long it takes to come back out of PTY A, one message
+ * in flight at a time.  Round-trip times are recorded in a log-linear
+ * histogram, and percentiles are reported as one CSV record per
+ * combination of payload size and load level on stdout.
+ *
+ * The load level is the number of extra PTY pairs, served by the same
+ * nulltty process, through which a separate process pushes bulk data in
+ * both directions for the duration of the measurement.
+ */
+
+#define TTY_A_PATH "latttyA"
+#define TTY_B_PATH "latttyB"
+#define PAIR_FILE  "bench_latency.pairs"
+
+#define MAX(a, b) (((a)>(b)) ? (a) : (b))
+#define MIN(a, b) (((a)<(b)) ? (a) : (b))
+
+/** Default number of timed round trips per run */
+#define LAT_ROUNDS 10000
+
+/** Untimed round trips made before measuring */
+#define LAT_WARMUP 100
+
+#define LAT_MSG_MAX 4096
+#define LAT_LIST_MAX 32
+#define LOAD_CHUNK 4096
+
+static const size_t default_sizes[] = { 1, 16, 64, 256, 1024 };
+static const size_t default_loads[] = { 0, 1, 4 };
+
+/** Round-trip times of one run */
+struct latency {
+    struct hist hist;
+    uint64_t min;
+    double sum;
+};
+
+
+/*** HELPER FUNCTIONS *********************************************************/
+
+static void latency_reset(struct latency *lat)
+{
+    memset(lat, 0, sizeof(*lat));
+    lat->min = UINT64_MAX;
+}
+
+static void latency_record(struct latency *lat, uint64_t v)
+{
+    hist_add(&lat->hist, v, 1);
+    lat->sum += v;
+    lat->min = MIN(lat->min, v);
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void load_path(char *buf, size_t size, size_t i, char side)
+{
+    snprintf(buf, size, "latload%zu%c", i, side);
+}
+
+/**
+ * Write a pair file naming the background load pairs
+ */
+static int write_pair_file(size_t nload)
+{
+    char a[32], b[32];
+    FILE *file;
+    size_t i;
+
+    if ( ( file = fopen(PAIR_FILE, "w") ) == NULL )
+        return -1;
+
+    for ( i = 0; i < nload; i++ ) {
+        load_path(a, sizeof(a), i, 'A');
+        load_path(b, sizeof(b), i, 'B');
+        fprintf(file, "%s %s\n", a, b);
+    }
+
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+/**
+ * Push bulk data both ways through the load pairs until killed
+ *
+ * Runs in a child process of its own.
+ */
+static void load_main(size_t nload)
+{
+    static uint8_t out[LOAD_CHUNK], in[LOAD_CHUNK];
+    char path[32];
+    int *fds, nfds = 0;
+    fd_set rfds, wfds;
+    size_t i;
+
+    if ( ( fds = calloc(2 * nload, sizeof(int)) ) == NULL )
+        _exit(1);
+
+    memset(out, 0x55, sizeof(out));
+
+    for ( i = 0; i < 2 * nload; i++ ) {
+        load_path(path, sizeof(path), i / 2, i % 2 ? 'B' : 'A');
+        if ( ( fds[i] = open_pty_slave(path) ) < 0 ) {
+            log_error_a("opening pty slave at path %s", path);
+            _exit(1);
+        }
+        nfds = MAX(nfds, fds[i] + 1);
+    }
+
+    while ( true ) {
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+        for ( i = 0; i < 2 * nload; i++ ) {
+            FD_SET(fds[i], &rfds);
+            FD_SET(fds[i], &wfds);
+        }
+
+        if ( select(nfds, &rfds, &wfds, NULL, NULL) < 0 && errno != EINTR )
+            _exit(1);
+
+        for ( i = 0; i < 2 * nload; i++ ) {
+            if ( FD_ISSET(fds[i], &wfds)
+                 && write(fds[i], out, sizeof(out)) < 0 && errno != EAGAIN )
+                _exit(1);
+            if ( FD_ISSET(fds[i], &rfds)
+                 && read(fds[i], in, sizeof(in)) < 0 && errno != EAGAIN )
+                _exit(1);
+        }
+    }
+}
+
+static int start_load(size_t nload)
+{
+    int pid;
+
+    switch ( pid = fork() ) {
+    case -1:
+        return -1;
+
+    case 0:
+        load_main(nload);
+        _exit(0);
+
+    default:
+        return pid;
+    }
+}
+
+static void stop_load(int pid)
+{
+    struct sigaction action;
+    int status;
+
+    /* Keep nulltty_child()'s SIGCHLD handler from taking this for nulltty
+     * dying on us */
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_handler = SIG_DFL;
+    sigaction(SIGCHLD, &action, NULL);
+
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+}
+
+static int bench_run(size_t msg_sz, size_t nload, size_t rounds,
+                     char *const *extra, struct latency *lat)
+{
+    uint8_t msg[LAT_MSG_MAX], buf[LAT_MSG_MAX];
+    char *args[LAT_LIST_MAX + 3];
+    int fd_a, fd_b, pid, load_pid = -1;
+    uint64_t start;
+    size_t i, j, nargs = 0;
+
+    if ( nload > 0 ) {
+        if ( write_pair_file(nload) < 0 ) {
+            log_error("writing pair file");
+            goto error;
+        }
+        args[nargs++] = "-f";
+        args[nargs++] = PAIR_FILE;
+    }
+    while ( *extra != NULL && nargs < LAT_LIST_MAX + 2 )
+        args[nargs++] = *extra++;
+    args[nargs] = NULL;
+
+    /* Launch nulltty and the background load */
+
+    pid = nulltty_child_args(TTY_A_PATH, TTY_B_PATH, args, -1);
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        goto error;
+    }
+
+    if ( nload > 0 && ( load_pid = start_load(nload) ) < 0 ) {
+        log_error("forking load generator");
+        goto error_nulltty;
+    }
+
+    /* Open PTY slaves */
+
+    if ( ( fd_a = open_pty_slave(TTY_A_PATH) ) < 0 ) {
+        log_error_a("opening pty slave at path %s", TTY_A_PATH);
+        goto error_load;
+    }
+    if ( ( fd_b = open_pty_slave(TTY_B_PATH) ) < 0 ) {
+        log_error_a("opening pty slave at path %s", TTY_B_PATH);
+        goto error_fd_a;
+    }
+
+    /* Ping-pong */
+
+    latency_reset(lat);
+    for ( i = 0; i < LAT_WARMUP + rounds; i++ ) {
+        for ( j = 0; j < msg_sz; j++ )
+            msg[j] = i + j;
+
+        start = now_ns();
+
+        if ( write_all(fd_a, msg, msg_sz) < 0
+             || read_all(fd_b, buf, msg_sz) < 0
+             || write_all(fd_b, buf, msg_sz) < 0
+             || read_all(fd_a, buf, msg_sz) < 0 ) {
+            log_error("relaying a round trip");
+            goto error_fd_b;
+        }
+
+        if ( i >= LAT_WARMUP )
+            latency_record(lat, now_ns() - start);
+
+        if ( memcmp(msg, buf, msg_sz) != 0 ) {
+            log_error("checking echoed data against original");
+            goto error_fd_b;
+        }
+    }
+
+    close(fd_b);
+    close(fd_a);
+    if ( load_pid > 0 )
+        stop_load(load_pid);
+    if ( nulltty_kill(pid) != 0 ) {
+        log_error("nulltty did not exit cleanly");
+        goto error;
+    }
+    if ( nload > 0 )
+        unlink(PAIR_FILE);
+
+    return 0;
+
+ error_fd_b:
+    close(fd_b);
+ error_fd_a:
+    close(fd_a);
+ error_load:
+    if ( load_pid > 0 )
+        stop_load(load_pid);
+ error_nulltty:
+    nulltty_kill(pid);
+ error:
+    if ( nload > 0 )
+        unlink(PAIR_FILE);
+    return -1;
+}
+
+static int parse_list(const char *str, size_t *list, size_t max)
+{
+    char *endptr;
+    long value;
+    size_t n = 0;
+
+    do {
+        value = strtol(str, &endptr, 10);
+        if ( endptr == str || value < 0 || n == max )
+            return -1;
+
+        list[n++] = value;
+        str = endptr + 1;
+    } while ( *endptr == ',' );
+
+    if ( *endptr != '\0' )
+        return -1;
+
+    return n;
+}
+
+static void print_usage(int retval)
+{
+    const char *usage_info =
+        "Usage: bench_latency [OPTIONS] [-- NULLTTY_OPTIONS]\n"
+        "\n"
+        "Measures round-trip latency through nulltty, printing one CSV\n"
+        "record per combination of payload size and load level.\n"
+        "\n"
+        "Options:\n"
+        "\t-s <sizes>\tComma separated payload sizes in bytes, at most 4096\n"
+        "\t\t\t(default 1,16,64,256,1024)\n"
+        "\t-l <loads>\tComma separated numbers of background bulk\n"
+        "\t\t\ttransfer pairs (default 0,1,4)\n"
+        "\t-n <count>\tRound trips per run (default 10000)\n"
+        "\t-q\t\tQuick sweep, for smoke testing\n"
+        "\t-h\t\tShow this help message and exit\n"
+        "\n";
+
+    printf("%s", usage_info);
+    exit(retval);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[LAT_LIST_MAX], loads[LAT_LIST_MAX];
+    size_t nsizes, nloads, rounds = LAT_ROUNDS;
+    struct latency lat;
+    int c, result;
+    size_t i, j;
+
+    nsizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    memcpy(sizes, default_sizes, sizeof(default_sizes));
+    nloads = sizeof(default_loads) / sizeof(default_loads[0]);
+    memcpy(loads, default_loads, sizeof(default_loads));
+
+    while ( ( c = getopt(argc, argv, "hqs:l:n:") ) != -1 ) {
+        switch ( c ) {
+        case 'h':
+            print_usage(0);
+            break;
+
+        case 'q':
+            nsizes = 2;
+            nloads = 2;
+            rounds = 1000;
+            break;
+
+        case 's':
+        case 'l':
+            result = parse_list(optarg, c == 's' ? sizes : loads,
+                                LAT_LIST_MAX);
+            if ( result < 0 ) {
+                fprintf(stderr, "Invalid list: %s\n", optarg);
+                return 1;
+            }
+            if ( c == 's' )
+                nsizes = result;
+            else
+                nloads = result;
+            break;
+
+        case 'n':
+            result = atoi(optarg);
+            if ( result <= 0 ) {
+                fprintf(stderr, "Invalid round trip count: %s\n", optarg);
+                return 1;
+            }
+            rounds = result;
+            break;
+
+        default:
+            print_usage(1);
+        }
+    }
+
+    for ( i = 0; i < nsizes; i++ ) {
+        if ( sizes[i] == 0 || sizes[i] > LAT_MSG_MAX ) {
+            fprintf(stderr, "Invalid payload size: %zu\n", sizes[i]);
+            return 1;
+        }
+    }
+
+    printf("load,size,count,min_us,mean_us,p50_us,p99_us,p999_us,max_us\n");
+
+    for ( i = 0; i < nloads; i++ ) {
+        for ( j = 0; j < nsizes; j++ ) {
+            if ( bench_run(sizes[j], loads[i], rounds, argv + optind,
+                           &lat) < 0 )
+                return 1;
+
+            printf("%zu,%zu,%llu,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                   loads[i], sizes[j], (unsigned long long)lat.hist.total,
+                   lat.min / 1e3, lat.sum / lat.hist.total / 1e3,
+                   hist_quantile(&lat.hist, 0.5) / 1e3,
+                   hist_quantile(&lat.hist, 0.99) / 1e3,
+                   hist_quantile(&lat.hist, 0.999) / 1e3,
+                   lat.hist.max / 1e3);
+            fflush(stdout);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,511 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_STREAM stderr
+#include "nulltty_child.h"
+
+/**
+ * Relay throughput benchmark
+ *
+ * Pushes messages through a freshly started nulltty for every combination
+ * of message size, writer chunk size and traffic direction, and reports
+ * one CSV record per run on stdout.  Each message is sent repeatedly until
+ * at least the minimum volume has been transferred, so that nulltty's own
+ * start-up cost does not dominate the small message sizes.
+ *
+ * System calls are counted from the totals nulltty prints on exit when it
+ * was configured with --enable-debug, and otherwise from the read and write
+ * counts in /proc/<pid>/io where that exists, which miss splice() and the
+ * event waits; the syscall_source column says which.
+ */
+
+#define TTY_A_PATH "benchttyA"
+#define TTY_B_PATH "benchttyB"
+
+#define MAX(a, b) (((a)>(b)) ? (a) : (b))
+#define MIN(a, b) (((a)<(b)) ? (a) : (b))
+
+/** Default minimum number of bytes moved in each direction per run */
+#define BENCH_MIN_BYTES (16 * 1024 * 1024)
+
+/** Upper bound on the number of times one message is repeated */
+#define BENCH_ROUNDS_MAX 65536
+
+/** Size of the reader's receive buffer */
+#define BENCH_READ_SZ 65536
+
+#define BENCH_LIST_MAX 32
+
+#define MB (1024.0 * 1024.0)
+
+static const size_t default_sizes[] = {
+    1, 16, 256, 4096, 65536, 1024 * 1024, 16 * 1024 * 1024, 64 * 1024 * 1024,
+};
+
+static const size_t default_chunks[] = { 64, 4096, 65536 };
+
+struct bench_direction {
+    int fd_out;
+    int fd_in;
+    const uint8_t *msg;
+    size_t msg_sz;
+    size_t chunk;
+    size_t total;
+    size_t n_out;
+    size_t n_in;
+};
+
+struct bench_result {
+    size_t bytes;
+    double seconds;
+    double user;
+    double sys;
+    long syscalls;
+    const char *syscall_source;
+};
+
+static void prepare_fd_sets(fd_set *rfds, fd_set *wfds,
+                            const struct bench_direction *dir)
+{
+    if ( dir->n_out < dir->total )
+        FD_SET(dir->fd_out, wfds);
+
+    if ( dir->n_in < dir->total )
+        FD_SET(dir->fd_in, rfds);
+}
+
+static int shuffle_data(fd_set *rfds, fd_set *wfds,
+                        struct bench_direction *dir, uint8_t *buf)
+{
+    size_t off, len, i;
+    ssize_t n;
+
+    if ( FD_ISSET(dir->fd_out, wfds) ) {
+        off = dir->n_out % dir->msg_sz;
+        len = MIN(dir->chunk, dir->msg_sz - off);
+        len = MIN(len, dir->total - dir->n_out);
+
+        n = write(dir->fd_out, dir->msg + off, len);
+        if ( n < 0 && errno != EAGAIN ) {
+            log_error_a("writing %zu bytes to slave pty", len);
+            return -1;
+        }
+        if ( n > 0 )
+            dir->n_out += n;
+    }
+
+    if ( FD_ISSET(dir->fd_in, rfds) ) {
+        len = MIN(BENCH_READ_SZ, dir->total - dir->n_in);
+
+        n = read(dir->fd_in, buf, len);
+        if ( n < 0 && errno != EAGAIN ) {
+            log_error_a("reading %zu bytes from slave pty", len);
+            return -1;
+        }
+
+        for ( i = 0; n > 0 && i < (size_t)n; i++ ) {
+            if ( buf[i] != dir->msg[( dir->n_in + i ) % dir->msg_sz] ) {
+                log_error_a("checking received data at offset %zu",
+                            dir->n_in + i);
+                return -1;
+            }
+        }
+        if ( n > 0 )
+            dir->n_in += n;
+    }
+
+    return 0;
+}
+
+static inline bool shuffle_complete(const struct bench_direction *dir)
+{
+    return ( dir->n_out == dir->total && dir->n_in == dir->total );
+}
+
+static double timespec_diff(const struct timespec *start,
+                            const struct timespec *end)
+{
+    return ( end->tv_sec - start->tv_sec )
+        + ( end->tv_nsec - start->tv_nsec ) / 1e9;
+}
+
+static double timeval_secs(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+/**
+ * Count a process's read and write system calls from /proc/<pid>/io
+ *
+ * @param pid Process ID
+ * @return Number of system calls, or -1 if unavailable
+ */
+static long proc_syscalls(int pid)
+{
+    char path[64], key[32];
+    unsigned long value;
+    long result = 0;
+    int found = 0;
+    FILE *file;
+
+    snprintf(path, sizeof(path), "/proc/%d/io", pid);
+    if ( ( file = fopen(path, "r") ) == NULL )
+        return -1;
+
+    while ( fscanf(file, "%31s %lu", key, &value) == 2 ) {
+        if ( strcmp(key, "syscr:") == 0 || strcmp(key, "syscw:") == 0 ) {
+            result += value;
+            found++;
+        }
+    }
+
+    fclose(file);
+    return found == 2 ? result : -1;
+}
+
+/**
+ * Find the system call total in nulltty's debug output
+ *
+ * Debug builds also trace every relay iteration to standard output, so
+ * only the totals at the very end are looked at.
+ *
+ * @param out Temporary file holding the exited child's standard output
+ * @return Number of system calls, or -1 if not reported
+ */
+static long debug_syscalls(FILE *out)
+{
+    static const char label[] = "All tracked syscalls:";
+    char tail[4096], *p;
+    size_t len;
+
+    if ( fseek(out, -(long)sizeof(tail) + 1, SEEK_END) < 0 )
+        rewind(out);
+
+    len = fread(tail, 1, sizeof(tail) - 1, out);
+    tail[len] = '\0';
+
+    if ( ( p = strstr(tail, label) ) == NULL )
+        return -1;
+
+    return strtol(p + sizeof(label) - 1, NULL, 10);
+}
+
+static int bench_run(const uint8_t *msg, size_t msg_sz, size_t chunk,
+                     size_t min_bytes, bool both, char *const *args,
+                     struct bench_result *result)
+{
+    struct bench_direction dir_a, dir_b;
+    struct timespec start, end;
+    struct rusage usage;
+    fd_set rfds, wfds;
+    uint8_t *buf;
+    size_t rounds;
+    long proc_count;
+    FILE *out;
+    int fd_a, fd_b, pid, nfds, status;
+
+    rounds = MAX(1, min_bytes / msg_sz);
+    rounds = MIN(rounds, BENCH_ROUNDS_MAX);
+
+    if ( ( buf = malloc(BENCH_READ_SZ) ) == NULL )
+        goto error;
+
+    /* Not a pipe, which the child could fill up and block on */
+    if ( ( out = tmpfile() ) == NULL )
+        goto error_buf;
+
+    /* Launch nulltty */
+
+    pid = nulltty_child_args(TTY_A_PATH, TTY_B_PATH, args, fileno(out));
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        goto error_out;
+    }
+
+    /* Open PTY slaves */
+
+    if ( ( fd_a = open_pty_slave(TTY_A_PATH) ) < 0 ) {
+        log_error_a("opening pty slave at path %s", TTY_A_PATH);
+        goto error_nulltty;
+    }
+    if ( ( fd_b = open_pty_slave(TTY_B_PATH) ) < 0 ) {
+        log_error_a("opening pty slave at path %s", TTY_B_PATH);
+        goto error_fd_a;
+    }
+
+    memset(&dir_a, 0, sizeof(dir_a));
+    dir_a.fd_out = fd_a;
+    dir_a.fd_in  = fd_b;
+    dir_a.msg    = msg;
+    dir_a.msg_sz = msg_sz;
+    dir_a.chunk  = chunk;
+    dir_a.total  = msg_sz * rounds;
+
+    dir_b = dir_a;
+    dir_b.fd_out = fd_b;
+    dir_b.fd_in  = fd_a;
+    if ( ! both )
+        dir_b.total = 0;
+
+    /* Shuffle data through the relay */
+
+    nfds = MAX(fd_a, fd_b) + 1;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ( ! ( shuffle_complete(&dir_a) && shuffle_complete(&dir_b) ) ) {
+        FD_ZERO(&rfds);
+        FD_ZERO(&wfds);
+
+        prepare_fd_sets(&rfds, &wfds, &dir_a);
+        prepare_fd_sets(&rfds, &wfds, &dir_b);
+
+        if ( select(nfds, &rfds, &wfds, NULL, NULL) < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            goto error_fd_b;
+        }
+
+        if ( shuffle_data(&rfds, &wfds, &dir_a, buf) < 0 )
+            goto error_fd_b;
+
+        if ( shuffle_data(&rfds, &wfds, &dir_b, buf) < 0 )
+            goto error_fd_b;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    close(fd_b);
+    close(fd_a);
+
+    /* Collect nulltty's resource usage */
+
+    proc_count = proc_syscalls(pid);
+
+    status = nulltty_kill_usage(pid, &usage);
+    if ( status != 0 ) {
+        log_error_a("nulltty exited with status %d", status);
+        goto error_out;
+    }
+
+    result->bytes = dir_a.total + dir_b.total;
+    result->seconds = timespec_diff(&start, &end);
+    result->user = timeval_secs(&usage.ru_utime);
+    result->sys = timeval_secs(&usage.ru_stime);
+
+    if ( ( result->syscalls = debug_syscalls(out) ) >= 0 )
+        result->syscall_source = "debug";
+    else if ( ( result->syscalls = proc_count ) >= 0 )
+        result->syscall_source = "procio";
+    else
+        result->syscall_source = "none";
+
+    fclose(out);
+    free(buf);
+    return 0;
+
+ error_fd_b:
+    close(fd_b);
+ error_fd_a:
+    close(fd_a);
+ error_nulltty:
+    nulltty_kill(pid);
+ error_out:
+    fclose(out);
+ error_buf:
+    free(buf);
+ error:
+    return -1;
+}
+
+static long parse_size(const char *str, char **endptr)
+{
+    long result;
+
+    result = strtol(str, endptr, 10);
+    if ( *endptr == str || result <= 0 )
+        return -1;
+
+    switch ( **endptr ) {
+    case 'k':
+    case 'K':
+        result *= 1024;
+        (*endptr)++;
+        break;
+
+    case 'm':
+    case 'M':
+        result *= 1024 * 1024;
+        (*endptr)++;
+        break;
+    }
+
+    return result;
+}
+
+static int parse_list(const char *str, size_t *list, size_t max)
+{
+    char *endptr;
+    long size;
+    size_t n = 0;
+
+    do {
+        size = parse_size(str, &endptr);
+        if ( size < 0 || n == max )
+            return -1;
+
+        list[n++] = size;
+        str = endptr + 1;
+    } while ( *endptr == ',' );
+
+    if ( *endptr != '\0' )
+        return -1;
+
+    return n;
+}
+
+static void print_usage(int retval)
+{
+    const char *usage_info =
+        "Usage: bench_relay [OPTIONS] [-- NULLTTY_OPTIONS]\n"
+        "\n"
+        "Measures nulltty's relay throughput, printing one CSV record per\n"
+        "combination of message size, writer chunk size and direction.\n"
+        "\n"
+        "Options:\n"
+        "\t-s <sizes>\tComma separated message sizes, optionally suffixed\n"
+        "\t\t\twith k or m (default 1,16,256,4k,64k,1m,16m,64m)\n"
+        "\t-c <sizes>\tComma separated writer chunk sizes\n"
+        "\t\t\t(default 64,4k,64k)\n"
+        "\t-d <dirs>\tDirections: 1, 2 or both (default both)\n"
+        "\t-n <size>\tMinimum bytes per direction per run (default 16m)\n"
+        "\t-q\t\tQuick sweep, for smoke testing\n"
+        "\t-h\t\tShow this help message and exit\n"
+        "\n";
+
+    printf("%s", usage_info);
+    exit(retval);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t sizes[BENCH_LIST_MAX], chunks[BENCH_LIST_MAX];
+    size_t nsizes, nchunks, min_bytes = BENCH_MIN_BYTES, max_size = 0;
+    bool one_dir = true, two_dir = true;
+    struct bench_result r;
+    uint8_t *msg;
+    char *endptr;
+    long size;
+    int c, result;
+    size_t i, j, k;
+
+    nsizes = sizeof(default_sizes) / sizeof(default_sizes[0]);
+    memcpy(sizes, default_sizes, sizeof(default_sizes));
+    nchunks = sizeof(default_chunks) / sizeof(default_chunks[0]);
+    memcpy(chunks, default_chunks, sizeof(default_chunks));
+
+    while ( ( c = getopt(argc, argv, "hqs:c:d:n:") ) != -1 ) {
+        switch ( c ) {
+        case 'h':
+            print_usage(0);
+            break;
+
+        case 'q':
+            nsizes = 4;
+            nchunks = 2;
+            min_bytes = 1024 * 1024;
+            break;
+
+        case 's':
+        case 'c':
+            result = parse_list(optarg, c == 's' ? sizes : chunks,
+                                BENCH_LIST_MAX);
+            if ( result < 0 ) {
+                fprintf(stderr, "Invalid size list: %s\n", optarg);
+                return 1;
+            }
+            if ( c == 's' )
+                nsizes = result;
+            else
+                nchunks = result;
+            break;
+
+        case 'd':
+            one_dir = strcmp(optarg, "1") == 0 || strcmp(optarg, "both") == 0;
+            two_dir = strcmp(optarg, "2") == 0 || strcmp(optarg, "both") == 0;
+            if ( ! one_dir && ! two_dir ) {
+                fprintf(stderr, "Invalid directions: %s\n", optarg);
+                return 1;
+            }
+            break;
+
+        case 'n':
+            size = parse_size(optarg, &endptr);
+            if ( size < 0 || *endptr != '\0' ) {
+                fprintf(stderr, "Invalid size: %s\n", optarg);
+                return 1;
+            }
+            min_bytes = size;
+            break;
+
+        default:
+            print_usage(1);
+        }
+    }
+
+    /* Prepare test data */
+
+    for ( i = 0; i < nsizes; i++ )
+        max_size = MAX(max_size, sizes[i]);
+
+    if ( ( msg = malloc(max_size) ) == NULL ) {
+        log_error("allocating test data");
+        return 1;
+    }
+    for ( i = 0; i < max_size; i++ )
+        msg[i] = random() % 256;
+
+    printf("dirs,msg_size,chunk,bytes,seconds,mb_per_s,"
+           "user_s,sys_s,cpu_s_per_gb,syscalls,syscalls_per_mb,"
+           "syscall_source\n");
+
+    for ( k = 1; k <= 2; k++ ) {
+        if ( ( k == 1 && ! one_dir ) || ( k == 2 && ! two_dir ) )
+            continue;
+
+        for ( i = 0; i < nsizes; i++ ) {
+            for ( j = 0; j < nchunks; j++ ) {
+                /* Chunks bigger than the message all behave the same */
+                if ( j > 0 && chunks[j-1] >= sizes[i] )
+                    continue;
+
+                if ( bench_run(msg, sizes[i], chunks[j], min_bytes, k == 2,
+                               argv + optind, &r) < 0 ) {
+                    free(msg);
+                    return 1;
+                }
+
+                printf("%zu,%zu,%zu,%zu,%.6f,%.2f,%.6f,%.6f,%.4f,%ld,%.1f,%s\n",
+                       k, sizes[i], MIN(chunks[j], sizes[i]), r.bytes,
+                       r.seconds, r.bytes / MB / r.seconds,
+                       r.user, r.sys,
+                       ( r.user + r.sys ) / ( r.bytes / MB / 1024.0 ),
+                       r.syscalls,
+                       r.syscalls >= 0 ? r.syscalls / ( r.bytes / MB ) : -1.0,
+                       r.syscall_source);
+                fflush(stdout);
+            }
+        }
+    }
+
+    free(msg);
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <stubs.h>
+
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nulltty_child.h"
+
+#define BUS_A_PATH "nulltty_busA"
+#define BUS_B_PATH "nulltty_busB"
+#define BUS_C_PATH "nulltty_busC"
+
+/* A small shared ring, so that the stalled endpoint soon falls more than
+ * half of it behind */
+#define BUS_SIZE "4k"
+
+/* Well beyond what the stalled endpoint's PTY and the ring can hold, sent
+ * in chunks small enough that an endpoint reading each one before the
+ * next is sent never falls behind */
+#define FLOOD_SIZE  ( 64 * 1024 )
+#define FLOOD_CHUNK 256
+
+static const char hello_a[] = "hello from A";
+static const char hello_b[] = "hello from B";
+
+struct bus_counts {
+    unsigned long long in, out, dropped;
+    size_t pending;
+};
+
+/**
+ * Send a message from one endpoint, and check it reaches the others but
+ * not the sender
+ */
+static int check_broadcast(int from, int to1, int to2, const char *msg)
+{
+    uint8_t buf[64];
+    size_t len = strlen(msg);
+
+    if ( write(from, msg, len) != (ssize_t)len ) {
+        log_error("writing to bus endpoint");
+        return -1;
+    }
+
+    if ( read_all(to1, buf, len) < 0 || memcmp(buf, msg, len) != 0
+         || read_all(to2, buf, len) < 0 || memcmp(buf, msg, len) != 0 ) {
+        log_error_a("checking \"%s\" reached the other endpoints", msg);
+        return -1;
+    }
+
+    if ( expect_quiet(from) < 0 ) {
+        log_error_a("checking \"%s\" was not echoed to its sender", msg);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Flood the bus from A, a chunk at a time, while B keeps up and C doesn't
+ * read at all
+ *
+ * B must get every byte, and A none of its own.
+ */
+static int flood(int fd_a, int fd_b)
+{
+    uint8_t msg[FLOOD_CHUNK], buf[FLOOD_CHUNK];
+    size_t sent, i;
+
+    for ( sent = 0; sent < FLOOD_SIZE; sent += FLOOD_CHUNK ) {
+        for ( i = 0; i < FLOOD_CHUNK; i++ )
+            msg[i] = random() % 256;
+
+        if ( write(fd_a, msg, FLOOD_CHUNK) != FLOOD_CHUNK ) {
+            log_error("writing to bus endpoint");
+            return -1;
+        }
+
+        if ( read_all(fd_b, buf, FLOOD_CHUNK) < 0
+             || memcmp(buf, msg, FLOOD_CHUNK) != 0 ) {
+            log_error_a("checking the flood reached a reading endpoint "
+                        "intact after %zu bytes", sent);
+            return -1;
+        }
+    }
+
+    if ( expect_quiet(fd_a) < 0 ) {
+        log_error("checking the flood was not echoed to its sender");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Ask nulltty for its status report and pick out each endpoint's counts
+ */
+static int get_counts(int pid, int report_fd, struct bus_counts counts[3])
+{
+    const char *links[3] = { BUS_A_PATH, BUS_B_PATH, BUS_C_PATH };
+    struct pollfd pfd = { report_fd, POLLIN, 0 };
+    char report[1024], link[64], *line, *eol;
+    struct bus_counts c;
+    size_t len = 0, i;
+    unsigned found = 0;
+    ssize_t n;
+
+    if ( kill(pid, SIGUSR1) < 0 )
+        return -1;
+
+    while ( found != 07 ) {
+        if ( len == sizeof(report) - 1 || poll(&pfd, 1, RELAY_TIMEOUT_MS) <= 0
+             || ( n = read(report_fd, report + len,
+                           sizeof(report) - 1 - len) ) <= 0 )
+            return -1;
+        len += n;
+        report[len] = '\0';
+
+        for ( line = report; ( eol = strchr(line, '\n') ) != NULL;
+              line = eol + 1 ) {
+            if ( sscanf(line, "%63[^:]: read %llu delivered %llu "
+                        "dropped %llu pending %zu", link, &c.in, &c.out,
+                        &c.dropped, &c.pending) != 5 )
+                continue;
+            for ( i = 0; i < 3; i++ ) {
+                if ( strcmp(link, links[i]) == 0 ) {
+                    counts[i] = c;
+                    found |= 1 << i;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+static int check_counts(const struct bus_counts counts[3])
+{
+    const struct bus_counts *a = &counts[0], *b = &counts[1], *c = &counts[2];
+    unsigned long long from_a = sizeof(hello_a) - 1 + FLOOD_SIZE;
+    unsigned long long from_b = sizeof(hello_b) - 1;
+
+    if ( a->in != from_a || b->in != from_b || c->in != 0 ) {
+        log_error("checking the bytes read from each endpoint");
+        return -1;
+    }
+
+    /* Endpoints which kept up got everything but their own data */
+    if ( a->out != from_b || a->dropped != 0
+         || b->out != from_a || b->dropped != 0 ) {
+        log_error("checking the endpoints which kept up lost nothing");
+        return -1;
+    }
+
+    /* The stalled one lost some, but every byte is accounted for */
+    if ( c->dropped == 0
+         || c->out + c->dropped + c->pending != from_a + from_b ) {
+        log_error_a("checking the stalled endpoint's losses: delivered %llu"
+                    "  dropped %llu  pending %zu", c->out, c->dropped,
+                    c->pending);
+        return -1;
+    }
+
+    return 0;
+}
+
+int check_bus()
+{
+    char *args[] = { "-N", "-b", BUS_SIZE, BUS_A_PATH, NULL };
+    struct bus_counts counts[3];
+    int report[2], saved_stderr;
+    int fd_a = -1, fd_b = -1, fd_c = -1;
+    int pid, status, result = -1;
+
+    /* The status report goes to nulltty's standard error */
+    if ( pipe(report) < 0 )
+        return -1;
+
+    fflush(stderr);
+    if ( ( saved_stderr = dup(2) ) < 0 || dup2(report[1], 2) < 0 ) {
+        log_error("redirecting nulltty's standard error");
+        goto out_pipe;
+    }
+
+    pid = nulltty_child_args(BUS_B_PATH, BUS_C_PATH, args, -1);
+
+    dup2(saved_stderr, 2);
+    close(saved_stderr);
+    close(report[1]);
+    report[1] = -1;
+
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        goto out_pipe;
+    }
+
+    if ( ( fd_a = open_pty_slave(BUS_A_PATH) ) < 0
+         || ( fd_b = open_pty_slave(BUS_B_PATH) ) < 0
+         || ( fd_c = open_pty_slave(BUS_C_PATH) ) < 0 ) {
+        log_error("opening bus endpoints");
+        goto out;
+    }
+
+    /* Everyone hears everyone else, but not themselves */
+
+    if ( check_broadcast(fd_a, fd_b, fd_c, hello_a) < 0
+         || check_broadcast(fd_b, fd_a, fd_c, hello_b) < 0 )
+        goto out;
+
+    /* A stalled endpoint mustn't hold up the others */
+
+    if ( flood(fd_a, fd_b) < 0 )
+        goto out;
+
+    if ( get_counts(pid, report[0], counts) < 0 ) {
+        log_error("reading nulltty's status report");
+        goto out;
+    }
+
+    if ( check_counts(counts) < 0 )
+        goto out;
+
+    result = 0;
+
+ out:
+    if ( fd_c >= 0 )
+        close(fd_c);
+    if ( fd_b >= 0 )
+        close(fd_b);
+    if ( fd_a >= 0 )
+        close(fd_a);
+
+    status = nulltty_kill(pid);
+    if ( status < 0 )
+        result = -1;
+    else if ( result == 0 )
+        printf("nulltty exited with status: %d\n", status);
+
+ out_pipe:
+    close(report[0]);
+    if ( report[1] >= 0 )
+        close(report[1]);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int result;
+
+    printf("Checking bus delivery...\n");
+    result = check_bus();
+
+    if ( result < 0 )
+        return -result;
+
+    return 0;
+}
@@ -0,0 +1,326 @@
+#include <stubs.h>
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nulltty_child.h"
+#include "capture.h"
+
+#define CAP_A_PATH "nulltty_capA"
+#define CAP_B_PATH "nulltty_capB"
+#define CAP_LOG    "nulltty_capture.log"
+
+/* Small enough to be quick to write back, with the flush thread running */
+#define CAP_SIZE     "64k"
+#define CAP_FLUSH_MS "10"
+
+/* Messages in both directions, spaced out so that a timed replay takes a
+ * measurable while */
+#define MESSAGES 9
+#define GAP_US   20000
+
+#define STREAM_MAX 4096
+
+/** Bytes sent each way, indexed by capture direction */
+struct streams {
+    uint8_t data[2][STREAM_MAX];
+    size_t len[2];
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Open a slave as it is, without the flush open_pty_slave() does, which
+ * would discard anything replayed into it already
+ */
+static int open_slave(const char *path)
+{
+    return open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+}
+
+/**
+ * Send messages through a pair, mostly from A to B but with some the other
+ * way, checking each arrives before sending the next
+ */
+static int send_messages(int fd_a, int fd_b, struct streams *sent)
+{
+    uint8_t msg[256], buf[256];
+    size_t i, j, len;
+    unsigned dir;
+
+    memset(sent, 0, sizeof(*sent));
+
+    for ( i = 0; i < MESSAGES; i++ ) {
+        dir = i % 3 == 1 ? CAPTURE_B_TO_A : CAPTURE_A_TO_B;
+        len = 1 + i * 29;
+        for ( j = 0; j < len; j++ )
+            msg[j] = i * 16 + j;
+
+        if ( write_all(dir == CAPTURE_A_TO_B ? fd_a : fd_b, msg, len) < 0
+             || read_all(dir == CAPTURE_A_TO_B ? fd_b : fd_a, buf, len) < 0
+             || memcmp(buf, msg, len) != 0 ) {
+            log_error_a("relaying message %zu", i);
+            return -1;
+        }
+
+        memcpy(sent->data[dir] + sent->len[dir], msg, len);
+        sent->len[dir] += len;
+        usleep(GAP_US);
+    }
+
+    return 0;
+}
+
+/**
+ * Relay traffic through a pair with capture on
+ */
+static int capture(struct streams *sent)
+{
+    char *args[] = { "-w", CAP_LOG, "-W", CAP_SIZE, "-F", CAP_FLUSH_MS,
+                     NULL };
+    int fd_a = -1, fd_b = -1;
+    int pid, status, result = -1;
+
+    pid = nulltty_child_args(CAP_A_PATH, CAP_B_PATH, args, -1);
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        return -1;
+    }
+
+    if ( ( fd_a = open_pty_slave(CAP_A_PATH) ) < 0
+         || ( fd_b = open_pty_slave(CAP_B_PATH) ) < 0 ) {
+        log_error("opening pty slaves");
+        goto out;
+    }
+
+    if ( send_messages(fd_a, fd_b, sent) < 0 )
+        goto out;
+
+    result = 0;
+
+ out:
+    if ( fd_b >= 0 )
+        close(fd_b);
+    if ( fd_a >= 0 )
+        close(fd_a);
+
+    /* The log is only finished off when nulltty exits cleanly */
+    status = nulltty_kill(pid);
+    if ( status != 0 ) {
+        log_error_a("nulltty exited with status %d after capturing", status);
+        return -1;
+    }
+
+    return result;
+}
+
+/**
+ * Check the log holds exactly what was sent each way, in order
+ *
+ * @param span Set to the time between the first and last records
+ */
+static int check_log(const struct streams *sent, uint64_t *span)
+{
+    const struct capture_header *header;
+    const struct capture_record *rec;
+    static struct streams logged;
+    uint64_t first = 0, last = 0;
+    uint8_t *log = NULL;
+    size_t size, off, end;
+    FILE *file;
+    int result = -1;
+
+    if ( ( file = fopen(CAP_LOG, "r") ) == NULL
+         || fseek(file, 0, SEEK_END) < 0 || ( size = ftell(file) ) == 0
+         || ( log = malloc(size) ) == NULL || fseek(file, 0, SEEK_SET) < 0
+         || fread(log, 1, size, file) != size ) {
+        log_error("reading capture log");
+        goto out;
+    }
+
+    header = (const struct capture_header *)log;
+    if ( size < sizeof(*header) || header->magic != CAPTURE_MAGIC
+         || header->version != CAPTURE_VERSION
+         || header->header_size != sizeof(*header)
+         || header->length != size - sizeof(*header)
+         || header->dropped_records != 0 ) {
+        log_error("checking capture log header");
+        goto out;
+    }
+
+    memset(&logged, 0, sizeof(logged));
+    end = header->header_size + header->length;
+    for ( off = header->header_size; off < end;
+          off += capture_record_size(rec->len) ) {
+        rec = (const struct capture_record *)( log + off );
+        if ( end - off < capture_record_size(rec->len) || rec->ts < last
+             || rec->pair != 0 || rec->dir > CAPTURE_B_TO_A
+             || logged.len[rec->dir] + rec->len > STREAM_MAX ) {
+            log_error_a("checking capture record at offset %zu", off);
+            goto out;
+        }
+
+        memcpy(logged.data[rec->dir] + logged.len[rec->dir], rec + 1,
+               rec->len);
+        logged.len[rec->dir] += rec->len;
+
+        if ( first == 0 )
+            first = rec->ts;
+        last = rec->ts;
+    }
+
+    if ( logged.len[0] != sent->len[0] || logged.len[1] != sent->len[1]
+         || memcmp(logged.data[0], sent->data[0], sent->len[0]) != 0
+         || memcmp(logged.data[1], sent->data[1], sent->len[1]) != 0 ) {
+        log_error("checking capture log against data sent");
+        goto out;
+    }
+
+    *span = last - first;
+    result = 0;
+
+ out:
+    if ( file != NULL )
+        fclose(file);
+    free(log);
+    return result;
+}
+
+/**
+ * Replay the log into a fresh pair, and check each side gets what was
+ * originally delivered to it, in order
+ *
+ * @param into_b_only Replay into B alone, rather than both sides
+ * @param fast Replay as fast as possible rather than at the original
+ * timing, which must then have been kept to
+ */
+static int replay(const struct streams *sent, uint64_t span,
+                  bool into_b_only, bool fast)
+{
+    char *args[6];
+    uint8_t buf[STREAM_MAX];
+    int fd_a = -1, fd_b = -1;
+    int pid, status, result = -1;
+    size_t nargs = 0;
+    uint64_t start;
+
+    args[nargs++] = "-R";
+    args[nargs++] = CAP_LOG;
+    if ( into_b_only ) {
+        args[nargs++] = "-I";
+        args[nargs++] = "b";
+    }
+    if ( fast )
+        args[nargs++] = "-x";
+    args[nargs] = NULL;
+
+    /* Taken before nulltty starts its replay's schedule */
+    start = now_ns();
+
+    pid = nulltty_child_args(CAP_A_PATH, CAP_B_PATH, args, -1);
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        return -1;
+    }
+
+    if ( ( fd_a = open_slave(CAP_A_PATH) ) < 0
+         || ( fd_b = open_slave(CAP_B_PATH) ) < 0 ) {
+        log_error("opening pty slaves");
+        goto out;
+    }
+
+    /* Data read from A is replayed into B, and vice-versa */
+
+    if ( read_all(fd_b, buf, sent->len[CAPTURE_A_TO_B]) < 0
+         || memcmp(buf, sent->data[CAPTURE_A_TO_B],
+                   sent->len[CAPTURE_A_TO_B]) != 0 ) {
+        log_error("checking data replayed into B");
+        goto out;
+    }
+
+    if ( ! into_b_only
+         && ( read_all(fd_a, buf, sent->len[CAPTURE_B_TO_A]) < 0
+              || memcmp(buf, sent->data[CAPTURE_B_TO_A],
+                        sent->len[CAPTURE_B_TO_A]) != 0 ) ) {
+        log_error("checking data replayed into A");
+        goto out;
+    }
+
+    if ( ! fast && now_ns() - start < span ) {
+        log_error_a("checking the replay took at least the %llums captured",
+                    (unsigned long long)span / 1000000);
+        goto out;
+    }
+
+    if ( expect_quiet(fd_a) < 0 || expect_quiet(fd_b) < 0 ) {
+        log_error("checking nothing more was replayed");
+        goto out;
+    }
+
+    /* The pair still relays once the replay is over */
+
+    if ( write_all(fd_a, "after", 5) < 0 || read_all(fd_b, buf, 5) < 0
+         || memcmp(buf, "after", 5) != 0 ) {
+        log_error("relaying after the replay");
+        goto out;
+    }
+
+    result = 0;
+
+ out:
+    if ( fd_b >= 0 )
+        close(fd_b);
+    if ( fd_a >= 0 )
+        close(fd_a);
+
+    status = nulltty_kill(pid);
+    if ( status < 0 )
+        return -1;
+    if ( result == 0 )
+        printf("nulltty exited with status: %d\n", status);
+    return result;
+}
+
+int check_capture()
+{
+    static struct streams sent;
+    uint64_t span;
+
+    unlink(CAP_LOG);
+
+    if ( capture(&sent) < 0 || check_log(&sent, &span) < 0 )
+        return -1;
+
+    if ( replay(&sent, span, true, true) < 0
+         || replay(&sent, span, false, true) < 0
+         || replay(&sent, span, false, false) < 0 )
+        return -1;
+
+    unlink(CAP_LOG);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int result;
+
+    printf("Checking capture and replay...\n");
+    result = check_capture();
+
+    if ( result < 0 )
+        return -result;
+
+    return 0;
+}
@@ -0,0 +1,329 @@
+#include <stubs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "nulltty_child.h"
+
+#define MUX_LINK_PATH "nulltty_mux"
+#define MUX_CH1_PATH  "nulltty_mux1"
+#define MUX_CH2_PATH  "nulltty_mux2"
+
+/* Small buffers, so that frames soon straddle the end of the link's
+ * receive ring */
+#define MUX_SIZE "512"
+
+/* Basic option framing */
+#define MUX_FLAG 0xf9
+#define MUX_EA   0x01
+#define MUX_CR   0x02
+#define MUX_PF   0x10
+#define MUX_SABM 0x2f
+#define MUX_UA   0x63
+#define MUX_DM   0x0f
+#define MUX_UIH  0xef
+
+/* Multiplexer control channel test command, and its response */
+#define MUX_TEST_CMD 0x23
+#define MUX_TEST_RSP 0x21
+
+/** Largest frame we build, with the default N1 */
+#define FRAME_MAX ( 127 + 6 )
+
+/* Frames of an awkward size, to land all over the ring */
+#define WRAP_FRAMES 24
+#define WRAP_LEN    97
+
+struct mux_fds {
+    int link;
+    int ch[2];
+};
+
+static uint8_t fcs_crc(uint8_t crc, const uint8_t *data, size_t len)
+{
+    unsigned bit;
+
+    while ( len-- > 0 ) {
+        crc ^= *data++;
+        for ( bit = 0; bit < 8; bit++ )
+            crc = crc & 1 ? ( crc >> 1 ) ^ 0xe0 : crc >> 1;
+    }
+
+    return crc;
+}
+
+/**
+ * Build a basic option frame
+ *
+ * @return Length of the frame
+ */
+static size_t build_frame(uint8_t *buf, uint8_t addr, uint8_t ctrl,
+                          const void *data, size_t len)
+{
+    uint8_t crc;
+
+    buf[0] = MUX_FLAG;
+    buf[1] = addr;
+    buf[2] = ctrl;
+    buf[3] = len << 1 | MUX_EA;
+    if ( len > 0 )
+        memcpy(buf + 4, data, len);
+
+    /* UIH frames only check their header */
+    crc = fcs_crc(0xff, buf + 1, 3);
+    if ( ( ctrl & ~MUX_PF ) != MUX_UIH )
+        crc = fcs_crc(crc, buf + 4, len);
+    buf[4 + len] = 0xff - crc;
+    buf[5 + len] = MUX_FLAG;
+
+    return len + 6;
+}
+
+/**
+ * Check that exactly the given bytes arrive next on a descriptor
+ */
+static int expect_bytes(int fd, const uint8_t *expect, size_t len)
+{
+    uint8_t *buf;
+    int result = -1;
+
+    if ( ( buf = malloc(len) ) == NULL )
+        return -1;
+
+    if ( read_all(fd, buf, len) == 0 && memcmp(buf, expect, len) == 0 )
+        result = 0;
+
+    free(buf);
+    return result;
+}
+
+/**
+ * Send a command and check the multiplexer's answer on the link
+ */
+static int check_reply(int link, unsigned dlci, uint8_t ctrl, uint8_t reply)
+{
+    uint8_t frame[FRAME_MAX], expect[FRAME_MAX];
+    size_t len, expect_len;
+
+    len = build_frame(frame, dlci << 2 | MUX_CR | MUX_EA, ctrl | MUX_PF,
+                      NULL, 0);
+    expect_len = build_frame(expect, dlci << 2 | MUX_CR | MUX_EA,
+                             reply | MUX_PF, NULL, 0);
+
+    if ( write_all(link, frame, len) < 0
+         || expect_bytes(link, expect, expect_len) < 0 ) {
+        log_error_a("checking the answer to a command on DLCI %u", dlci);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Commands to open channels are answered with UA, or with DM where there
+ * is no channel, and control channel commands come back as responses
+ */
+static int check_commands(const struct mux_fds *fds)
+{
+    static const uint8_t test_cmd[] = { MUX_TEST_CMD, 5 << 1 | MUX_EA,
+                                        'p', 'i', 'n', 'g', '!' };
+    static const uint8_t test_rsp[] = { MUX_TEST_RSP, 5 << 1 | MUX_EA,
+                                        'p', 'i', 'n', 'g', '!' };
+    uint8_t frame[FRAME_MAX], expect[FRAME_MAX];
+    size_t len, expect_len;
+
+    if ( check_reply(fds->link, 0, MUX_SABM, MUX_UA) < 0
+         || check_reply(fds->link, 1, MUX_SABM, MUX_UA) < 0
+         || check_reply(fds->link, 2, MUX_SABM, MUX_UA) < 0
+         || check_reply(fds->link, 5, MUX_SABM, MUX_DM) < 0 )
+        return -1;
+
+    len = build_frame(frame, MUX_CR | MUX_EA, MUX_UIH, test_cmd,
+                      sizeof(test_cmd));
+    expect_len = build_frame(expect, MUX_EA, MUX_UIH, test_rsp,
+                             sizeof(test_rsp));
+    if ( write_all(fds->link, frame, len) < 0
+         || expect_bytes(fds->link, expect, expect_len) < 0 ) {
+        log_error("checking the answer to a control channel test");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int send_data(int link, unsigned dlci, const char *msg)
+{
+    uint8_t frame[FRAME_MAX];
+    size_t len;
+
+    len = build_frame(frame, dlci << 2 | MUX_CR | MUX_EA, MUX_UIH, msg,
+                      strlen(msg));
+    return write_all(link, frame, len);
+}
+
+/**
+ * Data frames reach their channels, but bad frames and line noise don't
+ */
+static int check_frames(const struct mux_fds *fds)
+{
+    static const uint8_t noise[] = { 0x00, 0x55, 0xaa, 0x07 };
+    uint8_t frame[FRAME_MAX];
+    size_t len;
+
+    if ( send_data(fds->link, 1, "to one") < 0
+         || send_data(fds->link, 2, "to two") < 0
+         || expect_bytes(fds->ch[0], (const uint8_t *)"to one", 6) < 0
+         || expect_bytes(fds->ch[1], (const uint8_t *)"to two", 6) < 0 ) {
+        log_error("checking data frames reach their channels");
+        return -1;
+    }
+
+    /* A corrupted frame, noise, then a good frame which must still be
+     * found */
+    len = build_frame(frame, 1 << 2 | MUX_CR | MUX_EA, MUX_UIH, "corrupt",
+                      7);
+    frame[2] ^= 0x40;
+    if ( write_all(fds->link, frame, len) < 0
+         || write_all(fds->link, noise, sizeof(noise)) < 0
+         || send_data(fds->link, 1, "after noise") < 0
+         || expect_bytes(fds->ch[0], (const uint8_t *)"after noise", 11) < 0
+         || expect_quiet(fds->ch[0]) < 0 ) {
+        log_error("checking bad frames and noise are discarded");
+        return -1;
+    }
+
+    /* A frame written in pieces, split inside its header and its
+     * information field */
+    len = build_frame(frame, 2 << 2 | MUX_CR | MUX_EA, MUX_UIH, "in pieces",
+                      9);
+    if ( write_all(fds->link, frame, 2) < 0 || usleep(50000) < 0
+         || write_all(fds->link, frame + 2, 6) < 0 || usleep(50000) < 0
+         || write_all(fds->link, frame + 8, len - 8) < 0
+         || expect_bytes(fds->ch[1], (const uint8_t *)"in pieces", 9) < 0 ) {
+        log_error("checking a frame split across writes");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Frames straddling the end of the link's receive ring arrive intact
+ */
+static int check_wrap(const struct mux_fds *fds)
+{
+    uint8_t *stream, *data[2];
+    size_t len = 0, n_data[2] = { 0, 0 };
+    int i, ch, result = -1;
+    size_t j;
+
+    stream = malloc(WRAP_FRAMES * ( WRAP_LEN + 6 ));
+    data[0] = malloc(WRAP_FRAMES * WRAP_LEN);
+    data[1] = malloc(WRAP_FRAMES * WRAP_LEN);
+    if ( stream == NULL || data[0] == NULL || data[1] == NULL )
+        goto out;
+
+    for ( i = 0; i < WRAP_FRAMES; i++ ) {
+        ch = i % 2;
+        for ( j = 0; j < WRAP_LEN; j++ )
+            data[ch][n_data[ch] + j] = random() % 256;
+        len += build_frame(stream + len, ( ch + 1 ) << 2 | MUX_CR | MUX_EA,
+                           MUX_UIH, data[ch] + n_data[ch], WRAP_LEN);
+        n_data[ch] += WRAP_LEN;
+    }
+
+    if ( write_all(fds->link, stream, len) < 0
+         || expect_bytes(fds->ch[0], data[0], n_data[0]) < 0
+         || expect_bytes(fds->ch[1], data[1], n_data[1]) < 0 ) {
+        log_error("checking frames wrapping around the receive buffer");
+        goto out;
+    }
+
+    result = 0;
+
+ out:
+    free(data[1]);
+    free(data[0]);
+    free(stream);
+    return result;
+}
+
+/**
+ * Data written to a channel goes out on the link in UIH frames from it
+ */
+static int check_uplink(const struct mux_fds *fds)
+{
+    uint8_t expect[FRAME_MAX];
+    size_t len;
+
+    len = build_frame(expect, 2 << 2 | MUX_EA, MUX_UIH, "uplink", 6);
+    if ( write_all(fds->ch[1], (const uint8_t *)"uplink", 6) < 0
+         || expect_bytes(fds->link, expect, len) < 0 ) {
+        log_error("checking channel data is framed onto the link");
+        return -1;
+    }
+
+    return 0;
+}
+
+int check_mux()
+{
+    char *args[] = { "-X", "-b", MUX_SIZE, MUX_LINK_PATH, NULL };
+    struct mux_fds fds = { -1, { -1, -1 } };
+    int pid, status, result = -1;
+
+    pid = nulltty_child_args(MUX_CH1_PATH, MUX_CH2_PATH, args, -1);
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        return -1;
+    }
+
+    if ( ( fds.link = open_pty_slave(MUX_LINK_PATH) ) < 0
+         || ( fds.ch[0] = open_pty_slave(MUX_CH1_PATH) ) < 0
+         || ( fds.ch[1] = open_pty_slave(MUX_CH2_PATH) ) < 0 ) {
+        log_error("opening multiplexer pseudoterminals");
+        goto out;
+    }
+
+    if ( check_commands(&fds) < 0 || check_frames(&fds) < 0
+         || check_wrap(&fds) < 0 || check_uplink(&fds) < 0 )
+        goto out;
+
+    if ( expect_quiet(fds.link) < 0 ) {
+        log_error("checking nothing more was sent on the link");
+        goto out;
+    }
+
+    result = 0;
+
+ out:
+    if ( fds.ch[1] >= 0 )
+        close(fds.ch[1]);
+    if ( fds.ch[0] >= 0 )
+        close(fds.ch[0]);
+    if ( fds.link >= 0 )
+        close(fds.link);
+
+    status = nulltty_kill(pid);
+    if ( status < 0 )
+        return -1;
+    if ( result == 0 )
+        printf("nulltty exited with status: %d\n", status);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int result;
+
+    printf("Checking multiplexer framing...\n");
+    result = check_mux();
+
+    if ( result < 0 )
+        return -result;
+
+    return 0;
+}
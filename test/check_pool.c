@@ -0,0 +1,327 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "nulltty_child.h"
+
+#define POOL_PATH "nulltty_pool.sock"
+#define POOL_DIR  "."
+
+static int pool_connect(const char *request)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, POOL_PATH, sizeof(addr.sun_path) - 1);
+
+    if ( ( fd = socket(AF_UNIX, SOCK_STREAM, 0) ) < 0 )
+        return -1;
+
+    if ( connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+         || write(fd, request, strlen(request)) != (ssize_t)strlen(request) ) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Wait for a descriptor to turn readable
+ *
+ * @return 1 if readable, 0 on timeout, -1 on error
+ */
+static int wait_readable(int fd, int timeout_ms)
+{
+    struct pollfd pfd = { fd, POLLIN, 0 };
+
+    return poll(&pfd, 1, timeout_ms);
+}
+
+/**
+ * Receive a reply line, along with any descriptors passed with it
+ *
+ * @param fds Set to the descriptors received, or -1
+ * @return Length of the line, 0 if the pool hung up or didn't answer in
+ * time, -1 on error
+ */
+static ssize_t pool_reply(int sock, char *line, size_t size, int fds[2],
+                          int timeout_ms)
+{
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr *cmsg;
+    struct msghdr msg;
+    struct iovec iov;
+    size_t len = 0;
+    ssize_t n;
+
+    fds[0] = fds[1] = -1;
+
+    while ( len == 0 || line[len - 1] != '\n' ) {
+        if ( len == size - 1 )
+            return -1;
+        if ( wait_readable(sock, timeout_ms) <= 0 )
+            return 0;
+
+        iov.iov_base = line + len;
+        iov.iov_len = size - 1 - len;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if ( ( n = recvmsg(sock, &msg, 0) ) <= 0 )
+            return n;
+        len += n;
+
+        for ( cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+              cmsg = CMSG_NXTHDR(&msg, cmsg) ) {
+            if ( cmsg->cmsg_level == SOL_SOCKET
+                 && cmsg->cmsg_type == SCM_RIGHTS
+                 && cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)) )
+                memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+        }
+    }
+
+    line[len] = '\0';
+    return len;
+}
+
+/**
+ * Put a slave in raw mode without discarding what it holds
+ */
+static int make_raw(int fd)
+{
+    struct termios t;
+
+    if ( tcgetattr(fd, &t) < 0 )
+        return -1;
+    cfmakeraw(&t);
+    return tcsetattr(fd, TCSANOW, &t);
+}
+
+static int open_slave(const char *path)
+{
+    int fd;
+
+    if ( ( fd = open(path, O_RDWR | O_NOCTTY) ) < 0 )
+        return -1;
+
+    if ( make_raw(fd) < 0 ) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Send a message through a lent pair and check that it comes out intact
+ */
+static int check_transfer(int fd_out, int fd_in, const char *msg)
+{
+    char buf[64];
+    size_t len = strlen(msg), n_in = 0;
+    ssize_t n;
+
+    if ( write(fd_out, msg, len) != (ssize_t)len ) {
+        log_error("writing to lent slave");
+        return -1;
+    }
+
+    while ( n_in < len ) {
+        if ( wait_readable(fd_in, RELAY_TIMEOUT_MS) <= 0
+             || ( n = read(fd_in, buf + n_in, len - n_in) ) <= 0 ) {
+            log_error_a("reading \"%s\" from lent slave", msg);
+            return -1;
+        }
+        n_in += n;
+    }
+
+    if ( memcmp(buf, msg, len) != 0 ) {
+        log_error("checking data relayed through lent pair");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Check a reply names the pool's only pair
+ */
+static int check_paths(const char *line, char *link_a, char *link_b)
+{
+    char cwd[PATH_MAX], expect[2 * PATH_MAX + 16];
+
+    if ( getcwd(cwd, sizeof(cwd)) == NULL
+         || snprintf(link_a, PATH_MAX, "%s/" POOL_DIR "/0a", cwd) >= PATH_MAX
+         || snprintf(link_b, PATH_MAX, "%s/" POOL_DIR "/0b", cwd) >= PATH_MAX )
+        return -1;
+
+    snprintf(expect, sizeof(expect), "ok %s %s\n", link_a, link_b);
+    if ( strcmp(line, expect) != 0 ) {
+        log_error_a("unexpected reply: %s", line);
+        return -1;
+    }
+
+    return 0;
+}
+
+int check_pool()
+{
+    char *args[] = { "-L", "1", NULL };
+    char line[2 * PATH_MAX + 16], link_a[PATH_MAX], link_b[PATH_MAX];
+    int first = -1, second = -1, third = -1;
+    int fds[2] = { -1, -1 }, none[2];
+    int slave_a = -1, slave_b = -1;
+    int pid, status, result = -1;
+
+    unlink(POOL_PATH);
+    pid = nulltty_child_args(POOL_PATH, POOL_DIR, args, -1);
+    if ( pid < 0 ) {
+        log_error("forking nulltty child process");
+        return -1;
+    }
+
+    /* The first client borrows the pair, with descriptors of it */
+
+    if ( ( first = pool_connect("fds\n") ) < 0 ) {
+        log_error("connecting to pool");
+        goto out;
+    }
+
+    if ( pool_reply(first, line, sizeof(line), fds, RELAY_TIMEOUT_MS) <= 0
+         || check_paths(line, link_a, link_b) < 0 )
+        goto out;
+
+    if ( fds[0] < 0 || fds[1] < 0 ) {
+        log_error("receiving slave descriptors");
+        goto out;
+    }
+
+    if ( make_raw(fds[0]) < 0 || make_raw(fds[1]) < 0
+         || check_transfer(fds[0], fds[1], "lent by descriptor") < 0 )
+        goto out;
+
+    /* A second client has to wait its turn while the pair is out */
+
+    if ( ( second = pool_connect("paths\n") ) < 0 ) {
+        log_error("connecting to pool");
+        goto out;
+    }
+
+    if ( wait_readable(second, QUIET_TIMEOUT_MS) != 0 ) {
+        log_error("waiting client answered while the pool was empty");
+        goto out;
+    }
+
+    /* Bad requests are turned away at once, and hung up on */
+
+    if ( ( third = pool_connect("bogus\n") ) < 0 ) {
+        log_error("connecting to pool");
+        goto out;
+    }
+
+    if ( pool_reply(third, line, sizeof(line), none, RELAY_TIMEOUT_MS) <= 0
+         || strcmp(line, "error unknown request\n") != 0 ) {
+        log_error("checking reply to an unknown request");
+        goto out;
+    }
+
+    if ( wait_readable(third, RELAY_TIMEOUT_MS) <= 0
+         || read(third, line, sizeof(line)) != 0 ) {
+        log_error("checking the pool hangs up after an error");
+        goto out;
+    }
+
+    /* Leave data in flight when handing the pair back */
+
+    if ( wait_readable(first, 0) != 0 ) {
+        log_error("checking the borrower's connection stays quiet");
+        goto out;
+    }
+
+    if ( write(fds[0], "stale", 5) != 5 ) {
+        log_error("writing to lent slave");
+        goto out;
+    }
+    close(fds[0]);
+    close(fds[1]);
+    close(first);
+    first = -1;
+
+    /* The waiting client gets the pair, reset, once it comes back */
+
+    if ( pool_reply(second, line, sizeof(line), fds, RELAY_TIMEOUT_MS) <= 0
+         || check_paths(line, link_a, link_b) < 0 )
+        goto out;
+
+    if ( fds[0] >= 0 || fds[1] >= 0 ) {
+        log_error("checking paths request got no descriptors");
+        goto out;
+    }
+
+    if ( ( slave_a = open_slave(link_a) ) < 0
+         || ( slave_b = open_slave(link_b) ) < 0 ) {
+        log_error("opening recycled pair's slaves");
+        goto out;
+    }
+
+    if ( wait_readable(slave_b, QUIET_TIMEOUT_MS) != 0 ) {
+        log_error("checking recycled pair holds no stale data");
+        goto out;
+    }
+
+    if ( check_transfer(slave_b, slave_a, "lent by path") < 0 )
+        goto out;
+
+    result = 0;
+
+ out:
+    if ( slave_b >= 0 )
+        close(slave_b);
+    if ( slave_a >= 0 )
+        close(slave_a);
+    if ( third >= 0 )
+        close(third);
+    if ( second >= 0 )
+        close(second);
+    if ( first >= 0 ) {
+        close(fds[0]);
+        close(fds[1]);
+        close(first);
+    }
+
+    status = nulltty_kill(pid);
+    if ( status < 0 )
+        return -1;
+    if ( result == 0 )
+        printf("nulltty exited with status: %d\n", status);
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int result;
+
+    printf("Checking pool lending...\n");
+    result = check_pool();
+
+    if ( result < 0 )
+        return -result;
+
+    return 0;
+}
@@ -1,12 +1,10 @@
 #include <stubs.h>
 
-#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
-#include <termios.h>
 #include <unistd.h>
 
 #include "nulltty_child.h"
@@ -16,9 +14,6 @@
 
 #define MAX(a, b) ((a)>(b)) ? (a) : (b)
 
-#define log_error(fmt) printf("Error " fmt "\n")
-#define log_error_a(fmt, ...) printf("Error " fmt "\n", __VA_ARGS__)
-
 struct relay_direction {
     int fd_out;
     int fd_in;
@@ -29,24 +24,6 @@ struct relay_direction {
     size_t n_in;
 };
 
-static int open_pty_slave(const char *path)
-{
-    struct termios t = { 0 };
-    int fd;
-
-    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
-    if ( fd < 0 )
-        return -1;
-
-    if ( tcgetattr(fd, &t) < 0 )
-        return -1;
-    cfmakeraw(&t);
-    if ( tcsetattr(fd, TCSAFLUSH, &t) < 0 )
-        return -1;
-
-    return fd;
-}
-
 static int open_direction(struct relay_direction *dir,
                           const uint8_t *msg, size_t msg_sz,
                           const char *pty_path)
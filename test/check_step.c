@@ -0,0 +1,279 @@
+#include <stubs.h>
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nulltty_child.h"
+#include "ptys.h"
+
+#define PLAIN_A_PATH   "nulltty_stepA"
+#define PLAIN_B_PATH   "nulltty_stepB"
+#define COALESCE_A_PATH "nulltty_coalesceA"
+#define COALESCE_B_PATH "nulltty_coalesceB"
+#define DELAY_A_PATH   "nulltty_delayA"
+#define DELAY_B_PATH   "nulltty_delayB"
+
+/** How long the coalescing and delayed pairs hold data back */
+#define HOLD_US 100000
+
+/** How often a loop with no descriptor to poll is stepped */
+#define STEP_MS 10
+
+/** Steps taken to drain a loop's pending events before calling it idle */
+#define SETTLE_STEPS 100
+
+enum pair_kind {
+    PAIR_PLAIN,
+    PAIR_COALESCE,
+    PAIR_DELAY,
+    PAIR_KINDS,
+};
+
+static const char *const links[PAIR_KINDS][2] = {
+    { PLAIN_A_PATH, PLAIN_B_PATH },
+    { COALESCE_A_PATH, COALESCE_B_PATH },
+    { DELAY_A_PATH, DELAY_B_PATH },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Step a loop once, as an embedding program would: wait for its
+ * descriptor, where it has one, or the slave to turn readable, for no
+ * longer than the last step asked, and then step it
+ *
+ * Without a descriptor (the select() backend) the loop is also stepped
+ * every STEP_MS, since nothing else tells us it has events.
+ *
+ * @param timeout_ms Timeout asked for by the last step, updated for the
+ * next
+ * @return 1 if the slave is readable, 0 if not, -1 on error
+ */
+static int step(nulltty_loop_t loop, int loop_fd, int slave_fd,
+                int *timeout_ms)
+{
+    struct pollfd pfd[2] = { { slave_fd, POLLIN, 0 }, { loop_fd, POLLIN, 0 } };
+    int wait_ms = *timeout_ms, n;
+
+    if ( loop_fd < 0 && ( wait_ms < 0 || wait_ms > STEP_MS ) )
+        wait_ms = STEP_MS;
+
+    n = poll(pfd, loop_fd >= 0 ? 2 : 1, wait_ms);
+    if ( n < 0 && errno != EINTR )
+        return -1;
+
+    if ( nulltty_loop_step(loop, timeout_ms) < 0 ) {
+        log_error("stepping the relay loop");
+        return -1;
+    }
+
+    return n > 0 && ( pfd[0].revents & POLLIN ) ? 1 : 0;
+}
+
+/**
+ * Step a loop until it has nothing left to do, and check it then asks to
+ * wait indefinitely
+ */
+static int check_idle(nulltty_loop_t loop, int loop_fd)
+{
+    struct pollfd pfd = { loop_fd, POLLIN, 0 };
+    int timeout_ms = -1, i;
+
+    for ( i = 0; i < SETTLE_STEPS; i++ ) {
+        if ( nulltty_loop_step(loop, &timeout_ms) < 0 ) {
+            log_error("stepping the relay loop");
+            return -1;
+        }
+        if ( loop_fd >= 0 && poll(&pfd, 1, 0) == 0 )
+            break;
+    }
+
+    if ( timeout_ms != -1 ) {
+        log_error_a("checking an idle loop waits indefinitely, not %dms",
+                    timeout_ms);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Send a message from A to B through a pair, stepping the loop until it
+ * arrives
+ *
+ * Held data must make each step until it arrives ask to be stepped again
+ * within the holding time, and must not arrive before then.
+ */
+static int check_transfer(nulltty_loop_t loop, int loop_fd,
+                          enum pair_kind kind, int fd_a, int fd_b)
+{
+    static const char msg[] = "stepped across";
+    char buf[sizeof(msg) - 1];
+    int timeout_ms = -1, ready = 0;
+    bool held = false;
+    uint64_t start, deadline;
+
+    start = now_ns();
+    deadline = start + (uint64_t)RELAY_TIMEOUT_MS * 1000000;
+
+    if ( write_all(fd_a, msg, sizeof(buf)) < 0 ) {
+        log_error("writing to pty slave");
+        return -1;
+    }
+
+    while ( ready == 0 && now_ns() < deadline ) {
+        if ( ( ready = step(loop, loop_fd, fd_b, &timeout_ms) ) < 0 )
+            return -1;
+
+        if ( kind == PAIR_PLAIN || ready != 0 )
+            continue;
+
+        /* Once the data is in, it must be waited for, until it has been
+         * written out after its holding time, though it may not have
+         * reached the slave by the time the step returns */
+        if ( timeout_ms >= 0 ) {
+            if ( timeout_ms > HOLD_US / 1000 + 1 ) {
+                log_error_a("checking held data is waited for in time, "
+                            "not %dms", timeout_ms);
+                return -1;
+            }
+            held = true;
+        } else if ( held && now_ns() - start < (uint64_t)HOLD_US * 1000 ) {
+            log_error("checking the timeout stays set until held data is out");
+            return -1;
+        }
+    }
+
+    if ( read_all(fd_b, buf, sizeof(buf)) < 0
+         || memcmp(buf, msg, sizeof(buf)) != 0 ) {
+        log_error_a("checking data crossed %s", links[kind][0]);
+        return -1;
+    }
+
+    if ( kind != PAIR_PLAIN ) {
+        if ( ! held ) {
+            log_error_a("checking %s asked for a timeout with data held",
+                        links[kind][0]);
+            return -1;
+        }
+        if ( now_ns() - start < (uint64_t)HOLD_US * 1000 ) {
+            log_error_a("checking %s held data back", links[kind][0]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * The loop's descriptor is there to nest in another loop under epoll, and
+ * under select() we are told to step on the timeout instead
+ */
+static int check_loop_fd(nulltty_loop_t loop, int *loop_fd)
+{
+    errno = 0;
+    *loop_fd = nulltty_loop_fd(loop);
+
+#ifdef USE_EPOLL
+    if ( *loop_fd < 0 ) {
+        log_error("getting the relay loop's descriptor");
+        return -1;
+    }
+#else
+    if ( *loop_fd >= 0 || errno != ENOTSUP ) {
+        log_error("checking the select() backend has no loop descriptor");
+        return -1;
+    }
+#endif
+
+    return 0;
+}
+
+int check_step()
+{
+    struct nulltty_opts opts;
+    nulltty_t pairs[PAIR_KINDS] = { NULL };
+    int fds[PAIR_KINDS][2];
+    nulltty_loop_t loop;
+    int loop_fd, result = -1;
+    size_t i;
+
+    memset(fds, -1, sizeof(fds));
+
+    if ( ( loop = nulltty_loop_open() ) == NULL ) {
+        log_error("opening relay loop");
+        return -1;
+    }
+
+    for ( i = 0; i < PAIR_KINDS; i++ ) {
+        nulltty_opts_init(&opts);
+        if ( i == PAIR_COALESCE )
+            opts.coalesce[NULLTTY_SIDE_A].delay_us = HOLD_US;
+        if ( i == PAIR_DELAY )
+            opts.delay_us = HOLD_US;
+
+        pairs[i] = nulltty_open(links[i][0], links[i][1], &opts);
+        if ( pairs[i] == NULL || nulltty_loop_add(loop, pairs[i]) < 0 ) {
+            log_error_a("opening pair %s", links[i][0]);
+            goto out;
+        }
+
+        if ( ( fds[i][0] = open_pty_slave(links[i][0]) ) < 0
+             || ( fds[i][1] = open_pty_slave(links[i][1]) ) < 0 ) {
+            log_error_a("opening pty slaves of %s", links[i][0]);
+            goto out;
+        }
+    }
+
+    if ( check_loop_fd(loop, &loop_fd) < 0 || check_idle(loop, loop_fd) < 0 )
+        goto out;
+
+    for ( i = 0; i < PAIR_KINDS; i++ ) {
+        if ( check_transfer(loop, loop_fd, i, fds[i][0], fds[i][1]) < 0
+             || check_idle(loop, loop_fd) < 0 )
+            goto out;
+    }
+
+    result = 0;
+
+ out:
+    for ( i = 0; i < PAIR_KINDS; i++ ) {
+        if ( fds[i][1] >= 0 )
+            close(fds[i][1]);
+        if ( fds[i][0] >= 0 )
+            close(fds[i][0]);
+    }
+
+    nulltty_loop_close(loop);
+    for ( i = 0; i < PAIR_KINDS; i++ ) {
+        if ( pairs[i] != NULL )
+            nulltty_close(pairs[i]);
+    }
+
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int result;
+
+    printf("Checking stepping the relay library...\n");
+    result = check_step();
+
+    if ( result < 0 )
+        return -result;
+
+    return 0;
+}
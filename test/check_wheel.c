@@ -0,0 +1,277 @@
+#include <stubs.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nulltty_child.h"
+#include "wheel.h"
+
+/* Ticks spanned by each level's whole turn */
+#define LEVEL_SPAN(level) ( (uint64_t)1 << ( WHEEL_BITS * ( (level) + 1 ) ) )
+
+/* Beyond the top level's reach */
+#define WHEEL_REACH LEVEL_SPAN(WHEEL_LEVELS - 1)
+
+/* Not aligned to any level, so that timers straddle slot boundaries */
+#define START_TICK 1000003
+
+#define RANDOM_TIMERS 500
+#define RANDOM_STEPS  50000
+
+/**
+ * Expire every pending timer, advancing straight to each tick the wheel
+ * says has work, and check that each one expires exactly on its due tick
+ *
+ * @return Number of timers expired, or -1 on error
+ */
+static long run_until_empty(struct wheel *wheel)
+{
+    struct wheel_timer *expired;
+    uint64_t tick, last = wheel->now;
+    long n = 0;
+
+    while ( ( tick = wheel_next(wheel) ) != UINT64_MAX ) {
+        if ( tick <= last ) {
+            log_error_a("wheel_next() went back to tick %llu from %llu",
+                        (unsigned long long)tick, (unsigned long long)last);
+            return -1;
+        }
+        last = tick;
+
+        for ( expired = wheel_advance(wheel, tick); expired != NULL;
+              expired = expired->next ) {
+            if ( expired->due != tick || wheel_pending(expired) ) {
+                log_error_a("timer due at %llu expired at %llu",
+                            (unsigned long long)expired->due,
+                            (unsigned long long)tick);
+                return -1;
+            }
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/**
+ * Timers either side of each level's boundary, and far beyond the top
+ * level, expire on time
+ */
+static int check_boundaries(void)
+{
+    static struct wheel wheel;
+    struct wheel_timer timers[5 * WHEEL_LEVELS + 3];
+    size_t n = 0, i;
+    unsigned level;
+    long expired;
+
+    wheel_init(&wheel, START_TICK);
+
+    for ( level = 0; level < WHEEL_LEVELS; level++ ) {
+        wheel_add(&wheel, &timers[n++], START_TICK + LEVEL_SPAN(level) - 1);
+        wheel_add(&wheel, &timers[n++], START_TICK + LEVEL_SPAN(level));
+        wheel_add(&wheel, &timers[n++], START_TICK + LEVEL_SPAN(level) + 1);
+        wheel_add(&wheel, &timers[n++],
+                  ( START_TICK | ( LEVEL_SPAN(level) - 1 ) ) + 1);
+        wheel_add(&wheel, &timers[n++],
+                  ( START_TICK | ( LEVEL_SPAN(level) - 1 ) ) + 2);
+    }
+
+    /* Several turns of the top level away, and one long since due */
+    wheel_add(&wheel, &timers[n++], START_TICK + 3 * WHEEL_REACH + 17);
+    wheel_add(&wheel, &timers[n++], START_TICK + 64 * WHEEL_REACH);
+    wheel_add(&wheel, &timers[n++], 5);
+
+    if ( timers[n - 1].due != START_TICK + 1 ) {
+        log_error("checking a timer already due is put off to the next tick");
+        return -1;
+    }
+
+    for ( i = 0; i < n; i++ ) {
+        if ( ! wheel_pending(&timers[i]) ) {
+            log_error("checking added timers are pending");
+            return -1;
+        }
+    }
+
+    if ( ( expired = run_until_empty(&wheel) ) < 0 )
+        return -1;
+    if ( expired != (long)n ) {
+        log_error_a("expired %ld of %zu timers", expired, n);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * A single advance across many ticks expires everything due by then, and
+ * only that
+ */
+static int check_jump(void)
+{
+    static struct wheel wheel;
+    struct wheel_timer timers[64], *expired;
+    uint64_t target = START_TICK + 100000;
+    size_t i, n_due = 0, n_expired = 0;
+
+    wheel_init(&wheel, START_TICK);
+    for ( i = 0; i < 64; i++ ) {
+        wheel_add(&wheel, &timers[i], START_TICK + 1 + i * i * i * 7);
+        if ( timers[i].due <= target )
+            n_due++;
+    }
+
+    for ( expired = wheel_advance(&wheel, target); expired != NULL;
+          expired = expired->next ) {
+        if ( expired->due > target ) {
+            log_error("checking a jump only expires timers due by then");
+            return -1;
+        }
+        n_expired++;
+    }
+
+    if ( n_expired != n_due || wheel.now != target ) {
+        log_error_a("jump expired %zu of %zu timers due", n_expired, n_due);
+        return -1;
+    }
+
+    for ( i = 0; i < 64; i++ ) {
+        if ( wheel_pending(&timers[i]) != ( timers[i].due > target ) ) {
+            log_error("checking which timers are left pending after a jump");
+            return -1;
+        }
+    }
+
+    return run_until_empty(&wheel) == (long)( 64 - n_due ) ? 0 : -1;
+}
+
+/**
+ * A timer removed after being cascaded down a level never fires
+ */
+static int check_del_cascaded(void)
+{
+    static struct wheel wheel;
+    struct wheel_timer timer, other;
+    uint64_t due = START_TICK + 5000, tick;
+
+    wheel_init(&wheel, START_TICK);
+    wheel_add(&wheel, &timer, due);
+    wheel_add(&wheel, &other, due + 1);
+
+    /* Follow the wheel until the timer has been moved down to the bottom
+     * level, where it waits for its own tick */
+    while ( timer.level > 0 ) {
+        tick = wheel_next(&wheel);
+        if ( tick >= due || wheel_advance(&wheel, tick) != NULL ) {
+            log_error("checking a timer is cascaded before it is due");
+            return -1;
+        }
+    }
+
+    wheel_del(&wheel, &timer);
+    if ( wheel_pending(&timer) ) {
+        log_error("checking a removed timer is no longer pending");
+        return -1;
+    }
+
+    if ( wheel_next(&wheel) != due + 1 || run_until_empty(&wheel) != 1 ) {
+        log_error("checking a removed cascaded timer doesn't fire");
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Random adds, removals and advances, against a plain list of due ticks
+ */
+static int check_random(void)
+{
+    static struct wheel wheel;
+    static struct wheel_timer timers[RANDOM_TIMERS];
+    static uint64_t due[RANDOM_TIMERS];
+    struct wheel_timer *expired;
+    uint64_t now = START_TICK, next, earliest, to;
+    size_t step, i, j;
+
+    wheel_init(&wheel, now);
+    for ( i = 0; i < RANDOM_TIMERS; i++ )
+        timers[i].data = &due[i];
+
+    for ( step = 0; step < RANDOM_STEPS; step++ ) {
+        i = random() % RANDOM_TIMERS;
+
+        switch ( random() % 4 ) {
+        case 0:
+            if ( wheel_pending(&timers[i]) )
+                break;
+            switch ( random() % 4 ) {
+            case 0:  to = now + random() % 70; break;
+            case 1:  to = now + random() % 5000; break;
+            case 2:  to = now + random() % 300000; break;
+            default: to = now + (uint64_t)random() * 50; break;
+            }
+            wheel_add(&wheel, &timers[i], to);
+            due[i] = to > now ? to : now + 1;
+            break;
+
+        case 1:
+            if ( wheel_pending(&timers[i]) )
+                wheel_del(&wheel, &timers[i]);
+            break;
+
+        default:
+            earliest = UINT64_MAX;
+            for ( j = 0; j < RANDOM_TIMERS; j++ ) {
+                if ( wheel_pending(&timers[j]) && due[j] < earliest )
+                    earliest = due[j];
+            }
+            next = wheel_next(&wheel);
+            if ( next > earliest
+                 || ( earliest == UINT64_MAX && next != UINT64_MAX ) ) {
+                log_error_a("wheel_next() gave %llu with a timer due at %llu",
+                            (unsigned long long)next,
+                            (unsigned long long)earliest);
+                return -1;
+            }
+
+            /* Sometimes straight to the next tick with work, which may
+             * be a cascade, for timers to be due right on it */
+            switch ( random() % 3 ) {
+            case 0:  to = now + random() % 100000; break;
+            case 1:  to = next != UINT64_MAX ? next : now; break;
+            default: to = now + random() % 50; break;
+            }
+            for ( expired = wheel_advance(&wheel, to); expired != NULL;
+                  expired = expired->next ) {
+                if ( *(uint64_t *)expired->data > to ) {
+                    log_error("checking advances only expire timers due");
+                    return -1;
+                }
+            }
+            for ( j = 0; j < RANDOM_TIMERS; j++ ) {
+                if ( wheel_pending(&timers[j]) && due[j] <= to ) {
+                    log_error("checking advances expire every timer due");
+                    return -1;
+                }
+            }
+            now = to;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    printf("Checking timing wheel...\n");
+
+    if ( check_boundaries() < 0 || check_jump() < 0
+         || check_del_cascaded() < 0 || check_random() < 0 )
+        return 1;
+
+    return 0;
+}
@@ -1,8 +1,15 @@
 #include <stubs.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/wait.h>
+#include <termios.h>
 #include <unistd.h>
 
 #include "nulltty_child.h"
@@ -10,6 +17,23 @@
 /** Keep GCC 4.6's -Wunused-result happy */
 #define IGNORE_RESULT(x) do { (void) sizeof(x); } while ( 0 )
 
+/**
+ * Wait for an event on a descriptor, retrying if interrupted
+ *
+ * @return 1 if it happened, 0 on timeout, -1 on error
+ */
+static int wait_fd(int fd, short events, int timeout_ms)
+{
+    struct pollfd pfd = { fd, events, 0 };
+    int n;
+
+    do {
+        n = poll(&pfd, 1, timeout_ms);
+    } while ( n < 0 && errno == EINTR );
+
+    return n;
+}
+
 static void sigchld_handler(int signum)
 {
     const char msg[] = "nulltty child exited unexpectedly, terminating\n";
@@ -21,22 +45,44 @@ static void sigchld_handler(int signum)
 }
 
 int nulltty_child(const char *pty_a, const char *pty_b)
+{
+    return nulltty_child_args(pty_a, pty_b, NULL, -1);
+}
+
+int nulltty_child_args(const char *pty_a, const char *pty_b,
+                       char *const *args, int out_fd)
 {
     struct sigaction action;
     sigset_t new_mask, prev_mask, wait_set;
     int wait_result, signum, pid;
+    const char **argv;
+    size_t nargs = 0, i = 0;
+
+    while ( args != NULL && args[nargs] != NULL )
+        nargs++;
+
+    if ( ( argv = calloc(nargs + 6, sizeof(char *)) ) == NULL )
+        return -1;
+
+    argv[i++] = NULLTTY;
+    argv[i++] = "-s";
+    argv[i++] = "USR1";
+    while ( args != NULL && *args != NULL )
+        argv[i++] = *args++;
+    argv[i++] = pty_a;
+    argv[i++] = pty_b;
 
     memset(&action, 0, sizeof(action));
     sigemptyset(&action.sa_mask);
 
     action.sa_handler = sigchld_handler;
     if ( sigaction(SIGCHLD, &action, NULL) < 0 )
-        return -1;
+        goto error;
 
     sigemptyset(&new_mask);
     sigaddset(&new_mask, SIGUSR1);
     if ( sigprocmask(SIG_BLOCK, &new_mask, &prev_mask) < 0 )
-        return -1;
+        goto error;
 
     sigemptyset(&wait_set);
     sigaddset(&wait_set, SIGUSR1);
@@ -44,17 +90,20 @@ int nulltty_child(const char *pty_a, const char *pty_b)
 
     switch ( pid = fork() ) {
     case -1:
-        return -1;
+        goto error;
 
     case 0:
-        execl(NULLTTY, NULLTTY, "-s", "USR1", pty_a, pty_b, (char *)NULL);
-        return -1;
+        if ( out_fd >= 0 && dup2(out_fd, 1) < 0 )
+            _exit(127);
+        execv(NULLTTY, (char *const *)argv);
+        _exit(127);
 
     default:
         /* Wait for any of SIGUSR1 indicating nulltty ready, SIGCHLD
          * indicating that it terminated unexpectedly, or for the user to
          * kill us. */
         wait_result = sigwait(&wait_set, &signum);
+        free(argv);
         if ( sigprocmask(SIG_SETMASK, &prev_mask, NULL) < 0 )
             return -1;
 
@@ -63,9 +112,20 @@ int nulltty_child(const char *pty_a, const char *pty_b)
 
         return -1;
     }
+
+ error:
+    free(argv);
+    return -1;
 }
 
 int nulltty_kill(int pid)
+{
+    struct rusage usage;
+
+    return nulltty_kill_usage(pid, &usage);
+}
+
+int nulltty_kill_usage(int pid, struct rusage *usage)
 {
     int status;
     struct sigaction action;
@@ -80,9 +140,79 @@ int nulltty_kill(int pid)
     if ( kill(pid, SIGTERM) < 0 )
         return -1;
 
-    waitpid(pid, &status, 0);
+    if ( wait4(pid, &status, 0, usage) < 0 )
+        return -1;
     if ( ! WIFEXITED(status) )
         return -2;
 
     return WEXITSTATUS(status);
 }
+
+int open_pty_slave(const char *path)
+{
+    struct termios t = { 0 };
+    int fd;
+
+    fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if ( fd < 0 )
+        return -1;
+
+    if ( tcgetattr(fd, &t) < 0 )
+        goto error;
+    cfmakeraw(&t);
+    if ( tcsetattr(fd, TCSAFLUSH, &t) < 0 )
+        goto error;
+
+    return fd;
+
+ error:
+    close(fd);
+    return -1;
+}
+
+int write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    ssize_t n;
+
+    while ( len > 0 ) {
+        n = write(fd, p, len);
+        if ( n < 0 ) {
+            if ( ( errno != EAGAIN && errno != EINTR )
+                 || wait_fd(fd, POLLOUT, RELAY_TIMEOUT_MS) <= 0 )
+                return -1;
+            continue;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+int read_all(int fd, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    ssize_t n;
+
+    while ( len > 0 ) {
+        if ( wait_fd(fd, POLLIN, RELAY_TIMEOUT_MS) <= 0 )
+            return -1;
+
+        n = read(fd, p, len);
+        if ( n == 0 || ( n < 0 && errno != EAGAIN && errno != EINTR ) )
+            return -1;
+        if ( n > 0 ) {
+            p += n;
+            len -= n;
+        }
+    }
+
+    return 0;
+}
+
+int expect_quiet(int fd)
+{
+    return wait_fd(fd, POLLIN, QUIET_TIMEOUT_MS) == 0 ? 0 : -1;
+}
@@ -5,9 +5,83 @@
 #ifndef _NULLTTY_CHILD_H_
 #define _NULLTTY_CHILD_H_
 
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
 #define NULLTTY "../src/nulltty"
 
+/** How long to wait for the relay before giving up on it, in ms */
+#define RELAY_TIMEOUT_MS 5000
+
+/** How long to watch for data which ought not to arrive, in ms */
+#define QUIET_TIMEOUT_MS 200
+
+/*
+ * Checks report errors on standard output, in line with their progress;
+ * benchmarks define LOG_STREAM as stderr to keep stdout for their results.
+ */
+#ifndef LOG_STREAM
+#define LOG_STREAM stdout
+#endif
+
+#define log_error(fmt) fprintf(LOG_STREAM, "Error " fmt "\n")
+#define log_error_a(fmt, ...) fprintf(LOG_STREAM, "Error " fmt "\n", __VA_ARGS__)
+
 int nulltty_child(const char *pty_a, const char *pty_b);
 int nulltty_kill(int pid);
 
+/**
+ * Start nulltty with extra options and wait for its PTYs to be ready
+ *
+ * @param pty_a Path for PTY A's symlink
+ * @param pty_b Path for PTY B's symlink
+ * @param args NULL-terminated list of extra options, or NULL
+ * @param out_fd Descriptor to use as the child's standard output, or -1 to
+ * share ours
+ * @return Child PID, or -1 on error
+ */
+int nulltty_child_args(const char *pty_a, const char *pty_b,
+                       char *const *args, int out_fd);
+
+/**
+ * Terminate nulltty and collect its resource usage
+ *
+ * @param pid Child PID
+ * @param usage Set to the child's resource usage
+ * @return Child exit status, or a negative number on error
+ */
+int nulltty_kill_usage(int pid, struct rusage *usage);
+
+/**
+ * Open a PTY slave, non-blocking and in raw mode
+ *
+ * @param path Path of the slave or a symlink to it
+ * @return Descriptor, or -1 on error
+ */
+int open_pty_slave(const char *path);
+
+/**
+ * Write all of a buffer to a non-blocking descriptor
+ *
+ * @return 0 on success, -1 on error or if the descriptor stays full for
+ * RELAY_TIMEOUT_MS
+ */
+int write_all(int fd, const void *buf, size_t len);
+
+/**
+ * Read exactly len bytes from a non-blocking descriptor
+ *
+ * @return 0 on success, -1 on error or if nothing arrives for
+ * RELAY_TIMEOUT_MS
+ */
+int read_all(int fd, void *buf, size_t len);
+
+/**
+ * Check that nothing arrives on a descriptor for QUIET_TIMEOUT_MS
+ *
+ * @return 0 if nothing did, -1 otherwise
+ */
+int expect_quiet(int fd);
+
 #endif /* ! defined _NULLTTY_CHILD_H_ */